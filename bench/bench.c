@@ -0,0 +1,555 @@
+/*
+	g1a-wrapper benchmark harness
+
+	Builds synthetic payloads and bitmap icons in a temporary directory,
+	then times the main routines of the wrapper (write(), dump(),
+	bitmap_read() and error_emit()) and reports the median and 99th
+	percentile of each measure as JSON.
+*/
+
+
+
+/*
+	Header inclusions.
+*/
+
+#include "g1a-wrapper.h"
+#include "error.h"
+#include "bmp_utils.h"
+
+
+
+/*
+	Constants definitions.
+*/
+
+// Largest add-in accepted by the calculator (512 KiB, header included).
+#define PAYLOAD_MAX	(0x80000 - 0x200)
+// Smallest generated payload.
+#define PAYLOAD_MIN	0x400
+
+// Number of untimed runs before each measure.
+#define WARMUP		5
+// Default number of timed runs for each measure.
+#define REPETITIONS	101
+
+
+
+/*
+	Composed types definitions.
+*/
+
+// Measure result structure.
+struct Result
+{
+	// Number of timed repetitions.
+	int reps;
+	// Median and 99th percentile durations, in nanoseconds.
+	double median;
+	double p99;
+};
+
+// Parameters of a write() or dump() run.
+struct File_Job
+{
+	const char *input;
+	const char *output;
+	// Pristine header, copied before each write() as it is altered.
+	const unsigned char *header;
+};
+
+// Parameters of a bitmap_read() run.
+struct Bitmap_Job
+{
+	const char *file;
+	uint8_t icon[76];
+	struct Arena arena;
+};
+
+
+
+/*
+	Static variables definitions.
+*/
+
+// Temporary working directory.
+static char directory[] = "/tmp/g1a-bench.XXXXXX";
+// Number of timed repetitions.
+static int repetitions = REPETITIONS;
+
+
+
+/*
+	Static function definitions.
+*/
+
+/*
+	now()
+
+	Returns the value of the monotonic clock, in nanoseconds.
+
+	@return		Current time.
+*/
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+	compare()
+
+	Comparison function for qsort() on doubles.
+*/
+
+static int compare(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+/*
+	measure()
+
+	Runs a function several times after a warm-up and computes statistics
+	over the durations of the timed runs.
+
+	@arg	function	Function to measure.
+	@arg	arg		Argument given to the function.
+	@arg	reps		Number of timed repetitions.
+	@arg	result		Result structure to fill.
+*/
+
+static void measure(void (*function)(void *), void *arg, int reps,
+	struct Result *result)
+{
+	// Using an array of durations.
+	double *times = malloc(reps * sizeof(double));
+	// Using a start date and an iterator.
+	double start;
+	int i;
+
+	if(!times)
+	{
+		fputs("bench: alloc failure\n", stderr);
+		exit(1);
+	}
+
+	// Warming up caches and page tables.
+	for(i = 0; i < WARMUP; i++) function(arg);
+
+	// Timing each run separately to get the distribution.
+	for(i = 0; i < reps; i++)
+	{
+		start = now();
+		function(arg);
+		times[i] = now() - start;
+	}
+
+	// Extracting the median and the 99th percentile.
+	qsort(times, reps, sizeof(double), compare);
+	result->reps = reps;
+	result->median = times[reps / 2];
+	result->p99 = times[(reps * 99) / 100 < reps ? (reps * 99) / 100
+		: reps - 1];
+
+	free(times);
+}
+
+/*
+	path()
+
+	Builds a file name in the temporary directory. The returned string is
+	allocated and must be freed.
+
+	@arg	format	Base name format, with up to two integer conversions.
+	@arg	a, b	Format arguments.
+
+	@return		Allocated path.
+*/
+
+static char *path(const char *format, int a, int b)
+{
+	char *str = malloc(sizeof directory + 64);
+	int length;
+
+	if(!str) exit(1);
+	length = sprintf(str, "%s/", directory);
+	snprintf(str + length, 63, format, a, b);
+	return str;
+}
+
+/*
+	make_payload()
+
+	Writes a pseudo-random payload of the given size.
+
+	@arg	file	Output file name.
+	@arg	size	Payload size.
+*/
+
+static void make_payload(const char *file, size_t size)
+{
+	FILE *fp = fopen(file, "wb");
+	uint32_t state = 0x9e3779b9;
+	size_t i;
+
+	if(!fp)
+	{
+		fprintf(stderr, "bench: cannot create '%s'\n", file);
+		exit(1);
+	}
+
+	// Using a xorshift generator so that runs are comparable.
+	for(i = 0; i < size; i++)
+	{
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		fputc(state & 0xff, fp);
+	}
+
+	fclose(fp);
+}
+
+/*
+	put16(), put32()
+
+	Write little-endian integers to a stream.
+*/
+
+static void put16(FILE *fp, unsigned int x)
+{
+	fputc(x & 0xff, fp);
+	fputc((x >> 8) & 0xff, fp);
+}
+
+static void put32(FILE *fp, uint32_t x)
+{
+	put16(fp, x & 0xffff);
+	put16(fp, x >> 16);
+}
+
+/*
+	make_bitmap()
+
+	Writes a 30*19 checkerboard bitmap with the given depth and row order.
+
+	@arg	file		Output file name.
+	@arg	depth		Bits per pixel (1, 16, 24 or 32).
+	@arg	top_down	Non-zero for a top-down image (negative height).
+*/
+
+static void make_bitmap(const char *file, int depth, int top_down)
+{
+	const int width = 30, height = 19;
+	// Using the row size, padded to four bytes, and the palette size.
+	int row = ((width * depth + 31) / 32) * 4;
+	int palette = (depth == 1 ? 8 : 0);
+	int offset = 14 + 40 + palette;
+	int x, y, i, black;
+	FILE *fp = fopen(file, "wb");
+
+	if(!fp)
+	{
+		fprintf(stderr, "bench: cannot create '%s'\n", file);
+		exit(1);
+	}
+
+	// File header.
+	fputs("BM", fp);
+	put32(fp, offset + row * height);
+	put32(fp, 0);
+	put32(fp, offset);
+
+	// Information header.
+	put32(fp, 40);
+	put32(fp, width);
+	put32(fp, top_down ? (uint32_t)-height : (uint32_t)height);
+	put16(fp, 1);
+	put16(fp, depth);
+	put32(fp, 0);
+	put32(fp, row * height);
+	put32(fp, 2835);
+	put32(fp, 2835);
+	put32(fp, depth == 1 ? 2 : 0);
+	put32(fp, 0);
+
+	// Black and white palette for monochrome images.
+	if(depth == 1)
+	{
+		put32(fp, 0x00000000);
+		put32(fp, 0x00ffffff);
+	}
+
+	// Pixel rows.
+	for(y = 0; y < height; y++)
+	{
+		uint8_t line[128] = { 0 };
+
+		for(x = 0; x < width; x++)
+		{
+			black = (x + y) & 1;
+			switch(depth)
+			{
+			case 1:
+				if(!black) line[x >> 3] |= 128 >> (x & 7);
+				break;
+			case 16:
+				line[2 * x] = line[2 * x + 1] = black ? 0x00
+					: 0xff;
+				line[2 * x + 1] &= 0x7f;
+				break;
+			default:
+				for(i = 0; i < depth / 8; i++)
+					line[x * depth / 8 + i] = black ? 0x00
+						: 0xff;
+				break;
+			}
+		}
+
+		fwrite(line, 1, row, fp);
+	}
+
+	fclose(fp);
+}
+
+/*
+	run_write(), run_dump(), run_bitmap(), run_error()
+
+	Single runs of the measured routines.
+*/
+
+static void run_write(void *arg)
+{
+	struct File_Job *job = arg;
+	unsigned char header[0x200];
+	struct Payload payload;
+
+	memcpy(header, job->header, 0x200);
+	if(payload_open(&payload, job->input, 0)) exit(1);
+	write(&payload, job->output, header);
+	payload_close(&payload);
+}
+
+static void run_dump(void *arg)
+{
+	struct File_Job *job = arg;
+	dump(job->output);
+}
+
+static void run_bitmap(void *arg)
+{
+	struct Bitmap_Job *job = arg;
+	bitmap_read(job->file, 30, 19, job->icon, 0, &job->arena);
+	arena_reset(&job->arena);
+}
+
+static void run_error(void *arg)
+{
+	// Emitting the named warning, with harmless format arguments.
+	error_emit(WARNING, (const char *)arg, "bench", "bench", 8);
+}
+
+/*
+	print_result()
+
+	Prints the common fields of a result object.
+*/
+
+static void print_result(FILE *out, const struct Result *result)
+{
+	fprintf(out, "\"reps\": %d, \"median_ns\": %.0f, \"p99_ns\": %.0f",
+		result->reps, result->median, result->p99);
+}
+
+
+
+/*
+	main()
+
+	Benchmark entry point. Writes the JSON report to the given file; the
+	standard output is discarded as dump() prints to it.
+
+	@arg	argc	Command-line argument count.
+	@arg	argv	Command-line arguments: <output.json> [repetitions].
+
+	@return		Exit code.
+*/
+
+int main(int argc, char **argv)
+{
+	// Using an options structure and a header template.
+	struct Options options;
+	unsigned char header[0x200];
+	// Using measure parameters and results.
+	struct File_Job file_job;
+	struct Bitmap_Job bitmap_job;
+	struct Result result;
+	// Using the report stream.
+	FILE *out;
+	// Using a failure indicator, a payload size and iterators.
+	int failure = 0, first;
+	size_t size;
+	int depth, order, i;
+	const int depths[] = { 1, 16, 24, 32 };
+	const char *orders[] = { "bottom-up", "top-down" };
+
+	if(argc < 2)
+	{
+		fputs("usage: bench <output.json> [repetitions]\n", stderr);
+		return 1;
+	}
+	if(!(out = fopen(argv[1], "w")))
+	{
+		fprintf(stderr, "bench: cannot open '%s'\n", argv[1]);
+		return 1;
+	}
+	if(argc > 2 && (repetitions = atoi(argv[2])) < 1)
+		repetitions = REPETITIONS;
+
+	if(!mkdtemp(directory))
+	{
+		fputs("bench: cannot create temporary directory\n", stderr);
+		return 1;
+	}
+
+	// Registering the diagnostics that the measured routines can emit.
+	// Unregistered names are silently ignored by error_emit().
+	error_init("bench", 1, &failure);
+	error_add(FATAL, "input", "cannot open input file '%s' for reading");
+	error_add(FATAL, "output", "cannot open output file '%s' for "
+		"writing");
+	error_add(ERROR, "g1a-valid", "file '%s' is not a valid g1a file "
+		"(%s)");
+	error_add(WARNING, "~length", "%s '%s' is too long (maximum is %d "
+		"characters)");
+	error_add(WARNING, "~bmp-height", "bitmap image '%s' has height %d, "
+		"expected %d");
+	error_add(WARNING, "~bmp-color", "bitmap image '%s' is not black "
+		"and white");
+	// Masking a warning, to time the lookup of masked warnings.
+	error_argument("-Wbmp-height");
+
+	// Building the header once from default options.
+	memset(&options, 0, sizeof options);
+	strcpy(options.name, "BENCH");
+	strcpy(options.version, "01.00.0000");
+	strcpy(options.internal, "@BENCH");
+	strcpy(options.date, "2000.0101.0000");
+	generate(&options, header);
+
+	fputs("{\n", out);
+
+	/*
+		write() and dump().
+	*/
+
+	fputs("\t\"write\": [", out);
+	for(first = 1, size = PAYLOAD_MIN; ; size <<= 1)
+	{
+		if(size > PAYLOAD_MAX) size = PAYLOAD_MAX;
+
+		file_job.input = path("payload-%d.bin", size, 0);
+		file_job.output = path("payload-%d.g1a", size, 0);
+		file_job.header = header;
+		make_payload(file_job.input, size);
+
+		measure(run_write, &file_job, repetitions, &result);
+		fprintf(out, "%s\n\t\t{ \"size\": %lu, ", first ? "" : ",",
+			(unsigned long)size);
+		print_result(out, &result);
+		fprintf(out, ", \"mib_per_s\": %.2f }",
+			(size + 0x200) / (result.median / 1e9) / 1048576.0);
+		first = 0;
+
+		if(size == PAYLOAD_MAX) break;
+	}
+	fputs("\n\t],\n", out);
+
+	// Discarding the dump() output.
+	freopen("/dev/null", "w", stdout);
+
+	fputs("\t\"dump\": [", out);
+	for(first = 1, size = PAYLOAD_MIN; ; size <<= 1)
+	{
+		if(size > PAYLOAD_MAX) size = PAYLOAD_MAX;
+
+		file_job.input = path("payload-%d.bin", size, 0);
+		file_job.output = path("payload-%d.g1a", size, 0);
+
+		measure(run_dump, &file_job, repetitions, &result);
+		fprintf(out, "%s\n\t\t{ \"size\": %lu, ", first ? "" : ",",
+			(unsigned long)size);
+		print_result(out, &result);
+		fputs(" }", out);
+		first = 0;
+
+		remove(file_job.input);
+		remove(file_job.output);
+		free((char *)file_job.input);
+		free((char *)file_job.output);
+
+		if(size == PAYLOAD_MAX) break;
+	}
+	fputs("\n\t],\n", out);
+
+	/*
+		bitmap_read().
+	*/
+
+	fputs("\t\"bitmap_read\": [", out);
+	arena_init(&bitmap_job.arena);
+	for(first = 1, i = 0; i < 4; i++) for(order = 0; order < 2; order++)
+	{
+		depth = depths[i];
+		bitmap_job.file = path("icon-%d-%d.bmp", depth, order);
+		make_bitmap(bitmap_job.file, depth, order);
+
+		measure(run_bitmap, &bitmap_job, repetitions, &result);
+		fprintf(out, "%s\n\t\t{ \"depth\": %d, \"order\": \"%s\", ",
+			first ? "" : ",", depth, orders[order]);
+		print_result(out, &result);
+		fprintf(out, ", \"ns_per_pixel\": %.2f }",
+			result.median / (30 * 19));
+		first = 0;
+
+		remove(bitmap_job.file);
+		free((char *)bitmap_job.file);
+	}
+	arena_free(&bitmap_job.arena);
+	fputs("\n\t],\n", out);
+
+	/*
+		error_emit().
+	*/
+
+	fputs("\t\"error_emit\": [", out);
+
+	// Looking up a name that is not registered.
+	measure(run_error, "bench-unknown", repetitions, &result);
+	fputs("\n\t\t{ \"case\": \"unknown\", ", out);
+	print_result(out, &result);
+	fputs(" },", out);
+
+	// Looking up a masked warning.
+	measure(run_error, "bmp-height", repetitions, &result);
+	fputs("\n\t\t{ \"case\": \"masked\", ", out);
+	print_result(out, &result);
+	fputs(" },", out);
+
+	// Emitting a warning; stderr is discarded from here on.
+	freopen("/dev/null", "w", stderr);
+	measure(run_error, "length", repetitions, &result);
+	fputs("\n\t\t{ \"case\": \"emitted\", ", out);
+	print_result(out, &result);
+	fputs(" }", out);
+
+	fputs("\n\t]\n}\n", out);
+
+	fclose(out);
+	remove(directory);
+	return 0;
+}
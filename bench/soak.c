@@ -0,0 +1,383 @@
+/*
+	g1a-wrapper soak test
+
+	Runs the jobs of a long-lived process (icon decoding, wrapping flat and
+	ELF payloads to files and pipes, dumping, batches on both backends,
+	header checks and packs) many times over, including their failure
+	paths, and checks that the heap does not grow once the first iterations
+	are done. Built by 'make soak' with the address sanitizer, which also
+	reports leaks and invalid accesses; the harness can be built without it
+	and run under valgrind as well.
+*/
+
+
+
+/*
+	Header inclusions.
+*/
+
+#include <fcntl.h>
+#include <malloc.h>
+
+#include "g1a-wrapper.h"
+#include "error.h"
+#include "bmp_utils.h"
+#include "fsck.h"
+#include "header.h"
+#include "pack.h"
+
+
+
+/*
+	Constants definitions.
+*/
+
+// Default number of iterations.
+#define ITERATIONS	20000
+// Iterations run before the heap size is taken as a reference.
+#define WARMUP		100
+// Number of jobs in a batch, and iterations between batches.
+#define BATCH_JOBS	40
+#define BATCH_PERIOD	100
+// Heap growth tolerated at the end of the run, in bytes (stdio buffers).
+#define TOLERANCE	0x10000
+
+
+
+/*
+	Static variables definitions.
+*/
+
+// Temporary working directory.
+static char directory[] = "/tmp/g1a-soak.XXXXXX";
+
+
+
+/*
+	Static function definitions.
+*/
+
+/*
+	heap()
+
+	Returns the number of bytes currently allocated on the heap, as known
+	by the sanitizer allocator or by glibc.
+*/
+
+#ifdef __SANITIZE_ADDRESS__
+size_t __sanitizer_get_current_allocated_bytes(void);
+static size_t heap(void)
+{
+	return __sanitizer_get_current_allocated_bytes();
+}
+#else
+static size_t heap(void)
+{
+	return mallinfo2().uordblks;
+}
+#endif
+
+/*
+	path()
+
+	Builds an allocated path in the working directory.
+*/
+
+static char *path(const char *name, int index)
+{
+	char *p = malloc(sizeof directory + strlen(name) + 16);
+
+	if(!p) exit(1);
+	sprintf(p, "%s/%d-%s", directory, index, name);
+	return p;
+}
+
+/*
+	make_file()
+
+	Writes a file from a buffer.
+*/
+
+static void make_file(const char *file, const void *data, size_t size)
+{
+	FILE *fp = fopen(file, "wb");
+
+	if(!fp || fwrite(data, 1, size, fp) != size) exit(1);
+	fclose(fp);
+}
+
+/*
+	put32()
+
+	Stores a 32-bit integer, in big or little endian.
+*/
+
+static void put32(uint8_t *p, uint32_t x, int big)
+{
+	int i;
+	for(i = 0; i < 4; i++) p[big ? 3 - i : i] = x >> (8 * i);
+}
+
+/*
+	make_bitmap()
+
+	Writes a 24-bit 30*19 bitmap, or only its first bytes.
+*/
+
+static void make_bitmap(const char *file, size_t truncate)
+{
+	uint8_t data[54 + 92 * 19] = { 'B', 'M' };
+	int i;
+
+	put32(data + 2, sizeof data, 0);
+	put32(data + 10, 54, 0);
+	put32(data + 14, 40, 0);
+	put32(data + 18, 30, 0);
+	put32(data + 22, 19, 0);
+	data[26] = 1;
+	data[28] = 24;
+	for(i = 54; i < (int)sizeof data; i++) data[i] = i & 8 ? 0xff : 0;
+
+	make_file(file, data, truncate ? truncate : sizeof data);
+}
+
+/*
+	make_elf()
+
+	Writes a big-endian ELF file with two loadable segments separated by a
+	gap, or overlapping segments.
+*/
+
+static void make_elf(const char *file, int overlap)
+{
+	uint8_t data[52 + 2 * 32 + 0x300] = { 0x7f, 'E', 'L', 'F', 1, 2, 1 };
+	int i;
+
+	data[17] = 2;
+	data[19] = 42;
+	put32(data + 28, 52, 1);
+	data[43] = 32;
+	data[45] = 2;
+
+	for(i = 0; i < 2; i++)
+	{
+		uint8_t *ph = data + 52 + 32 * i;
+		put32(ph, 1, 1);
+		put32(ph + 4, 116 + 0x180 * i, 1);
+		put32(ph + 8, PAYLOAD_BASE + (overlap ? 0x100 : 0x200) * i, 1);
+		put32(ph + 12, PAYLOAD_BASE + (overlap ? 0x100 : 0x200) * i,
+			1);
+		put32(ph + 16, 0x180, 1);
+		put32(ph + 20, 0x180, 1);
+	}
+	for(i = 116; i < (int)sizeof data; i++) data[i] = i;
+
+	make_file(file, data, sizeof data);
+}
+
+/*
+	wrap_file()
+
+	Wraps a payload with a header, as a single run does. Returns 1 if the
+	payload was refused.
+*/
+
+static int wrap_file(const char *input, const char *output,
+	const unsigned char *header)
+{
+	unsigned char data[HEADER_SIZE];
+	struct Payload payload;
+
+	if(payload_open(&payload, input, PAYLOAD_ELF)) return 1;
+	memcpy(data, header, HEADER_SIZE);
+	write(&payload, output, data);
+	payload_close(&payload);
+	return 0;
+}
+
+/*
+	run_batch()
+
+	Wraps then dumps a batch of files with the given backend, checks them,
+	and dumps them again from a pack.
+*/
+
+static void run_batch(char **inputs, char **outputs,
+	const unsigned char *header, enum Batch_Backend backend)
+{
+	struct Batch_Job jobs[BATCH_JOBS];
+	struct Fsck fsck;
+	struct Pack pack;
+	char *file = path("batch.pack", 0);
+	int i;
+
+	memset(jobs, 0, sizeof jobs);
+	for(i = 0; i < BATCH_JOBS; i++)
+	{
+		jobs[i].input = inputs[i];
+		jobs[i].output = outputs[i];
+		memcpy(jobs[i].header, header, HEADER_SIZE);
+	}
+	batch_wrap(jobs, BATCH_JOBS, backend);
+
+	memset(jobs, 0, sizeof jobs);
+	for(i = 0; i < BATCH_JOBS; i++) jobs[i].input = outputs[i];
+	batch_dump(jobs, BATCH_JOBS, backend);
+
+	// Checking the whole working directory, as --fsck does.
+	memset(&fsck, 0, sizeof fsck);
+	fsck_add(&fsck, directory);
+	fsck_run(&fsck, 0);
+
+	// Packing the checked files, and reading their headers back.
+	pack_write(&pack, file, &fsck);
+	dump(file);
+	remove(file);
+	free(file);
+	fsck_free(&fsck);
+}
+
+
+
+/*
+	main()
+
+	Soak test entry point.
+
+	@arg	argc	Command-line argument count.
+	@arg	argv	Command-line arguments: [iterations].
+
+	@return		0 if the heap stayed flat, 1 otherwise.
+*/
+
+int main(int argc, char **argv)
+{
+	// Using the options and header of every job, and the job arena.
+	struct Options options;
+	unsigned char header[HEADER_SIZE];
+	struct Arena arena;
+	// Using the test files.
+	char *bitmap, *truncated, *flat, *elf, *overlap, *output;
+	char *inputs[BATCH_JOBS], *outputs[BATCH_JOBS];
+	// Using a named pipe, written as special outputs are, its reading end
+	// and a buffer to drain it.
+	char *fifo;
+	FILE *reader;
+	char drain[0x1000];
+	uint8_t payload[0x1000];
+	// Using the reference heap size, a failure indicator and iterators.
+	size_t reference = 0, end;
+	int iterations = ITERATIONS, failure = 0, i;
+
+	if(argc > 1 && (iterations = atoi(argv[1])) <= WARMUP)
+		iterations = ITERATIONS;
+	if(!mkdtemp(directory))
+	{
+		fputs("soak: cannot create temporary directory\n", stderr);
+		return 1;
+	}
+
+	// Registering only the fatal errors: the expected diagnostics of the
+	// failure paths are not registered, so they are silently ignored.
+	error_init("soak", 1, &failure);
+	error_add(FATAL, "output", "cannot open output file '%s' for "
+		"writing");
+	error_add(FATAL, "output-write", "cannot write output file '%s' "
+		"(%s)");
+
+	// Building the test files.
+	bitmap = path("icon.bmp", 0);
+	truncated = path("truncated.bmp", 0);
+	flat = path("flat.bin", 0);
+	elf = path("payload.elf", 0);
+	overlap = path("overlap.elf", 0);
+	output = path("output.g1a", 0);
+	make_bitmap(bitmap, 0);
+	make_bitmap(truncated, 200);
+	for(i = 0; i < (int)sizeof payload; i++) payload[i] = i * 7;
+	make_file(flat, payload, sizeof payload);
+	make_elf(elf, 0);
+	make_elf(overlap, 1);
+	for(i = 0; i < BATCH_JOBS; i++)
+	{
+		inputs[i] = path("batch.bin", i);
+		outputs[i] = path("batch.g1a", i);
+		make_file(inputs[i], payload, 0x100 + 0x40 * i);
+	}
+
+	// Opening the reading end first, so that the pipe can be written.
+	fifo = path("output.fifo", 0);
+	if(mkfifo(fifo, 0600) || !(reader = fdopen(open(fifo, O_RDONLY
+		| O_NONBLOCK), "rb"))) return 1;
+
+	memset(&options, 0, sizeof options);
+	strcpy(options.name, "SOAK");
+	strcpy(options.version, "01.00.0000");
+	strcpy(options.internal, "@SOAK");
+	strcpy(options.date, "2000.0101.0000");
+	arena_init(&arena);
+
+	// Discarding the dump() output.
+	freopen("/dev/null", "w", stdout);
+
+	for(i = 0; i < iterations; i++)
+	{
+		if(i == WARMUP) reference = heap();
+
+		// Decoding icons, including the failure paths, then resetting
+		// the arena as a job does.
+		bitmap_read(bitmap, 30, 19, options.icon, 0, &arena);
+		bitmap_read(truncated, 30, 19, options.icon, 0, &arena);
+		bitmap_read(flat, 30, 19, options.icon, 0, &arena);
+		bitmap_read("/nonexistent.bmp", 30, 19, options.icon, 0,
+			&arena);
+		arena_reset(&arena);
+		generate(&options, header);
+
+		// Wrapping flat and ELF payloads, and dumping the result.
+		wrap_file(flat, output, header);
+		wrap_file(elf, output, header);
+		wrap_file(overlap, output, header);
+		wrap_file(flat, fifo, header);
+		while(fread(drain, 1, sizeof drain, reader));
+		clearerr(reader);
+		dump(output);
+		dump(flat);
+
+		if(i % BATCH_PERIOD) continue;
+		run_batch(inputs, outputs, header, (i / BATCH_PERIOD) & 1 ?
+			BATCH_THREADS : BATCH_URING);
+	}
+
+	end = heap();
+	arena_free(&arena);
+
+	// Cleaning up.
+	remove(bitmap);
+	remove(truncated);
+	remove(flat);
+	remove(elf);
+	remove(overlap);
+	remove(output);
+	free(bitmap);
+	free(truncated);
+	free(flat);
+	free(elf);
+	free(overlap);
+	free(output);
+	for(i = 0; i < BATCH_JOBS; i++)
+	{
+		remove(inputs[i]);
+		remove(outputs[i]);
+		free(inputs[i]);
+		free(outputs[i]);
+	}
+	fclose(reader);
+	remove(fifo);
+	free(fifo);
+	remove(directory);
+
+	fprintf(stderr, "soak: %d iterations, heap %zu -> %zu bytes\n",
+		iterations, reference, end);
+	return end > reference + TOLERANCE;
+}
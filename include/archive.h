@@ -0,0 +1,113 @@
+/*
+	Archive module.
+
+	Reads g1a files stored in tar and zip archives, and in packs (see
+	pack.h), without extracting them. Members are located from their
+	headers only: tar headers are found by seeking from one to the next,
+	zip members are listed by the central directory, and the header table
+	and index of packs are mapped in memory. Reading a member fetches only
+	the requested bytes; deflated members are inflated as a stream, only as
+	far as needed, and the headers of packed files are not read at all.
+
+	Inputs name either a whole archive, whose g1a files are the members
+	with extension '.g1a', or a single member as 'archive.tar:member'.
+*/
+
+#ifndef _ARCHIVE_H
+	#define _ARCHIVE_H 1
+
+/*
+	Header inclusions.
+*/
+
+#include <limits.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "output.h"
+
+
+
+/*
+	Composed types definitions.
+*/
+
+// Archive formats.
+enum Archive_Type
+{
+	// Not an archive.
+	ARCHIVE_NONE	= 0,
+	ARCHIVE_TAR	= 1,
+	ARCHIVE_ZIP	= 2,
+	ARCHIVE_PACK	= 3
+};
+
+// Archive member.
+struct Archive_Member
+{
+	// Member name, stored in the archive (valid until the next member is
+	// read).
+	const char *name;
+	// Is it a regular file ?
+	int regular;
+	// Compression method (0 for stored, 8 for deflated).
+	int method;
+	// Offset of the header (zip local header, or stored g1a header of a
+	// packed file) and of the data, which is only known once the member is
+	// read (0 until then).
+	uint64_t header;
+	uint64_t offset;
+	// Stored and original sizes.
+	uint64_t stored;
+	uint64_t size;
+};
+
+// Open archive.
+struct Archive
+{
+	// Archive file descriptor, format and size.
+	int fd;
+	enum Archive_Type type;
+	uint64_t size;
+	// Offset of the next tar header, or of the next entry in the zip
+	// central directory, and number of zip entries left; index of the
+	// next packed file, and number of files.
+	uint64_t next;
+	uint64_t count;
+	// Zip central directory, loaded in memory.
+	uint8_t *directory;
+	uint64_t directory_size;
+	// Pack superblock, header table, index and names, mapped in memory.
+	uint8_t *map;
+	uint64_t map_size;
+	// Requested member, or NULL for all the g1a files, and has it been
+	// found ?
+	const char *member;
+	int found;
+	// Name of the current member.
+	char name[PATH_MAX];
+};
+
+
+
+/*
+	Function prototypes.
+*/
+
+// Opening the archive named by an input, if it is one.
+int  archive_open(struct Archive *archive, const char *input);
+// Reading the next g1a file of the archive.
+int  archive_next(struct Archive *archive, struct Archive_Member *member);
+// Reading the first bytes of a member.
+ssize_t archive_read(struct Archive *archive, struct Archive_Member *member,
+	void *buffer, size_t size);
+// Copying a member to an output file, after its first bytes.
+int  archive_copy(struct Archive *archive, struct Archive_Member *member,
+	struct Output *output, uint64_t skip);
+// Naming a member for display.
+char *archive_label(const char *input, const struct Archive *archive,
+	const struct Archive_Member *member);
+// Closing the archive.
+void archive_close(struct Archive *archive);
+
+#endif // _ARCHIVE_H
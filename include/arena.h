@@ -0,0 +1,63 @@
+/*
+	Arena module.
+
+	Provides memory for the transient data of a job (files being parsed or
+	decoded). Allocations are never freed one by one: the whole arena is
+	reset in one step when the job finishes. The first block is kept across
+	resets, so that a long series of jobs runs in constant memory and, once
+	the first job is done, usually without calling malloc() at all.
+*/
+
+#ifndef _ARENA_H
+	#define _ARENA_H 1
+
+/*
+	Header inclusions.
+*/
+
+#include <stddef.h>
+
+
+
+/*
+	Constants definitions.
+*/
+
+// Size of the blocks, larger allocations getting a block of their own.
+#define ARENA_BLOCK	0x10000
+
+
+
+/*
+	Composed types definitions.
+*/
+
+// Arena block, followed by its data.
+struct Arena_Block;
+
+// Arena.
+struct Arena
+{
+	// First block (kept across resets) and block being filled.
+	struct Arena_Block *first;
+	struct Arena_Block *current;
+	// Used size of the current block.
+	size_t used;
+};
+
+
+
+/*
+	Function prototypes.
+*/
+
+// Initializing an empty arena.
+void  arena_init(struct Arena *arena);
+// Allocating memory, aligned for any type.
+void *arena_alloc(struct Arena *arena, size_t size);
+// Releasing all the allocations at once, keeping the first block.
+void  arena_reset(struct Arena *arena);
+// Releasing all the memory of the arena.
+void  arena_free(struct Arena *arena);
+
+#endif // _ARENA_H
@@ -0,0 +1,66 @@
+/*
+	Batch module.
+
+	Wraps or dumps many files in one run. Most payloads are small, so such
+	runs are dominated by system calls rather than copies: jobs are either
+	spread over worker threads, or submitted as chains of operations
+	(open, read, write, close, rename) through io_uring, many jobs at once.
+	The io_uring backend falls back to threads when it is not available.
+*/
+
+#ifndef _BATCH_H
+	#define _BATCH_H 1
+
+/*
+	Header inclusions.
+*/
+
+#include <stdint.h>
+
+#include "header.h"
+
+
+
+/*
+	Composed types definitions.
+*/
+
+// I/O backends.
+enum Batch_Backend
+{
+	// io_uring if available, threads otherwise.
+	BATCH_AUTO	= 0,
+	BATCH_URING	= 1,
+	BATCH_THREADS	= 2
+};
+
+// Batch job.
+struct Batch_Job
+{
+	// Input and output file names (no output when dumping).
+	const char *input;
+	char *output;
+	// Generated header, without size and checksums (wrap), or header as
+	// read from the file (dump).
+	uint8_t header[HEADER_SIZE];
+	// Input file size (dump).
+	uint64_t size;
+	// Error number, 0 on success, and defect of invalid ELF inputs.
+	int error;
+	const char *defect;
+};
+
+
+
+/*
+	Function prototypes.
+*/
+
+// Wrapping payloads into g1a files.
+enum Batch_Backend batch_wrap(struct Batch_Job *jobs, int count,
+	enum Batch_Backend backend);
+// Reading the headers of g1a files.
+enum Batch_Backend batch_dump(struct Batch_Job *jobs, int count,
+	enum Batch_Backend backend);
+
+#endif // _BATCH_H
@@ -8,15 +8,22 @@
 #include <stdio.h>
 #include <stdint.h>
 
+#include "arena.h"
+
 
 
 /*
 	Function prototypes.
 */
 
-// Load a bitmap from a file, with predefined size.
+// Load a bitmap from a file, scaled to a predefined size.
 void bitmap_read(const char *file, unsigned int width, unsigned int height,
-	uint8_t *data);
+	uint8_t *data, int dither, struct Arena *arena);
+// Split a sprite sheet cell name ('sheet.bmp@col,row').
+size_t bitmap_cell(const char *file, unsigned int *column,
+	unsigned int *row);
+// Free the decoded sprite sheets.
+void bitmap_free(void);
 // Output raw bitmap data to stream.
 void bitmap_output(uint8_t *data, int width, int height, FILE *stream);
 
@@ -0,0 +1,56 @@
+/*
+	Bundle module.
+
+	Writes the outputs of a batch as entries of a single tar archive (POSIX
+	ustar, with pax records for long names), to a file or to a pipe. No
+	intermediate g1a file is created: each entry is the generated header,
+	followed by the payload copied in the kernel (copy_file_range() to a
+	file, splice() to a pipe) when the input is a plain file.
+*/
+
+#ifndef _BUNDLE_H
+	#define _BUNDLE_H 1
+
+/*
+	Header inclusions.
+*/
+
+#include <time.h>
+
+#include "batch.h"
+#include "output.h"
+
+
+
+/*
+	Composed types definitions.
+*/
+
+// Archive being written.
+struct Bundle
+{
+	struct Output output;
+	// Date of all the entries, or -1 to use the dates of their inputs.
+	time_t mtime;
+};
+
+
+
+/*
+	Function prototypes.
+*/
+
+// Finding an entry name shared by several jobs.
+int  bundle_unique(const struct Batch_Job *jobs, int count,
+	const char **duplicate);
+// Creating an archive, '-' standing for the standard output.
+int  bundle_open(struct Bundle *bundle, const char *path, time_t mtime);
+// Wrapping the payload of a job into an archive entry.
+int  bundle_add(struct Bundle *bundle, struct Batch_Job *job,
+	const char *name);
+// Ending the archive and moving it into place.
+int  bundle_close(struct Bundle *bundle);
+// Removing a partial archive.
+void bundle_abort(struct Bundle *bundle);
+
+#endif // _BUNDLE_H
@@ -0,0 +1,47 @@
+/*
+	Cache module.
+
+	Local content-addressed store of generated g1a files. Entries are keyed
+	by a hash of the generated header (which covers every option and the
+	icon) and of the payload. Hits are materialized by reflink, hard link or
+	copy, and the store is kept under a size limit by evicting the least
+	recently used entries.
+*/
+
+#ifndef _CACHE_H
+	#define _CACHE_H 1
+
+/*
+	Header inclusions.
+*/
+
+#include <stdint.h>
+#include "payload.h"
+
+
+
+/*
+	Constants definitions.
+*/
+
+// Default cache size limit (256 MiB).
+#define CACHE_DEFAULT_LIMIT	(256ull << 20)
+
+
+
+/*
+	Function prototypes.
+*/
+
+// Computing the key of a wrap job.
+void cache_key(const unsigned char *header, const struct Payload *payload,
+	char key[33]);
+// Materializing a cached file, if present.
+int  cache_fetch(const char *dir, const char *key, const char *output);
+// Storing a generated file.
+void cache_store(const char *dir, const char *key, const char *output,
+	uint64_t limit);
+// Displaying cache statistics.
+void cache_stats(const char *dir, uint64_t limit);
+
+#endif // _CACHE_H
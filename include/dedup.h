@@ -0,0 +1,87 @@
+/*
+	Dedup module.
+
+	Finds g1a files whose payloads (everything after the header) are
+	byte-identical, such as renamed or re-versioned builds. Files are
+	grouped by size first, which rules out most of them without reading
+	anything; only files of a shared size have their payload hashed, and
+	files of a shared hash are then compared byte by byte with the first
+	one of their group. Payloads are read through fixed buffers, so the
+	memory used only depends on the number of files. Files whose headers
+	are identical too can be replaced with reflinks or hard links.
+*/
+
+#ifndef _DEDUP_H
+	#define _DEDUP_H 1
+
+/*
+	Header inclusions.
+*/
+
+#include <stdint.h>
+
+#include "fsck.h"
+
+
+
+/*
+	Composed types definitions.
+*/
+
+// Ways of consolidating identical files.
+enum Dedup_Link
+{
+	// Not consolidating.
+	DEDUP_NONE	= 0,
+	// Reflink if the file system supports it, hard link otherwise.
+	DEDUP_AUTO	= 1,
+	DEDUP_REFLINK	= 2,
+	DEDUP_HARD	= 3
+};
+
+// File record.
+struct Dedup_File
+{
+	// File name (pointing to the file list).
+	const char *path;
+	// File size, device and inode number.
+	uint64_t size;
+	uint64_t device;
+	uint64_t inode;
+	// Payload hash, if the size is shared.
+	uint64_t hash[2];
+	// Index of the first file of the cluster (the file itself for the
+	// first one), or -1 if the payload is unique.
+	int cluster;
+	// Is the whole file identical to the first one of its cluster, and is
+	// it the same file (already linked) ?
+	int whole;
+	int same;
+	// Error number if the file could not be read, 0 otherwise.
+	int error;
+};
+
+// Set of files.
+struct Dedup
+{
+	// Files, sorted by cluster once dedup_run() returns, and their number.
+	struct Dedup_File *files;
+	int count;
+};
+
+
+
+/*
+	Function prototypes.
+*/
+
+// Creating the records of the files of a list.
+int  dedup_init(struct Dedup *dedup, const struct Fsck *list);
+// Finding the clusters of identical payloads.
+void dedup_run(struct Dedup *dedup);
+// Replacing a file with a link to the first file of its cluster.
+int  dedup_link(struct Dedup *dedup, int index, enum Dedup_Link mode);
+// Freeing the records.
+void dedup_free(struct Dedup *dedup);
+
+#endif // _DEDUP_H
@@ -0,0 +1,20 @@
+/*
+	Dependency file module.
+
+	Records the files read while generating an output, and writes them as a
+	Makefile rule (the format used by gcc -MD, which ninja also reads).
+*/
+
+#ifndef _DEPFILE_H
+	#define _DEPFILE_H 1
+
+/*
+	Function prototypes.
+*/
+
+// Recording a dependency.
+void depfile_add(const char *file);
+// Writing the dependency rule of a target.
+int  depfile_write(const char *depfile, const char *target);
+
+#endif // _DEPFILE_H
@@ -0,0 +1,31 @@
+/*
+	Diff module.
+
+	Compares two g1a files: their headers field by field, following the
+	header description table, and their binary contents as a list of
+	differing byte ranges.
+*/
+
+#ifndef _DIFF_H
+	#define _DIFF_H 1
+
+/*
+	Header inclusions.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+
+/*
+	Function prototypes.
+*/
+
+// Comparing two decoded headers, and displaying the differing fields.
+int diff_header(const uint8_t *a, const uint8_t *b);
+// Comparing two binary contents, and displaying the differing ranges.
+int diff_payload(const uint8_t *a, size_t a_size, const uint8_t *b,
+	size_t b_size);
+
+#endif // _DIFF_H
@@ -32,9 +32,14 @@ enum Error_Level
 void error_init(const char *prefix, int exit_code, int *failure);
 // Adding errors.
 void error_add(enum Error_Level level, const char *name, const char *format);
+// Releasing the errors.
+void error_free(void);
 // Disabling error with a command-line argument of format -[DNWE]<error_name>.
 int  error_argument(const char *argument);
 // Emitting errors on stderr.
 void error_emit(enum Error_Level level, const char *name, ...);
+// Listing the number of times every error was emitted.
+void error_counts(void (*callback)(enum Error_Level level, const char *name,
+	unsigned long count, void *data), void *data);
 
 #endif // _ERROR_H
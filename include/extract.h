@@ -0,0 +1,30 @@
+/*
+	Extraction module.
+
+	Gets the binary content of a g1a file back, after checking its header,
+	by copying it in the kernel from offset 0x200 of the file. g1a files
+	stored in archives are extracted the same way, from the archive.
+*/
+
+#ifndef _EXTRACT_H
+	#define _EXTRACT_H 1
+
+/*
+	Header inclusions.
+*/
+
+#include "archive.h"
+
+
+
+/*
+	Function prototypes.
+*/
+
+// Extracting the binary content of a g1a file.
+int extract(const char *input, const char *output, const char **defect);
+// Extracting the binary content of a g1a file stored in an archive.
+int extract_member(struct Archive *archive, struct Archive_Member *member,
+	const char *output, const char **defect);
+
+#endif // _EXTRACT_H
@@ -0,0 +1,63 @@
+/*
+	Fsck module.
+
+	Checks, and optionally repairs, the headers of many g1a files at once.
+	Directories are walked recursively for files with extension '.g1a'.
+	Only the header and the size of every file are read, on worker threads,
+	and every defect is classified rather than the first one. Repairable
+	headers (wrong sizes, checksums or MCS inversion) are fixed by
+	rewriting the header in place, with a single write.
+*/
+
+#ifndef _FSCK_H
+	#define _FSCK_H 1
+
+/*
+	Header inclusions.
+*/
+
+#include <stdint.h>
+
+
+
+/*
+	Composed types definitions.
+*/
+
+// Checked file.
+struct Fsck_File
+{
+	// File name (allocated).
+	char *path;
+	// File size.
+	uint64_t size;
+	// Defects found (enum Header_Defect bits), and were they repaired ?
+	unsigned int defects;
+	int repaired;
+	// Error number if the file could not be read or repaired, 0 otherwise.
+	int error;
+};
+
+// Set of files to check.
+struct Fsck
+{
+	// Files, their number and the allocated number of entries.
+	struct Fsck_File *files;
+	int count;
+	int capacity;
+};
+
+
+
+/*
+	Function prototypes.
+*/
+
+// Adding a file, or the g1a files of a directory tree.
+int  fsck_add(struct Fsck *fsck, const char *path);
+// Checking all the files, and repairing them if requested.
+void fsck_run(struct Fsck *fsck, int repair);
+// Freeing the file list.
+void fsck_free(struct Fsck *fsck);
+
+#endif // _FSCK_H
@@ -6,12 +6,20 @@
 */
 
 #include <ctype.h>
+#include <errno.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <sys/stat.h>
+
+#include "arena.h"
+#include "archive.h"
+#include "batch.h"
+#include "dedup.h"
+#include "payload.h"
 
 
 
@@ -24,18 +32,82 @@ struct Options
 {
 	// Is the actio to dump a file ?
 	int dump;
-	// Input and output file names.
+	// Is the action to extract binary content from g1a files ?
+	int extract;
+	// Is the action to compare two g1a files ?
+	int diff;
+	// Is the action to list g1a files, one per line ?
+	int index;
+	// Is the action to check g1a files and directories, and are the
+	// defective headers repaired ?
+	int fsck;
+	int repair;
+	// Patterns file, if the action is to scan g1a files for them.
+	char *scan;
+	// Is the action to find duplicate payloads, and how are identical
+	// files consolidated ?
+	int dedup;
+	enum Dedup_Link link;
+	// Pack written from the input files and directories, if the action is
+	// to pack them, and is the action to restore the files of packs ?
+	char *pack;
+	int unpack;
+	// Are all the input files wrapped or dumped, and with which backend ?
+	int batch;
+	enum Batch_Backend io;
+	// Input, output and icon file names.
 	char *input;
 	char *output;
+	char *icon_file;
+	// Inherited input and output file descriptors (-1 if not used), and
+	// their names ('/dev/fd/N').
+	int input_fd;
+	int output_fd;
+	char fd_names[2][24];
+	// All the input file names (several files can be extracted at once),
+	// and their icon files in batch mode (NULL for the default icon).
+	char **inputs;
+	char **icons;
+	int input_count;
+	// Batch manifest file name, and its contents (which the input and
+	// icon file names point to).
+	char *manifest;
+	char *manifest_data;
+	// Archive receiving the batch outputs, or NULL.
+	char *bundle;
+	// Settings of the variants written from the same input, if any.
+	char **variants;
+	int variant_count;
 	// Is the output file name dynamcally allocated ?
 	int output_dynamic;
+	// Is the output rebuilt whenever the inputs change, and after how
+	// many milliseconds without changes ?
+	int watch;
+	int debounce;
+	// Are output files synced to disk at the end of the run ?
+	int durable;
+	// Are nondeterministic defaults (current date) refused ? Build
+	// timestamp from SOURCE_DATE_EPOCH, or -1 if it is not set.
+	int reproducible;
+	time_t epoch;
+	// Dependency file name (or NULL), and is it dynamically allocated ?
+	char *depfile;
+	int depfile_dynamic;
+	// Cache directory (or NULL), size limit and statistics command.
+	char *cache;
+	uint64_t cache_limit;
+	int cache_stats;
 	// Program name, version, internal name, build date.
 	char name[9];
 	char version[11];
 	char internal[9];
 	char date[15];
-	// Raw monochrome icon data.
+	// Raw monochrome icon data, and is it dithered when scaled ?
 	uint8_t icon[76];
+	int dither;
+	// Arena for transient parsing memory (set by main()), reset after
+	// every job.
+	struct Arena *arena;
 };
 
 /* File header structure.
@@ -80,16 +152,58 @@ int main(int argc, char **argv);
 // Generating options structure from command-line arguments.
 void args(int argc, char **argv, struct Options *options);
 // Generating header data from options.
-void generate(struct Options options, unsigned char *data);
+void generate(const struct Options *options, unsigned char *data);
+// Applying the settings of a variant to options.
+void variant(struct Options *options, char *settings);
+// Naming the program after its output file.
+void default_name(char *name, const char *output);
+// Generating and writing an output file, using the cache if enabled.
+void wrap(const struct Options *options, const struct Payload *payload);
 // Writing header data and binary content to file.
-void write(const char * inputfile, const char *outputfile,
+void write(const struct Payload *payload, const char *outputfile,
+	unsigned char *data);
+// Writing header data and binary content to an open file descriptor.
+void write_fd(const struct Payload *payload, int fd, const char *name,
 	unsigned char *data);
 
 // Testing if a string matches a simple format.
 int string_format(const char *str, const char *format);
 
+// Reading the headers of a g1a file or of the g1a files of an archive.
+int headers(const char *input, void (*show)(const char *filename,
+	const uint8_t *raw, uint64_t filesize), int spaced);
 // Dumping a g1a file's header content.
 void dump(const char *filename);
+// Checking and displaying a header read from a g1a file.
+void dump_header(const char *filename, const uint8_t *raw, uint64_t filesize);
+// Listing g1a files, one per line.
+void catalog(const struct Options *options);
+// Checking and displaying a header read from a g1a file, on one line.
+void index_header(const char *filename, const uint8_t *raw,
+	uint64_t filesize);
+// Checking and repairing the headers of g1a files and directories.
+int fsck(const struct Options *options);
+// Looking for byte signatures in the payloads of g1a files.
+int scan(const struct Options *options);
+// Finding the g1a files with identical payloads.
+void dedup(const struct Options *options);
+// Storing g1a files in a pack.
+void pack(const struct Options *options);
+// Restoring the g1a files of packs.
+void unpack(const struct Options *options);
+// Reading the jobs listed in a batch manifest.
+void manifest(struct Options *options);
+// Wrapping or dumping all the input files.
+void batch(const struct Options *options);
+// Rebuilding the output whenever the input or icon files change.
+void watch(struct Options *options, uint32_t size);
+// Extracting the binary content of g1a files.
+void unwrap(const struct Options *options);
+// Extracting the binary content of the g1a files of an archive.
+void unwrap_archive(const struct Options *options, struct Archive *archive,
+	const char *input);
+// Comparing two g1a files.
+int diff(const char *first, const char *second);
 // Displaying program help.
 void help(void);
 // Displaying header information.
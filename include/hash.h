@@ -0,0 +1,53 @@
+/*
+	Hash module.
+
+	Streaming implementation of the 128-bit MurmurHash3 (x64 variant),
+	used to identify payloads and cache entries by content. It is not a
+	cryptographic hash.
+*/
+
+#ifndef _HASH_H
+	#define _HASH_H 1
+
+/*
+	Header inclusions.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+
+/*
+	Composed types definitions.
+*/
+
+// Hash computation state.
+struct Hash
+{
+	// Running hash values.
+	uint64_t h1, h2;
+	// Total number of bytes hashed.
+	uint64_t length;
+	// Pending bytes that do not fill a block yet.
+	uint8_t tail[16];
+	unsigned int tail_length;
+};
+
+
+
+/*
+	Function prototypes.
+*/
+
+// Initializing a hash computation.
+void hash_init(struct Hash *hash, uint64_t seed);
+// Hashing data.
+void hash_update(struct Hash *hash, const void *data, size_t size);
+// Finalizing the computation and getting the 128-bit value.
+void hash_final(struct Hash *hash, uint64_t value[2]);
+// Hashing a memory area in one call.
+void hash_data(const void *data, size_t size, uint64_t seed,
+	uint64_t value[2]);
+
+#endif // _HASH_H
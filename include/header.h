@@ -0,0 +1,132 @@
+/*
+	Header module.
+
+	Describes the g1a header layout as a table of fields, which drives
+	header generation, validation, dumping and the --info output. Constant
+	fields are assembled once into a template that every generated header
+	starts from.
+*/
+
+#ifndef _HEADER_H
+	#define _HEADER_H 1
+
+/*
+	Header inclusions.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+
+/*
+	Constants definitions.
+*/
+
+// Header size.
+#define HEADER_SIZE	0x200
+// Size of the inverted (MCS) part at the beginning of the header.
+#define HEADER_INVERTED	0x020
+// Number of defect classes, and defects that header_audit() can repair.
+#define HEADER_DEFECTS	9
+#define HEADER_REPAIRABLE (DEFECT_INVERTED | DEFECT_SIZE1 | DEFECT_SIZE2 \
+	| DEFECT_CHECKSUM1 | DEFECT_CHECKSUM2)
+
+
+
+/*
+	Composed types definitions.
+*/
+
+// Header defects found by header_audit(), as bits.
+enum Header_Defect
+{
+	// The file is shorter than the header, or too large for the size
+	// fields.
+	DEFECT_SHORT		= 0x001,
+	DEFECT_LARGE		= 0x002,
+	// The identification fields are wrong: not a g1a file.
+	DEFECT_MAGIC		= 0x004,
+	DEFECT_TYPE		= 0x008,
+	// The MCS part is stored without being inverted.
+	DEFECT_INVERTED		= 0x010,
+	// The size fields do not match the file size.
+	DEFECT_SIZE1		= 0x020,
+	DEFECT_SIZE2		= 0x040,
+	// The checksums do not match the file size.
+	DEFECT_CHECKSUM1	= 0x080,
+	DEFECT_CHECKSUM2	= 0x100
+};
+
+// Field types.
+enum Field_Type
+{
+	// Fixed value, stored in the template.
+	FIELD_CONSTANT,
+	// Total file size, 32-bit big endian.
+	FIELD_SIZE,
+	// Low byte of the file size plus a constant.
+	FIELD_CHECKSUM,
+	// Text copied from the options.
+	FIELD_STRING,
+	// Monochrome icon.
+	FIELD_ICON,
+	// Unused, unknown or unsupported data.
+	FIELD_RAW
+};
+
+// Header field descriptor.
+struct Header_Field
+{
+	// Offset and size in the header.
+	unsigned int offset, size;
+	// Field type.
+	enum Field_Type type;
+	// Short name, and description as displayed by --info.
+	const char *name;
+	const char *description;
+	// Constant value, or checksum addend as its first byte.
+	const char *value;
+	// Offset of the source string in struct Options (FIELD_STRING).
+	size_t option;
+	// Defect reported when this field is invalid (NULL if unchecked).
+	const char *defect;
+};
+
+
+
+/*
+	Global variables declarations.
+*/
+
+// Header layout, terminated by a field of size 0.
+extern const struct Header_Field header_fields[];
+// Short names of the defect classes, by bit index.
+extern const char *header_defects[HEADER_DEFECTS];
+
+
+
+/*
+	Function prototypes.
+*/
+
+// Getting the header template with all constant fields set.
+const uint8_t *header_template(void);
+// Looking up a field by name.
+const struct Header_Field *header_field(const char *name);
+// Setting the size and checksums, and inverting the MCS header.
+void header_finalize(uint8_t *data, uint32_t size);
+// Decoding the MCS header of a raw header (inverting it back).
+void header_decode(const uint8_t *raw, uint8_t *data);
+// Checking a decoded header against the file size.
+const char *header_check(const uint8_t *data, uint64_t filesize);
+// Finding every defect of a raw header, and the repaired header.
+unsigned int header_audit(const uint8_t *raw, uint64_t filesize,
+	uint8_t *fixed);
+// Reading the file size stored in a field.
+uint32_t header_size(const uint8_t *data, const struct Header_Field *field);
+// Extracting a string field into a NUL-terminated buffer.
+char *header_string(const uint8_t *data, const struct Header_Field *field,
+	char *buffer);
+
+#endif // _HEADER_H
@@ -0,0 +1,24 @@
+/*
+	Metrics module.
+
+	Publishes the statistics as a Prometheus text-format file, for the
+	textfile collector of node_exporter: job counts and rates, phase
+	latency histograms, I/O counters, cache hit ratio, diagnostic counts
+	and queue depth. The file is replaced atomically, at exit and after
+	every rebuild in watch mode, so that collectors never read a partial
+	file.
+*/
+
+#ifndef _METRICS_H
+	#define _METRICS_H 1
+
+/*
+	Function prototypes.
+*/
+
+// Enabling metrics, written to the given file at exit.
+void metrics_init(const char *file);
+// Writing the metrics file now (does nothing if metrics are disabled).
+void metrics_write(void);
+
+#endif // _METRICS_H
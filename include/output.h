@@ -0,0 +1,76 @@
+/*
+	Output module.
+
+	Writes output files atomically: data goes to a temporary file created in
+	the destination directory and preallocated to its final size, which is
+	renamed over the destination once complete. In durable mode, the file
+	systems that received output files are synced once at the end of the
+	run instead of syncing every file.
+*/
+
+#ifndef _OUTPUT_H
+	#define _OUTPUT_H 1
+
+/*
+	Header inclusions.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+
+
+/*
+	Composed types definitions.
+*/
+
+// Output file being written.
+struct Output
+{
+	// Temporary file descriptor.
+	int fd;
+	// Final and temporary file names.
+	const char *path;
+	char *temp;
+	// Current write offset.
+	uint64_t offset;
+};
+
+
+
+/*
+	Function prototypes.
+*/
+
+// Enabling or disabling durable mode.
+void output_durable(int enable);
+// Creating a temporary output file with the given final size.
+int  output_open(struct Output *output, const char *path, uint64_t size);
+// Writing to an open descriptor, in place.
+void output_stream(struct Output *output, int fd, const char *path);
+// Appending data to an output file.
+int  output_append(struct Output *output, const void *data, size_t size);
+int  output_appendv(struct Output *output, struct iovec *iov, int count);
+int  output_zero(struct Output *output, size_t size);
+// Filling an empty output file from another file, by reflink, hard link or
+// copy.
+int  output_clone(struct Output *output, int fd);
+int  output_link(struct Output *output, const char *source);
+int  output_copy(struct Output *output, int fd, uint64_t offset,
+	uint64_t size);
+// Renaming the output file into place.
+int  output_commit(struct Output *output);
+// Overwriting part of an existing file, keeping its size.
+int  output_patch(const char *path, const void *data, size_t size,
+	uint64_t offset);
+// Registering an output file written by other means, for output_sync().
+int  output_remember(const char *path);
+// Removing the temporary file after a failure.
+void output_abort(struct Output *output);
+// Syncing all the file systems written to, in durable mode.
+int  output_sync(void);
+// Building a default output file name from an input file name.
+char *output_name(const char *input, const char *dir, const char *extension);
+
+#endif // _OUTPUT_H
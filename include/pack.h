@@ -0,0 +1,91 @@
+/*
+	Pack module.
+
+	Stores many g1a files in a single pack file, which avoids the inode
+	and block slack of small files and turns cold scans into sequential
+	reads. All the headers are kept uncompressed in one contiguous table,
+	so that listing a pack maps them without reading anything else; every
+	payload is compressed on its own (as a raw deflate frame, or stored if
+	that is smaller), so that any file is extracted with a single seek.
+
+	Layout (integers are little-endian):
+
+		0x000	Superblock (PACK_SUPER bytes):
+			  0x00	Magic 'G1A-PACK'
+			  0x08	Version (32 bits)
+			  0x0c	Number of files (32 bits)
+			  0x10	Offset of the header table (64 bits)
+			  0x18	Offset of the index (64 bits)
+			  0x20	Offset and size of the names (64 bits each)
+			  0x30	Offset of the frames (64 bits)
+		0x200	Header table: one 512-byte header per file
+		...	Index: one PACK_ENTRY-byte entry per file:
+			  0x00	Frame offset (64 bits)
+			  0x08	Frame size (64 bits)
+			  0x10	Payload size (64 bits)
+			  0x18	Name offset in the names (32 bits)
+			  0x1c	Name length (16 bits)
+			  0x1e	Compression method, 0 or 8 as in zip (16 bits)
+		...	Names, without separators
+		...	Frames, in file order
+
+	Packs are read by the archive module, as 'file.pack' for all of its
+	files and 'file.pack:name' for one of them.
+*/
+
+#ifndef _PACK_H
+	#define _PACK_H 1
+
+/*
+	Header inclusions.
+*/
+
+#include <stdint.h>
+
+#include "archive.h"
+#include "fsck.h"
+
+
+
+/*
+	Constants definitions.
+*/
+
+// Magic number and format version.
+#define PACK_MAGIC	"G1A-PACK"
+#define PACK_VERSION	1
+// Sizes of the superblock, of the stored headers and of index entries.
+#define PACK_SUPER	0x200
+#define PACK_HEADER	0x200
+#define PACK_ENTRY	32
+
+
+
+/*
+	Composed types definitions.
+*/
+
+// Pack being written.
+struct Pack
+{
+	// Number of files packed, total size of the files and pack size.
+	int count;
+	uint64_t size;
+	uint64_t stored;
+	// File that could not be read, if any.
+	const char *failed;
+};
+
+
+
+/*
+	Function prototypes.
+*/
+
+// Writing the files of a checked list to a pack.
+int  pack_write(struct Pack *pack, const char *path, const struct Fsck *list);
+// Restoring a whole g1a file from an archive into a directory.
+int  pack_restore(struct Archive *archive, struct Archive_Member *member,
+	const char *dir);
+
+#endif // _PACK_H
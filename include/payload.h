@@ -0,0 +1,87 @@
+/*
+	Payload module.
+
+	Loads the binary content of an add-in into memory, by mapping the input
+	file when possible, so that it can be hashed and written without any
+	intermediate copy. ELF files can be loaded directly: the image is then
+	made of their loadable segments, with zeros in the gaps, as objcopy -O
+	binary would output it.
+*/
+
+#ifndef _PAYLOAD_H
+	#define _PAYLOAD_H 1
+
+/*
+	Header inclusions.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+
+/*
+	Constants definitions.
+*/
+
+// Loading flag: converting ELF files to binary images.
+#define PAYLOAD_ELF		1
+// Load address of add-ins, and end of their memory area.
+#define PAYLOAD_BASE		0x00300200
+#define PAYLOAD_LIMIT		0x00380000
+
+
+
+/*
+	Composed types definitions.
+*/
+
+// Payload part: file data, or zeros if data is NULL.
+struct Payload_Segment
+{
+	const uint8_t *data;
+	size_t size;
+};
+
+// Loaded payload.
+struct Payload
+{
+	// Payload bytes (NULL for ELF files, see segments) and image size.
+	const uint8_t *data;
+	size_t size;
+	// Is the file mapped (or else allocated) ?
+	int mapped;
+	// Whole file contents.
+	const uint8_t *file;
+	size_t file_size;
+	// Image segments of ELF files, in address order, or NULL.
+	struct Payload_Segment *segments;
+	int segment_count;
+	// Single segment of other files.
+	struct Payload_Segment whole;
+	// Defect of invalid ELF files, or NULL.
+	const char *defect;
+};
+
+// Output file (see output.h).
+struct Output;
+
+
+
+/*
+	Function prototypes.
+*/
+
+// Loading a payload from a file, or from an open file descriptor.
+int  payload_open(struct Payload *payload, const char *file, int flags);
+int  payload_fd(struct Payload *payload, int fd, int flags);
+// Getting the segments of a payload.
+const struct Payload_Segment *payload_segments(const struct Payload *payload,
+	int *count);
+// Appending a payload to an output file, after a header.
+int  payload_write(const struct Payload *payload, struct Output *output,
+	const void *header, size_t size);
+// Releasing a payload.
+void payload_close(struct Payload *payload);
+
+#endif // _PAYLOAD_H
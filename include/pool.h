@@ -0,0 +1,28 @@
+/*
+	Pool module.
+
+	Runs a job on every index of a range, on worker threads, one per
+	processor. The calling thread is one of the workers. Indexes are handed
+	out in increasing order, each one to a single worker.
+*/
+
+#ifndef _POOL_H
+	#define _POOL_H 1
+
+/*
+	Constants definitions.
+*/
+
+// Maximum number of worker threads.
+#define POOL_THREADS_MAX	16
+
+
+
+/*
+	Function prototypes.
+*/
+
+// Running a job on every index of a range, on worker threads.
+void pool_run(int count, void (*job)(void *arg, int index), void *arg);
+
+#endif // _POOL_H
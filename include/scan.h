@@ -0,0 +1,116 @@
+/*
+	Scan module.
+
+	Looks for byte signatures in the payloads (everything after the header)
+	of many g1a files at once. Files are mapped in memory and scanned on
+	worker threads. All the patterns are matched in a single pass with the
+	Wu-Manber algorithm: a table indexed by pairs of bytes tells how far the
+	window can be moved without skipping a possible match, which skips
+	most of the payload when patterns are a few bytes long or more, and
+	the pairs that end a pattern prefix select the patterns to compare.
+
+	Patterns are read from a file, one per line, as a name followed by a
+	quoted string (with C escapes \\, \", \n, \t, \0 and \xHH) or by hex
+	bytes, optionally separated by spaces:
+
+		strcpy_v1	0a 9f 4e 0b e4 01
+		banner		"Copyright (C) 2004\0"
+
+	Empty lines and lines starting with '#' are ignored.
+*/
+
+#ifndef _SCAN_H
+	#define _SCAN_H 1
+
+/*
+	Header inclusions.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "fsck.h"
+
+
+
+/*
+	Constants definitions.
+*/
+
+// Number of byte pairs, which index the shift table.
+#define SCAN_PAIRS	0x10000
+// Maximum window length: longer patterns are only matched on their first
+// bytes by the shift table.
+#define SCAN_WINDOW	64
+
+
+
+/*
+	Composed types definitions.
+*/
+
+// Pattern.
+struct Scan_Pattern
+{
+	// Name, bytes and length (the name points to the patterns file data,
+	// the bytes are allocated).
+	const char *name;
+	uint8_t *bytes;
+	size_t size;
+	// Next pattern with the same window end, or -1.
+	int next;
+};
+
+// Compiled set of patterns.
+struct Scan
+{
+	// Patterns and their number.
+	struct Scan_Pattern *patterns;
+	int count;
+	// Window length: shortest pattern length, at most SCAN_WINDOW.
+	size_t window;
+	// Shift of the window for every pair of bytes (or byte, if the window
+	// is one byte long), and first pattern whose window ends with it.
+	uint8_t *shift;
+	int *heads;
+	// Patterns file data, and line of the first syntax error.
+	char *data;
+	int line;
+};
+
+// Match.
+struct Scan_Match
+{
+	// Offset in the file, and pattern index.
+	uint64_t offset;
+	int pattern;
+};
+
+// Matches found in a file.
+struct Scan_Result
+{
+	// Matches, in file order, their number and the allocated number.
+	struct Scan_Match *matches;
+	int count;
+	int capacity;
+	// Error number if the file could not be read, 0 otherwise.
+	int error;
+};
+
+
+
+/*
+	Function prototypes.
+*/
+
+// Reading and compiling a patterns file.
+int  scan_load(struct Scan *scan, const char *file);
+// Scanning the payloads of files.
+void scan_run(const struct Scan *scan, const struct Fsck *files,
+	struct Scan_Result *results);
+// Freeing the matches of files.
+void scan_results_free(struct Scan_Result *results, int count);
+// Freeing the patterns.
+void scan_free(struct Scan *scan);
+
+#endif // _SCAN_H
@@ -0,0 +1,137 @@
+/*
+	Statistics module.
+
+	Collects per-phase timings and I/O counters when the --stats option is
+	given, and reports them at exit. When disabled, the instrumentation
+	reduces to a test on a global flag.
+
+	Counters are kept per thread, so that concurrent jobs never contend on
+	them, and are only summed when a report or a snapshot is made. Phase
+	durations are also sorted into decade buckets, from 10 us to 10 s.
+*/
+
+#ifndef _STATS_H
+	#define _STATS_H 1
+
+/*
+	Header inclusions.
+*/
+
+#include <stdint.h>
+
+
+
+/*
+	Constants definitions.
+*/
+
+// Number of latency buckets: bucket k holds durations up to 10^(k-5) s.
+#define STATS_BUCKETS	7
+
+
+
+/*
+	Composed types definitions.
+*/
+
+// Timed program phases.
+enum Stats_Phase
+{
+	STATS_ARGS	= 0,
+	STATS_ICON	= 1,
+	STATS_GENERATE	= 2,
+	STATS_WRITE	= 3,
+	STATS_DUMP	= 4,
+	STATS_CACHE	= 5,
+	STATS_EXTRACT	= 6,
+	STATS_DIFF	= 7,
+	STATS_BATCH	= 8,
+	STATS_INDEX	= 9,
+	STATS_FSCK	= 10,
+	STATS_SCAN	= 11,
+	STATS_DEDUP	= 12,
+	STATS_PACK	= 13,
+	STATS_UNPACK	= 14,
+	STATS_PHASES
+};
+
+// I/O counters.
+enum Stats_Counter
+{
+	STATS_BYTES_READ	= 0,
+	STATS_BYTES_WRITTEN	= 1,
+	STATS_READ_CALLS	= 2,
+	STATS_WRITE_CALLS	= 3,
+	STATS_SYSCALLS		= 4,
+	STATS_URING_OPS		= 5,
+	STATS_JOBS_QUEUED	= 6,
+	STATS_JOBS_DONE		= 7,
+	STATS_CACHE_HITS	= 8,
+	STATS_CACHE_MISSES	= 9,
+	STATS_COUNTERS
+};
+
+// Aggregated state of the statistics.
+struct Stats_Snapshot
+{
+	// Time since statistics were enabled, in nanoseconds.
+	uint64_t uptime;
+	// Counter values, summed over all the threads.
+	uint64_t counters[STATS_COUNTERS];
+	// Accumulated durations, number of runs and latency distribution of
+	// every phase, summed over all the threads (runs longer than the last
+	// bucket are not in any).
+	uint64_t phase_total[STATS_PHASES];
+	uint64_t phase_count[STATS_PHASES];
+	uint64_t phase_buckets[STATS_PHASES][STATS_BUCKETS];
+};
+
+
+
+/*
+	Macros.
+
+	These are the only entry points that should be used in the hot paths, as
+	they do not call anything unless statistics are enabled.
+*/
+
+#define STATS_BEGIN(phase) \
+	do { if(stats_enabled) stats_begin(phase); } while(0)
+#define STATS_END(phase) \
+	do { if(stats_enabled) stats_end(phase); } while(0)
+#define STATS_ADD(counter, value) \
+	do { if(stats_enabled) stats_add(counter, value); } while(0)
+
+
+
+/*
+	Global variables declarations.
+*/
+
+// Non-zero when statistics are collected.
+extern int stats_enabled;
+
+
+
+/*
+	Function prototypes.
+*/
+
+// Enabling statistics, reporting either on stderr (NULL) or to a file.
+void stats_init(const char *file);
+// Enabling statistics collection without a report.
+void stats_enable(void);
+// Starting and stopping the clock of a phase.
+void stats_begin(enum Stats_Phase phase);
+void stats_end(enum Stats_Phase phase);
+// Adding a value to a counter.
+void stats_add(enum Stats_Counter counter, uint64_t value);
+// Outputting the collected statistics.
+void stats_report(void);
+// Aggregating the collected statistics.
+void stats_snapshot(struct Stats_Snapshot *snapshot);
+// Getting the report names of phases and counters.
+const char *stats_phase_name(enum Stats_Phase phase);
+const char *stats_counter_name(enum Stats_Counter counter);
+
+#endif // _STATS_H
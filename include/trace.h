@@ -0,0 +1,66 @@
+/*
+	Trace module.
+
+	Records begin and end events of program phases and jobs, in the Chrome
+	trace-event format read by Perfetto and chrome://tracing, to show how
+	jobs were spread over the worker threads. Every thread records into its
+	own ring buffer, without synchronization; the buffers are merged into
+	the trace file at exit. When a buffer is full, the oldest events are
+	overwritten. When disabled, the instrumentation reduces to a test on a
+	global flag.
+*/
+
+#ifndef _TRACE_H
+	#define _TRACE_H 1
+
+/*
+	Header inclusions.
+*/
+
+#include <stdint.h>
+
+
+
+/*
+	Constants definitions.
+*/
+
+// Number of events kept per thread.
+#define TRACE_EVENTS	16384
+
+
+
+/*
+	Macros.
+
+	Event names and argument keys must be string literals (or otherwise
+	live until exit), as only their addresses are recorded.
+*/
+
+#define TRACE_BEGIN(name, key, value) \
+	do { if(trace_enabled) trace_event('B', name, key, value); } while(0)
+#define TRACE_END(name) \
+	do { if(trace_enabled) trace_event('E', name, NULL, 0); } while(0)
+
+
+
+/*
+	Global variables declarations.
+*/
+
+// Non-zero when events are recorded.
+extern int trace_enabled;
+
+
+
+/*
+	Function prototypes.
+*/
+
+// Enabling tracing, written to the given file at exit.
+void trace_init(const char *file);
+// Recording an event, with an optional integer argument.
+void trace_event(char phase, const char *name, const char *key,
+	int64_t value);
+
+#endif // _TRACE_H
@@ -0,0 +1,61 @@
+/*
+	Watch module.
+
+	Waits for files to be rewritten, using inotify. The directories of the
+	files are watched rather than the files themselves, so that files
+	replaced by a rename (as many tools do) are still followed. Bursts of
+	events, such as a linker closing its output several times, are merged
+	into a single notification.
+*/
+
+#ifndef _WATCH_H
+	#define _WATCH_H 1
+
+/*
+	Header inclusions.
+*/
+
+#include <stdint.h>
+
+
+
+/*
+	Constants definitions.
+*/
+
+// Maximum number of watched files.
+#define WATCH_MAX	8
+// Default debounce delay, in milliseconds.
+#define WATCH_DEBOUNCE	5
+
+
+
+/*
+	Composed types definitions.
+*/
+
+// Set of watched files.
+struct Watch
+{
+	// inotify descriptor.
+	int fd;
+	// Number of files, their base names and directory watch descriptors.
+	int count;
+	const char *names[WATCH_MAX];
+	int wds[WATCH_MAX];
+};
+
+
+
+/*
+	Function prototypes.
+*/
+
+// Starting to watch files.
+int  watch_open(struct Watch *watch, const char **files, int count);
+// Waiting for some of the files to change.
+int  watch_wait(struct Watch *watch, int debounce, uint32_t *changed);
+// Stopping to watch.
+void watch_close(struct Watch *watch);
+
+#endif // _WATCH_H
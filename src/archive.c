@@ -0,0 +1,1041 @@
+/*
+	Archive module.
+*/
+
+
+
+/*
+	Header inclusions.
+*/
+
+// Standard headers.
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Library headers.
+#include <zlib.h>
+
+// Project headers.
+#include "archive.h"
+#include "pack.h"
+#include "stats.h"
+
+
+
+/*
+	Constants definitions.
+*/
+
+// Size of tar blocks.
+#define BLOCK		512
+// Largest pax extended header that is read, in bytes.
+#define PAX_MAX		0x10000
+// Zip record signatures, and sizes of the fixed parts of the records.
+#define ZIP_LOCAL	0x04034b50
+#define ZIP_CENTRAL	0x02014b50
+#define ZIP_END		0x06054b50
+#define ZIP_END64	0x06064b50
+#define ZIP_LOCATOR	0x07064b50
+#define ZIP_LOCAL_SIZE	30
+#define ZIP_CENTRAL_SIZE 46
+#define ZIP_END_SIZE	22
+#define ZIP_END64_SIZE	56
+#define ZIP_LOCATOR_SIZE 20
+// Longest zip archive comment.
+#define ZIP_COMMENT	0xffff
+// Size of the compressed chunks read when inflating.
+#define CHUNK		0x1000
+
+
+
+/*
+	Composed types definitions.
+*/
+
+// Inflated member being read.
+struct Inflater
+{
+	// zlib stream.
+	z_stream stream;
+	// Archive descriptor, offset and size of the compressed data left.
+	int fd;
+	uint64_t offset, left;
+	// Compressed data buffer.
+	uint8_t chunk[CHUNK];
+};
+
+
+
+/*
+	Static function definitions.
+*/
+
+/*
+	get16(), get32(), get64()
+
+	Read little-endian integers, as stored in zip archives.
+*/
+
+static uint32_t get16(const uint8_t *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+	return get16(p) | (uint32_t)get16(p + 2) << 16;
+}
+
+static uint64_t get64(const uint8_t *p)
+{
+	return get32(p) | (uint64_t)get32(p + 4) << 32;
+}
+
+/*
+	number()
+
+	Reads a numeric tar header field, in octal, or in base 256 when its
+	first bit is set (large values, as written by GNU tar).
+
+	@arg	field	Field data.
+	@arg	size	Field size.
+
+	@return		Field value.
+*/
+
+static uint64_t number(const uint8_t *field, int size)
+{
+	// Using the value and an iterator.
+	uint64_t value = 0;
+	int i = 0;
+
+	if(*field & 0x80)
+	{
+		value = *field & 0x3f;
+		for(i = 1; i < size; i++) value = value << 8 | field[i];
+		return value;
+	}
+
+	while(i < size && field[i] == ' ') i++;
+	for(; i < size && field[i] >= '0' && field[i] <= '7'; i++)
+		value = value << 3 | (field[i] - '0');
+	return value;
+}
+
+/*
+	archive_pread()
+
+	Reads data at the given offset of the archive, retrying on short reads.
+
+	@arg	archive	Archive.
+	@arg	buffer	Receives the data.
+	@arg	size	Number of bytes to read.
+	@arg	offset	Offset in the archive.
+
+	@return		0 on success, 1 on failure (errno is set, to EINVAL if
+			the archive is truncated).
+*/
+
+static int archive_pread(struct Archive *archive, void *buffer, size_t size,
+	uint64_t offset)
+{
+	// Using a cursor in the buffer.
+	uint8_t *ptr = buffer;
+	ssize_t x;
+
+	while(size)
+	{
+		x = pread(archive->fd, ptr, size, offset);
+		STATS_ADD(STATS_SYSCALLS, 1);
+		if(x < 0 && errno == EINTR) continue;
+		if(x < 0) return 1;
+		if(!x)
+		{
+			errno = EINVAL;
+			return 1;
+		}
+
+		STATS_ADD(STATS_READ_CALLS, 1);
+		STATS_ADD(STATS_BYTES_READ, x);
+		ptr += x;
+		size -= x;
+		offset += x;
+	}
+
+	return 0;
+}
+
+/*
+	archive_directory()
+
+	Loads the central directory of a zip archive, located by its end
+	record (or by the zip64 end record, for large archives).
+
+	@arg	archive	Archive.
+
+	@return		0 on success, 1 on failure (errno is set).
+*/
+
+static int archive_directory(struct Archive *archive)
+{
+	// Using the end of the archive, the end records and their position.
+	uint8_t tail[ZIP_COMMENT + ZIP_END_SIZE], end64[ZIP_END64_SIZE];
+	const uint8_t *end = NULL, *locator;
+	uint64_t start, offset;
+	size_t size;
+	int i;
+
+	// Looking for the end record, before the archive comment.
+	size = archive->size < sizeof tail ? archive->size : sizeof tail;
+	start = archive->size - size;
+	if(archive_pread(archive, tail, size, start)) return 1;
+
+	for(i = size - ZIP_END_SIZE; i >= 0 && !end; i--)
+		if(get32(tail + i) == ZIP_END) end = tail + i;
+	if(!end) goto invalid;
+
+	archive->count = get16(end + 10);
+	archive->directory_size = get32(end + 12);
+	offset = get32(end + 16);
+
+	// Using the zip64 end record when there is one.
+	locator = end - ZIP_LOCATOR_SIZE;
+	if(end - tail >= ZIP_LOCATOR_SIZE && get32(locator) == ZIP_LOCATOR)
+	{
+		if(archive_pread(archive, end64, sizeof end64,
+			get64(locator + 8))) return 1;
+		if(get32(end64) != ZIP_END64) goto invalid;
+
+		archive->count = get64(end64 + 32);
+		archive->directory_size = get64(end64 + 40);
+		offset = get64(end64 + 48);
+	}
+
+	if(offset > archive->size || archive->directory_size > archive->size
+		- offset) goto invalid;
+
+	archive->directory = malloc(archive->directory_size + 1);
+	if(!archive->directory) return 1;
+	return archive_pread(archive, archive->directory,
+		archive->directory_size, offset);
+
+invalid:
+	errno = EINVAL;
+	return 1;
+}
+
+/*
+	archive_tar()
+
+	Reads the next tar member. Long names and sizes are taken from pax
+	extended headers and GNU long name entries, which precede the member.
+
+	@arg	archive	Archive.
+	@arg	member	Receives the member.
+
+	@return		0 on success, 1 at the end of the archive (errno is 0)
+			or on failure (errno is set).
+*/
+
+static int archive_tar(struct Archive *archive, struct Archive_Member *member)
+{
+	// Using the header block, its checksum, and the extended headers.
+	uint8_t block[BLOCK];
+	unsigned int sum;
+	char *pax, *record, *key, *end;
+	int named = 0, sized = 0, i;
+	// Using the entry type, size (and the one of the pax header) and data
+	// offset.
+	uint64_t size, extended = 0, offset, length;
+	char type;
+
+	while(1)
+	{
+		errno = 0;
+		if(archive->next + BLOCK > archive->size) return 1;
+		if(archive_pread(archive, block, BLOCK, archive->next))
+			return 1;
+
+		// Stopping at the first empty block.
+		for(i = 0; i < BLOCK && !block[i]; i++);
+		if(i == BLOCK) return 1;
+
+		// Checking the header, its checksum field counting as spaces.
+		for(sum = 8 * ' ', i = 0; i < BLOCK; i++)
+			sum += i < 148 || i >= 156 ? block[i] : 0;
+		if(sum != number(block + 148, 8)) goto invalid;
+
+		type = block[156];
+		offset = archive->next + BLOCK;
+		size = sized ? extended : number(block + 124, 12);
+		if(offset > archive->size || size > archive->size - offset)
+			goto invalid;
+		archive->next = offset + ((size + BLOCK - 1) & -BLOCK);
+
+		// Reading the name of the next entry (GNU long names).
+		if(type == 'L')
+		{
+			if(size >= PATH_MAX)
+			{
+				errno = ENAMETOOLONG;
+				return 1;
+			}
+			if(archive_pread(archive, archive->name, size, offset))
+				return 1;
+			archive->name[size] = 0;
+			named = 1;
+			continue;
+		}
+
+		// Reading the name and size of the next entry (pax headers).
+		if(type == 'x')
+		{
+			if(size > PAX_MAX) goto invalid;
+			pax = malloc(size + 1);
+			if(!pax) return 1;
+			if(archive_pread(archive, pax, size, offset))
+			{
+				free(pax);
+				return 1;
+			}
+			pax[size] = 0;
+
+			// Records are 'length key=value\n', the length counting
+			// the whole record.
+			for(record = pax; record < pax + size; record += length)
+			{
+				length = strtoull(record, &key, 10);
+				if(!length || length > (uint64_t)(pax + size
+					- record) || *key++ != ' ') break;
+				record[length - 1] = 0;
+				end = strchr(key, '=');
+				if(!end) continue;
+				*end++ = 0;
+
+				if(!strcmp(key, "path") && strlen(end) < PATH_MAX)
+				{
+					strcpy(archive->name, end);
+					named = 1;
+				}
+				else if(!strcmp(key, "size"))
+				{
+					extended = strtoull(end, NULL, 10);
+					sized = 1;
+				}
+			}
+
+			free(pax);
+			continue;
+		}
+
+		// Skipping global headers.
+		if(type == 'g') continue;
+
+		// Building the name from the ustar prefix and name fields.
+		if(!named)
+		{
+			i = 0;
+			if(!memcmp(block + 257, "ustar", 6) && block[345])
+			{
+				i = strnlen((char *)block + 345, 155);
+				memcpy(archive->name, block + 345, i);
+				archive->name[i++] = '/';
+			}
+			memcpy(archive->name + i, block, 100);
+			archive->name[i + strnlen((char *)block, 100)] = 0;
+		}
+
+		member->name = archive->name;
+		member->regular = type == '0' || type == 0 || type == '7';
+		member->method = 0;
+		member->header = offset - BLOCK;
+		member->offset = offset;
+		member->stored = member->size = size;
+		return 0;
+	}
+
+invalid:
+	errno = EINVAL;
+	return 1;
+}
+
+/*
+	archive_zip()
+
+	Reads the next zip member from the central directory.
+
+	@arg	archive	Archive.
+	@arg	member	Receives the member (its data offset is only known
+			once its local header is read).
+
+	@return		0 on success, 1 at the end of the archive (errno is 0)
+			or on failure (errno is set).
+*/
+
+static int archive_zip(struct Archive *archive, struct Archive_Member *member)
+{
+	// Using the directory entry and its variable fields.
+	const uint8_t *entry, *extra, *field;
+	uint32_t name, extras, comment, id, length;
+
+	errno = 0;
+	if(!archive->count) return 1;
+	if(archive->next + ZIP_CENTRAL_SIZE > archive->directory_size)
+		goto invalid;
+
+	entry = archive->directory + archive->next;
+	name = get16(entry + 28);
+	extras = get16(entry + 30);
+	comment = get16(entry + 32);
+	if(get32(entry) != ZIP_CENTRAL || archive->next + ZIP_CENTRAL_SIZE
+		+ name + extras + comment > archive->directory_size)
+		goto invalid;
+	if(name >= PATH_MAX)
+	{
+		errno = ENAMETOOLONG;
+		return 1;
+	}
+
+	memcpy(archive->name, entry + ZIP_CENTRAL_SIZE, name);
+	archive->name[name] = 0;
+	member->name = archive->name;
+	member->regular = name && archive->name[name - 1] != '/';
+	// Encrypted members cannot be read.
+	member->method = get16(entry + 8) & 1 ? -1 : (int)get16(entry + 10);
+	member->stored = get32(entry + 20);
+	member->size = get32(entry + 24);
+	member->header = get32(entry + 42);
+	member->offset = 0;
+
+	// Large values are stored in the zip64 extra field, in this order.
+	extra = entry + ZIP_CENTRAL_SIZE + name;
+	for(field = extra; field + 4 <= extra + extras; field += 4 + length)
+	{
+		id = get16(field);
+		length = get16(field + 2);
+		if(id != 1) continue;
+
+		field += 4;
+		if(member->size == 0xffffffff && length >= 8)
+			member->size = get64(field), field += 8, length -= 8;
+		if(member->stored == 0xffffffff && length >= 8)
+			member->stored = get64(field), field += 8, length -= 8;
+		if(member->header == 0xffffffff && length >= 8)
+			member->header = get64(field);
+		break;
+	}
+
+	archive->next += ZIP_CENTRAL_SIZE + name + extras + comment;
+	archive->count--;
+	return 0;
+
+invalid:
+	errno = EINVAL;
+	return 1;
+}
+
+/*
+	archive_tables()
+
+	Maps the superblock, header table, index and names of a pack in
+	memory, after checking that they fit in the pack.
+
+	@arg	archive	Archive.
+	@arg	super	Superblock.
+
+	@return		0 on success, 1 on failure (errno is set).
+*/
+
+static int archive_tables(struct Archive *archive, const uint8_t *super)
+{
+	// Using the offsets of the tables and the number of files.
+	uint64_t table = get64(super + 0x10), index = get64(super + 0x18);
+	uint64_t names = get64(super + 0x20), data = get64(super + 0x30);
+	uint64_t count = get32(super + 0x0c);
+
+	if(get32(super + 0x08) != PACK_VERSION)
+	{
+		errno = ENOTSUP;
+		return 1;
+	}
+	if(table != PACK_SUPER || index != table + count * PACK_HEADER
+		|| names != index + count * PACK_ENTRY || get64(super + 0x28)
+		> archive->size || data != names + get64(super + 0x28)
+		|| data > archive->size)
+	{
+		errno = EINVAL;
+		return 1;
+	}
+
+	archive->map = mmap(NULL, data, PROT_READ, MAP_SHARED, archive->fd, 0);
+	STATS_ADD(STATS_SYSCALLS, 1);
+	if(archive->map == MAP_FAILED)
+	{
+		archive->map = NULL;
+		return 1;
+	}
+
+	archive->map_size = data;
+	archive->count = count;
+	return 0;
+}
+
+/*
+	archive_pack()
+
+	Reads the next packed file from the index.
+
+	@arg	archive	Archive.
+	@arg	member	Receives the member: the whole g1a file, whose header
+			is in the header table and whose payload is a frame.
+
+	@return		0 on success, 1 at the end of the pack (errno is 0) or
+			on failure (errno is set).
+*/
+
+static int archive_pack(struct Archive *archive, struct Archive_Member *member)
+{
+	// Using the index entry, and the name offset and length.
+	const uint8_t *entry;
+	uint64_t names = get64(archive->map + 0x20);
+	uint32_t name, length;
+
+	errno = 0;
+	if(archive->next >= archive->count) return 1;
+
+	entry = archive->map + get64(archive->map + 0x18) + archive->next
+		* PACK_ENTRY;
+	name = get32(entry + 24);
+	length = get16(entry + 28);
+	if((uint64_t)name + length > get64(archive->map + 0x28))
+		goto invalid;
+	if(length >= PATH_MAX)
+	{
+		errno = ENAMETOOLONG;
+		return 1;
+	}
+
+	memcpy(archive->name, archive->map + names + name, length);
+	archive->name[length] = 0;
+	member->name = archive->name;
+	member->regular = 1;
+	member->method = get16(entry + 30);
+	member->header = PACK_SUPER + archive->next * PACK_HEADER;
+	member->offset = get64(entry);
+	member->stored = get64(entry + 8);
+	member->size = get64(entry + 16) + PACK_HEADER;
+
+	// Frames follow the tables.
+	if(member->offset < archive->map_size || member->offset > archive->size
+		|| member->stored > archive->size - member->offset
+		|| member->size < PACK_HEADER) goto invalid;
+
+	archive->next++;
+	return 0;
+
+invalid:
+	errno = EINVAL;
+	return 1;
+}
+
+/*
+	archive_data()
+
+	Locates the data of a member, reading its zip local header if needed.
+
+	@arg	archive	Archive.
+	@arg	member	Member, whose data offset is set.
+
+	@return		0 on success, 1 on failure (errno is set).
+*/
+
+static int archive_data(struct Archive *archive,
+	struct Archive_Member *member)
+{
+	// Using the local header.
+	uint8_t local[ZIP_LOCAL_SIZE];
+	uint64_t offset;
+
+	if(member->method && member->method != Z_DEFLATED)
+	{
+		errno = ENOTSUP;
+		return 1;
+	}
+	if(member->offset) return 0;
+
+	if(archive_pread(archive, local, sizeof local, member->header))
+		return 1;
+	offset = member->header + ZIP_LOCAL_SIZE + get16(local + 26)
+		+ get16(local + 28);
+	if(get32(local) != ZIP_LOCAL || offset > archive->size
+		|| member->stored > archive->size - offset)
+	{
+		errno = EINVAL;
+		return 1;
+	}
+
+	member->offset = offset;
+	return 0;
+}
+
+/*
+	inflater_open()
+
+	Starts inflating a deflated member.
+
+	@arg	inflater	Inflater to initialize.
+	@arg	archive		Archive.
+	@arg	member		Member, whose data is located.
+
+	@return		0 on success, 1 on failure (errno is set).
+*/
+
+static int inflater_open(struct Inflater *inflater, struct Archive *archive,
+	const struct Archive_Member *member)
+{
+	memset(&inflater->stream, 0, sizeof inflater->stream);
+	inflater->fd = archive->fd;
+	inflater->offset = member->offset;
+	inflater->left = member->stored;
+
+	// Zip members are raw deflate streams, without zlib header.
+	if(inflateInit2(&inflater->stream, -MAX_WBITS) != Z_OK)
+	{
+		errno = ENOMEM;
+		return 1;
+	}
+	return 0;
+}
+
+/*
+	inflater_read()
+
+	Inflates data, reading compressed chunks only as they are needed.
+
+	@arg	inflater	Inflater.
+	@arg	buffer		Receives the inflated data.
+	@arg	size		Size of the buffer.
+
+	@return		Number of bytes inflated, less than the buffer size only
+			at the end of the stream, or -1 on failure (errno is
+			set).
+*/
+
+static ssize_t inflater_read(struct Inflater *inflater, void *buffer,
+	size_t size)
+{
+	// Using the stream, and the status and size of the last operation.
+	z_stream *stream = &inflater->stream;
+	ssize_t x;
+	int status = Z_OK;
+
+	stream->next_out = buffer;
+	stream->avail_out = size;
+
+	while(stream->avail_out && status != Z_STREAM_END)
+	{
+		// Reading the next compressed chunk.
+		if(!stream->avail_in)
+		{
+			x = inflater->left < CHUNK ? inflater->left : CHUNK;
+			if(!x) break;
+			x = pread(inflater->fd, inflater->chunk, x,
+				inflater->offset);
+			STATS_ADD(STATS_SYSCALLS, 1);
+			if(x < 0 && errno == EINTR) continue;
+			if(x < 0) return -1;
+			if(!x) break;
+
+			STATS_ADD(STATS_READ_CALLS, 1);
+			STATS_ADD(STATS_BYTES_READ, x);
+			inflater->offset += x;
+			inflater->left -= x;
+			stream->next_in = inflater->chunk;
+			stream->avail_in = x;
+		}
+
+		status = inflate(stream, Z_NO_FLUSH);
+		if(status != Z_OK && status != Z_STREAM_END)
+		{
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	return size - stream->avail_out;
+}
+
+/*
+	inflater_close()
+
+	Stops inflating a member.
+
+	@arg	inflater	Inflater.
+*/
+
+static void inflater_close(struct Inflater *inflater)
+{
+	inflateEnd(&inflater->stream);
+}
+
+/*
+	data_read()
+
+	Reads the first bytes of the data of a located member.
+
+	@arg	archive	Archive.
+	@arg	member	Member, whose data is located.
+	@arg	buffer	Receives the data.
+	@arg	size	Number of bytes to read.
+
+	@return		Number of bytes read, less than size if the data is
+			shorter, or -1 on failure (errno is set).
+*/
+
+static ssize_t data_read(struct Archive *archive,
+	const struct Archive_Member *member, void *buffer, size_t size)
+{
+	// Using the inflater of deflated members.
+	struct Inflater inflater;
+	ssize_t x;
+
+	if(size > member->size) size = member->size;
+
+	if(!member->method) return archive_pread(archive, buffer, size,
+		member->offset) ? -1 : (ssize_t)size;
+
+	if(inflater_open(&inflater, archive, member)) return -1;
+	x = inflater_read(&inflater, buffer, size);
+	inflater_close(&inflater);
+	return x;
+}
+
+/*
+	data_copy()
+
+	Copies the data of a located member to an output file, after its first
+	bytes.
+
+	@arg	archive	Archive.
+	@arg	member	Member, whose data is located.
+	@arg	output	Output file.
+	@arg	skip	Number of bytes left out at the beginning.
+
+	@return		0 on success, 1 on failure (errno is set).
+*/
+
+static int data_copy(struct Archive *archive,
+	const struct Archive_Member *member, struct Output *output,
+	uint64_t skip)
+{
+	// Using the inflater of deflated members, the inflated size and the
+	// part of the inflated data that is left out.
+	struct Inflater inflater;
+	uint8_t buffer[0x10000];
+	uint64_t total = 0, start;
+	ssize_t x;
+	int error;
+
+	if(skip > member->size) skip = member->size;
+
+	if(!member->method) return output_copy(output, archive->fd,
+		member->offset + skip, member->size - skip);
+
+	if(inflater_open(&inflater, archive, member)) return 1;
+	do
+	{
+		x = inflater_read(&inflater, buffer, sizeof buffer);
+		if(x < 0) goto fail;
+
+		// Leaving out the first bytes.
+		start = total < skip ? skip - total : 0;
+		if(start < (uint64_t)x && output_append(output, buffer + start,
+			x - start)) goto fail;
+		total += x;
+	}
+	while(x == sizeof buffer);
+	inflater_close(&inflater);
+
+	// The member must have the size given by the directory.
+	if(total != member->size)
+	{
+		errno = EINVAL;
+		return 1;
+	}
+	return 0;
+
+fail:
+	error = errno;
+	inflater_close(&inflater);
+	errno = error;
+	return 1;
+}
+
+
+
+/*
+	Function definitions.
+*/
+
+/*
+	archive_open()
+
+	Opens the archive named by an input: either the input itself, or the
+	file before the first colon that ends the name of an existing file, the
+	rest naming a member. Inputs that are not archives are left for the
+	caller to read as files.
+
+	@arg	archive	Archive structure to initialize; its type is
+			ARCHIVE_NONE if the input is not an archive, and
+			nothing is open then.
+	@arg	input	Input name.
+
+	@return		0 on success, 1 on failure (errno is set).
+*/
+
+int archive_open(struct Archive *archive, const char *input)
+{
+	// Using the archive file name, its status and its first block.
+	char path[PATH_MAX];
+	const char *file = input, *colon = NULL;
+	struct stat st;
+	uint8_t block[BLOCK];
+
+	archive->type = ARCHIVE_NONE;
+	archive->directory = NULL;
+	archive->map = NULL;
+	archive->member = NULL;
+	archive->found = 0;
+	archive->next = 0;
+	archive->count = 0;
+
+	// Splitting the input when it does not name a file.
+	if(stat(input, &st))
+	{
+		for(colon = strchr(input, ':'); colon; colon = strchr(colon + 1,
+			':'))
+		{
+			if(colon - input >= PATH_MAX) return 0;
+			memcpy(path, input, colon - input);
+			path[colon - input] = 0;
+			if(!stat(path, &st) && S_ISREG(st.st_mode)) break;
+		}
+		if(!colon) return 0;
+
+		file = path;
+		archive->member = colon + 1;
+	}
+	if(!S_ISREG(st.st_mode)) return 0;
+
+	archive->fd = open(file, O_RDONLY | O_CLOEXEC);
+	STATS_ADD(STATS_SYSCALLS, 1);
+	if(archive->fd < 0) return 1;
+	archive->size = st.st_size;
+
+	// Recognizing the format from the first bytes. Zip archives start with
+	// a member, or with the end record when they are empty; packs start
+	// with their superblock, which is as large as a tar block.
+	memset(block, 0, sizeof block);
+	if(st.st_size && archive_pread(archive, block, st.st_size < BLOCK ?
+		st.st_size : BLOCK, 0)) goto fail;
+
+	if(get32(block) == ZIP_LOCAL || get32(block) == ZIP_END)
+	{
+		archive->type = ARCHIVE_ZIP;
+		if(archive_directory(archive)) goto fail;
+	}
+	else if(!memcmp(block + 257, "ustar", 5)) archive->type = ARCHIVE_TAR;
+	else if(!memcmp(block, PACK_MAGIC, 8))
+	{
+		archive->type = ARCHIVE_PACK;
+		if(archive_tables(archive, block)) goto fail;
+	}
+	else
+	{
+		close(archive->fd);
+		archive->member = NULL;
+	}
+
+	return 0;
+
+fail:
+	archive_close(archive);
+	return 1;
+}
+
+/*
+	archive_next()
+
+	Reads the next g1a file of the archive: the requested member (once), or
+	the next regular member with extension '.g1a' (or packed file).
+
+	@arg	archive	Archive.
+	@arg	member	Receives the member.
+
+	@return		0 on success, 1 at the end of the archive (errno is 0)
+			or on failure (errno is set, to ENOENT if the requested
+			member does not exist).
+*/
+
+int archive_next(struct Archive *archive, struct Archive_Member *member)
+{
+	// Using the member names without their leading './', and the length
+	// of the current one.
+	const char *name, *wanted = archive->member;
+	size_t length;
+
+	if(archive->found)
+	{
+		errno = 0;
+		return 1;
+	}
+	while(wanted && !strncmp(wanted, "./", 2)) wanted += 2;
+
+	while(!(archive->type == ARCHIVE_TAR ? archive_tar(archive, member)
+		: archive->type == ARCHIVE_ZIP ? archive_zip(archive, member)
+		: archive_pack(archive, member)))
+	{
+		if(!member->regular) continue;
+
+		name = member->name;
+		while(!strncmp(name, "./", 2)) name += 2;
+		length = strlen(name);
+
+		// All packed files are g1a files, whatever their name.
+		if(!wanted && (archive->type == ARCHIVE_PACK || (length > 4
+			&& !strcasecmp(name + length - 4, ".g1a")))) return 0;
+		if(wanted && !strcmp(name, wanted))
+		{
+			archive->found = 1;
+			return 0;
+		}
+	}
+
+	if(!errno && archive->member) errno = ENOENT;
+	return 1;
+}
+
+/*
+	archive_read()
+
+	Reads the first bytes of a member, inflating only what is needed. The
+	header of a packed file is taken from the mapped header table.
+
+	@arg	archive	Archive.
+	@arg	member	Member.
+	@arg	buffer	Receives the data.
+	@arg	size	Number of bytes to read.
+
+	@return		Number of bytes read, less than size if the member is
+			shorter, or -1 on failure (errno is set).
+*/
+
+ssize_t archive_read(struct Archive *archive, struct Archive_Member *member,
+	void *buffer, size_t size)
+{
+	// Using the payload of a packed file, and the size of its header part.
+	struct Archive_Member payload;
+	size_t head;
+	ssize_t x;
+
+	if(archive_data(archive, member)) return -1;
+	if(archive->type != ARCHIVE_PACK) return data_read(archive, member,
+		buffer, size);
+
+	if(size > member->size) size = member->size;
+	head = size < PACK_HEADER ? size : PACK_HEADER;
+	memcpy(buffer, archive->map + member->header, head);
+	if(size == head) return size;
+
+	payload = *member;
+	payload.size -= PACK_HEADER;
+	x = data_read(archive, &payload, (uint8_t *)buffer + head, size - head);
+	return x < 0 ? -1 : (ssize_t)head + x;
+}
+
+/*
+	archive_copy()
+
+	Copies a member to an output file, after its first bytes. Stored
+	members are copied in the kernel (see output_copy()); deflated members
+	are inflated as a stream. Only the frame of a packed file is read when
+	its header is left out.
+
+	@arg	archive	Archive.
+	@arg	member	Member.
+	@arg	output	Output file.
+	@arg	skip	Number of bytes left out at the beginning.
+
+	@return		0 on success, 1 on failure (errno is set).
+*/
+
+int archive_copy(struct Archive *archive, struct Archive_Member *member,
+	struct Output *output, uint64_t skip)
+{
+	// Using the payload of a packed file.
+	struct Archive_Member payload;
+
+	if(archive_data(archive, member)) return 1;
+	if(archive->type != ARCHIVE_PACK) return data_copy(archive, member,
+		output, skip);
+
+	if(skip > member->size) skip = member->size;
+	if(skip < PACK_HEADER && output_append(output, archive->map
+		+ member->header + skip, PACK_HEADER - skip)) return 1;
+
+	payload = *member;
+	payload.size -= PACK_HEADER;
+	return data_copy(archive, &payload, output, skip > PACK_HEADER ? skip
+		- PACK_HEADER : 0);
+}
+
+/*
+	archive_label()
+
+	Builds the name under which a member is displayed, 'archive:member',
+	as it would be given on the command line. The returned string is
+	allocated.
+
+	@arg	input	Input name the archive was opened with.
+	@arg	archive	Archive.
+	@arg	member	Member.
+
+	@return		Allocated name, or NULL on alloc failure.
+*/
+
+char *archive_label(const char *input, const struct Archive *archive,
+	const struct Archive_Member *member)
+{
+	// Using the name.
+	char *label;
+
+	if(archive->member) return strdup(input);
+
+	label = malloc(strlen(input) + strlen(member->name) + 2);
+	if(label) sprintf(label, "%s:%s", input, member->name);
+	return label;
+}
+
+/*
+	archive_close()
+
+	Closes the archive.
+
+	@arg	archive	Archive.
+*/
+
+void archive_close(struct Archive *archive)
+{
+	close(archive->fd);
+	free(archive->directory);
+	if(archive->map) munmap(archive->map, archive->map_size);
+	archive->directory = NULL;
+	archive->map = NULL;
+}
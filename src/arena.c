@@ -0,0 +1,156 @@
+/*
+	Arena module.
+*/
+
+
+
+/*
+	Header inclusions.
+*/
+
+// Standard headers.
+#include <stdint.h>
+#include <stdlib.h>
+
+// Project headers.
+#include "arena.h"
+
+
+
+/*
+	Constants definitions.
+*/
+
+// Alignment of allocations.
+#define ARENA_ALIGN	(sizeof(max_align_t))
+
+
+
+/*
+	Composed types definitions.
+*/
+
+// Arena block, followed by its data.
+struct Arena_Block
+{
+	// Next block, and data size.
+	struct Arena_Block *next;
+	size_t size;
+	// Aligned data.
+	max_align_t data[];
+};
+
+
+
+/*
+	Function definitions.
+*/
+
+/*
+	arena_init()
+
+	Initializes an empty arena. No memory is allocated until the first
+	allocation.
+
+	@arg	arena	Arena to initialize.
+*/
+
+void arena_init(struct Arena *arena)
+{
+	arena->first = arena->current = NULL;
+	arena->used = 0;
+}
+
+/*
+	arena_alloc()
+
+	Allocates memory from the current block, or from a new block if it is
+	full. The memory stays valid until the next reset.
+
+	@arg	arena	Arena.
+	@arg	size	Number of bytes.
+
+	@return		Allocated memory, or NULL on alloc failure.
+*/
+
+void *arena_alloc(struct Arena *arena, size_t size)
+{
+	// Using a new block, and its size.
+	struct Arena_Block *block;
+	size_t capacity;
+
+	// Rounding the size up to keep the next allocation aligned.
+	if(size > SIZE_MAX - ARENA_BLOCK) return NULL;
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+	if(arena->current && arena->used + size <= arena->current->size)
+	{
+		arena->used += size;
+		return (char *)arena->current->data + arena->used - size;
+	}
+
+	// Chaining a new block, large enough for the allocation.
+	capacity = size > ARENA_BLOCK ? size : ARENA_BLOCK;
+	block = malloc(sizeof *block + capacity);
+	if(!block) return NULL;
+	block->next = NULL;
+	block->size = capacity;
+
+	if(arena->current) arena->current->next = block;
+	else arena->first = block;
+	arena->current = block;
+	arena->used = size;
+
+	return block->data;
+}
+
+/*
+	arena_reset()
+
+	Releases all the allocations of the arena. The first block is kept for
+	the next job if it has the standard size; larger blocks and the blocks
+	chained after it are freed, so that the memory of the arena does not
+	grow with the number of jobs.
+
+	@arg	arena	Arena.
+*/
+
+void arena_reset(struct Arena *arena)
+{
+	// Using a block iterator.
+	struct Arena_Block *block, *next;
+
+	if(!arena->first) return;
+
+	for(block = arena->first->next; block; block = next)
+	{
+		next = block->next;
+		free(block);
+	}
+	arena->first->next = NULL;
+
+	if(arena->first->size != ARENA_BLOCK)
+	{
+		free(arena->first);
+		arena->first = NULL;
+	}
+
+	arena->current = arena->first;
+	arena->used = 0;
+}
+
+/*
+	arena_free()
+
+	Releases all the memory of the arena, which is left empty and can be
+	used again.
+
+	@arg	arena	Arena.
+*/
+
+void arena_free(struct Arena *arena)
+{
+	arena_reset(arena);
+	free(arena->first);
+	arena_init(arena);
+}
@@ -0,0 +1,869 @@
+/*
+	Batch module.
+*/
+
+
+
+/*
+	Header inclusions.
+*/
+
+// Feature macros, for struct statx.
+#define _GNU_SOURCE
+
+// Standard headers.
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+// Project headers.
+#include "batch.h"
+#include "output.h"
+#include "payload.h"
+#include "pool.h"
+#include "stats.h"
+#include "trace.h"
+
+
+
+/*
+	Constants definitions.
+*/
+
+// Number of jobs submitted at once through io_uring.
+#define BATCH_WINDOW		32
+// Ring size: a job chains at most 8 operations.
+#define BATCH_ENTRIES		(BATCH_WINDOW * 8)
+
+
+
+/*
+	Composed types definitions.
+
+	These types are used only in this file.
+*/
+
+// Operations of a job, stored in the completion user data.
+enum Batch_Step
+{
+	STEP_STATX_IN	= 0,
+	STEP_STATX_OUT	= 1,
+	STEP_OPEN_IN	= 2,
+	STEP_READ	= 3,
+	STEP_CLOSE_IN	= 4,
+	STEP_OPEN_OUT	= 5,
+	STEP_HEADER	= 6,
+	STEP_PAYLOAD	= 7,
+	STEP_CLOSE_OUT	= 8,
+	STEP_RENAME	= 9,
+	STEP_PROBE_OPEN	= 10,
+	STEP_PROBE	= 11,
+	STEP_PROBE_CLOSE= 12
+};
+
+// io_uring instance, with its submission and completion rings mapped.
+struct Ring
+{
+	// Ring descriptor.
+	int fd;
+	// Submission ring fields, and the submission entries.
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	struct io_uring_sqe *sqes;
+	// Completion ring fields and entries.
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+	// Mappings and their sizes.
+	void *sq_map, *cq_map;
+	size_t sq_size, cq_size, sqes_size;
+	// Local submission tail, and number of operations not completed yet.
+	unsigned tail, inflight;
+	// Registered header buffers, one per job of the window.
+	uint8_t *headers;
+};
+
+// State of a job in the io_uring backend.
+struct Uring_Job
+{
+	// Status of the input and output files.
+	struct statx in, out;
+	// First bytes of the input, payload buffer, and temporary output file
+	// name.
+	uint8_t magic[4];
+	uint8_t *data;
+	char *temp;
+	// Expected read and write sizes.
+	uint32_t size;
+	// Completed operations (bit field of steps), and first error.
+	unsigned done;
+	int error;
+};
+
+// Buffer reused by the successive jobs of a window slot.
+struct Buffer
+{
+	void *data;
+	size_t size;
+};
+
+// Jobs run on worker threads, and the action.
+struct Run
+{
+	struct Batch_Job *jobs;
+	int dump;
+};
+
+
+
+/*
+	Static function definitions.
+*/
+
+/*
+	wrap_job(), dump_job()
+
+	Run a job with plain system calls, going through the payload and output
+	modules as a single run does.
+
+	@arg	job	Job to run.
+
+	@return		0 on success, or an error number.
+*/
+
+static int wrap_job(struct Batch_Job *job)
+{
+	// Using the payload, the output file and a finalized header.
+	struct Payload payload;
+	struct Output output;
+	uint8_t header[HEADER_SIZE];
+	uint32_t size;
+	int error;
+
+	if(payload_open(&payload, job->input, PAYLOAD_ELF))
+	{
+		job->defect = payload.defect;
+		return errno;
+	}
+	size = payload.size + HEADER_SIZE;
+
+	memcpy(header, job->header, HEADER_SIZE);
+	header_finalize(header, size);
+
+	if(output_open(&output, job->output, size)) goto fail;
+	if(payload_write(&payload, &output, header, HEADER_SIZE))
+	{
+		output_abort(&output);
+		goto fail;
+	}
+	if(output_commit(&output)) goto fail;
+
+	payload_close(&payload);
+	return 0;
+
+fail:
+	error = errno;
+	payload_close(&payload);
+	return error;
+}
+
+static int dump_job(struct Batch_Job *job)
+{
+	// Using the file descriptor and status.
+	struct stat st;
+	ssize_t x;
+	int fd, error = 0;
+
+	fd = open(job->input, O_RDONLY | O_CLOEXEC);
+	STATS_ADD(STATS_SYSCALLS, 1);
+	if(fd < 0) return errno;
+
+	// Short files are reported as such by header_check().
+	memset(job->header, 0, HEADER_SIZE);
+	do x = pread(fd, job->header, HEADER_SIZE, 0);
+	while(x < 0 && errno == EINTR);
+
+	if(x < 0 || fstat(fd, &st)) error = errno;
+	else job->size = st.st_size;
+
+	close(fd);
+	STATS_ADD(STATS_SYSCALLS, 3);
+	STATS_ADD(STATS_READ_CALLS, 1);
+	STATS_ADD(STATS_BYTES_READ, x > 0 ? x : 0);
+	return error;
+}
+
+/*
+	run_job()
+
+	Pool job: runs a job of a batch. Every job is timed as a run of the
+	write or dump phase.
+
+	@arg	arg	Jobs, and the action.
+	@arg	index	Index of the job.
+*/
+
+static void run_job(void *arg, int index)
+{
+	// Using the jobs, the job and the phase it is timed as.
+	struct Run *run = arg;
+	struct Batch_Job *job = run->jobs + index;
+	enum Stats_Phase phase = run->dump ? STATS_DUMP : STATS_WRITE;
+
+	TRACE_BEGIN(run->dump ? "dump" : "wrap", "job", index);
+	STATS_BEGIN(phase);
+	job->error = run->dump ? dump_job(job) : wrap_job(job);
+	STATS_END(phase);
+	TRACE_END(run->dump ? "dump" : "wrap");
+	STATS_ADD(STATS_JOBS_DONE, 1);
+}
+
+/*
+	run_threads()
+
+	Runs jobs on worker threads, one per processor. The calling thread is
+	one of the workers.
+
+	@arg	jobs	Jobs to run.
+	@arg	count	Number of jobs.
+	@arg	dump	Non-zero to dump, zero to wrap.
+*/
+
+static void run_threads(struct Batch_Job *jobs, int count, int dump)
+{
+	struct Run run = { jobs, dump };
+	pool_run(count, run_job, &run);
+}
+
+/*
+	ring_init()
+
+	Sets up an io_uring instance, maps its rings and registers the header
+	buffers and a table of direct descriptors, two per job of the window.
+	Direct descriptors let the operations of a chain use a file opened by a
+	previous operation of the same chain.
+
+	@arg	ring	Ring structure to initialize.
+
+	@return		0 on success, 1 if io_uring is not usable.
+*/
+
+static int ring_init(struct Ring *ring)
+{
+	// Using the setup parameters, the buffer vector and the file table.
+	struct io_uring_params p;
+	struct iovec iov;
+	int files[BATCH_WINDOW * 2];
+	int i;
+
+	memset(&p, 0, sizeof p);
+	memset(ring, 0, sizeof *ring);
+	ring->sq_map = ring->cq_map = ring->sqes = MAP_FAILED;
+	ring->headers = NULL;
+
+	ring->fd = syscall(__NR_io_uring_setup, BATCH_ENTRIES, &p);
+	STATS_ADD(STATS_SYSCALLS, 1);
+	if(ring->fd < 0) return 1;
+
+	// Direct descriptors appeared in Linux 5.15; requiring a feature of
+	// 5.17 ensures they are supported.
+	if(!(p.features & IORING_FEAT_SINGLE_MMAP)
+		|| !(p.features & IORING_FEAT_CQE_SKIP)) goto fail;
+
+	// Mapping both rings at once, and the submission entries.
+	ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_size = p.cq_off.cqes + p.cq_entries *
+		sizeof(struct io_uring_cqe);
+	if(ring->cq_size > ring->sq_size) ring->sq_size = ring->cq_size;
+	ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	ring->sq_map = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	STATS_ADD(STATS_SYSCALLS, 2);
+	if(ring->sq_map == MAP_FAILED || ring->sqes == MAP_FAILED) goto fail;
+	ring->cq_map = ring->sq_map;
+
+	ring->sq_head  = (unsigned *)((char *)ring->sq_map + p.sq_off.head);
+	ring->sq_tail  = (unsigned *)((char *)ring->sq_map + p.sq_off.tail);
+	ring->sq_mask  = (unsigned *)((char *)ring->sq_map +
+		p.sq_off.ring_mask);
+	ring->sq_array = (unsigned *)((char *)ring->sq_map + p.sq_off.array);
+	ring->cq_head  = (unsigned *)((char *)ring->cq_map + p.cq_off.head);
+	ring->cq_tail  = (unsigned *)((char *)ring->cq_map + p.cq_off.tail);
+	ring->cq_mask  = (unsigned *)((char *)ring->cq_map +
+		p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)((char *)ring->cq_map +
+		p.cq_off.cqes);
+	ring->tail = *ring->sq_tail;
+
+	// Registering the header buffers, so that the kernel does not have
+	// to map them for every operation.
+	ring->headers = aligned_alloc(4096, BATCH_WINDOW * HEADER_SIZE);
+	if(!ring->headers) goto fail;
+	iov.iov_base = ring->headers;
+	iov.iov_len = BATCH_WINDOW * HEADER_SIZE;
+
+	// Registering an empty table of direct descriptors.
+	for(i = 0; i < BATCH_WINDOW * 2; i++) files[i] = -1;
+
+	STATS_ADD(STATS_SYSCALLS, 2);
+	if(syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS,
+		&iov, 1)) goto fail;
+	if(syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_FILES,
+		files, BATCH_WINDOW * 2)) goto fail;
+
+	return 0;
+
+fail:
+	if(ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_size);
+	if(ring->sq_map != MAP_FAILED) munmap(ring->sq_map, ring->sq_size);
+	free(ring->headers);
+	close(ring->fd);
+	return 1;
+}
+
+/*
+	ring_exit()
+
+	Releases an io_uring instance.
+
+	@arg	ring	Ring to release.
+*/
+
+static void ring_exit(struct Ring *ring)
+{
+	munmap(ring->sqes, ring->sqes_size);
+	munmap(ring->sq_map, ring->sq_size);
+	close(ring->fd);
+	free(ring->headers);
+	STATS_ADD(STATS_SYSCALLS, 3);
+}
+
+/*
+	ring_sqe()
+
+	Queues an operation. The caller never queues more operations than the
+	ring can hold before calling ring_run().
+
+	@arg	ring	Ring.
+	@arg	opcode	Operation code.
+	@arg	job	Index of the job in the window.
+	@arg	step	Operation of the job.
+	@arg	link	Non-zero to run the next operation only if this one
+			succeeds.
+
+	@return		Submission entry, to be filled by the caller.
+*/
+
+static struct io_uring_sqe *ring_sqe(struct Ring *ring, uint8_t opcode,
+	int job, enum Batch_Step step, int link)
+{
+	unsigned index = ring->tail & *ring->sq_mask;
+	struct io_uring_sqe *sqe = ring->sqes + index;
+
+	memset(sqe, 0, sizeof *sqe);
+	sqe->opcode = opcode;
+	sqe->flags = link ? IOSQE_IO_LINK : 0;
+	sqe->user_data = ((uint64_t)job << 8) | step;
+	ring->sq_array[index] = index;
+
+	ring->tail++;
+	ring->inflight++;
+	return sqe;
+}
+
+/*
+	ring_run()
+
+	Submits the queued operations and waits for all of them to complete,
+	recording the completed steps and the first error of every job. A read
+	or write that transfers less than expected is an error: it also breaks
+	the chain.
+
+	@arg	ring	Ring.
+	@arg	state	State of the jobs of the window.
+
+	@return		0 on success, 1 on failure (errno is set).
+*/
+
+static int ring_run(struct Ring *ring, struct Uring_Job *state)
+{
+	// Using the number of operations to submit, and the completion ring
+	// cursors.
+	unsigned submit = ring->inflight, head, tail;
+	struct io_uring_cqe *cqe;
+	struct Uring_Job *job;
+	unsigned step;
+	long x;
+
+	STATS_ADD(STATS_URING_OPS, submit);
+	__atomic_store_n(ring->sq_tail, ring->tail, __ATOMIC_RELEASE);
+
+	while(ring->inflight)
+	{
+		// Submitting what is left, and waiting for everything to
+		// complete.
+		x = syscall(__NR_io_uring_enter, ring->fd, submit,
+			ring->inflight, IORING_ENTER_GETEVENTS, NULL, 0);
+		STATS_ADD(STATS_SYSCALLS, 1);
+		if(x < 0 && errno == EINTR) continue;
+		if(x < 0) return 1;
+		submit -= x;
+
+		head = *ring->cq_head;
+		tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+		for(; head != tail; head++, ring->inflight--)
+		{
+			cqe = ring->cqes + (head & *ring->cq_mask);
+			job = state + (cqe->user_data >> 8);
+			step = cqe->user_data & 0xff;
+
+			// The output may legitimately not exist.
+			if(cqe->res < 0 && step == STEP_STATX_OUT) continue;
+
+			if(cqe->res >= 0 && (step == STEP_READ || step ==
+				STEP_PAYLOAD) && (uint32_t)cqe->res != job->size)
+				cqe->res = -EIO;
+			if(cqe->res >= 0 && step == STEP_HEADER && cqe->res !=
+				HEADER_SIZE) cqe->res = -EIO;
+
+			if(cqe->res >= 0) job->done |= 1 << step;
+			else if(!job->error) job->error = -cqe->res;
+		}
+
+		__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	return 0;
+}
+
+/*
+	reserve()
+
+	Makes a buffer large enough for the given size. Buffers only grow, so
+	that after the first jobs, a batch runs without allocating memory.
+
+	@arg	buffer	Buffer.
+	@arg	size	Needed size.
+
+	@return		Buffer data, or NULL on alloc failure.
+*/
+
+static void *reserve(struct Buffer *buffer, size_t size)
+{
+	void *data;
+
+	if(size <= buffer->size) return buffer->data;
+
+	data = realloc(buffer->data, size);
+	if(!data) return NULL;
+	buffer->data = data;
+	buffer->size = size;
+	return data;
+}
+
+/*
+	temp_name()
+
+	Builds a temporary file name next to an output file. The name is unique
+	within the run, and O_EXCL catches collisions with other processes.
+
+	@arg	buffer	Buffer receiving the name.
+	@arg	output	Output file name.
+	@arg	index	Job index.
+
+	@return		Name, or NULL on alloc failure.
+*/
+
+static char *temp_name(struct Buffer *buffer, const char *output, int index)
+{
+	const char *base = strrchr(output, '/');
+	char *temp = reserve(buffer, strlen(output) + 32);
+	int length;
+
+	if(!temp) return NULL;
+	base = base ? base + 1 : output;
+	length = base - output;
+
+	sprintf(temp, "%.*s.%s.%d-%d", length, output, base, (int)getpid(),
+		index);
+	return temp;
+}
+
+/*
+	uring_wrap()
+
+	Wraps payloads through io_uring, a window of jobs at a time. The status
+	of the inputs and outputs is fetched first; then every job is submitted
+	as a single chain:
+
+		openat(input) -> read -> close -> openat(temporary output)
+		-> write(header) -> write(payload) -> close -> renameat
+
+	Jobs whose chain fails for any reason are run again with plain system
+	calls, which handle special files and report accurate errors. Payload
+	buffers and temporary names are reused from one window to the next.
+	Every window is timed as a run of the write phase.
+
+	@arg	jobs	Jobs.
+	@arg	count	Number of jobs.
+
+	@return		0 on success, 1 if io_uring is not usable.
+*/
+
+static int uring_wrap(struct Batch_Job *jobs, int count)
+{
+	// Using the ring and the job states.
+	struct Ring ring;
+	struct Uring_Job state[BATCH_WINDOW], *s;
+	struct Buffer buffers[BATCH_WINDOW] = { { NULL, 0 } };
+	struct Buffer names[BATCH_WINDOW] = { { NULL, 0 } };
+	struct io_uring_sqe *sqe;
+	struct Batch_Job *job;
+	uint8_t *header;
+	int base, n, j, failed;
+
+	if(ring_init(&ring)) return 1;
+
+	for(base = 0; base < count; base += BATCH_WINDOW)
+	{
+		n = count - base < BATCH_WINDOW ? count - base : BATCH_WINDOW;
+		memset(state, 0, sizeof state);
+		TRACE_BEGIN("uring window", "jobs", n);
+		STATS_BEGIN(STATS_WRITE);
+
+		// Getting the size and the first bytes of the inputs, and the
+		// status of the outputs.
+		for(j = 0; j < n; j++)
+		{
+			sqe = ring_sqe(&ring, IORING_OP_OPENAT, j,
+				STEP_PROBE_OPEN, 1);
+			sqe->fd = AT_FDCWD;
+			sqe->addr = (uintptr_t)jobs[base + j].input;
+			sqe->open_flags = O_RDONLY;
+			sqe->file_index = 2 * j + 1;
+
+			sqe = ring_sqe(&ring, IORING_OP_READ, j, STEP_PROBE, 1);
+			sqe->flags |= IOSQE_FIXED_FILE;
+			sqe->fd = 2 * j;
+			sqe->addr = (uintptr_t)state[j].magic;
+			sqe->len = 4;
+
+			sqe = ring_sqe(&ring, IORING_OP_CLOSE, j,
+				STEP_PROBE_CLOSE, 0);
+			sqe->file_index = 2 * j + 1;
+
+			sqe = ring_sqe(&ring, IORING_OP_STATX, j, STEP_STATX_IN,
+				0);
+			sqe->fd = AT_FDCWD;
+			sqe->addr = (uintptr_t)jobs[base + j].input;
+			sqe->len = STATX_TYPE | STATX_MODE | STATX_SIZE;
+			sqe->off = (uintptr_t)&state[j].in;
+
+			sqe = ring_sqe(&ring, IORING_OP_STATX, j,
+				STEP_STATX_OUT, 0);
+			sqe->fd = AT_FDCWD;
+			sqe->addr = (uintptr_t)jobs[base + j].output;
+			sqe->len = STATX_TYPE | STATX_MODE;
+			sqe->off = (uintptr_t)&state[j].out;
+		}
+		if(ring_run(&ring, state)) goto fail;
+
+		// Submitting a chain for every regular file that is to replace
+		// a regular file (or nothing).
+		for(j = 0; j < n; j++)
+		{
+			job = jobs + base + j;
+			s = state + j;
+			header = ring.headers + j * HEADER_SIZE;
+
+			// ELF files are converted by the plain path.
+			if(s->error) continue;
+			if(!S_ISREG(s->in.stx_mode) || ((s->done & (1 <<
+				STEP_STATX_OUT)) && !S_ISREG(s->out.stx_mode))
+				|| s->in.stx_size > UINT32_MAX - HEADER_SIZE
+				|| !memcmp(s->magic, "\x7f" "ELF", 4))
+			{
+				s->error = EINVAL;
+				continue;
+			}
+
+			s->size = s->in.stx_size;
+			s->data = reserve(&buffers[j], s->size ? s->size : 1);
+			s->temp = temp_name(&names[j], job->output, base + j);
+			if(!s->data || !s->temp)
+			{
+				s->error = ENOMEM;
+				continue;
+			}
+
+			memcpy(header, job->header, HEADER_SIZE);
+			header_finalize(header, s->size + HEADER_SIZE);
+
+			sqe = ring_sqe(&ring, IORING_OP_OPENAT, j, STEP_OPEN_IN,
+				1);
+			sqe->fd = AT_FDCWD;
+			sqe->addr = (uintptr_t)job->input;
+			// Direct descriptors are not in the process file
+			// table, and do not take O_CLOEXEC.
+			sqe->open_flags = O_RDONLY;
+			sqe->file_index = 2 * j + 1;
+
+			sqe = ring_sqe(&ring, IORING_OP_READ, j, STEP_READ, 1);
+			sqe->flags |= IOSQE_FIXED_FILE;
+			sqe->fd = 2 * j;
+			sqe->addr = (uintptr_t)s->data;
+			sqe->len = s->size;
+
+			sqe = ring_sqe(&ring, IORING_OP_CLOSE, j, STEP_CLOSE_IN,
+				1);
+			sqe->file_index = 2 * j + 1;
+
+			// Replacing an existing output keeps its permissions,
+			// as the plain path does (minus the umask).
+			sqe = ring_sqe(&ring, IORING_OP_OPENAT, j,
+				STEP_OPEN_OUT, 1);
+			sqe->fd = AT_FDCWD;
+			sqe->addr = (uintptr_t)s->temp;
+			sqe->open_flags = O_WRONLY | O_CREAT | O_EXCL;
+			sqe->len = (s->done & (1 << STEP_STATX_OUT)) ?
+				s->out.stx_mode & 07777 : 0666;
+			sqe->file_index = 2 * j + 2;
+
+			sqe = ring_sqe(&ring, IORING_OP_WRITE_FIXED, j,
+				STEP_HEADER, 1);
+			sqe->flags |= IOSQE_FIXED_FILE;
+			sqe->fd = 2 * j + 1;
+			sqe->addr = (uintptr_t)header;
+			sqe->len = HEADER_SIZE;
+			sqe->buf_index = 0;
+
+			sqe = ring_sqe(&ring, IORING_OP_WRITE, j, STEP_PAYLOAD,
+				1);
+			sqe->flags |= IOSQE_FIXED_FILE;
+			sqe->fd = 2 * j + 1;
+			sqe->addr = (uintptr_t)s->data;
+			sqe->len = s->size;
+			sqe->off = HEADER_SIZE;
+
+			sqe = ring_sqe(&ring, IORING_OP_CLOSE, j,
+				STEP_CLOSE_OUT, 1);
+			sqe->file_index = 2 * j + 2;
+
+			sqe = ring_sqe(&ring, IORING_OP_RENAMEAT, j,
+				STEP_RENAME, 0);
+			sqe->fd = AT_FDCWD;
+			sqe->addr = (uintptr_t)s->temp;
+			sqe->len = AT_FDCWD;
+			sqe->addr2 = (uintptr_t)job->output;
+		}
+		if(ring_run(&ring, state)) goto fail;
+
+		// Cleaning up, and running failed jobs again.
+		for(j = 0; j < n; j++)
+		{
+			job = jobs + base + j;
+			s = state + j;
+
+			failed = !(s->done & (1 << STEP_RENAME));
+			if(failed && (s->done & (1 << STEP_OPEN_OUT)))
+			{
+				unlink(s->temp);
+				STATS_ADD(STATS_SYSCALLS, 1);
+			}
+
+			if(failed) job->error = wrap_job(job);
+			else
+			{
+				job->error = output_remember(job->output) ?
+					errno : 0;
+				STATS_ADD(STATS_READ_CALLS, 1);
+				STATS_ADD(STATS_WRITE_CALLS, 2);
+				STATS_ADD(STATS_BYTES_READ, s->size);
+				STATS_ADD(STATS_BYTES_WRITTEN, s->size +
+					HEADER_SIZE);
+			}
+		}
+		STATS_ADD(STATS_JOBS_DONE, n);
+		STATS_END(STATS_WRITE);
+		TRACE_END("uring window");
+	}
+
+	// Releasing the buffers, and giving up io_uring for the remaining
+	// jobs if the ring broke.
+fail:
+	if(base < count)
+	{
+		STATS_END(STATS_WRITE);
+		TRACE_END("uring window");
+	}
+	for(j = 0; j < BATCH_WINDOW; j++)
+	{
+		free(buffers[j].data);
+		free(names[j].data);
+	}
+	ring_exit(&ring);
+	if(base < count) run_threads(jobs + base, count - base, 0);
+	return 0;
+}
+
+/*
+	uring_dump()
+
+	Reads the headers of g1a files through io_uring, a window of jobs at a
+	time. Every job is a chain: openat -> read -> close, with the status of
+	the file fetched alongside. Headers are read into the registered
+	buffers. Failed jobs are run again with plain system calls. Every window
+	is timed as a run of the dump phase.
+
+	@arg	jobs	Jobs.
+	@arg	count	Number of jobs.
+
+	@return		0 on success, 1 if io_uring is not usable.
+*/
+
+static int uring_dump(struct Batch_Job *jobs, int count)
+{
+	// Using the ring and the job states.
+	struct Ring ring;
+	struct Uring_Job state[BATCH_WINDOW];
+	struct io_uring_sqe *sqe;
+	struct Batch_Job *job;
+	int base, n, j;
+
+	if(ring_init(&ring)) return 1;
+
+	for(base = 0; base < count; base += BATCH_WINDOW)
+	{
+		n = count - base < BATCH_WINDOW ? count - base : BATCH_WINDOW;
+		memset(state, 0, sizeof state);
+		TRACE_BEGIN("uring window", "jobs", n);
+		STATS_BEGIN(STATS_DUMP);
+
+		for(j = 0; j < n; j++)
+		{
+			job = jobs + base + j;
+			state[j].size = HEADER_SIZE;
+
+			sqe = ring_sqe(&ring, IORING_OP_STATX, j, STEP_STATX_IN,
+				0);
+			sqe->fd = AT_FDCWD;
+			sqe->addr = (uintptr_t)job->input;
+			sqe->len = STATX_SIZE;
+			sqe->off = (uintptr_t)&state[j].in;
+
+			sqe = ring_sqe(&ring, IORING_OP_OPENAT, j, STEP_OPEN_IN,
+				1);
+			sqe->fd = AT_FDCWD;
+			sqe->addr = (uintptr_t)job->input;
+			sqe->open_flags = O_RDONLY;
+			sqe->file_index = j + 1;
+
+			sqe = ring_sqe(&ring, IORING_OP_READ_FIXED, j,
+				STEP_READ, 1);
+			sqe->flags |= IOSQE_FIXED_FILE;
+			sqe->fd = j;
+			sqe->addr = (uintptr_t)(ring.headers + j * HEADER_SIZE);
+			sqe->len = HEADER_SIZE;
+			sqe->buf_index = 0;
+
+			sqe = ring_sqe(&ring, IORING_OP_CLOSE, j, STEP_CLOSE_IN,
+				0);
+			sqe->file_index = j + 1;
+		}
+		if(ring_run(&ring, state))
+		{
+			STATS_END(STATS_DUMP);
+			TRACE_END("uring window");
+			ring_exit(&ring);
+			run_threads(jobs + base, count - base, 1);
+			return 0;
+		}
+
+		// Short files fail the read, and are handled by the plain path.
+		for(j = 0; j < n; j++)
+		{
+			job = jobs + base + j;
+			if(state[j].error)
+			{
+				job->error = dump_job(job);
+				continue;
+			}
+
+			memcpy(job->header, ring.headers + j * HEADER_SIZE,
+				HEADER_SIZE);
+			job->size = state[j].in.stx_size;
+			job->error = 0;
+			STATS_ADD(STATS_READ_CALLS, 1);
+			STATS_ADD(STATS_BYTES_READ, HEADER_SIZE);
+		}
+		STATS_ADD(STATS_JOBS_DONE, n);
+		STATS_END(STATS_DUMP);
+		TRACE_END("uring window");
+	}
+
+	ring_exit(&ring);
+	return 0;
+}
+
+
+
+/*
+	Function definitions.
+*/
+
+/*
+	batch_wrap()
+
+	Wraps the payload of every job into its output file. The header of each
+	job must have been generated; the sizes and checksums are set here.
+
+	@arg	jobs	Jobs; their error field is set.
+	@arg	count	Number of jobs.
+	@arg	backend	Requested backend.
+
+	@return		Backend actually used.
+*/
+
+enum Batch_Backend batch_wrap(struct Batch_Job *jobs, int count,
+	enum Batch_Backend backend)
+{
+	STATS_ADD(STATS_JOBS_QUEUED, count);
+	if(backend != BATCH_THREADS && !uring_wrap(jobs, count))
+		return BATCH_URING;
+
+	run_threads(jobs, count, 0);
+	return BATCH_THREADS;
+}
+
+/*
+	batch_dump()
+
+	Reads the header and the size of every job's input file.
+
+	@arg	jobs	Jobs; their header, size and error fields are set.
+	@arg	count	Number of jobs.
+	@arg	backend	Requested backend.
+
+	@return		Backend actually used.
+*/
+
+enum Batch_Backend batch_dump(struct Batch_Job *jobs, int count,
+	enum Batch_Backend backend)
+{
+	STATS_ADD(STATS_JOBS_QUEUED, count);
+	if(backend != BATCH_THREADS && !uring_dump(jobs, count))
+		return BATCH_URING;
+
+	run_threads(jobs, count, 1);
+	return BATCH_THREADS;
+}
@@ -9,13 +9,31 @@
 */
 
 // Standard headers.
+#include <ctype.h>
 #include <stdio.h>
-#include <stdlib.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
 
 // Project headers.
+#include "arena.h"
 #include "error.h"
 #include "bmp_utils.h"
+#include "depfile.h"
+#include "stats.h"
+
+
+
+/*
+	Constants definitions.
+*/
+
+// Largest accepted source dimension.
+#define BITMAP_MAX	0x10000
+// Intensity of white pixels (sum of three 8-bit channels), and threshold.
+#define WHITE		765
+#define THRESHOLD	384
 
 
 
@@ -28,18 +46,87 @@
 // Bitmap meta-information structure definition.
 struct Bitmap
 {
+	// Source size, and row order.
 	unsigned int width, height;
+	int top_down;
+	// Depth, and size of a row in the file.
 	unsigned int depth;
-	const uint8_t *data;
+	size_t row_size;
+	// Intensities of the palette entries (monochrome images).
+	uint16_t palette[2];
+};
+
+// Scaling state, from the source size to the target size.
+struct Scaler
+{
+	// Source and target sizes.
+	unsigned int width, height;
+	unsigned int target_width, target_height;
+	// For every source column (when downscaling): first target column,
+	// and weight in it (the rest goes to the next column).
+	uint32_t *column, *weight;
+	// Intensities of the current source row, their horizontal sums, and
+	// the accumulated sums of the current target row.
+	uint16_t *values;
+	uint32_t *sums;
+	uint64_t *rows;
+	// Number of target rows done, and position in the current one.
+	unsigned int done;
+	uint64_t position;
+	// Dithering errors of the current and next target rows, or NULL.
+	int32_t *errors[2];
 };
 
 
+// Decoded sprite sheet, kept for the whole run.
+struct Sheet
+{
+	// Next decoded sheet.
+	struct Sheet *next;
+	// File name, and state of the file when it was decoded.
+	char *file;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	// Was the sheet dithered ?
+	int dither;
+	// Size, and monochrome pixels (rows padded to four bytes, from the
+	// top).
+	unsigned int width, height;
+	uint8_t data[];
+};
+
+
+
+/*
+	Static variables definitions.
+*/
+
+// Decoded sprite sheets, and has bitmap_free() been registered ?
+static struct Sheet *sheets = NULL;
+static int registered = 0;
+
 
 /*
 	Static declarations.
 */
 
-static int bitmap_pixels(const struct Bitmap *bmp, uint8_t *address);
+static const struct Sheet *bitmap_sheet(const char *file, int dither,
+	struct Arena *arena);
+static void bitmap_copy(const struct Sheet *sheet, unsigned int column,
+	unsigned int row, unsigned int width, unsigned int height,
+	uint8_t *address);
+static int bitmap_decode(FILE *fp, const char *file, const struct Bitmap
+	*bmp, long offset, unsigned int width, unsigned int height,
+	uint8_t *data_ptr, int dither, struct Arena *arena);
+static int bitmap_header(FILE *fp, struct Bitmap *bmp, long *offset);
+static void bitmap_values(const struct Bitmap *bmp, const uint8_t *line,
+	uint16_t *values);
+static void bitmap_scale(struct Scaler *scaler, int top_down,
+	uint8_t *address);
+static void bitmap_emit(struct Scaler *scaler, int top_down,
+	uint8_t *address);
 
 
 
@@ -50,30 +137,62 @@ static int bitmap_pixels(const struct Bitmap *bmp, uint8_t *address);
 	should be only black and white. If not, a warning is emitted and each
 	pixel is turned into the closer color according to an arithmetic mean.
 
+	Images of another size are scaled with an area-averaging filter: every
+	target pixel is the mean of the source area it covers. The file is
+	streamed row by row, and the memory used (taken from the given arena,
+	which the caller resets once the icon is no longer needed) only
+	depends on the width, so that large masters convert quickly. Pixels
+	are reduced to one bit at the end, by thresholding or dithering.
+
+	A file name of the form 'sheet.bmp@col,row' designates a cell of a
+	sprite sheet, whose cells have the requested size. The sheet is decoded
+	once, and its cells are then copied from memory.
+
 	@arg	file	File to read.
 	@arg	width	Bitmap width.
 	@arg	height	Bitmap height.
 	@arg	data	Memory area to copy data to.
+	@arg	dither	Non-zero to dither instead of thresholding.
+	@arg	arena	Arena for the rows and scaling state.
 */
 
 void bitmap_read(const char *file, unsigned int width, unsigned int height,
-	uint8_t *data_ptr)
+	uint8_t *data_ptr, int dither, struct Arena *arena)
 {
 	/*
 		Variables declaration.
 	*/
 
-	// Using an integer to read parts of bitmap header.
-	uint32_t l;
-	// Using a short-named pointer to bitmap data.
-	uint8_t *data;
-	// Using a bitmap structure.
-	struct Bitmap *bmp;
-	// Using a long to store the file size to read.
-	long size;
+	// Using a bitmap structure and the pixel data offset.
+	struct Bitmap bmp;
+	long offset;
+	// Using the sprite sheet, the cell and its path.
+	const struct Sheet *sheet;
+	unsigned int column, row;
+	size_t length;
+	char *path;
 	// Using a file pointer.
 	FILE *fp;
 
+	// Serving sprite sheet cells from the decoded sheet.
+	length = bitmap_cell(file, &column, &row);
+	if(length)
+	{
+		path = arena_alloc(arena, length + 1);
+		if(!path)
+		{
+			error_emit(ERROR, "alloc");
+			return;
+		}
+		memcpy(path, file, length);
+		path[length] = 0;
+
+		sheet = bitmap_sheet(path, dither, arena);
+		if(sheet) bitmap_copy(sheet, column, row, width, height,
+			data_ptr);
+		return;
+	}
+
 	// Opening the bitmap file.
 	fp = fopen(file,"r");
 	// Emitting an error on failure.
@@ -85,202 +204,596 @@ void bitmap_read(const char *file, unsigned int width, unsigned int height,
 		return;
 	}
 
+	// Recording the bitmap as a dependency of the output.
+	depfile_add(file);
+
 
 
 	/*
-		Reading file.
+		Reading headers.
 	*/
 
-	// Allocating memory for the size of a bitmap.
-	bmp = (struct Bitmap *)malloc(sizeof(struct Bitmap));
-	// Emitting an error on alloc failure.
-	if(!bmp)
+	switch(bitmap_header(fp, &bmp, &offset))
 	{
-		// Emitting a bmp-alloc error.
-		error_emit(ERROR,"bmp-alloc",file);
-		// Closing the file pointer.
+	case 1:
+		error_emit(ERROR, "bmp-valid", file);
+		fclose(fp);
+		return;
+	case 2:
+		// Emitting an error if the depth is not supported.
+		error_emit(ERROR, "bmp-depth", file, bmp.depth);
 		fclose(fp);
-		// Returning from function.
 		return;
 	}
+	// Emitting a warning for 16-bit bitmaps, that aren't fully supported.
+	if(bmp.depth == 16) error_emit(WARNING, "bmp-16-bit", file);
 
-	// Getting the file size. Seeking the file end.
-	fseek(fp, 0, SEEK_END);
-	// Allocating memory for the size of the file.
-	data = (uint8_t *)malloc(size = ftell(fp) + 1);
-	// Setting structure data pointer.
-	bmp->data = data;
-	// Moving the file pointer to the beginning of the file.
-	fseek(fp, 0, SEEK_SET);
-	// Handling alloc failure.
-	if(!bmp->data)
+	// Emitting warnings for images that have to be enlarged.
+	if(bmp.width < width) error_emit(WARNING, "bmp-width", file,
+		bmp.width, width);
+	if(bmp.height < height) error_emit(WARNING, "bmp-height", file,
+		bmp.height, height);
+
+	bitmap_decode(fp, file, &bmp, offset, width, height, data_ptr, dither,
+		arena);
+	fclose(fp);
+}
+
+/*
+	bitmap_cell()
+
+	Splits a sprite sheet cell name, of the form 'sheet.bmp@col,row'.
+
+	@arg	file	File name.
+	@arg	column	Receives the cell column, if not NULL.
+	@arg	row	Receives the cell row, if not NULL.
+
+	@return		Length of the sheet file name, 0 if the name does not
+			designate a cell.
+*/
+
+size_t bitmap_cell(const char *file, unsigned int *column,
+	unsigned int *row)
+{
+	// Using the cell suffix, its parsed values and its length.
+	const char *at = strrchr(file, '@');
+	unsigned int x, y;
+	int end = 0;
+
+	if(!at || at == file || !isdigit((unsigned char)at[1])) return 0;
+	if(sscanf(at + 1, "%u,%u%n", &x, &y, &end) != 2 || at[1 + end])
+		return 0;
+
+	if(column) *column = x;
+	if(row) *row = y;
+	return at - file;
+}
+
+/*
+	bitmap_free()
+
+	Frees the decoded sprite sheets. Registered with atexit() when the
+	first sheet is decoded.
+*/
+
+void bitmap_free(void)
+{
+	// Using the next sheet.
+	struct Sheet *next;
+
+	while(sheets)
+	{
+		next = sheets->next;
+		free(sheets);
+		sheets = next;
+	}
+}
+
+/*
+	bitmap_sheet()
+
+	Returns a decoded sprite sheet, decoding it at its own size if it is
+	not known yet, or if its file changed since it was decoded.
+
+	@arg	file	Sheet file name.
+	@arg	dither	Non-zero to dither instead of thresholding.
+	@arg	arena	Arena for the rows of the decoding.
+
+	@return		Decoded sheet, NULL on failure (an error is emitted).
+*/
+
+static const struct Sheet *bitmap_sheet(const char *file, int dither,
+	struct Arena *arena)
+{
+	// Using the file information, the bitmap structure and the pixel data
+	// offset.
+	struct stat st;
+	struct Bitmap bmp;
+	long offset;
+	// Using the sheet, the size of its pixels, and a file pointer.
+	struct Sheet *sheet, **link;
+	size_t size;
+	FILE *fp;
+
+	fp = fopen(file, "r");
+	if(!fp || fstat(fileno(fp), &st))
+	{
+		error_emit(ERROR, "bmp-no-open", file);
+		if(fp) fclose(fp);
+		return NULL;
+	}
+	STATS_ADD(STATS_SYSCALLS, 1);
+
+	// Looking for the sheet, which is decoded again if it changed.
+	for(link = &sheets; *link; link = &(*link)->next)
+	{
+		sheet = *link;
+		if(sheet->dev != st.st_dev || sheet->ino != st.st_ino
+			|| sheet->dither != dither) continue;
+
+		if(sheet->size == st.st_size && sheet->mtime.tv_sec ==
+			st.st_mtim.tv_sec && sheet->mtime.tv_nsec ==
+			st.st_mtim.tv_nsec)
+		{
+			fclose(fp);
+			depfile_add(sheet->file);
+			return sheet;
+		}
+
+		*link = sheet->next;
+		free(sheet);
+		break;
+	}
+
+	switch(bitmap_header(fp, &bmp, &offset))
 	{
-		// Emitting a bmp-alloc error.
-		error_emit(ERROR,"bmp-alloc",file);
-		// Freeing the previous allocated bitmap pointer.
-		free(bmp);
-		// Closing the file.
+	case 1:
+		error_emit(ERROR, "bmp-valid", file);
 		fclose(fp);
-		// Finally returning from function.
-		return;
+		return NULL;
+	case 2:
+		error_emit(ERROR, "bmp-depth", file, bmp.depth);
+		fclose(fp);
+		return NULL;
 	}
+	if(bmp.depth == 16) error_emit(WARNING, "bmp-16-bit", file);
 
-	// Reading file data to the allocated memory.
-	fread((void *)bmp->data, size, 1, fp);
-	// Closing the file.
+	// Allocating the sheet, its pixels and its file name at once.
+	size = (((size_t)bmp.width + 31) >> 5 << 2) * bmp.height;
+	sheet = malloc(sizeof *sheet + size + strlen(file) + 1);
+	if(!sheet)
+	{
+		error_emit(ERROR, "alloc");
+		fclose(fp);
+		return NULL;
+	}
+	sheet->file = (char *)sheet->data + size;
+	strcpy(sheet->file, file);
+	sheet->dev = st.st_dev;
+	sheet->ino = st.st_ino;
+	sheet->size = st.st_size;
+	sheet->mtime = st.st_mtim;
+	sheet->dither = dither;
+	sheet->width = bmp.width;
+	sheet->height = bmp.height;
+
+	if(bitmap_decode(fp, file, &bmp, offset, bmp.width, bmp.height,
+		sheet->data, dither, arena))
+	{
+		free(sheet);
+		fclose(fp);
+		return NULL;
+	}
 	fclose(fp);
 
-	// Getting bitmap signature.
-	l = (data[0] << 8) | data[1];
-	// Checking if the signature is one of BM, BA, CI, CP, IC or PT.
-	if(l != 0x424d && l != 0x4241 && l != 4349 && l != 4350 && l != 4943
-		&& l!=5054)
+	if(!registered) registered = !atexit(bitmap_free);
+	sheet->next = sheets;
+	sheets = sheet;
+	depfile_add(sheet->file);
+	return sheet;
+}
+
+/*
+	bitmap_copy()
+
+	Copies a cell of a decoded sprite sheet. Cells are counted from the top
+	left corner of the sheet.
+
+	@arg	sheet	Decoded sheet.
+	@arg	column	Cell column.
+	@arg	row	Cell row.
+	@arg	width	Cell width.
+	@arg	height	Cell height.
+	@arg	address	Target monochrome bitmap.
+*/
+
+static void bitmap_copy(const struct Sheet *sheet, unsigned int column,
+	unsigned int row, unsigned int width, unsigned int height,
+	uint8_t *address)
+{
+	// Using the sizes of the rows, and iterators.
+	const size_t sheet_size = ((size_t)sheet->width + 31) >> 5 << 2;
+	const unsigned int size = (width + 31) >> 5 << 2;
+	const uint8_t *line;
+	unsigned int x, y, left;
+
+	if(column >= sheet->width / width || row >= sheet->height / height)
 	{
-		// If not, emitting an error.
-		error_emit(ERROR, "bmp-valid", file);
-		// Also returning.
+		error_emit(ERROR, "bmp-cell", column, row, sheet->file,
+			sheet->width / width, sheet->height / height);
 		return;
 	}
 
-	// Getting image width.
-	l = (data[21] << 24) | (data[20] << 16) | (data[19] << 8) | data[18];
-	// If it doesn't match the wanted width, emit a warning.
-	if(l != width) error_emit(ERROR, "bmp-width", file, l, width);
-	// Setting the structure attribute.
-	bmp->width = l;
-
-	// Getting image height.
-	l = (data[25] << 24) | (data[24] << 16) | (data[23] << 8) | data[22];
-	// If it doesn't match the wanted height, emit a warning.
-	if(l != height) error_emit(WARNING, "bmp-height", file, l, height);
-	// Setting the structure attribute.
-	bmp->height = l;
-
-	// Getting the bitmap depth.
-	l = (data[29] << 8) | data[28];
-	// Emitting an error if it's not supported.
-	if(l != 1 && l != 16 && l != 24 && l != 32)
+	memset(address, 0, size * height);
+	left = column * width;
+	for(y = 0; y < height; y++)
 	{
-		// Emitting an error.
-		error_emit(ERROR,"bmp-depth",file,l);
-		// Returning from function.
-		return;
+		line = sheet->data + ((size_t)row * height + y) * sheet_size;
+		for(x = 0; x < width; x++)
+			if(line[(left + x) >> 3] & (128 >> ((left + x) & 7)))
+			address[y * size + (x >> 3)] |= 128 >> (x & 7);
 	}
-	// Emitting a warning for 16-bit bitmaps, that aren't fully supported.
-	if(l == 16) error_emit(WARNING, "bmp-16-bit", file);
-	// Setting the structure member.
-	bmp->depth = l;
+}
+
+/*
+	bitmap_decode()
+
+	Decodes the pixels of an opened bitmap, scaling them to the requested
+	size.
+
+	@arg	fp	Bitmap file.
+	@arg	file	Bitmap file name, for diagnostics.
+	@arg	bmp	Bitmap structure, read from the headers.
+	@arg	offset	Offset of the pixel data.
+	@arg	width	Target width.
+	@arg	height	Target height.
+	@arg	data	Target monochrome bitmap.
+	@arg	dither	Non-zero to dither instead of thresholding.
+	@arg	arena	Arena for the rows and scaling state.
+
+	@return		0 on success, 1 on failure (an error is emitted).
+*/
+
+static int bitmap_decode(FILE *fp, const char *file, const struct Bitmap
+	*bmp, long offset, unsigned int width, unsigned int height,
+	uint8_t *data_ptr, int dither, struct Arena *arena)
+{
+	// Using the scaling state.
+	struct Scaler scaler = { 0 };
+	// Using the current row and iterators.
+	uint8_t *line;
+	unsigned int x, y, mixed = 0;
+	uint64_t start, end;
+
+
 
-	// Reading bitmap information into the given data pointer.
-	l = bitmap_pixels(bmp, data_ptr);
+	/*
+		Preparing the scaling.
+	*/
+
+	scaler.width = bmp->width;
+	scaler.height = bmp->height;
+	scaler.target_width = width;
+	scaler.target_height = height;
+
+	line = arena_alloc(arena, bmp->row_size);
+	scaler.values = arena_alloc(arena, bmp->width * sizeof(uint16_t));
+	scaler.sums = arena_alloc(arena, (width + 1) * sizeof(uint32_t));
+	scaler.rows = arena_alloc(arena, width * sizeof(uint64_t));
+	scaler.column = arena_alloc(arena, bmp->width * sizeof(uint32_t));
+	scaler.weight = arena_alloc(arena, bmp->width * sizeof(uint32_t));
+	if(dither)
+	{
+		scaler.errors[0] = arena_alloc(arena, (width + 2) *
+			sizeof(int32_t));
+		scaler.errors[1] = arena_alloc(arena, (width + 2) *
+			sizeof(int32_t));
+	}
+	if(!line || !scaler.values || !scaler.sums || !scaler.rows
+		|| !scaler.column || !scaler.weight || (dither &&
+		(!scaler.errors[0] || !scaler.errors[1])))
+	{
+		error_emit(ERROR, "alloc");
+		return 1;
+	}
+	memset(scaler.rows, 0, width * sizeof(uint64_t));
+	if(dither)
+	{
+		memset(scaler.errors[0], 0, (width + 2) * sizeof(int32_t));
+		memset(scaler.errors[1], 0, (width + 2) * sizeof(int32_t));
+	}
+
+	// Splitting every source column between (at most) two target columns
+	// when downscaling. Column x covers [x * width, (x + 1) * width) and
+	// target column j covers [j * bmp->width, (j + 1) * bmp->width).
+	if(width <= bmp->width) for(x = 0; x < bmp->width; x++)
+	{
+		start = (uint64_t)x * width;
+		end = start + width;
+		scaler.column[x] = start / bmp->width;
+		scaler.weight[x] = ((uint64_t)scaler.column[x] + 1) *
+			bmp->width < end ? ((uint64_t)scaler.column[x] + 1) *
+			bmp->width - start : width;
+	}
+
+	// Emptying the existing bitmap.
+	memset(data_ptr, 0, (((size_t)width + 31) >> 5 << 2) * height);
+
+
+
+	/*
+		Streaming the rows.
+	*/
+
+	if(fseek(fp, offset, SEEK_SET)) goto invalid;
+
+	for(y = 0; y < bmp->height; y++)
+	{
+		if(fread(line, bmp->row_size, 1, fp) != 1) goto invalid;
+		STATS_ADD(STATS_BYTES_READ, bmp->row_size);
+		STATS_ADD(STATS_READ_CALLS, 1);
+
+		bitmap_values(bmp, line, scaler.values);
+
+		// Checking for pixels that are neither black nor white, which
+		// only matters when the image is not scaled.
+		if(bmp->width == width && bmp->height == height)
+			for(x = 0; x < bmp->width; x++) mixed |=
+			scaler.values[x] != 0 && scaler.values[x] != WHITE;
+
+		bitmap_scale(&scaler, bmp->top_down, data_ptr);
+	}
 
 	// If the bitmap has non purely-black-and-white pixels, emit a warning.
-	if(l) error_emit(WARNING, "bmp-color", file);
+	if(mixed) error_emit(WARNING, "bmp-color", file);
+	return 0;
+
+invalid:
+	error_emit(ERROR, "bmp-valid", file);
+	return 1;
 }
 
 /*
-	bitmap_pixels()
+	bitmap_header()
 
-	Extracts the pixels from a bitmap and writes them to a preallocated
-	memory area in black-and-white indexed format.
+	Reads the headers of a bitmap file, and the palette of monochrome
+	images.
 
-	@arg	bmp	Bitmap structure to read data from.
-	@arg	address	Address to write bitmap pixels to.
+	@arg	fp	Bitmap file, at its beginning.
+	@arg	bmp	Bitmap structure to fill.
+	@arg	offset	Receives the offset of the pixel data.
 
-	@return		1 if non-black-and-white pixels are found, 0 otherwise.
+	@return		0 on success, 1 if the file is not a valid bitmap, 2 if
+			its depth is not supported.
 */
 
-static int bitmap_pixels(const struct Bitmap *bmp, uint8_t *address)
+static int bitmap_header(FILE *fp, struct Bitmap *bmp, long *offset)
 {
-	// Using the offset of raw pixel data in the bitmap data.
-	const unsigned int offset =
-		(bmp->data[0x0d] << 24) | (bmp->data[0x0c] << 16) |
-		(bmp->data[0x0b] << 8) | bmp->data[0x0a];
-	// Using a direct pointer to pixel data.
-	const uint8_t *data = bmp->data + offset;
-
-	// Using an integer to store the line length.
-	int line_length = (bmp->depth == 1 ? 4 : 30 * (bmp->depth >> 3));
-	// Using a warning indicator, related to the presence of pixels in the
-	// image, that are neither black nor white.
-	int warning = 0;
-	// Using two iterators, an offset and a dummy integer.
-	int x, y, v, s;
-	// Using a byte.
-	uint8_t byte;
-
-	// Adapting line length because it needs to be divisible by 4.
-	line_length += line_length & 3;
+	// Using the headers and the palette.
+	uint8_t header[54], palette[8];
+	// Using the information header size, the compression and the raw
+	// height, which is negative for top-down images.
+	uint32_t size, compression, l;
+	int32_t height;
 
-	// Emptying the existing bitmap.
-	for(x=0; x < 76; x++) address[x] = 0;
+	if(fread(header, sizeof header, 1, fp) != 1) return 1;
+	STATS_ADD(STATS_BYTES_READ, sizeof header);
+	STATS_ADD(STATS_READ_CALLS, 1);
 
-	for(y=18; y+1; y--) for(x=0; x<30; x++)
+	// Checking if the signature is one of BM, BA, CI, CP, IC or PT.
+	l = (header[0] << 8) | header[1];
+	if(l != 0x424d && l != 0x4241 && l != 0x4349 && l != 0x4350
+		&& l != 0x4943 && l != 0x5054) return 1;
+
+	*offset = header[10] | (header[11] << 8) | (header[12] << 16)
+		| ((uint32_t)header[13] << 24);
+	size = header[14] | (header[15] << 8) | (header[16] << 16)
+		| ((uint32_t)header[17] << 24);
+	bmp->width = header[18] | (header[19] << 8) | (header[20] << 16)
+		| ((uint32_t)header[21] << 24);
+	height = header[22] | (header[23] << 8) | (header[24] << 16)
+		| ((uint32_t)header[25] << 24);
+	bmp->depth = header[28] | (header[29] << 8);
+	compression = header[30] | (header[31] << 8) | (header[32] << 16)
+		| ((uint32_t)header[33] << 24);
+
+	bmp->top_down = height < 0;
+	bmp->height = height < 0 ? -(uint32_t)height : (uint32_t)height;
+	if(*offset < 0 || !bmp->width || !bmp->height || bmp->width >
+		BITMAP_MAX || bmp->height > BITMAP_MAX) return 1;
+
+	if(bmp->depth != 1 && bmp->depth != 16 && bmp->depth != 24
+		&& bmp->depth != 32) return 2;
+	// Only uncompressed images are supported (bit fields are assumed to
+	// be the default ones).
+	if(compression && (compression != 3 || bmp->depth < 16)) return 1;
+
+	// Rows are padded to four bytes.
+	bmp->row_size = ((size_t)bmp->width * bmp->depth + 31) / 32 * 4;
+
+	// Without a palette, set bits are black.
+	bmp->palette[0] = WHITE;
+	bmp->palette[1] = 0;
+	if(bmp->depth == 1 && *offset >= 14 + (long)size + 8
+		&& !fseek(fp, 14 + size, SEEK_SET)
+		&& fread(palette, sizeof palette, 1, fp) == 1)
 	{
-		// Extracting a pixel using various methods depending on the
-		// bitmap depth.
-		switch(bmp->depth)
+		bmp->palette[0] = palette[0] + palette[1] + palette[2];
+		bmp->palette[1] = palette[4] + palette[5] + palette[6];
+	}
+
+	return 0;
+}
+
+/*
+	bitmap_values()
+
+	Converts a row of pixels to intensities: the sum of the three channels,
+	from 0 (black) to 765 (white).
+
+	@arg	bmp	Bitmap structure.
+	@arg	line	Row, as stored in the file.
+	@arg	values	Intensities of the pixels.
+*/
+
+static void bitmap_values(const struct Bitmap *bmp, const uint8_t *line,
+	uint16_t *values)
+{
+	// Using an iterator and a 16-bit pixel.
+	unsigned int x, v;
+
+	switch(bmp->depth)
+	{
+	// 32-bit assumes B8-G8-R8-X8 or B8-G8-R8-A8.
+	case 32:
+		for(x = 0; x < bmp->width; x++) values[x] = line[4 * x]
+			+ line[4 * x + 1] + line[4 * x + 2];
+		break;
+
+	// Handling classical 24 bits bitmaps.
+	case 24:
+		for(x = 0; x < bmp->width; x++) values[x] = line[3 * x]
+			+ line[3 * x + 1] + line[3 * x + 2];
+		break;
+
+	// 16 bits are read as X1-R5-G5-B5, little endian.
+	case 16:
+		for(x = 0; x < bmp->width; x++)
+		{
+			v = line[2 * x] | (line[2 * x + 1] << 8);
+			values[x] = (((v >> 10) & 31) + ((v >> 5) & 31)
+				+ (v & 31)) * WHITE / 93;
+		}
+		break;
+
+	// Handling monochrome bitmaps through their palette.
+	case 1:
+		for(x = 0; x < bmp->width; x++) values[x] = bmp->palette[
+			(line[x >> 3] >> (7 - (x & 7))) & 1];
+		break;
+	}
+}
+
+/*
+	bitmap_scale()
+
+	Adds a source row to the scaling state: its pixels are summed into the
+	target columns they cover, then into the target rows the source row
+	covers, each weighted by the covered length. Target rows are output as
+	soon as they are complete.
+
+	@arg	scaler		Scaling state.
+	@arg	top_down	Non-zero if rows come from the top of the image.
+	@arg	address		Target monochrome bitmap.
+*/
+
+static void bitmap_scale(struct Scaler *scaler, int top_down,
+	uint8_t *address)
+{
+	// Using the sizes, in short variables.
+	const unsigned int width = scaler->width, height = scaler->height;
+	const unsigned int tw = scaler->target_width;
+	const unsigned int th = scaler->target_height;
+	// Using the covered ranges, and iterators.
+	uint64_t start, end, limit, part;
+	unsigned int x, j;
+
+	// Summing the row horizontally, into at most two target columns per
+	// source column when downscaling.
+	memset(scaler->sums, 0, (tw + 1) * sizeof *scaler->sums);
+	if(tw <= width) for(x = 0; x < width; x++)
+	{
+		scaler->sums[scaler->column[x]] += scaler->values[x] *
+			scaler->weight[x];
+		scaler->sums[scaler->column[x] + 1] += scaler->values[x] *
+			(tw - scaler->weight[x]);
+	}
+	// Otherwise, spreading every source column over several ones.
+	else for(x = 0; x < width; x++)
+	{
+		start = (uint64_t)x * tw;
+		end = start + tw;
+		while(start < end)
 		{
-		// 32-bit assumes X8-R8-G8-B8 or A8-R8-G8-B8.
-		case 32:
-			// Computing the pixel byte offset.
-			v = line_length * y + (x<<2) + 1;
-			// Computing the sum of the three channel intensities.
-			s = data[v] + data[v+1] + data[v+2];
-			// Checking pure-black-and-white warning.
-			if(s && s != 765) warning = 1;
-			// Reducing to boolean.
-			s = (s < 384);
-			break;
-
-		// Handling classical 24 bits bitmaps.
-		case 24:
-			// Computing the pixel byte offset.
-			v = line_length * y + x * 3;
-			// Extracting the three bytes and getting their sum.
-			s = data[v] + data[v+1] + data[v+2];
-			// Checking if the pixel is different that strictly
-			// black or white.
-			if(s && s != 765) warning = 1;
-			// Reducing to boolean.
-			s = (s < 384);
-			break;
-
-		// 16 bits are not well supported (weird decoded values).
-		case 16:
-			// Extracting two bytes.
-			v = line_length * y + (x << 1);
-			v = data[v] + data[v+1];
-			// Extracting the three sections.
-			s  = (v & 0x7c00) >> 12;
-			s += (v & 0x03e0) >> 5;
-			s += (v & 0x001f);
-			// Reducing to boolean.
-			s = (s < 23);
-			break;
-
-		// Handling monochrome bitmaps.
-		case 1: 
-			// Extracting the right byte.
-			v = line_length * y + (x >> 3);
-			// Isolating the sought bit.
-			s = data[v] & (128 >> (x & 7));
-			break;
+			j = start / width;
+			limit = (uint64_t)(j + 1) * width;
+			part = (end < limit ? end : limit) - start;
+			scaler->sums[j] += scaler->values[x] * part;
+			start += part;
 		}
+	}
+
+	// Summing the row vertically. Source row y covers [y * th, (y + 1) *
+	// th) and target row i covers [i * height, (i + 1) * height).
+	start = scaler->position;
+	end = start + th;
+	while(start < end && scaler->done < th)
+	{
+		limit = (uint64_t)(scaler->done + 1) * height;
+		part = (end < limit ? end : limit) - start;
+		for(j = 0; j < tw; j++) scaler->rows[j] += (uint64_t)
+			scaler->sums[j] * part;
+		start += part;
 
-		// Getting the offset of the byte to edit.
-		v = ((18-y) << 2) + (x >> 3);
-		// Getting the byte at this offset.
-		byte = address[v];
-		// Altering the byte depending on the pixel value.
-		if(s) byte |= (128 >> (x & 7));
-		else byte &= ~(128 >> (x & 7));
-		// Writing the new byte.
-		address[v] = byte;
+		if(start == limit) bitmap_emit(scaler, top_down, address);
 	}
+	scaler->position = end;
+}
+
+/*
+	bitmap_emit()
+
+	Outputs a complete target row, reducing the averaged intensities to one
+	bit by thresholding, or by Floyd-Steinberg error diffusion.
 
-	// Returning the warning indicator.
-	return warning;
+	@arg	scaler		Scaling state.
+	@arg	top_down	Non-zero if rows come from the top of the image.
+	@arg	address		Target monochrome bitmap.
+*/
+
+static void bitmap_emit(struct Scaler *scaler, int top_down,
+	uint8_t *address)
+{
+	// Using the target row, its size in bytes and the area of a pixel.
+	const unsigned int tw = scaler->target_width;
+	unsigned int row = top_down ? scaler->done : scaler->target_height - 1
+		- scaler->done;
+	const unsigned int size = (tw + 31) >> 5 << 2;
+	const uint64_t area = (uint64_t)scaler->width * scaler->height;
+	// Using the current and next error rows, a value and an iterator.
+	int32_t *current = scaler->errors[0], *next = scaler->errors[1];
+	int32_t value, error;
+	unsigned int j;
+
+	for(j = 0; j < tw; j++)
+	{
+		value = scaler->rows[j] / area;
+		scaler->rows[j] = 0;
+
+		// Diffusing the error to the next pixels (errors are shifted
+		// by one to have room for the left neighbour).
+		if(current)
+		{
+			value += current[j + 1];
+			error = value - (value < THRESHOLD ? 0 : WHITE);
+			current[j + 2] += error * 7 / 16;
+			next[j] += error * 3 / 16;
+			next[j + 1] += error * 5 / 16;
+			next[j + 2] += error / 16;
+		}
+
+		if(value < THRESHOLD) address[row * size + (j >> 3)] |=
+			128 >> (j & 7);
+	}
+
+	// Moving to the next error row.
+	if(current)
+	{
+		memset(current, 0, (tw + 2) * sizeof *current);
+		scaler->errors[0] = next;
+		scaler->errors[1] = current;
+	}
+	scaler->done++;
 }
 
 /*
@@ -0,0 +1,320 @@
+/*
+	Bundle module.
+*/
+
+
+
+/*
+	Header inclusions.
+*/
+
+// Standard headers.
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Project headers.
+#include "bundle.h"
+#include "header.h"
+#include "payload.h"
+#include "stats.h"
+
+
+
+/*
+	Constants definitions.
+*/
+
+// Size of tar blocks, and of the name field of ustar headers.
+#define BLOCK		512
+#define NAME_SIZE	100
+
+
+
+/*
+	Static function definitions.
+*/
+
+/*
+	bundle_header()
+
+	Writes a ustar header block.
+
+	@arg	bundle	Archive.
+	@arg	name	Entry name, at most NAME_SIZE characters.
+	@arg	type	Entry type: '0' for a file, 'x' for pax records.
+	@arg	size	Entry size.
+	@arg	mtime	Modification date.
+
+	@return		0 on success, 1 on failure (errno is set).
+*/
+
+static int bundle_header(struct Bundle *bundle, const char *name, char type,
+	uint64_t size, time_t mtime)
+{
+	// Using the header block, its checksum and an iterator.
+	char block[BLOCK];
+	unsigned int sum = 0;
+	int i;
+
+	memset(block, 0, sizeof block);
+	strncpy(block, name, NAME_SIZE);
+	strcpy(block + 100, "0000644");
+	strcpy(block + 108, "0000000");
+	strcpy(block + 116, "0000000");
+	sprintf(block + 124, "%011llo", (unsigned long long)size);
+	sprintf(block + 136, "%011llo", (unsigned long long)(mtime > 0 ?
+		mtime : 0));
+	block[156] = type;
+	memcpy(block + 257, "ustar", 6);
+	memcpy(block + 263, "00", 2);
+
+	// The checksum is computed with its own field set to spaces.
+	memset(block + 148, ' ', 8);
+	for(i = 0; i < BLOCK; i++) sum += (unsigned char)block[i];
+	sprintf(block + 148, "%06o", sum);
+	block[155] = ' ';
+
+	return output_append(&bundle->output, block, BLOCK);
+}
+
+/*
+	bundle_entry()
+
+	Writes the headers of a file entry, preceded by a pax record when the
+	name does not fit in the ustar header.
+
+	@arg	bundle	Archive.
+	@arg	name	Entry name.
+	@arg	size	Entry size.
+	@arg	mtime	Modification date.
+
+	@return		0 on success, 1 on failure (errno is set).
+*/
+
+static int bundle_entry(struct Bundle *bundle, const char *name,
+	uint64_t size, time_t mtime)
+{
+	// Using the pax record, its length, the length of its length and the
+	// next power of ten.
+	char record[BLOCK + 32];
+	size_t length = strlen(name), total, digits, limit;
+
+	if(length > NAME_SIZE && length < BLOCK)
+	{
+		// The record length includes its own decimal representation.
+		total = length + 7;
+		for(digits = 1, limit = 10; total + digits >= limit; digits++)
+			limit *= 10;
+		total += digits;
+		sprintf(record, "%zu path=%s\n", total, name);
+
+		if(bundle_header(bundle, "PaxHeader", 'x', total, mtime)
+			|| output_append(&bundle->output, record, total)
+			|| output_zero(&bundle->output, -total & (BLOCK - 1)))
+			return 1;
+	}
+	else if(length >= BLOCK)
+	{
+		errno = ENAMETOOLONG;
+		return 1;
+	}
+
+	return bundle_header(bundle, name, '0', size, mtime);
+}
+
+/*
+	compare_names()
+
+	Orders entry names, for qsort().
+*/
+
+static int compare_names(const void *a, const void *b)
+{
+	return strcmp(*(const char * const *)a, *(const char * const *)b);
+}
+
+
+
+/*
+	Function definitions.
+*/
+
+/*
+	bundle_unique()
+
+	Looks for an entry name shared by several jobs. Such an archive would
+	hold several entries of the same name, of which extracting keeps only
+	the last one.
+
+	@arg	jobs		Jobs, named after their output.
+	@arg	count		Number of jobs.
+	@arg	duplicate	Receives a name shared by several jobs, or NULL
+				if all the names are unique.
+
+	@return		0 on success, 1 on alloc failure (errno is set).
+*/
+
+int bundle_unique(const struct Batch_Job *jobs, int count,
+	const char **duplicate)
+{
+	// Using the sorted names, and an iterator.
+	const char **names = malloc(count * sizeof *names);
+	int i;
+
+	*duplicate = NULL;
+	if(count && !names) return 1;
+
+	for(i = 0; i < count; i++) names[i] = jobs[i].output;
+	qsort(names, count, sizeof *names, compare_names);
+	for(i = 1; i < count && !*duplicate; i++)
+		if(!strcmp(names[i - 1], names[i])) *duplicate = names[i];
+
+	free(names);
+	return 0;
+}
+
+/*
+	bundle_open()
+
+	Creates an archive. Files are written to a temporary file, renamed into
+	place by bundle_close().
+
+	@arg	bundle	Archive structure to initialize.
+	@arg	path	Archive file name, or '-' for the standard output.
+	@arg	mtime	Date of all the entries, or -1 to use the dates of their
+			inputs.
+
+	@return		0 on success, 1 on failure (errno is set).
+*/
+
+int bundle_open(struct Bundle *bundle, const char *path, time_t mtime)
+{
+	bundle->mtime = mtime;
+	if(strcmp(path, "-")) return output_open(&bundle->output, path, 0);
+
+	output_stream(&bundle->output, STDOUT_FILENO, path);
+	return 0;
+}
+
+/*
+	bundle_add()
+
+	Wraps the payload of a job into an archive entry, with the header of
+	the job (which is finalized here). Plain files are copied in the
+	kernel; ELF files and streams are converted in memory, as a single run
+	does.
+
+	@arg	bundle	Archive.
+	@arg	job	Job; its error and defect fields are set if its input
+			cannot be used, and no entry is written then.
+	@arg	name	Entry name.
+
+	@return		0 on success or if the job failed, 1 if the archive
+			cannot be written any more (errno is set).
+*/
+
+int bundle_add(struct Bundle *bundle, struct Batch_Job *job,
+	const char *name)
+{
+	// Using the input descriptor and status, its first bytes and the
+	// payload of converted inputs.
+	struct stat st;
+	uint8_t magic[4];
+	struct Payload payload;
+	int fd, converted, error;
+	uint64_t size;
+
+	fd = open(job->input, O_RDONLY | O_CLOEXEC);
+	STATS_ADD(STATS_SYSCALLS, 2);
+	if(fd < 0 || fstat(fd, &st))
+	{
+		job->error = errno;
+		if(fd >= 0) close(fd);
+		return 0;
+	}
+
+	// Only plain flat files are copied as they are.
+	converted = !S_ISREG(st.st_mode) || (st.st_size >= 4 && pread(fd,
+		magic, 4, 0) == 4 && !memcmp(magic, "\x7f" "ELF", 4));
+	if(converted)
+	{
+		close(fd);
+		fd = -1;
+		if(payload_open(&payload, job->input, PAYLOAD_ELF))
+		{
+			job->error = errno;
+			job->defect = payload.defect;
+			return 0;
+		}
+		size = payload.size;
+	}
+	else size = st.st_size;
+
+	if(size + HEADER_SIZE > UINT32_MAX)
+	{
+		job->error = EFBIG;
+		goto end;
+	}
+	header_finalize(job->header, size + HEADER_SIZE);
+
+	// Writing the entry: headers, g1a header, payload and padding.
+	if(bundle_entry(bundle, name, size + HEADER_SIZE, bundle->mtime >= 0
+		? bundle->mtime : st.st_mtime)
+		|| (converted ? payload_write(&payload, &bundle->output,
+		job->header, HEADER_SIZE) : output_append(&bundle->output,
+		job->header, HEADER_SIZE) || output_copy(&bundle->output, fd,
+		0, size))
+		|| output_zero(&bundle->output, -(size + HEADER_SIZE) &
+		(BLOCK - 1)))
+	{
+		error = errno;
+		if(converted) payload_close(&payload);
+		else close(fd);
+		errno = error;
+		return 1;
+	}
+
+end:
+	if(converted) payload_close(&payload);
+	else close(fd);
+	STATS_ADD(STATS_SYSCALLS, 1);
+	return 0;
+}
+
+/*
+	bundle_close()
+
+	Ends the archive with two empty blocks, and moves it into place.
+
+	@arg	bundle	Archive.
+
+	@return		0 on success, 1 on failure (errno is set).
+*/
+
+int bundle_close(struct Bundle *bundle)
+{
+	if(output_zero(&bundle->output, 2 * BLOCK))
+	{
+		output_abort(&bundle->output);
+		return 1;
+	}
+	return output_commit(&bundle->output);
+}
+
+/*
+	bundle_abort()
+
+	Removes a partial archive (streams are only closed).
+
+	@arg	bundle	Archive.
+*/
+
+void bundle_abort(struct Bundle *bundle)
+{
+	output_abort(&bundle->output);
+}
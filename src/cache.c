@@ -0,0 +1,465 @@
+/*
+	Cache module.
+*/
+
+
+
+/*
+	Header inclusions.
+*/
+
+// Standard headers.
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+// Project headers.
+#include "cache.h"
+#include "error.h"
+#include "hash.h"
+#include "output.h"
+
+
+
+/*
+	Constants definitions.
+*/
+
+// Hash seed, to be changed whenever the output format changes so that old
+// entries are no longer hit.
+#define CACHE_SEED	0x6731615f76310001ull
+
+
+
+/*
+	Composed types definitions.
+
+	These types are used only in this file.
+*/
+
+// Cache statistics, stored in the 'stats' file of the cache directory.
+struct Cache_Stats
+{
+	unsigned long long hits, misses, stores, evictions;
+	unsigned long long entries, bytes;
+};
+
+// Cache entry, as seen during eviction.
+struct Cache_Entry
+{
+	// Last use date.
+	time_t mtime;
+	// File size.
+	off_t size;
+	// File name, relative to the cache directory.
+	char name[40];
+};
+
+
+
+/*
+	Static function definitions.
+*/
+
+/*
+	entry_path()
+
+	Builds the path of an entry: <dir>/<2 hex digits>/<30 hex digits>.g1a.
+	The returned string is allocated.
+
+	@arg	dir	Cache directory.
+	@arg	key	Entry key.
+	@arg	subdir	Non-zero to get the subdirectory name only.
+
+	@return		Allocated path, or NULL on alloc failure.
+*/
+
+static char *entry_path(const char *dir, const char *key, int subdir)
+{
+	char *path = malloc(strlen(dir) + 40);
+
+	if(!path) return NULL;
+	if(subdir) sprintf(path, "%s/%.2s", dir, key);
+	else sprintf(path, "%s/%.2s/%s.g1a", dir, key, key + 2);
+	return path;
+}
+
+/*
+	ledger_open()
+
+	Opens and locks the statistics file of the cache, and reads it.
+
+	@arg	dir	Cache directory.
+	@arg	stats	Statistics structure to fill.
+
+	@return		Locked file descriptor, or -1 on failure.
+*/
+
+static int ledger_open(const char *dir, struct Cache_Stats *stats)
+{
+	// Using the file name, a read buffer and a descriptor.
+	char *path = malloc(strlen(dir) + 8);
+	char buffer[256];
+	ssize_t x;
+	int fd;
+
+	memset(stats, 0, sizeof *stats);
+	if(!path) return -1;
+
+	// Creating the cache directory on first use.
+	mkdir(dir, 0777);
+	sprintf(path, "%s/stats", dir);
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+	free(path);
+	if(fd < 0) return -1;
+
+	// Serializing updates from concurrent runs.
+	if(flock(fd, LOCK_EX))
+	{
+		close(fd);
+		return -1;
+	}
+
+	x = pread(fd, buffer, sizeof buffer - 1, 0);
+	buffer[x > 0 ? x : 0] = 0;
+	sscanf(buffer, "hits %llu\nmisses %llu\nstores %llu\nevictions %llu\n"
+		"entries %llu\nbytes %llu\n", &stats->hits, &stats->misses,
+		&stats->stores, &stats->evictions, &stats->entries,
+		&stats->bytes);
+
+	return fd;
+}
+
+/*
+	ledger_close()
+
+	Writes the statistics file back and releases it.
+
+	@arg	fd	Descriptor returned by ledger_open().
+	@arg	stats	Statistics to save.
+*/
+
+static void ledger_close(int fd, const struct Cache_Stats *stats)
+{
+	char buffer[256];
+	int length;
+
+	length = snprintf(buffer, sizeof buffer, "hits %llu\nmisses %llu\n"
+		"stores %llu\nevictions %llu\nentries %llu\nbytes %llu\n",
+		stats->hits, stats->misses, stats->stores, stats->evictions,
+		stats->entries, stats->bytes);
+
+	if(pwrite(fd, buffer, length, 0) == length) ftruncate(fd, length);
+	close(fd);
+}
+
+/*
+	compare_entries()
+
+	Comparison function for qsort(), oldest entries first.
+*/
+
+static int compare_entries(const void *a, const void *b)
+{
+	const struct Cache_Entry *x = a, *y = b;
+	return (x->mtime > y->mtime) - (x->mtime < y->mtime);
+}
+
+/*
+	evict()
+
+	Scans the cache, recomputes its size and removes the least recently
+	used entries until it fits in 90% of the limit. Must be called with the
+	statistics file locked.
+
+	@arg	dir	Cache directory.
+	@arg	stats	Statistics to update.
+	@arg	limit	Size limit, in bytes.
+*/
+
+static void evict(const char *dir, struct Cache_Stats *stats,
+	uint64_t limit)
+{
+	// Using the entry list, its size and capacity.
+	struct Cache_Entry *entries = NULL, *tmp;
+	size_t count = 0, capacity = 0, removed = 0, i;
+	// Using directory streams and the current entry status.
+	DIR *top, *sub;
+	struct dirent *d, *e;
+	struct stat st;
+	char *path = malloc(strlen(dir) + 40);
+	// Using the total size.
+	uint64_t bytes = 0;
+
+	if(!path) return;
+	top = opendir(dir);
+	if(!top)
+	{
+		free(path);
+		return;
+	}
+
+	// Listing the entries of every two-digit subdirectory.
+	while((d = readdir(top)))
+	{
+		if(strlen(d->d_name) != 2 || d->d_name[0] == '.') continue;
+		sprintf(path, "%s/%s", dir, d->d_name);
+		if(!(sub = opendir(path))) continue;
+
+		while((e = readdir(sub)))
+		{
+			if(strlen(e->d_name) != 34) continue;
+			if(fstatat(dirfd(sub), e->d_name, &st, 0)) continue;
+
+			if(count == capacity)
+			{
+				capacity = capacity ? capacity * 2 : 256;
+				tmp = realloc(entries, capacity * sizeof *tmp);
+				if(!tmp) break;
+				entries = tmp;
+			}
+
+			entries[count].mtime = st.st_mtime;
+			entries[count].size = st.st_size;
+			// Names have been checked to fit: "xx/<34 chars>".
+			memcpy(entries[count].name, d->d_name, 2);
+			entries[count].name[2] = '/';
+			memcpy(entries[count].name + 3, e->d_name, 35);
+			bytes += st.st_size;
+			count++;
+		}
+
+		closedir(sub);
+	}
+	closedir(top);
+
+	// Removing the oldest entries first.
+	qsort(entries, count, sizeof *entries, compare_entries);
+	for(i = 0; i < count && bytes > limit - limit / 10; i++)
+	{
+		sprintf(path, "%s/%s", dir, entries[i].name);
+		if(unlink(path)) continue;
+		bytes -= entries[i].size;
+		stats->evictions++;
+		removed++;
+	}
+
+	stats->entries = count - removed;
+	stats->bytes = bytes;
+
+	free(entries);
+	free(path);
+}
+
+
+
+/*
+	Function definitions.
+*/
+
+/*
+	cache_key()
+
+	Computes the key of a wrap job. The generated header already contains
+	every option in normalized form (fixed-size, zero-padded fields) and the
+	decoded icon, so it is hashed along with the payload.
+
+	@arg	header	Generated header, before size and checksums are set.
+	@arg	payload	Payload.
+	@arg	key	Buffer receiving the key as 32 hexadecimal digits.
+*/
+
+void cache_key(const unsigned char *header, const struct Payload *payload,
+	char key[33])
+{
+	// Using the hash state, the payload segments and a block of zeros for
+	// the gaps of ELF images.
+	static const uint8_t zeros[0x1000];
+	const struct Payload_Segment *segments;
+	struct Hash hash;
+	uint64_t value[2];
+	size_t size, x;
+	int count, i;
+
+	hash_init(&hash, CACHE_SEED);
+	hash_update(&hash, header, 0x200);
+
+	segments = payload_segments(payload, &count);
+	for(i = 0; i < count; i++)
+	{
+		if(segments[i].data) hash_update(&hash, segments[i].data,
+			segments[i].size);
+		else for(size = segments[i].size; size; size -= x)
+		{
+			x = size < sizeof zeros ? size : sizeof zeros;
+			hash_update(&hash, zeros, x);
+		}
+	}
+	hash_final(&hash, value);
+
+	sprintf(key, "%016llx%016llx", (unsigned long long)value[0],
+		(unsigned long long)value[1]);
+}
+
+/*
+	cache_fetch()
+
+	Looks up an entry and, if found, materializes it as the output file: by
+	reflink if the file system supports it, otherwise by hard link, and
+	otherwise by copy.
+
+	@arg	dir	Cache directory.
+	@arg	key	Entry key.
+	@arg	output	Output file name.
+
+	@return		1 on a hit, 0 on a miss or failure.
+*/
+
+int cache_fetch(const char *dir, const char *key, const char *output)
+{
+	// Using the entry path and descriptor, and the output file.
+	char *path = entry_path(dir, key, 0);
+	struct Output out;
+	struct Cache_Stats stats;
+	struct stat st;
+	int fd, hit = 0;
+
+	if(!path) return 0;
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	if(fd >= 0 && !fstat(fd, &st))
+	{
+		// Marking the entry as recently used. Hard-linked outputs also
+		// get a fresh modification date this way.
+		futimens(fd, NULL);
+
+		if(output_open(&out, output, 0))
+			error_emit(WARNING, "cache", output, strerror(errno));
+		else if(output_clone(&out, fd) && output_link(&out, path)
+			&& output_copy(&out, fd, 0, st.st_size))
+		{
+			error_emit(WARNING, "cache", output, strerror(errno));
+			output_abort(&out);
+		}
+		else if(output_commit(&out))
+			error_emit(WARNING, "cache", output, strerror(errno));
+		else hit = 1;
+	}
+	if(fd >= 0) close(fd);
+	free(path);
+
+	// Counting hits and misses.
+	if((fd = ledger_open(dir, &stats)) >= 0)
+	{
+		if(hit) stats.hits++;
+		else stats.misses++;
+		ledger_close(fd, &stats);
+	}
+
+	return hit;
+}
+
+/*
+	cache_store()
+
+	Adds a generated file to the cache, by reflink or copy (never by hard
+	link, so that later changes to the output cannot alter the cache), and
+	evicts old entries if the cache exceeds its size limit.
+
+	@arg	dir	Cache directory.
+	@arg	key	Entry key.
+	@arg	output	Generated file.
+	@arg	limit	Cache size limit, in bytes.
+*/
+
+void cache_store(const char *dir, const char *key, const char *output,
+	uint64_t limit)
+{
+	// Using the entry path, the generated file and the cache file.
+	char *path = entry_path(dir, key, 0);
+	char *subdir = entry_path(dir, key, 1);
+	struct Output entry;
+	struct Cache_Stats stats;
+	struct stat st;
+	int fd = -1, ledger;
+
+	if(!path || !subdir) goto end;
+
+	// Creating the subdirectory on first use.
+	mkdir(dir, 0777);
+	mkdir(subdir, 0777);
+
+	fd = open(output, O_RDONLY | O_CLOEXEC);
+	if(fd < 0 || fstat(fd, &st)) goto fail;
+
+	if(output_open(&entry, path, st.st_size)) goto fail;
+	if(output_clone(&entry, fd) && output_copy(&entry, fd, 0, st.st_size))
+	{
+		output_abort(&entry);
+		goto fail;
+	}
+	if(output_commit(&entry)) goto fail;
+
+	// Accounting for the new entry and evicting if needed.
+	if((ledger = ledger_open(dir, &stats)) >= 0)
+	{
+		stats.stores++;
+		stats.entries++;
+		stats.bytes += st.st_size;
+		if(stats.bytes > limit) evict(dir, &stats, limit);
+		ledger_close(ledger, &stats);
+	}
+	goto end;
+
+fail:
+	error_emit(WARNING, "cache", dir, strerror(errno));
+end:
+	if(fd >= 0) close(fd);
+	free(path);
+	free(subdir);
+}
+
+/*
+	cache_stats()
+
+	Displays the cache statistics. The size is recomputed by scanning the
+	cache, which also applies the size limit.
+
+	@arg	dir	Cache directory.
+	@arg	limit	Cache size limit, in bytes.
+*/
+
+void cache_stats(const char *dir, uint64_t limit)
+{
+	struct Cache_Stats stats;
+	unsigned long long lookups;
+	int fd = ledger_open(dir, &stats);
+
+	if(fd < 0)
+	{
+		error_emit(ERROR, "cache-open", dir, strerror(errno));
+		return;
+	}
+
+	evict(dir, &stats, limit);
+	lookups = stats.hits + stats.misses;
+
+	printf("Cache directory '%s'\n", dir);
+	printf("Entries         %llu\n", stats.entries);
+	printf("Size            %llu bytes (limit %llu)\n\n", stats.bytes,
+		(unsigned long long)limit);
+	printf("Hits            %llu\n", stats.hits);
+	printf("Misses          %llu\n", stats.misses);
+	printf("Hit ratio       %.1f%%\n", lookups ? 100.0 * stats.hits /
+		lookups : 0.0);
+	printf("Stores          %llu\n", stats.stores);
+	printf("Evictions       %llu\n", stats.evictions);
+
+	ledger_close(fd, &stats);
+}
@@ -0,0 +1,547 @@
+/*
+	Dedup module.
+*/
+
+
+
+/*
+	Header inclusions.
+*/
+
+// Feature macros, for statx().
+#define _GNU_SOURCE
+
+// Standard headers.
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+// Project headers.
+#include "dedup.h"
+#include "hash.h"
+#include "header.h"
+#include "output.h"
+#include "pool.h"
+#include "stats.h"
+#include "trace.h"
+
+
+
+/*
+	Constants definitions.
+*/
+
+// Size of the buffers payloads are read through.
+#define DEDUP_BUFFER		0x10000
+// Seed of the payload hashes.
+#define DEDUP_SEED		0x6731612d64656475ull
+
+// Cluster states of the files, before clusters are known: files to hash,
+// files sharing the inode of the previous one, and files that turned out
+// to differ from the first file of their group.
+#define DEDUP_HASH		-2
+#define DEDUP_COPY		-3
+#define DEDUP_MISMATCH		-4
+
+
+
+/*
+	Composed types definitions.
+
+	These types are used only in this file.
+*/
+
+// Files a stage is run on, on worker threads.
+struct Run
+{
+	struct Dedup *dedup;
+	// Job run on every file.
+	void (*job)(struct Dedup *dedup, int index);
+};
+
+
+
+/*
+	Static function definitions.
+*/
+
+/*
+	read_full()
+
+	Reads a part of a file, retrying after interruptions and short reads.
+
+	@arg	fd	File descriptor.
+	@arg	buffer	Buffer.
+	@arg	size	Number of bytes to read.
+	@arg	offset	Offset in the file.
+
+	@return		0 on success, or an error number (EIO if the file is
+			shorter than expected).
+*/
+
+static int read_full(int fd, void *buffer, size_t size, uint64_t offset)
+{
+	ssize_t x;
+
+	while(size)
+	{
+		x = pread(fd, buffer, size, offset);
+		STATS_ADD(STATS_SYSCALLS, 1);
+		STATS_ADD(STATS_READ_CALLS, 1);
+		if(x < 0 && errno == EINTR) continue;
+		if(x <= 0) return x < 0 ? errno : EIO;
+
+		STATS_ADD(STATS_BYTES_READ, x);
+		buffer = (uint8_t *)buffer + x;
+		size -= x;
+		offset += x;
+	}
+
+	return 0;
+}
+
+/*
+	stat_job()
+
+	Gets the size and identity of a file, without opening it.
+*/
+
+static void stat_job(struct Dedup *dedup, int index)
+{
+	struct Dedup_File *file = dedup->files + index;
+	struct statx stx;
+
+	STATS_ADD(STATS_SYSCALLS, 1);
+	if(statx(AT_FDCWD, file->path, 0, STATX_SIZE | STATX_INO, &stx))
+	{
+		file->error = errno;
+		return;
+	}
+
+	file->size = stx.stx_size;
+	file->device = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+	file->inode = stx.stx_ino;
+}
+
+/*
+	hash_job()
+
+	Hashes the payload of a file whose size is shared.
+*/
+
+static void hash_job(struct Dedup *dedup, int index)
+{
+	// Using the file, its descriptor, a read buffer and the hash state.
+	struct Dedup_File *file = dedup->files + index;
+	uint8_t buffer[DEDUP_BUFFER];
+	struct Hash hash;
+	uint64_t offset, size;
+	int fd;
+
+	if(file->cluster != DEDUP_HASH) return;
+
+	fd = open(file->path, O_RDONLY | O_CLOEXEC);
+	STATS_ADD(STATS_SYSCALLS, 1);
+	if(fd < 0)
+	{
+		file->error = errno;
+		return;
+	}
+
+	hash_init(&hash, DEDUP_SEED);
+	for(offset = HEADER_SIZE; offset < file->size; offset += size)
+	{
+		size = file->size - offset;
+		if(size > DEDUP_BUFFER) size = DEDUP_BUFFER;
+		if((file->error = read_full(fd, buffer, size, offset))) break;
+		hash_update(&hash, buffer, size);
+	}
+	hash_final(&hash, file->hash);
+
+	close(fd);
+	STATS_ADD(STATS_SYSCALLS, 1);
+}
+
+/*
+	read_pair()
+
+	Reads the same part of two files. Errors on the first file are not
+	reported as such.
+
+	@return		0 on success, -1 if the first file cannot be read, or
+			the error number of the second file.
+*/
+
+static int read_pair(const int fds[2], uint8_t buffers[2][DEDUP_BUFFER],
+	size_t size, uint64_t offset)
+{
+	if(read_full(fds[0], buffers[0], size, offset)) return -1;
+	return read_full(fds[1], buffers[1], size, offset);
+}
+
+/*
+	same_inode()
+
+	Tells if two files are the same file.
+*/
+
+static int same_inode(const struct Dedup_File *x, const struct Dedup_File *y)
+{
+	return x->device == y->device && x->inode == y->inode;
+}
+
+/*
+	compare_job()
+
+	Compares a file with the first one of its group, byte by byte: the
+	payloads, then the headers. Files that differ (hash collisions) or
+	cannot be compared leave the group.
+*/
+
+static void compare_job(struct Dedup *dedup, int index)
+{
+	// Using the file and the first one of its group.
+	struct Dedup_File *file = dedup->files + index, *first;
+	// Using their descriptors and read buffers.
+	uint8_t buffers[2][DEDUP_BUFFER];
+	int fds[2], error = 0;
+	uint64_t offset, size;
+
+	if(file->cluster < 0 || file->cluster == index) return;
+	first = dedup->files + file->cluster;
+
+	// Files sharing their inode are identical.
+	if(same_inode(file, first))
+	{
+		file->whole = file->same = 1;
+		return;
+	}
+
+	fds[0] = open(first->path, O_RDONLY | O_CLOEXEC);
+	fds[1] = open(file->path, O_RDONLY | O_CLOEXEC);
+	STATS_ADD(STATS_SYSCALLS, 2);
+	if(fds[1] < 0) error = errno;
+	else if(fds[0] < 0) error = -1;
+
+	for(offset = HEADER_SIZE; !error && offset < file->size; offset += size)
+	{
+		size = file->size - offset;
+		if(size > DEDUP_BUFFER) size = DEDUP_BUFFER;
+		error = read_pair(fds, buffers, size, offset);
+		if(!error && memcmp(buffers[0], buffers[1], size)) error = -1;
+	}
+
+	if(!error) error = read_pair(fds, buffers, HEADER_SIZE, 0);
+	if(!error) file->whole = !memcmp(buffers[0], buffers[1], HEADER_SIZE);
+
+	// Leaving the group.
+	if(error)
+	{
+		file->cluster = DEDUP_MISMATCH;
+		if(error > 0) file->error = error;
+	}
+
+	if(fds[0] >= 0) close(fds[0]);
+	if(fds[1] >= 0) close(fds[1]);
+	STATS_ADD(STATS_SYSCALLS, 2);
+}
+
+/*
+	run_job()
+
+	Pool job: runs the job of a stage on a file.
+
+	@arg	arg	Files, and the job.
+	@arg	index	Index of the file.
+*/
+
+static void run_job(void *arg, int index)
+{
+	struct Run *run = arg;
+
+	// Files that could not be read are left out.
+	if(run->dedup->files[index].error) return;
+
+	TRACE_BEGIN("dedup", "job", index);
+	run->job(run->dedup, index);
+	TRACE_END("dedup");
+}
+
+/*
+	run_threads()
+
+	Runs a job on every file, on worker threads, one per processor. The
+	calling thread is one of the workers.
+
+	@arg	dedup	Set of files.
+	@arg	job	Job to run.
+*/
+
+static void run_threads(struct Dedup *dedup,
+	void (*job)(struct Dedup *dedup, int index))
+{
+	struct Run run = { dedup, job };
+	pool_run(dedup->count, run_job, &run);
+}
+
+/*
+	compare_size()
+
+	Orders files by size then inode, for qsort(). Unreadable files come
+	last.
+*/
+
+static int compare_size(const void *a, const void *b)
+{
+	const struct Dedup_File *x = a, *y = b;
+
+	if(!x->error != !y->error) return x->error ? 1 : -1;
+	if(x->size != y->size) return x->size < y->size ? -1 : 1;
+	if(x->device != y->device) return x->device < y->device ? -1 : 1;
+	if(x->inode != y->inode) return x->inode < y->inode ? -1 : 1;
+	return strcmp(x->path, y->path);
+}
+
+/*
+	compare_hash()
+
+	Orders files by size, payload hash, then inode, for qsort(). Files
+	whose payload was not hashed, or could not be, come last.
+*/
+
+static int compare_hash(const void *a, const void *b)
+{
+	const struct Dedup_File *x = a, *y = b;
+	int i;
+
+	if((x->error || x->cluster == -1) != (y->error || y->cluster == -1))
+		return x->error || x->cluster == -1 ? 1 : -1;
+	if(x->size != y->size) return x->size < y->size ? -1 : 1;
+	for(i = 0; i < 2; i++) if(x->hash[i] != y->hash[i])
+		return x->hash[i] < y->hash[i] ? -1 : 1;
+	return compare_size(a, b);
+}
+
+/*
+	swap()
+
+	Exchanges two file records.
+*/
+
+static void swap(struct Dedup_File *x, struct Dedup_File *y)
+{
+	struct Dedup_File t = *x;
+	*x = *y;
+	*y = t;
+}
+
+/*
+	same_payload()
+
+	Tells if two files are in the same size and hash group.
+*/
+
+static int same_payload(const struct Dedup_File *x, const struct Dedup_File *y)
+{
+	return !x->error && !y->error && x->cluster != -1 && y->cluster != -1
+		&& x->size == y->size && x->hash[0] == y->hash[0]
+		&& x->hash[1] == y->hash[1];
+}
+
+
+
+/*
+	Function definitions.
+*/
+
+/*
+	dedup_init()
+
+	Creates the records of the files of a list.
+
+	@arg	dedup	Set of files to initialize.
+	@arg	list	File list, as collected by fsck_add(). The file names
+			are not copied: the list must be kept until
+			dedup_free().
+
+	@return		0 on success, 1 on alloc failure.
+*/
+
+int dedup_init(struct Dedup *dedup, const struct Fsck *list)
+{
+	int i;
+
+	dedup->count = list->count;
+	dedup->files = calloc(list->count + 1, sizeof *dedup->files);
+	if(!dedup->files) return 1;
+
+	for(i = 0; i < list->count; i++)
+	{
+		dedup->files[i].path = list->files[i].path;
+		dedup->files[i].error = list->files[i].error;
+		dedup->files[i].cluster = -1;
+	}
+
+	return 0;
+}
+
+/*
+	dedup_run()
+
+	Finds the clusters of files with identical payloads. Only the files of
+	a shared size are read, and each inode once when hashing.
+
+	@arg	dedup	Set of files. The files are sorted so that the files of
+			a cluster are contiguous, the first one first, and their
+			cluster, whole, same and error fields are set.
+*/
+
+void dedup_run(struct Dedup *dedup)
+{
+	// Using the file iterators.
+	struct Dedup_File *files = dedup->files;
+	int i, k, n, end;
+
+	STATS_ADD(STATS_JOBS_QUEUED, dedup->count);
+	run_threads(dedup, stat_job);
+	qsort(files, dedup->count, sizeof *files, compare_size);
+
+	// Hashing the files of a shared size. Files without a payload are
+	// not g1a files.
+	for(i = 0; i < dedup->count; i = k)
+	{
+		for(k = i + 1; k < dedup->count && !files[k].error
+			&& files[k].size == files[i].size; k++);
+		if(files[i].error || k - i < 2 || files[i].size <= HEADER_SIZE)
+			continue;
+
+		files[i].cluster = DEDUP_HASH;
+		for(i++; i < k; i++) files[i].cluster = files[i].device
+			== files[i - 1].device && files[i].inode
+			== files[i - 1].inode ? DEDUP_COPY : DEDUP_HASH;
+	}
+	run_threads(dedup, hash_job);
+
+	for(i = 0; i < dedup->count; i++) if(files[i].cluster == DEDUP_COPY)
+	{
+		memcpy(files[i].hash, files[i - 1].hash, sizeof files[i].hash);
+		files[i].error = files[i - 1].error;
+	}
+
+	// Grouping the files by hash, the first file of every group being
+	// the reference the others are compared with.
+	qsort(files, dedup->count, sizeof *files, compare_hash);
+	for(i = 0; i < dedup->count; i = k)
+	{
+		for(k = i + 1; k < dedup->count && same_payload(files + i,
+			files + k); k++);
+		for(n = i; n < k; n++) files[n].cluster = k - i > 1 ? i : -1;
+	}
+	run_threads(dedup, compare_job);
+	STATS_ADD(STATS_JOBS_DONE, dedup->count);
+
+	// Moving the files that left their group after the files that stayed
+	// (they may be duplicates of each other, but 128-bit hash collisions
+	// are not worth a second pass), and dropping the clusters that only
+	// their first file is left in.
+	for(i = 0; i < dedup->count; i = k)
+	{
+		for(k = i + 1; k < dedup->count && (files[k].cluster == i
+			|| files[k].cluster == DEDUP_MISMATCH); k++);
+		if(files[i].cluster != i) continue;
+
+		for(n = i + 1, end = k; n < end;)
+		{
+			if(files[n].cluster != DEDUP_MISMATCH) n++;
+			else swap(files + n, files + --end);
+		}
+		for(n = end; n < k; n++) files[n].cluster = -1;
+		if(end == i + 1)
+		{
+			files[i].cluster = -1;
+			continue;
+		}
+
+		// Files sharing their inode with any earlier file of the cluster
+		// take no space of their own: ordering the cluster by inode
+		// again (the first file stays first) puts them side by side.
+		qsort(files + i + 1, end - i - 1, sizeof *files, compare_size);
+		for(n = i + 1; n < end; n++) if(same_inode(files + n, files + i)
+			|| (n > i + 1 && same_inode(files + n, files + n - 1)))
+			files[n].same = 1;
+	}
+}
+
+/*
+	dedup_link()
+
+	Replaces a file whose whole contents are identical to the first file of
+	its cluster with a reflink or a hard link to it. The replacement is
+	atomic, and keeps the permissions of the file it replaces (except for
+	hard links, which share those of the first file).
+
+	@arg	dedup	Set of files.
+	@arg	index	Index of the file to replace.
+	@arg	mode	Consolidation mode.
+
+	@return		0 on success or if there is nothing to do, 1 on failure
+			(errno is set).
+*/
+
+int dedup_link(struct Dedup *dedup, int index, enum Dedup_Link mode)
+{
+	// Using the file, the first one of its cluster, and the output.
+	struct Dedup_File *file = dedup->files + index, *first;
+	struct Output output;
+	int fd, error = 1, hard = 0;
+
+	if(file->cluster < 0 || file->cluster == index || !file->whole
+		|| file->same || mode == DEDUP_NONE) return 0;
+	first = dedup->files + file->cluster;
+
+	fd = open(first->path, O_RDONLY | O_CLOEXEC);
+	STATS_ADD(STATS_SYSCALLS, 1);
+	if(fd < 0) return 1;
+	if(output_open(&output, file->path, 0))
+	{
+		close(fd);
+		return 1;
+	}
+
+	if(mode != DEDUP_HARD) error = output_clone(&output, fd);
+	if(error && mode != DEDUP_REFLINK)
+		hard = !(error = output_link(&output, first->path));
+	close(fd);
+	STATS_ADD(STATS_SYSCALLS, 1);
+
+	if(error)
+	{
+		error = errno;
+		output_abort(&output);
+		errno = error;
+		return 1;
+	}
+	if(output_commit(&output)) return 1;
+
+	file->same = hard;
+	return 0;
+}
+
+/*
+	dedup_free()
+
+	Frees the records.
+
+	@arg	dedup	Set of files.
+*/
+
+void dedup_free(struct Dedup *dedup)
+{
+	free(dedup->files);
+	dedup->files = NULL;
+	dedup->count = 0;
+}
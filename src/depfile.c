@@ -0,0 +1,144 @@
+/*
+	Dependency file module.
+*/
+
+
+
+/*
+	Header inclusions.
+*/
+
+// Standard headers.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Project headers.
+#include "depfile.h"
+#include "output.h"
+
+
+
+/*
+	Static variables definitions.
+*/
+
+// Recorded dependencies (the strings are not copied).
+static const char **dependencies = NULL;
+static int dependency_count = 0;
+
+
+
+/*
+	Static function definitions.
+*/
+
+/*
+	escape()
+
+	Appends a file name to a buffer, escaped for make: spaces and '#' are
+	preceded by a backslash, and '$' is doubled.
+
+	@arg	buffer	Output buffer, large enough for twice the name length.
+	@arg	name	File name.
+
+	@return		Pointer to the end of the escaped name.
+*/
+
+static char *escape(char *buffer, const char *name)
+{
+	for(; *name; name++)
+	{
+		if(*name == ' ' || *name == '#') *buffer++ = '\\';
+		else if(*name == '$') *buffer++ = '$';
+		*buffer++ = *name;
+	}
+
+	return buffer;
+}
+
+
+
+/*
+	Function definitions.
+*/
+
+/*
+	depfile_add()
+
+	Records a file that the output depends on. Duplicates are ignored.
+
+	@arg	file	File name; must remain valid until depfile_write().
+*/
+
+void depfile_add(const char *file)
+{
+	// Using a temporary pointer and an iterator.
+	const char **tmp;
+	int i;
+
+	for(i = 0; i < dependency_count; i++)
+		if(!strcmp(dependencies[i], file)) return;
+
+	tmp = realloc(dependencies, (dependency_count + 1) * sizeof *tmp);
+	if(!tmp) return;
+	dependencies = tmp;
+	dependencies[dependency_count++] = file;
+}
+
+/*
+	depfile_write()
+
+	Writes a rule listing the recorded dependencies of a target, atomically
+	replacing the dependency file.
+
+	@arg	depfile	Dependency file name.
+	@arg	target	Target (output file) name.
+
+	@return		0 on success, 1 on failure (errno is set).
+*/
+
+int depfile_write(const char *depfile, const char *target)
+{
+	// Using the rule text, its size and a cursor.
+	char *rule, *ptr;
+	size_t size = 2 * strlen(target) + 4;
+	struct Output output;
+	int i, ret;
+
+	// Computing an upper bound of the rule size.
+	for(i = 0; i < dependency_count; i++)
+		size += 2 * strlen(dependencies[i]) + 4;
+
+	rule = malloc(size);
+	if(!rule) return 1;
+
+	// Writing "target: dep1 \<newline> dep2..." as gcc does.
+	ptr = escape(rule, target);
+	*ptr++ = ':';
+	for(i = 0; i < dependency_count; i++)
+	{
+		if(i) ptr += sprintf(ptr, " \\\n");
+		*ptr++ = ' ';
+		ptr = escape(ptr, dependencies[i]);
+	}
+	*ptr++ = '\n';
+
+	// Replacing the dependency file atomically, as build tools may read
+	// it concurrently.
+	if(output_open(&output, depfile, ptr - rule))
+	{
+		free(rule);
+		return 1;
+	}
+	if(output_append(&output, rule, ptr - rule))
+	{
+		output_abort(&output);
+		free(rule);
+		return 1;
+	}
+	ret = output_commit(&output);
+
+	free(rule);
+	return ret;
+}
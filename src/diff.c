@@ -0,0 +1,198 @@
+/*
+	Diff module.
+*/
+
+
+
+/*
+	Header inclusions.
+*/
+
+// Standard headers.
+#include <stdio.h>
+#include <string.h>
+
+// Project headers.
+#include "diff.h"
+#include "header.h"
+
+
+
+/*
+	Constants definitions.
+*/
+
+// Size of the chunks compared at once. Identical chunks are skipped with a
+// single memcmp(), which the C library vectorizes.
+#define DIFF_CHUNK	0x1000
+
+
+
+/*
+	Static function definitions.
+*/
+
+/*
+	field_value()
+
+	Displays the value of a header field on a single line, prefixed with a
+	'-' or '+' sign.
+
+	@arg	sign	Sign character.
+	@arg	data	Decoded header.
+	@arg	field	Field to display.
+*/
+
+static void field_value(char sign, const uint8_t *data,
+	const struct Header_Field *field)
+{
+	// Using a buffer for text fields, and an iterator.
+	char text[16];
+	unsigned int i;
+
+	printf("\t\t%c ", sign);
+
+	// Displaying text as text and sizes as numbers.
+	if(field->type == FIELD_STRING)
+		printf("'%s'\n", header_string(data, field, text));
+	else if(field->type == FIELD_SIZE)
+		printf("%u bytes\n", header_size(data, field));
+	// Large fields are not worth displaying.
+	else if(field->size > 16) puts("(different content)");
+	else
+	{
+		for(i = 0; i < field->size; i++)
+			printf("%s%02x", i ? " " : "", data[field->offset + i]);
+		putchar('\n');
+	}
+}
+
+/*
+	range()
+
+	Displays a range of differing bytes, after the table header if it is
+	the first one.
+
+	@arg	count	Number of ranges displayed so far, incremented.
+	@arg	start	Offset of the first differing byte.
+	@arg	end	Offset after the last differing byte.
+*/
+
+static void range(int *count, size_t start, size_t end)
+{
+	if(!(*count)++) puts("Payload differences :\n\nStart\t\tEnd\t\tSize");
+	printf("0x%06zX\t0x%06zX\t%zu\n", start, end, end - start);
+}
+
+
+
+/*
+	Function definitions.
+*/
+
+/*
+	diff_header()
+
+	Compares two decoded headers field by field, and displays the fields
+	that differ using the --info layout, with both values.
+
+	@arg	a	First header.
+	@arg	b	Second header.
+
+	@return		Number of differing fields.
+*/
+
+int diff_header(const uint8_t *a, const uint8_t *b)
+{
+	// Using a field iterator and a difference counter.
+	const struct Header_Field *field;
+	int count = 0;
+
+	for(field = header_fields; field->size; field++)
+	{
+		if(!memcmp(a + field->offset, b + field->offset, field->size))
+			continue;
+
+		// Displaying the table header before the first difference.
+		if(!count++) puts("Header differences :\n\nOffset\tSize\t"
+			"Description");
+		printf("0x%03X\t%d\t%s\n", field->offset, field->size,
+			field->description);
+		field_value('-', a, field);
+		field_value('+', b, field);
+	}
+
+	if(count) putchar('\n');
+	return count;
+}
+
+/*
+	diff_payload()
+
+	Compares two binary contents and displays the ranges of bytes that
+	differ. Identical chunks are skipped as a whole; only differing chunks
+	are scanned, one machine word at a time where possible. If the sizes
+	differ, the extra bytes form a last range.
+
+	@arg	a	First content.
+	@arg	a_size	Size of the first content.
+	@arg	b	Second content.
+	@arg	b_size	Size of the second content.
+
+	@return		Number of differing ranges.
+*/
+
+int diff_payload(const uint8_t *a, size_t a_size, const uint8_t *b,
+	size_t b_size)
+{
+	// Using the common size, the current chunk, the start of the current
+	// range and a byte offset.
+	size_t size = a_size < b_size ? a_size : b_size;
+	size_t chunk, end, start = 0, i;
+	// Using a range indicator and counter, and words to compare.
+	int open = 0, count = 0;
+	uint64_t x, y;
+
+	for(chunk = 0; chunk < size; chunk += DIFF_CHUNK)
+	{
+		end = chunk + DIFF_CHUNK < size ? chunk + DIFF_CHUNK : size;
+
+		// Skipping identical chunks, and closing the current range.
+		if(!memcmp(a + chunk, b + chunk, end - chunk))
+		{
+			if(open) range(&count, start, chunk);
+			open = 0;
+			continue;
+		}
+
+		for(i = chunk; i < end; i++)
+		{
+			// Skipping identical words outside of ranges.
+			if(!open && i + 8 <= end)
+			{
+				memcpy(&x, a + i, 8);
+				memcpy(&y, b + i, 8);
+				if(x == y)
+				{
+					i += 7;
+					continue;
+				}
+			}
+
+			// Opening and closing ranges.
+			if(a[i] != b[i] && !open) start = i, open = 1;
+			else if(a[i] == b[i] && open)
+			{
+				range(&count, start, i);
+				open = 0;
+			}
+		}
+	}
+
+	// Closing the last range, extended by the extra bytes if any.
+	if(a_size != b_size && !open) start = size, open = 1;
+	if(open) range(&count, start, a_size > b_size ? a_size : b_size);
+
+	if(count) putchar('\n');
+	return count;
+}
@@ -33,6 +33,9 @@ struct Error
 	const char *name;
 	const char *format;
 
+	// Number of times the error was emitted, even masked.
+	unsigned long count;
+
 	// Linked list pointer.
 	struct Error *next;
 };
@@ -61,7 +64,7 @@ static int *failure;
 /*
 	error_init()
 
-	Initializes the error module.
+	Initializes the error module. The error list is released on exit.
 
 	@arg	program_name		Program name, shown before error.
 	@arg	default_exit_code	Exit code on fatal error.
@@ -71,10 +74,16 @@ static int *failure;
 void error_init(const char *program_name, int default_exit_code,
 	int *failure_indicator)
 {
+	// Using an indicator of the exit handler registration.
+	static int registered = 0;
+
 	// Initializing static values.
 	prefix = program_name;
 	exit_code = default_exit_code;
 	failure = failure_indicator;
+
+	// Releasing the error list on exit, fatal errors included.
+	if(!registered) registered = !atexit(error_free);
 }
 
 /*
@@ -98,6 +107,9 @@ void error_add(enum Error_Level level, const char *name, const char *format)
 	struct Error *error = malloc(sizeof(struct Error));
 	struct Error *parser = error_first;
 
+	// Giving up on alloc failure: the error will not be displayed.
+	if(!error) return;
+
 	// If no error has been added already, setting error_first.
 	if(!error_first) error_first = error;
 	// Else, adding it at the end of the linked list.
@@ -131,10 +143,30 @@ void error_add(enum Error_Level level, const char *name, const char *format)
 
 	// Activating the error by default.
 	error->activated = 1;
+	error->count = 0;
 	// Linking a NULL pointer at list end.
 	error->next = NULL;
 }
 
+/*
+	error_free()
+
+	Releases the error list. No error can be emitted afterwards.
+*/
+
+void error_free(void)
+{
+	// Using a list parser.
+	struct Error *next;
+
+	while(error_first)
+	{
+		next = error_first->next;
+		free(error_first);
+		error_first = next;
+	}
+}
+
 /*
 	error_argument()
 
@@ -215,6 +247,8 @@ void error_emit(enum Error_Level level, const char *name, ...)
 	struct Error *parser = error_first;
 	// Using an argument list.
 	va_list args;
+	// Using an indicator of the error being counted.
+	int counted = 0;
 
 	// Starting the va_list to get the arguments for the format.
 	va_start(args, name);
@@ -224,6 +258,15 @@ void error_emit(enum Error_Level level, const char *name, ...)
 	// same name.
 	while(parser)
 	{
+		// Counting the error once, even if it has several messages or
+		// is masked.
+		if(!counted && parser->level == level && !strcmp(parser->name,
+			name))
+		{
+			__atomic_fetch_add(&parser->count, 1, __ATOMIC_RELAXED);
+			counted = 1;
+		}
+
 		// Testing if current one matches the given level and name.
 		if(parser->level == level && !strcmp(parser->name, name)
 			&& parser->activated)
@@ -255,3 +298,32 @@ void error_emit(enum Error_Level level, const char *name, ...)
 	// Ending the argument list.
 	va_end(args);
 }
+
+/*
+	error_counts()
+
+	Calls a function for every registered error, with the number of times
+	it was emitted. Errors with several messages are listed once.
+
+	@arg	callback	Function to call.
+	@arg	data		Argument given to the function.
+*/
+
+void error_counts(void (*callback)(enum Error_Level level, const char *name,
+	unsigned long count, void *data), void *data)
+{
+	// Using linked list parsers.
+	struct Error *parser, *first;
+
+	for(parser = error_first; parser; parser = parser->next)
+	{
+		// Skipping the errors already listed.
+		for(first = error_first; first != parser; first = first->next)
+			if(first->level == parser->level && !strcmp(first->name,
+			parser->name)) break;
+		if(first != parser) continue;
+
+		callback(parser->level, parser->name, __atomic_load_n(&parser
+			->count, __ATOMIC_RELAXED), data);
+	}
+}
@@ -0,0 +1,145 @@
+/*
+	Extraction module.
+*/
+
+
+
+/*
+	Header inclusions.
+*/
+
+// Standard headers.
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Project headers.
+#include "extract.h"
+#include "header.h"
+#include "output.h"
+#include "stats.h"
+
+
+
+/*
+	Function definitions.
+*/
+
+/*
+	extract()
+
+	Checks the header of a g1a file as dump() does, and copies its binary
+	content to the output file. The content never goes through user space
+	unless the kernel cannot copy it (see output_copy()).
+
+	@arg	input	g1a file name.
+	@arg	output	Output file name.
+	@arg	defect	Set to the header defect if the file is not a valid g1a
+			file, NULL otherwise.
+
+	@return		0 on success, 1 on failure (errno is set).
+*/
+
+int extract(const char *input, const char *output, const char **defect)
+{
+	// Using raw and decoded header data.
+	uint8_t raw[HEADER_SIZE], data[HEADER_SIZE];
+	// Using the input file descriptor and status, and the output file.
+	struct Output out;
+	struct stat st;
+	ssize_t x;
+	int fd;
+
+	*defect = NULL;
+	fd = open(input, O_RDONLY | O_CLOEXEC);
+	STATS_ADD(STATS_SYSCALLS, 1);
+	if(fd < 0) return 1;
+	STATS_ADD(STATS_SYSCALLS, 3);
+	if(fstat(fd, &st)) goto fail;
+
+	// Reading the header, which short files do not have.
+	memset(raw, 0, HEADER_SIZE);
+	do x = pread(fd, raw, HEADER_SIZE, 0);
+	while(x < 0 && errno == EINTR);
+	if(x < 0) goto fail;
+	STATS_ADD(STATS_READ_CALLS, 1);
+	STATS_ADD(STATS_BYTES_READ, x);
+
+	// Checking it against the file size.
+	header_decode(raw, data);
+	*defect = header_check(data, st.st_size);
+	if(*defect)
+	{
+		close(fd);
+		errno = EINVAL;
+		return 1;
+	}
+
+	// Copying everything after the header.
+	if(output_open(&out, output, st.st_size - HEADER_SIZE)) goto fail;
+	if(output_copy(&out, fd, HEADER_SIZE, st.st_size - HEADER_SIZE))
+	{
+		output_abort(&out);
+		goto fail;
+	}
+	if(output_commit(&out)) goto fail;
+
+	close(fd);
+	return 0;
+
+fail:
+	x = errno;
+	close(fd);
+	errno = x;
+	return 1;
+}
+
+/*
+	extract_member()
+
+	Extracts the binary content of a g1a file stored in an archive, after
+	checking its header. Stored members are copied in the kernel, deflated
+	ones are inflated as a stream.
+
+	@arg	archive	Archive.
+	@arg	member	Archive member.
+	@arg	output	Output file name.
+	@arg	defect	Set to the header defect if the member is not a valid
+			g1a file, NULL otherwise.
+
+	@return		0 on success, 1 on failure (errno is set).
+*/
+
+int extract_member(struct Archive *archive, struct Archive_Member *member,
+	const char *output, const char **defect)
+{
+	// Using raw and decoded header data, and the output file.
+	uint8_t raw[HEADER_SIZE], data[HEADER_SIZE];
+	struct Output out;
+
+	// Reading the header, which short members do not have.
+	*defect = NULL;
+	memset(raw, 0, HEADER_SIZE);
+	if(archive_read(archive, member, raw, HEADER_SIZE) < 0) return 1;
+
+	header_decode(raw, data);
+	*defect = header_check(data, member->size);
+	if(*defect)
+	{
+		errno = EINVAL;
+		return 1;
+	}
+
+	// Copying everything after the header.
+	if(output_open(&out, output, member->size - HEADER_SIZE)) return 1;
+	if(archive_copy(archive, member, &out, HEADER_SIZE))
+	{
+		output_abort(&out);
+		return 1;
+	}
+	return output_commit(&out);
+}
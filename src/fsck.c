@@ -0,0 +1,403 @@
+/*
+	Fsck module.
+*/
+
+
+
+/*
+	Header inclusions.
+*/
+
+// Feature macros, for statx().
+#define _GNU_SOURCE
+
+// Standard headers.
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Project headers.
+#include "fsck.h"
+#include "header.h"
+#include "pool.h"
+#include "stats.h"
+#include "trace.h"
+
+
+
+/*
+	Composed types definitions.
+
+	These types are used only in this file.
+*/
+
+// Files checked on worker threads.
+struct Run
+{
+	struct Fsck_File *files;
+	// Are the defective headers repaired ?
+	int repair;
+};
+
+
+
+/*
+	Static function definitions.
+*/
+
+/*
+	append()
+
+	Adds a file to the list.
+
+	@arg	fsck	File list.
+	@arg	path	Allocated file name, owned by the list from now on.
+	@arg	error	Error number if the file cannot be read, 0 otherwise.
+
+	@return		0 on success, 1 on alloc failure (the name is freed).
+*/
+
+static int append(struct Fsck *fsck, char *path, int error)
+{
+	// Using the new file entry.
+	struct Fsck_File *file;
+
+	if(fsck->count == fsck->capacity)
+	{
+		int capacity = fsck->capacity ? fsck->capacity * 2 : 64;
+		file = realloc(fsck->files, capacity * sizeof *file);
+		if(!file)
+		{
+			free(path);
+			errno = ENOMEM;
+			return 1;
+		}
+		fsck->files = file;
+		fsck->capacity = capacity;
+	}
+
+	file = fsck->files + fsck->count++;
+	memset(file, 0, sizeof *file);
+	file->path = path;
+	file->error = error;
+	return 0;
+}
+
+/*
+	join()
+
+	Builds an allocated path from a directory and a name.
+
+	@arg	directory	Directory path.
+	@arg	name		Entry name.
+
+	@return		Allocated path, or NULL on alloc failure.
+*/
+
+static char *join(const char *directory, const char *name)
+{
+	size_t length = strlen(directory);
+	char *path = malloc(length + strlen(name) + 2);
+
+	if(!path) return NULL;
+	memcpy(path, directory, length);
+	if(length && directory[length - 1] != '/') path[length++] = '/';
+	strcpy(path + length, name);
+	return path;
+}
+
+/*
+	walk()
+
+	Adds the g1a files of a directory and of its subdirectories, whose
+	types are taken from the directory entries when possible. Symbolic
+	links are not followed. Subdirectories that cannot be opened are added
+	as unreadable files.
+
+	@arg	fsck	File list.
+	@arg	fd	Directory file descriptor, which is closed.
+	@arg	path	Directory path.
+
+	@return		0 on success, 1 on alloc failure.
+*/
+
+static int walk(struct Fsck *fsck, int fd, const char *path)
+{
+	// Using the directory stream, the current entry and its type.
+	DIR *dir = fdopendir(fd);
+	struct dirent *entry;
+	struct stat st;
+	int type, sub, error = 0;
+	// Using the path of the entry and the length of its name.
+	char *child;
+	size_t length;
+
+	STATS_ADD(STATS_SYSCALLS, 1);
+	if(!dir)
+	{
+		error = errno;
+		close(fd);
+		child = strdup(path);
+		if(child) return append(fsck, child, error);
+		errno = ENOMEM;
+		return 1;
+	}
+
+	while(!error && (entry = readdir(dir)))
+	{
+		if(!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+			continue;
+
+		// Some file systems do not store the entry types.
+		type = entry->d_type;
+		if(type == DT_UNKNOWN && !fstatat(dirfd(dir), entry->d_name,
+			&st, AT_SYMLINK_NOFOLLOW))
+			type = S_ISDIR(st.st_mode) ? DT_DIR :
+			S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+
+		length = strlen(entry->d_name);
+		if(type == DT_REG && (length < 4 || strcmp(entry->d_name
+			+ length - 4, ".g1a"))) continue;
+		if(type != DT_REG && type != DT_DIR) continue;
+
+		child = join(path, entry->d_name);
+		if(!child)
+		{
+			errno = ENOMEM;
+			error = 1;
+			break;
+		}
+
+		if(type == DT_REG)
+		{
+			error = append(fsck, child, 0);
+			continue;
+		}
+
+		sub = openat(dirfd(dir), entry->d_name, O_RDONLY | O_DIRECTORY
+			| O_NOFOLLOW | O_CLOEXEC);
+		STATS_ADD(STATS_SYSCALLS, 1);
+		if(sub < 0)
+		{
+			error = append(fsck, child, errno);
+			continue;
+		}
+
+		error = walk(fsck, sub, child);
+		free(child);
+	}
+
+	closedir(dir);
+	return error;
+}
+
+/*
+	compare()
+
+	Orders files by name, for qsort().
+*/
+
+static int compare(const void *a, const void *b)
+{
+	const struct Fsck_File *x = a, *y = b;
+	return strcmp(x->path, y->path);
+}
+
+/*
+	check()
+
+	Reads the header and size of a file, classifies its defects, and
+	repairs them if requested and possible by rewriting the whole header.
+
+	@arg	file	File to check; its size, defects, repaired and error
+			fields are set.
+	@arg	repair	Non-zero to repair the header.
+*/
+
+static void check(struct Fsck_File *file, int repair)
+{
+	// Using the header as read and as repaired.
+	uint8_t raw[HEADER_SIZE], fixed[HEADER_SIZE];
+	// Using the file descriptor, its status, and the reason why it cannot
+	// be written, if any.
+	struct statx stx;
+	int fd = -1, denied = 0;
+	ssize_t x;
+
+	// Opening read-only files too, which can at least be checked.
+	if(repair)
+	{
+		fd = open(file->path, O_RDWR | O_CLOEXEC);
+		STATS_ADD(STATS_SYSCALLS, 1);
+		if(fd < 0) denied = errno;
+	}
+	if(fd < 0) fd = open(file->path, O_RDONLY | O_CLOEXEC);
+	STATS_ADD(STATS_SYSCALLS, 1);
+	if(fd < 0)
+	{
+		file->error = errno;
+		return;
+	}
+
+	if(statx(fd, "", AT_EMPTY_PATH, STATX_SIZE, &stx))
+	{
+		file->error = errno;
+		close(fd);
+		return;
+	}
+	file->size = stx.stx_size;
+
+	// Short files are reported as such by header_audit().
+	memset(raw, 0, HEADER_SIZE);
+	do x = pread(fd, raw, HEADER_SIZE, 0);
+	while(x < 0 && errno == EINTR);
+	STATS_ADD(STATS_SYSCALLS, 3);
+	STATS_ADD(STATS_READ_CALLS, 1);
+	STATS_ADD(STATS_BYTES_READ, x > 0 ? x : 0);
+	if(x < 0)
+	{
+		file->error = errno;
+		close(fd);
+		return;
+	}
+
+	file->defects = header_audit(raw, file->size, fixed);
+	if(!repair || !file->defects || file->defects & ~HEADER_REPAIRABLE)
+	{
+		close(fd);
+		return;
+	}
+
+	// Rewriting the header, unless the file cannot be written.
+	if(denied) file->error = denied;
+	else
+	{
+		do x = pwrite(fd, fixed, HEADER_SIZE, 0);
+		while(x < 0 && errno == EINTR);
+		STATS_ADD(STATS_SYSCALLS, 1);
+		STATS_ADD(STATS_WRITE_CALLS, 1);
+		STATS_ADD(STATS_BYTES_WRITTEN, x > 0 ? x : 0);
+
+		if(x == HEADER_SIZE) file->repaired = 1;
+		else file->error = x < 0 ? errno : EIO;
+	}
+
+	if(close(fd) && file->repaired)
+	{
+		file->error = errno;
+		file->repaired = 0;
+	}
+}
+
+/*
+	check_job()
+
+	Pool job: checks a file of the list.
+
+	@arg	arg	Files, and the repair flag.
+	@arg	index	Index of the file.
+*/
+
+static void check_job(void *arg, int index)
+{
+	struct Run *run = arg;
+
+	// Unreadable directories have nothing to check.
+	if(run->files[index].error) return;
+
+	TRACE_BEGIN("fsck", "job", index);
+	check(run->files + index, run->repair);
+	TRACE_END("fsck");
+	STATS_ADD(STATS_JOBS_DONE, 1);
+}
+
+
+
+/*
+	Function definitions.
+*/
+
+/*
+	fsck_add()
+
+	Adds a file to check, or all the files with extension '.g1a' in a
+	directory tree. Files given by name are checked whatever their name.
+	The files of a directory are sorted by name.
+
+	@arg	fsck	File list, which must be zeroed before the first call.
+	@arg	path	File or directory name.
+
+	@return		0 on success, 1 if the path cannot be read or on alloc
+			failure (errno is set).
+*/
+
+int fsck_add(struct Fsck *fsck, const char *path)
+{
+	// Using the path status, the directory descriptor and the index of
+	// its first file.
+	struct stat st;
+	int fd, first = fsck->count;
+
+	if(stat(path, &st)) return 1;
+	STATS_ADD(STATS_SYSCALLS, 1);
+
+	if(!S_ISDIR(st.st_mode))
+	{
+		char *copy = strdup(path);
+		if(!copy)
+		{
+			errno = ENOMEM;
+			return 1;
+		}
+		return append(fsck, copy, 0);
+	}
+
+	fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	STATS_ADD(STATS_SYSCALLS, 1);
+	if(fd < 0 || walk(fsck, fd, path)) return 1;
+
+	qsort(fsck->files + first, fsck->count - first, sizeof *fsck->files,
+		compare);
+	return 0;
+}
+
+/*
+	fsck_run()
+
+	Checks all the files on worker threads, one per processor. The calling
+	thread is one of the workers.
+
+	@arg	fsck	File list, whose entries are filled.
+	@arg	repair	Non-zero to repair the headers whose defects are all
+			repairable.
+*/
+
+void fsck_run(struct Fsck *fsck, int repair)
+{
+	struct Run run = { fsck->files, repair };
+
+	STATS_ADD(STATS_JOBS_QUEUED, fsck->count);
+	pool_run(fsck->count, check_job, &run);
+}
+
+/*
+	fsck_free()
+
+	Frees the file list.
+
+	@arg	fsck	File list.
+*/
+
+void fsck_free(struct Fsck *fsck)
+{
+	int i;
+
+	for(i = 0; i < fsck->count; i++) free(fsck->files[i].path);
+	free(fsck->files);
+	fsck->files = NULL;
+	fsck->count = fsck->capacity = 0;
+}
@@ -14,6 +14,21 @@
 #include "g1a-wrapper.h"
 #include "error.h"
 #include "bmp_utils.h"
+#include "bundle.h"
+#include "cache.h"
+#include "depfile.h"
+#include "diff.h"
+#include "extract.h"
+#include "fsck.h"
+#include "header.h"
+#include "metrics.h"
+#include "output.h"
+#include "pack.h"
+#include "payload.h"
+#include "scan.h"
+#include "stats.h"
+#include "trace.h"
+#include "watch.h"
 
 /*
 	main()
@@ -38,10 +53,23 @@ int main(int argc, char **argv)
 	const char *fatals[] = {
 		// No binary input file provided.
 		"no-input", "no input file",
+		// No cache directory provided.
+		"no-cache", "no cache directory (use --cache=<dir>)",
+		// No output file for an inherited input descriptor.
+		"no-output", "no output file (use -o or --output-fd)",
 		// Input file cannot be read.
 		"input", "cannot open input file '%s' for reading",
+		// Input ELF file cannot be converted.
+		"elf", "cannot use ELF file '%s' (%s)",
 		// Output file cannot be written.
 		"output", "cannot open output file '%s' for writing",
+		// Writing to the output file failed.
+		"output-write", "cannot write output file '%s' (%s)",
+		// SOURCE_DATE_EPOCH is not a valid timestamp.
+		"epoch", "invalid SOURCE_DATE_EPOCH value '%s'",
+		// Reproducible mode needs a fixed build date.
+		"no-date", "no build date in reproducible mode (use --date or "
+			"SOURCE_DATE_EPOCH)",
 		// NULL terminator.
 		NULL
 	};
@@ -60,6 +88,71 @@ int main(int argc, char **argv)
 		"bmp-valid", "file '%s' is not a valid bmp file",
 		// Bitmap format is not supported.
 		"bmp-depth", "bitmap image '%s' has unsupported depth %d",
+		// A sprite sheet cell does not exist.
+		"bmp-cell", "cell %u,%u is outside of sprite sheet '%s' (%u*%u "
+			"cells)",
+		// Dependency file cannot be written.
+		"depfile", "cannot write dependency file '%s' (%s)",
+		// A batch job failed.
+		"batch", "cannot wrap '%s' into '%s' (%s)",
+		"batch-read", "cannot read '%s' (%s)",
+		"elf", "cannot use ELF file '%s' (%s)",
+		// An option cannot be used in batch mode.
+		"batch-option", "%s cannot be used with --batch",
+		// The batch manifest cannot be read.
+		"manifest", "cannot read manifest file '%s' (%s)",
+		// The bundle cannot be written.
+		"bundle", "cannot write bundle '%s' (%s)",
+		// An option cannot be used with a bundle.
+		"bundle-option", "%s cannot be used with --bundle",
+		// Several inputs would give bundle entries of the same name.
+		"bundle-name", "several entries of bundle '%s' would be named "
+			"'%s'",
+		// An option cannot be used with file descriptors.
+		"fd-option", "%s cannot be used with --input-fd or --output-fd",
+		// Invalid file descriptor number.
+		"fd", "invalid file descriptor '%s'",
+		// --diff was not given two files.
+		"diff-count", "--diff needs two files, %d given",
+		// A variant setting is invalid.
+		"variant", "invalid variant setting '%s'",
+		"variant-output", "a variant has no output file (out=)",
+		// An option cannot be used with variants.
+		"variant-option", "%s cannot be used with --variant",
+		// An option cannot be used in watch mode.
+		"watch-option", "--watch can only be used to wrap a file",
+		// Input files cannot be watched.
+		"watch", "cannot watch input files (%s)",
+		// An output could not be rebuilt in watch mode.
+		"watch-input", "cannot read input file '%s' (%s)",
+		"watch-output", "cannot update output file '%s' (%s)",
+		// Binary content could not be extracted.
+		"extract", "cannot extract '%s' to '%s' (%s)",
+		// A file or archive member cannot be read.
+		"read", "cannot read '%s' (%s)",
+		// A defective header cannot be repaired.
+		"repair", "cannot repair '%s' (%s)",
+		// The patterns file cannot be used.
+		"scan-patterns", "cannot read patterns file '%s' (%s)",
+		"scan-syntax", "invalid pattern at line %d of '%s'",
+		"scan-empty", "no pattern in '%s'",
+		// A duplicate file cannot be replaced with a link.
+		"link", "cannot link '%s' to '%s' (%s)",
+		// A pack cannot be written, or a packed file restored.
+		"pack", "cannot write pack '%s' (%s)",
+		"unpack", "cannot unpack '%s' to '%s' (%s)",
+		// Output files could not be synced to disk.
+		"sync", "cannot sync output files to disk (%s)",
+		// Cache directory cannot be used.
+		"cache-open", "cannot open cache directory '%s' (%s)",
+		// Invalid cache size limit.
+		"cache-size", "invalid cache size '%s'",
+		// Statistics report file cannot be written.
+		"stats-output", "cannot open statistics file '%s' for writing",
+		// Metrics file cannot be written.
+		"metrics-output", "cannot write metrics file '%s' (%s)",
+		// Trace file cannot be written.
+		"trace-output", "cannot write trace file '%s' (%s)",
 		// The given file to dump is not a valid g1a file.
 		"g1a-valid", "file '%s' is not a valid g1a file (%s)",
 		// NULL terminator.
@@ -78,6 +171,10 @@ int main(int argc, char **argv)
 		"~bmp-height", "bitmap image '%s' has height %d, expected %d",
 		// The given bitmap is not made only of black and white pixels.
 		"~bmp-color", "bitmap image '%s' is not black and white",
+		// io_uring was requested but cannot be used.
+		"~uring", "io_uring is not available, using threads",
+		// The cache could not be read or updated.
+		"~cache", "cache not used for '%s' (%s)",
 		// 16-bit bitmaps are not fully supported.
 		"bmp-16-bit", "16-bit bitmap '%s' is not fully supported",
 		// NULL terminator.
@@ -87,14 +184,20 @@ int main(int argc, char **argv)
 	const char *notes[] = {
 		// Default value used.
 		"~default", "No %s provided, falling back to '%s'",
+		// The output has been rebuilt in watch mode.
+		"~rebuild", "Rebuilt '%s' (%s) in %.2fms",
 		// NULL terminator.
 		NULL
 	};
 
-	// Using memory for a header.
-	unsigned char header[0x200];
-	// Using an options structure.
-	struct Options options;
+	// Using the input binary content, and its size once closed.
+	struct Payload payload;
+	uint32_t size;
+	// Using an options structure, and the options of every variant.
+	struct Options options, *variants = NULL;
+	// Using an arena for the transient memory of every job (static, so that
+	// it remains reachable on every return path).
+	static struct Arena arena;
 	// Using a failure indicator.
 	int failure = 0;
 	// Using an iterator.
@@ -110,33 +213,226 @@ int main(int argc, char **argv)
 		error_add(WARNING, warnings[i], warnings[i+1]);
 	for(i = 0; notes[i]; i+=2) error_add(NOTE, notes[i], notes[i+1]);
 
+	// Enabling statistics and metrics first, so that argument parsing is
+	// timed too.
+	for(i = 1; i < argc; i++)
+	{
+		if(!strcmp(argv[i], "--stats")) stats_init(NULL);
+		else if(!strncmp(argv[i], "--stats=", 8))
+			stats_init(argv[i] + 8);
+		else if(!strncmp(argv[i], "--metrics=", 10))
+			metrics_init(argv[i] + 10);
+		else if(!strcmp(argv[i], "--trace") && i + 1 < argc)
+			trace_init(argv[++i]);
+	}
+
 	// Parsing command-line arguments.
+	arena_init(&arena);
+	options.arena = &arena;
+	STATS_BEGIN(STATS_ARGS);
 	args(argc, argv, &options);
+	STATS_END(STATS_ARGS);
 
 	// If an error occurred, returning from the program.
 	if(failure) return 1;
 
+	// Displaying cache statistics if requested.
+	if(options.cache_stats)
+	{
+		cache_stats(options.cache, options.cache_limit);
+		return failure;
+	}
+
+	// Wrapping or dumping all the input files in batch mode, then
+	// returning.
+	if(options.batch)
+	{
+		STATS_BEGIN(STATS_BATCH);
+		batch(&options);
+		STATS_END(STATS_BATCH);
+
+		if(output_sync()) error_emit(ERROR, "sync", strerror(errno));
+		free(options.inputs);
+		free(options.icons);
+		free(options.manifest_data);
+		stats_report();
+		return failure;
+	}
+
 	// Dumping input file if the dump option has been activated. Then,
 	// returning the program.
 	if(options.dump)
 	{
 		// Dumping the file.
+		STATS_BEGIN(STATS_DUMP);
 		dump(options.input);
-		// Returning the program.
+		STATS_END(STATS_DUMP);
+		// Reporting statistics and returning the program.
+		free(options.inputs);
+		stats_report();
 		return 0;
 	}
 
-	// Generating the header according to the command-line parameters.
-	generate(options, header);
+	// Comparing two files if requested, then returning 1 if they differ,
+	// as diff does.
+	if(options.diff)
+	{
+		STATS_BEGIN(STATS_DIFF);
+		i = diff(options.inputs[0], options.inputs[1]);
+		STATS_END(STATS_DIFF);
+
+		free(options.inputs);
+		stats_report();
+		return failure ? 2 : i != 0;
+	}
+
+	// Extracting binary content if requested, then returning.
+	if(options.extract)
+	{
+		STATS_BEGIN(STATS_EXTRACT);
+		unwrap(&options);
+		STATS_END(STATS_EXTRACT);
+
+		if(output_sync()) error_emit(ERROR, "sync", strerror(errno));
+		free(options.inputs);
+		stats_report();
+		return failure;
+	}
+
+	// Listing g1a files if requested, then returning.
+	if(options.index)
+	{
+		STATS_BEGIN(STATS_INDEX);
+		catalog(&options);
+		STATS_END(STATS_INDEX);
+
+		free(options.inputs);
+		stats_report();
+		return failure;
+	}
+
+	// Checking the headers of g1a files if requested, then returning 1 if
+	// defects remain.
+	if(options.fsck)
+	{
+		STATS_BEGIN(STATS_FSCK);
+		i = fsck(&options);
+		STATS_END(STATS_FSCK);
+
+		free(options.inputs);
+		stats_report();
+		return failure || i;
+	}
+
+	// Scanning g1a files if requested, then returning 1 if nothing was
+	// found, as grep does.
+	if(options.scan)
+	{
+		STATS_BEGIN(STATS_SCAN);
+		i = scan(&options);
+		STATS_END(STATS_SCAN);
+
+		free(options.inputs);
+		stats_report();
+		return failure ? 2 : !i;
+	}
+
+	// Finding duplicate payloads if requested, then returning.
+	if(options.dedup)
+	{
+		STATS_BEGIN(STATS_DEDUP);
+		dedup(&options);
+		STATS_END(STATS_DEDUP);
+
+		if(output_sync()) error_emit(ERROR, "sync", strerror(errno));
+		free(options.inputs);
+		stats_report();
+		return failure;
+	}
 
-	// Writing the header and the binary content.
-	write(options.input, options.output, header);
+	// Packing g1a files if requested, then returning.
+	if(options.pack)
+	{
+		STATS_BEGIN(STATS_PACK);
+		pack(&options);
+		STATS_END(STATS_PACK);
+
+		if(output_sync()) error_emit(ERROR, "sync", strerror(errno));
+		free(options.inputs);
+		stats_report();
+		return failure;
+	}
+
+	// Restoring the g1a files of packs if requested, then returning.
+	if(options.unpack)
+	{
+		STATS_BEGIN(STATS_UNPACK);
+		unpack(&options);
+		STATS_END(STATS_UNPACK);
+
+		if(output_sync()) error_emit(ERROR, "sync", strerror(errno));
+		free(options.inputs);
+		stats_report();
+		return failure;
+	}
+
+	// Reading the settings of every variant before writing anything.
+	if(options.variant_count)
+	{
+		variants = malloc(options.variant_count * sizeof *variants);
+		if(!variants) error_emit(FATAL, "alloc");
+
+		for(i = 0; i < options.variant_count; i++)
+		{
+			variants[i] = options;
+			variant(&variants[i], options.variants[i]);
+		}
+		if(failure) return 1;
+	}
+
+	// Loading the binary content, once for all the variants, from the
+	// input file or from the inherited descriptor.
+	if(options.input_fd >= 0 ? payload_fd(&payload, options.input_fd,
+		PAYLOAD_ELF) : payload_open(&payload, options.input,
+		PAYLOAD_ELF))
+	{
+		if(payload.defect) error_emit(FATAL, "elf", options.input,
+			payload.defect);
+		error_emit(FATAL, "input", options.input);
+	}
+	if(options.input_fd < 0) depfile_add(options.input);
+
+	// Writing the output file, or every variant from the same pages.
+	output_durable(options.durable);
+	if(!variants) wrap(&options, &payload);
+	for(i = 0; i < options.variant_count; i++) wrap(&variants[i], &payload);
+
+	size = payload.size;
+	payload_close(&payload);
+	free(variants);
+	free(options.variants);
+
+	// Writing the dependency file, if requested.
+	if(options.depfile && depfile_write(options.depfile, options.output))
+		error_emit(ERROR, "depfile", options.depfile, strerror(errno));
+	if(options.depfile_dynamic) free(options.depfile);
+
+	// In durable mode, syncing the output file system once.
+	if(output_sync()) error_emit(ERROR, "sync", strerror(errno));
+
+	// Rebuilding the output on changes, until interrupted.
+	if(options.watch) watch(&options, size);
 
 	// Freeing the output file name field if it was dynamically allocated.
 	if(options.output_dynamic) free(options.output);
+	free(options.inputs);
+	arena_free(&arena);
 
-	// Successfully returning from the program.
-	return 0;
+	// Reporting statistics, if enabled.
+	stats_report();
+
+	// Returning from the program.
+	return failure;
 }
 
 /*
@@ -155,6 +451,12 @@ void args(int argc, char **argv, struct Options *options)
 	// Using default icon data.
 	uint8_t default_icon_1[] = { 0x00, 0x00, 0x00, 0x04 };
 	uint8_t default_icon_2[] = { 0x00, 0x00, 0x01, 0xfc };
+	// Using the SOURCE_DATE_EPOCH environment variable, and a raw time and
+	// a time structure for the build date.
+	const char *epoch = getenv("SOURCE_DATE_EPOCH");
+	char *end;
+	time_t rawtime;
+	struct tm tm;
 	// Using an iterator to parse the various arguments.
 	int i;
 
@@ -162,13 +464,53 @@ void args(int argc, char **argv, struct Options *options)
 		Initializing values.
 	*/
 
-	// By default, action is to wrap, not to dump.
+	// By default, action is to wrap, not to dump or extract.
 	options->dump = 0;
+	options->extract = 0;
+	options->diff = 0;
+	options->index = 0;
+	options->fsck = 0;
+	options->repair = 0;
+	options->scan = NULL;
+	options->dedup = 0;
+	options->link = DEDUP_NONE;
+	options->pack = NULL;
+	options->unpack = 0;
+	options->batch = 0;
+	options->io = BATCH_AUTO;
 	// No default file specified.
 	options->input = NULL;
 	options->output = NULL;
+	options->inputs = NULL;
+	options->icons = NULL;
+	options->input_fd = -1;
+	options->output_fd = -1;
+	options->input_count = 0;
+	options->manifest = NULL;
+	options->manifest_data = NULL;
+	options->bundle = NULL;
+	options->icon_file = NULL;
+	options->variants = NULL;
+	options->variant_count = 0;
+	// Icons are thresholded by default.
+	options->dither = 0;
+	// Not watching the input files by default.
+	options->watch = 0;
+	options->debounce = WATCH_DEBOUNCE;
 	// The output file name wasn't dynamically allocated, for now.
 	options->output_dynamic = 0;
+	// Output files are not synced by default.
+	options->durable = 0;
+	// Nondeterministic defaults are allowed by default.
+	options->reproducible = 0;
+	options->epoch = -1;
+	// No dependency file by default.
+	options->depfile = NULL;
+	options->depfile_dynamic = 0;
+	// No cache by default.
+	options->cache = NULL;
+	options->cache_limit = CACHE_DEFAULT_LIMIT;
+	options->cache_stats = 0;
 	// Empty program name and build date.
 	*options->name = 0;
 	*options->date = 0;
@@ -188,6 +530,12 @@ void args(int argc, char **argv, struct Options *options)
 	{
 		// If the argument show an error, mask it.
 		if(!error_argument(argv[i])) argv[i] = NULL;
+		// Dithering applies to icons given before the option too.
+		else if(!strcmp(argv[i], "--dither"))
+		{
+			options->dither = 1;
+			argv[i] = NULL;
+		}
 	}
 
 	// Parsing the different given parameters.
@@ -215,6 +563,108 @@ void args(int argc, char **argv, struct Options *options)
 			// be automatically set.
 			i++;
 		}
+		// Handling command --extract : binary content extraction.
+		if(!strcmp(argv[i], "--extract"))
+		{
+			// Setting the extract option. The input files are all
+			// the other arguments.
+			options->extract = 1;
+			continue;
+		}
+		// Handling command --index : g1a file listing.
+		if(!strcmp(argv[i], "--index"))
+		{
+			// Setting the index option. The input files are all the
+			// other arguments.
+			options->index = 1;
+			continue;
+		}
+		// Handling command --fsck : g1a file checking.
+		if(!strcmp(argv[i], "--fsck"))
+		{
+			// Setting the fsck option. The input files and
+			// directories are all the other arguments.
+			options->fsck = 1;
+			continue;
+		}
+		// Handling command --scan : signature search.
+		if(!strcmp(argv[i], "--scan") && i + 1 < argc)
+		{
+			// Setting the patterns file. The input files and
+			// directories are all the other arguments.
+			options->scan = argv[++i];
+			continue;
+		}
+		// Handling command --dedup : duplicate payload search.
+		if(!strcmp(argv[i], "--dedup"))
+		{
+			// Setting the dedup option. The input files and
+			// directories are all the other arguments.
+			options->dedup = 1;
+			continue;
+		}
+		// Handling command --pack : g1a file packing.
+		if(!strcmp(argv[i], "--pack") && i + 1 < argc)
+		{
+			// Setting the pack file. The input files and
+			// directories are all the other arguments.
+			options->pack = argv[++i];
+			continue;
+		}
+		// Handling command --unpack : packed g1a file restoring.
+		if(!strcmp(argv[i], "--unpack"))
+		{
+			// Setting the unpack option. The input packs are all
+			// the other arguments.
+			options->unpack = 1;
+			continue;
+		}
+		// Handling option --link : duplicate file consolidation.
+		if(!strcmp(argv[i], "--link") || !strncmp(argv[i], "--link=", 7))
+		{
+			if(!argv[i][6] || !strcmp(argv[i] + 7, "auto"))
+				options->link = DEDUP_AUTO;
+			else if(!strcmp(argv[i] + 7, "reflink"))
+				options->link = DEDUP_REFLINK;
+			else if(!strcmp(argv[i] + 7, "hard"))
+				options->link = DEDUP_HARD;
+			else error_emit(ERROR, "option", argv[i]);
+			continue;
+		}
+		// Handling option --repair : defective header repair.
+		if(!strcmp(argv[i], "--repair"))
+		{
+			options->repair = 1;
+			continue;
+		}
+		// Handling option --batch : wrap or dump every input file.
+		if(!strcmp(argv[i], "--batch"))
+		{
+			options->batch = 1;
+			continue;
+		}
+		// Handling option --bundle : batch outputs in a tar archive.
+		if(!strcmp(argv[i], "--bundle") && i + 1 < argc)
+		{
+			options->batch = 1;
+			options->bundle = argv[++i];
+			continue;
+		}
+		// Handling option --manifest : batch jobs listed in a file.
+		if(!strncmp(argv[i], "--manifest=", 11))
+		{
+			options->batch = 1;
+			options->manifest = argv[i] + 11;
+			continue;
+		}
+		// Handling command --diff : g1a file comparison.
+		if(!strcmp(argv[i], "--diff"))
+		{
+			// Setting the diff option. The two files are the other
+			// arguments.
+			options->diff = 1;
+			continue;
+		}
 
 
 
@@ -225,6 +675,25 @@ void args(int argc, char **argv, struct Options *options)
 		// Handling option -o : output file name.
 		if(!strcmp(argv[i],"-o")) options->output = argv[++i];
 
+		// Handling options --input-fd and --output-fd : inherited file
+		// descriptors.
+		else if((!strcmp(argv[i], "--input-fd")
+			|| !strcmp(argv[i], "--output-fd")) && i + 1 < argc)
+		{
+			// Using the descriptor index, and the end of the number.
+			int k = argv[i][2] == 'o';
+			int *fd = k ? &options->output_fd : &options->input_fd;
+			char *end;
+
+			*fd = strtol(argv[++i], &end, 10);
+			if(*end || end == argv[i] || *fd < 0)
+			{
+				error_emit(ERROR, "fd", argv[i]);
+				*fd = -1;
+			}
+			else sprintf(options->fd_names[k], "/dev/fd/%d", *fd);
+		}
+
 		// Handling option -n : application name.
 		else if(!strcmp(argv[i],"-n"))
 		{
@@ -236,13 +705,109 @@ void args(int argc, char **argv, struct Options *options)
 				"application name", name, 8);
 		}
 
+		// Handling option -MD : dependency file with default name.
+		else if(!strcmp(argv[i], "-MD"))
+		{
+			// Using the empty string until the output name is known.
+			if(!options->depfile) options->depfile = "";
+		}
+
+		// Handling option -MF : dependency file name.
+		else if(!strcmp(argv[i], "-MF")) options->depfile = argv[++i];
+
 		// Handling option -i : program icon.
 		else if(!strcmp(argv[i],"-i"))
 		{
-			// Reading the bitmap data (this is a heavy procedure).
-			bitmap_read(argv[++i], 30, 19, options->icon);
+			// Reading the bitmap data (this is a heavy procedure),
+			// timing it apart from the rest of the parsing.
+			STATS_END(STATS_ARGS);
+			STATS_BEGIN(STATS_ICON);
+			options->icon_file = argv[++i];
+			bitmap_read(options->icon_file, 30, 19, options->icon,
+				options->dither, options->arena);
+			arena_reset(options->arena);
+			STATS_END(STATS_ICON);
+			STATS_BEGIN(STATS_ARGS);
+		}
+
+		// Handling option --io : batch I/O backend.
+		else if(!strcmp(argv[i], "--io=auto")) options->io = BATCH_AUTO;
+		else if(!strcmp(argv[i], "--io=uring"))
+			options->io = BATCH_URING;
+		else if(!strcmp(argv[i], "--io=threads"))
+			options->io = BATCH_THREADS;
+
+		// Handling option --variant : additional option set.
+		else if(!strcmp(argv[i], "--variant") && argv[i + 1])
+		{
+			// Using the extended variant list.
+			char **variants = realloc(options->variants,
+				(options->variant_count + 1) * sizeof *variants);
+
+			if(!variants)
+			{
+				error_emit(ERROR, "alloc");
+				continue;
+			}
+
+			options->variants = variants;
+			variants[options->variant_count++] = argv[++i];
+		}
+
+		// Handling option --watch : rebuild on changes.
+		else if(!strcmp(argv[i], "--watch")) options->watch = 1;
+		else if(!strncmp(argv[i], "--watch=", 8))
+		{
+			// Using the end of the number.
+			char *end;
+
+			options->watch = 1;
+			options->debounce = strtol(argv[i] + 8, &end, 10);
+			if(*end || end == argv[i] + 8 || options->debounce < 0)
+				error_emit(ERROR, "option", argv[i]);
+		}
+
+		// Handling option --durable : sync output to disk.
+		else if(!strcmp(argv[i], "--durable")) options->durable = 1;
+
+		// Handling option --reproducible : deterministic output only.
+		else if(!strcmp(argv[i], "--reproducible"))
+			options->reproducible = 1;
+
+		// Handling option --cache : cache directory.
+		else if(!strncmp(argv[i], "--cache=", 8))
+			options->cache = argv[i] + 8;
+
+		// Handling option --cache-size : cache size limit.
+		else if(!strncmp(argv[i], "--cache-size=", 13))
+		{
+			// Using the end of the number, for the unit suffix.
+			char *end;
+
+			options->cache_limit = strtoull(argv[i] + 13, &end, 10);
+			// Applying the unit.
+			if(*end == 'K' || *end == 'k')
+				options->cache_limit <<= 10, end++;
+			else if(*end == 'M') options->cache_limit <<= 20, end++;
+			else if(*end == 'G') options->cache_limit <<= 30, end++;
+
+			if(*end || end == argv[i] + 13) error_emit(ERROR,
+				"cache-size", argv[i] + 13);
 		}
 
+		// Handling command --cache-stats : display cache statistics.
+		else if(!strcmp(argv[i], "--cache-stats"))
+			options->cache_stats = 1;
+
+		// Skipping options --stats and --metrics, already handled by
+		// main().
+		else if(!strcmp(argv[i], "--stats")
+			|| !strncmp(argv[i], "--stats=", 8)
+			|| !strncmp(argv[i], "--metrics=", 10)) continue;
+
+		// Skipping option --trace and its file, handled by main().
+		else if(!strcmp(argv[i], "--trace") && i + 1 < argc) i++;
+
 
 
 		/*
@@ -306,29 +871,139 @@ void args(int argc, char **argv, struct Options *options)
 		// Everything else is considered as the binary file name.
 		else
 		{
-			// If there is already an input file.
-			if(options->input)
+			// Using the extended input list.
+			char **inputs = realloc(options->inputs,
+				(options->input_count + 1) * sizeof *inputs);
+
+			if(!inputs)
 			{
-				// Emitting an error.
-				error_emit(ERROR, "illegal", argv[i]);
-				// Continuing to prevent re-assignment.
+				error_emit(ERROR, "alloc");
 				continue;
 			}
 
-			// Setting the input file name.
-			options->input = argv[i];
+			// Adding the file name to the list.
+			options->inputs = inputs;
+			inputs[options->input_count++] = argv[i];
+			// Setting the input file name if it's the first one.
+			if(!options->input) options->input = argv[i];
 		}
 	}
 
+	// Adding the jobs of the batch manifest to the input files.
+	if(options->manifest) manifest(options);
+
+	// Naming the inherited descriptors, which stand for the input and
+	// output files.
+	if(options->input_fd >= 0)
+	{
+		if(options->input) error_emit(ERROR, "illegal", options->input);
+		options->input = options->fd_names[0];
+	}
+	if(options->output_fd >= 0)
+	{
+		if(options->output) error_emit(ERROR, "fd-option", "-o");
+		options->output = options->fd_names[1];
+	}
+	// Descriptors only apply to wrapping a single payload.
+	if(options->input_fd >= 0 || options->output_fd >= 0)
+	{
+		if(options->dump || options->extract || options->index
+			|| options->fsck || options->scan || options->dedup
+			|| options->pack || options->unpack || options->diff
+			|| options->batch || options->cache_stats)
+			error_emit(ERROR, "fd-option", "this command");
+		if(options->watch) error_emit(ERROR, "fd-option", "--watch");
+		if(options->cache) error_emit(ERROR, "fd-option", "--cache");
+		if(options->variant_count) error_emit(ERROR, "fd-option",
+			"--variant");
+	}
+
+	// Only extraction, listing, checking, scanning, deduplication and
+	// packing can handle several input files, and comparison needs exactly
+	// two.
+	if(options->diff && options->input_count != 2)
+		error_emit(ERROR, "diff-count", options->input_count);
+	else if(!options->extract && !options->index && !options->fsck
+		&& !options->scan && !options->dedup && !options->pack
+		&& !options->unpack && !options->diff && !options->batch)
+		for(i = 1; i < options->input_count; i++)
+		error_emit(ERROR, "illegal", options->inputs[i]);
+
+	// Variants have their own output files and can only be wrapped.
+	if(options->variant_count)
+	{
+		if(options->dump || options->extract || options->index
+			|| options->fsck || options->scan || options->dedup
+			|| options->pack || options->unpack || options->diff
+			|| options->batch)
+			error_emit(ERROR, "variant-option", "this command");
+		if(options->output) error_emit(ERROR, "variant-option",
+			"-o (use out=)");
+		if(options->depfile) error_emit(ERROR, "variant-option",
+			"-MD and -MF");
+		if(options->watch) error_emit(ERROR, "variant-option",
+			"--watch");
+	}
+
+	// Watching only applies to wrapping a single file.
+	if(options->watch && (options->dump || options->extract
+		|| options->index || options->fsck || options->scan
+		|| options->dedup || options->pack || options->unpack
+		|| options->diff || options->batch || options->cache_stats))
+		error_emit(ERROR, "watch-option");
+
+	// Batch jobs are not cached and have no dependency files.
+	if(options->batch && options->cache)
+		error_emit(ERROR, "batch-option", "--cache");
+	if(options->batch && options->depfile)
+		error_emit(ERROR, "batch-option", "-MD and -MF");
+	if(options->batch && options->index)
+		error_emit(ERROR, "batch-option", "--index");
+	if(options->batch && options->fsck)
+		error_emit(ERROR, "batch-option", "--fsck");
+	if(options->batch && options->scan)
+		error_emit(ERROR, "batch-option", "--scan");
+	if(options->batch && options->dedup)
+		error_emit(ERROR, "batch-option", "--dedup");
+	if(options->batch && options->pack)
+		error_emit(ERROR, "batch-option", "--pack");
+	if(options->batch && options->unpack)
+		error_emit(ERROR, "batch-option", "--unpack");
+	// Only duplicates can be linked.
+	if(options->link && !options->dedup)
+		error_emit(ERROR, "option", "--link");
+	// Only checked files can be repaired.
+	if(options->repair && !options->fsck)
+		error_emit(ERROR, "option", "--repair");
+	// Bundles only hold wrapped outputs.
+	if(options->bundle && options->dump)
+		error_emit(ERROR, "bundle-option", "-d");
+
+	// Displaying cache statistics does not need an input file.
+	if(options->cache_stats)
+	{
+		if(!options->cache) error_emit(FATAL, "no-cache");
+		return;
+	}
+
 	// Testing if a input binary file was given.
 	if(!options->input) error_emit(FATAL, "no-input");
 
-	// Skipping all those default values if the wanted action is to dump
-	//a g1a file.
-	if(options->dump) return;
+	// An input descriptor has no name to derive the output file name from.
+	if(options->input_fd >= 0 && !options->output) error_emit(FATAL,
+		"no-output");
 
-	// Setting the default output filename if no one was given.
-	if(!options->output)
+	// Skipping all those default values if the wanted action is to dump
+	//a g1a file, extract binary content, list, check, scan, deduplicate,
+	// pack, unpack or compare files.
+	if(options->dump || options->extract || options->index
+		|| options->fsck || options->scan || options->dedup
+		|| options->pack || options->unpack || options->diff) return;
+
+	// Setting the default output filename if no one was given. In batch
+	// mode, it is the output directory, and names are set per job; each
+	// variant has its own.
+	if(!options->output && !options->batch && !options->variant_count)
 	{
 		// Looking for the dot.
 		char *tmp = strrchr(options->input,'.');
@@ -355,8 +1030,31 @@ void args(int argc, char **argv, struct Options *options)
 			options->output);
 	}
 
+	// Setting the default dependency file name, replacing the output file
+	// extension with '.d' as gcc does.
+	if(options->depfile && !*options->depfile && !options->batch)
+	{
+		// Looking for the dot after the last slash.
+		char *dot = strrchr(options->output, '.');
+		char *sla = strrchr(options->output, '/');
+		// Using the base name length.
+		int length = strlen(options->output);
+
+		if(dot && (!sla || dot > sla)) length = dot - options->output;
+
+		options->depfile = malloc(length + 3);
+		if(!options->depfile)
+		{
+			error_emit(ERROR, "alloc");
+			return;
+		}
+		options->depfile_dynamic = 1;
+		memcpy(options->depfile, options->output, length);
+		strcpy(options->depfile + length, ".d");
+	}
+
 	// Setting the default filename if no one was given.
-	if(!*options->name)
+	if(!*options->name && !options->batch && !options->variant_count)
 	{
 		// Looking for the dot in the binary file name.
 		char *dot = strrchr(options->output, '.');
@@ -380,329 +1078,1495 @@ void args(int argc, char **argv, struct Options *options)
 		options->name[length] = 0;
 	}
 
+	// Reading the build timestamp given by the environment, if any. It is
+	// interpreted in UTC, which also avoids looking up the local time
+	// zone. It dates the bundle entries too, so it is checked even with
+	// --date.
+	if(epoch)
+	{
+		errno = 0;
+		rawtime = strtoll(epoch, &end, 10);
+		if(errno || !*epoch || *end || rawtime < 0
+			|| !gmtime_r(&rawtime, &tm) || tm.tm_year + 1900 > 9999)
+			error_emit(FATAL, "epoch", epoch);
+		options->epoch = rawtime;
+	}
+
 	// Setting the default build date if no one was given.
 	if(!*options->date)
 	{
-		// Using a raw time and a time structure pointer.
-		time_t rawtime;
-		struct tm *info;
-
-		// Getting the raw time.
-		time(&rawtime);
-		// Getting time information from raw time.
-		info = localtime(&rawtime);
+		// Using the build timestamp given by the environment, if any.
+		// Otherwise, the current time is not reproducible.
+		if(!epoch && options->reproducible)
+			error_emit(FATAL, "no-date");
+		else if(!epoch)
+		{
+			// Getting the raw time.
+			time(&rawtime);
+			// Getting time information from raw time.
+			localtime_r(&rawtime, &tm);
+		}
 
 		// Generating a date string from the structure informations.
-		sprintf(options->date,"%04d.%02d%02d.%02d%02d",
-			info->tm_year + 1900, info->tm_mon + 1, info->tm_mday,
-			info->tm_hour, info->tm_min);
+		// Years past 9999 are refused above, so that it always fits.
+		if(snprintf(options->date, sizeof options->date,
+			"%04d.%02d%02d.%02d%02d", tm.tm_year + 1900,
+			tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min)
+			>= (int)sizeof options->date)
+			error_emit(FATAL, "epoch", epoch ? epoch : "");
 	}
 }
 
 /*
 	generate()
 
-	Generates a g1a header structure according to the given options.
+	Generates a g1a header structure according to the given options. The
+	header starts as a copy of the template, which holds all the constant
+	fields; only the fields that depend on the options are then written.
 
 	@arg	options	Options structure.
 	@arg	data	Address of g1a header structure.
 */
 
-void generate(struct Options options, unsigned char *data)
+void generate(const struct Options *options, unsigned char *data)
 {
-	// Using a predefined array for an unknown five-byte sequence.
-	unsigned char unknown[5] = { 0x00, 0x10, 0x00, 0x10, 0x00 };
-
-	// As there are many unknown or null areas in the header, initializing
-	// all the data with zeros.
-	memset(data, 0, 0x200);
-
-	// Copying string "USBPower", that appears in system all files in the
-	// calculator's file system.
-	strcpy(data, "USBPower");
-	// This flag indicates that the current file is an add-in.
-	data[8] = 0xf3;
-	// These five bytes appear insignificant.
-	memcpy(data + 9, unknown, 5);
-	// Skipping a checksum.
-
-	// This byte role is quite unknown.
-	data[0x0f] = 0x01;
-	// Skipping a file size and a checksum.
-
-	// These nine first bytes also seem insignificant, the last two
-	// represent the number of objects in an MCS file (not interesting
-	// here).
-	memset(data + 0x15, 0, 11);
-
-	// Here begins the add-in header.
-	// Writing the application internal name.
-	strncpy(data + 32, options.internal, 8);
-	// Writing the number of e-strips (not handled here).
-	data[43] = 0;
-	// Writing the program version.
-	strncpy(data + 48, options.version, 10);
-	// Writing the build date.
-	strncpy(data + 60, options.date, 14);
-	// Writing the program icon.
-	memcpy(data + 76, options.icon + 4, 68);
-	// Skipping the e-strips data.
-
-	// Writing the program name.
-	strncpy(data + 468, options.name, 8);
-	// Skipping a file size.
+	// Using a field iterator.
+	const struct Header_Field *field;
+
+	// Starting from the template ("USBPower", add-in flag, unknown
+	// sequences, everything else zeroed).
+	memcpy(data, header_template(), HEADER_SIZE);
+
+	// Writing the fields that come from the options. The size and
+	// checksums are set later by write().
+	for(field = header_fields; field->size; field++)
+	{
+		// Writing text fields (internal name, version, date, name).
+		if(field->type == FIELD_STRING)
+			strncpy((char *)data + field->offset, (const char *)
+			options + field->option, field->size);
+
+		// Writing the program icon, without its first line.
+		else if(field->type == FIELD_ICON)
+			memcpy(data + field->offset, options->icon + 4,
+			field->size);
+	}
 }
 
 /*
-	write()
+	variant()
 
-	Write the header content to the output file, and then appends the
-	contents of the input file.
-	Also computes and writes total file size and checksums.
+	Applies the settings of a variant to a copy of the options. Settings are
+	comma-separated 'key=value' pairs: 'out' (output file name, mandatory),
+	'name', 'icon', 'version', 'internal' and 'date'. Other fields keep the
+	values given on the command line; the program name defaults to the
+	output file name.
 
-	@arg	input_file	Input binary file name.
-	@arg	output_file	Output g1a file name.
-	@arg	data		Header data address (casted as char *).
+	@arg	options		Options structure to modify.
+	@arg	settings	Variant settings, split in place.
 */
 
-void write(const char *input_file, const char *output_file,
-	unsigned char *data)
+void variant(struct Options *options, char *settings)
 {
-	// Using input and output file pointers.
-	FILE *input, *output;
-	// Using an unsigned int to store file size.
-	unsigned int size;
-	// Using a byte.
-	uint8_t byte;
-	// Using an iterator.
-	int i;
+	// Using the current setting, its value and the next one.
+	char *key, *value, *next;
 
-	// Opening input file.
-	input = fopen(input_file, "rb");
-	// Handling failure with a fatal error.
-	if(!input) error_emit(FATAL, "input", input_file);
+	options->output = NULL;
 
-	// Opening output file.
-	output = fopen(output_file, "wb");
-	// Handling failure with a fatal error.
-	if(!output)
+	for(key = settings; key; key = next)
 	{
-		// Closing the input file.
-		fclose(input);
-		// Emitting the fatal error.
-		error_emit(FATAL,"output",output_file);
-	}
+		// Splitting the settings.
+		next = strchr(key, ',');
+		if(next) *next++ = 0;
+		value = strchr(key, '=');
+		if(!value)
+		{
+			error_emit(ERROR, "variant", key);
+			continue;
+		}
+		*value++ = 0;
 
-	// Getting the total file size.
-	fseek(input, 0, SEEK_END);
-	// Adding 0x200 bytes for the g1a header.
-	size = ftell(input) + 0x200;
-	fseek(input, 0, SEEK_SET);
+		if(!strcmp(key, "out")) options->output = value;
+		else if(!strcmp(key, "icon"))
+		{
+			STATS_BEGIN(STATS_ICON);
+			options->icon_file = value;
+			bitmap_read(value, 30, 19, options->icon,
+				options->dither, options->arena);
+			arena_reset(options->arena);
+			STATS_END(STATS_ICON);
+		}
+		else if(!strcmp(key, "name"))
+		{
+			strncpy(options->name, value, 8);
+			if(strlen(value) > 8) error_emit(WARNING, "length",
+				"application name", value, 8);
+		}
+		else if(!strcmp(key, "version"))
+		{
+			strncpy(options->version, value, 10);
+			if(strlen(value) > 10) error_emit(WARNING, "length",
+				"version string", value, 10);
+			else if(string_format(value, "00.00.0000"))
+				error_emit(WARNING, "format", "version string",
+				value, "MM.mm.pppp");
+		}
+		else if(!strcmp(key, "internal"))
+		{
+			strncpy(options->internal, value, 8);
+			if(strlen(value) > 8) error_emit(WARNING, "length",
+				"internal name", value, 8);
+			else if(string_format(options->internal, "@AAAAAAA"))
+				error_emit(WARNING, "format", "internal name",
+				options->internal, "@[A-Z]{0,7}");
+		}
+		else if(!strcmp(key, "date"))
+		{
+			strncpy(options->date, value, 14);
+			if(strlen(value) > 14) error_emit(WARNING, "length",
+				"date string", value, 14);
+			else if(string_format(value, "0000.0000.0000"))
+				error_emit(WARNING, "format", "date string",
+				value, "yyyy.MMdd.hhmm");
+		}
+		else
+		{
+			value[-1] = '=';
+			error_emit(ERROR, "variant", key);
+		}
+	}
 
-	// Computing the checksums (automatically truncated).
-	data[0x00e] = size + 0x41;
-	data[0x014] = size + 0xB8;
-	// Writing the file size at offsets 0x010 and 0x1f0.
-	for(i=0; i<4; i++)
+	if(!options->output)
 	{
-		// Getting a byte in the file size (this cast does not break
-		// the strict aliasing rule).
-		byte = *(((uint8_t *)&size) + 3 - i);
-		// Writing the current byte in the data.
-		data[0x010 + i] = data[0x1f0 + i] = byte;
+		error_emit(ERROR, "variant-output");
+		return;
 	}
-
-	// Inverting the MCS standard header.
-	for(i=0; i < 0x020; i++) data[i] = ~data[i];
-	// Writing the header to the file.
-	fwrite(data, 1, 0x200, output);
-
-	// Copying binary data.
-	while(fread(&byte, 1, 1, input)) fwrite(&byte, 1, 1, output);
-
-	// Closing the input and output files.
-	fclose(input);
-	fclose(output);
+	if(!*options->name) default_name(options->name, options->output);
 }
 
 /*
-	sring_format()
-
-	This simple function checks if a string matches the given fixed-length
-	format.
-	If the format is shorter than the string (and the format matches all
-	the beginning of the string), the string matches.
-
-	List of special characters :
-	-  'a' = [a-z]
-	-  'A' = [A-Z]
-	-  '0' = [0-9]
-	-  '*' = everything printable
-	Everything else is literal.
+	default_name()
 
-	@arg	string	String to test.
-	@arg	format	Format to match.
+	Names the program after its output file, without directory and
+	extension, truncated to 8 characters.
 
-	@return		0 if the string matches, 1 otherwise.
-	
+	@arg	name	Program name field (at least 9 bytes).
+	@arg	output	Output file name.
 */
 
-int string_format(const char *str, const char *format)
+void default_name(char *name, const char *output)
 {
-	// Iterating over the characters.
-	while(*str && *format)
-	{
-		// Handling the current character.
-		switch(*format)
-		{
-			// Handling lowercase letters with islower().
-			case 'a': if(!islower(*str)) return 1; break;
-			// Handling uppercase letters with isupper().
-			case 'A': if(!isupper(*str)) return 1; break;
-			// Handling decimal digits with isdigit().
-			case '0': if(!isdigit(*str)) return 1; break;
-			// Handling printable characters with isprint().
-			case '*': if(!isprint(*str)) return 1; break;
-			// Handling anything else as literal.
-			default: if(*str != *format) return 1; break;
-		}
-
-		// Incrementing the two pointer.
-		str++;
-		format++;
-	}
-
-	// At this point, the string matches, except if it's longer that the
-	// format.
-	return !*format;
+	// Using the base name and its length.
+	const char *base = strrchr(output, '/');
+	const char *dot;
+	int length;
+
+	base = base ? base + 1 : output;
+	dot = strrchr(base, '.');
+	length = dot ? dot - base : (int)strlen(base);
+	if(length > 8) length = 8;
+
+	memcpy(name, base, length);
+	name[length] = 0;
 }
 
 /*
-	dump()
+	wrap()
 
-	Dumps the file header contents, assuming the file is a g1a file.
+	Generates the header of an output file and writes it along with the
+	payload, unless the cache already has the result.
 
-	@arg	filename	File to dump header.
+	@arg	options	Options of the output file.
+	@arg	payload	Input binary content.
 */
 
-void dump(const char *filename)
+void wrap(const struct Options *options, const struct Payload *payload)
 {
-	// Using an array to store header data.
-	char data[0x200];
-	// Using a file pointer to read file contents.
-	FILE *fp;
-	// Using an integer to store the total file size and a temporary
-	// integers.
-	int filesize, t1, t2;
-	// Using an iterator.
-	int i;
-	// Using a parsing pointer.
-	char *ptr;
-
-	// Opening file.
-	fp = fopen(filename, "r");
-	// Handling failure by emitting a fatal error.
-	if(!fp) error_emit(FATAL, "input", filename);
-	// Reading file header contents.
-	fread(data, 0x200, 1, fp);
-	// Retrieving the file size.
-	fseek(fp, 0, SEEK_END);
-	filesize = ftell(fp);
-	// Closing the file.
-	fclose(fp);
-
-	// Inverting the general header !
-	for(i=0; i < 0x020; i++) data[i] = ~data[i];
+	// Using memory for a header and a cache key.
+	unsigned char header[HEADER_SIZE];
+	char key[33];
+	// Using a cache hit indicator.
+	int hit = 0;
 
+	STATS_ADD(STATS_JOBS_QUEUED, 1);
+	TRACE_BEGIN("job", NULL, 0);
 
+	// Generating the header according to the options.
+	STATS_BEGIN(STATS_GENERATE);
+	generate(options, header);
+	STATS_END(STATS_GENERATE);
 
-	/*
-		Checking file validity.
-	*/
-
-	// A g1a must have binary code with its header !
-	if(filesize < 0x200)
+	// Looking up the output in the cache, if enabled.
+	if(options->cache)
 	{
-		// Emitting an error if there's not binary code.
-		error_emit(ERROR, "g1a-valid", filename, "too short");
-		// Then returning : why would we analyze an non-g1a file ?
-		return;
+		STATS_BEGIN(STATS_CACHE);
+		cache_key(header, payload, key);
+		hit = cache_fetch(options->cache, key, options->output);
+		STATS_END(STATS_CACHE);
+		STATS_ADD(hit ? STATS_CACHE_HITS : STATS_CACHE_MISSES, 1);
 	}
-
-	// Looking for initial string "USBPower".
-	if(strncmp(data, "USBPower", 8))
+	if(hit)
 	{
-		// Emitting an error if not found.
-		error_emit(ERROR, "g1a-valid", filename, "\"USBPower\"");
+		STATS_ADD(STATS_JOBS_DONE, 1);
+		TRACE_END("job");
 		return;
 	}
 
-	// Looking for MCS add-in indicator.
-	if((unsigned char )data[8] != 0xf3)
+	// Writing the header and the binary content, and storing the result in
+	// the cache.
+	STATS_BEGIN(STATS_WRITE);
+	if(options->output_fd >= 0) write_fd(payload, options->output_fd,
+		options->output, header);
+	else write(payload, options->output, header);
+	STATS_END(STATS_WRITE);
+
+	if(options->cache)
+	{
+		STATS_BEGIN(STATS_CACHE);
+		cache_store(options->cache, key, options->output,
+			options->cache_limit);
+		STATS_END(STATS_CACHE);
+	}
+	STATS_ADD(STATS_JOBS_DONE, 1);
+	TRACE_END("job");
+}
+
+/*
+	write()
+
+	Write the header content to the output file, and then appends the
+	contents of the input file.
+	Also computes and writes total file size and checksums.
+	The output is written to a temporary file, preallocated to the final
+	size, and renamed over the output file only once complete, so that
+	readers never see a partial g1a file.
+
+	@arg	payload		Input binary content.
+	@arg	output_file	Output g1a file name.
+	@arg	data		Header data address (casted as char *).
+*/
+
+void write(const struct Payload *payload, const char *output_file,
+	unsigned char *data)
+{
+	// Using an output file.
+	struct Output output;
+	// Using an unsigned int to store file size.
+	unsigned int size;
+
+	// Getting the total file size, adding 0x200 bytes for the g1a header.
+	size = payload->size + HEADER_SIZE;
+
+	// Opening the output file, preallocated to its final size.
+	if(output_open(&output, output_file, size))
+		error_emit(FATAL, "output", output_file);
+
+	// Writing the file size and checksums, and inverting the MCS header.
+	header_finalize(data, size);
+
+	// Writing the header and the binary data, straight from the loaded
+	// input.
+	if(payload_write(payload, &output, data, HEADER_SIZE))
+	{
+		// Removing the partial output before exiting.
+		output_abort(&output);
+		error_emit(FATAL, "output-write", output_file, strerror(errno));
+	}
+
+	// Moving the output file into place.
+	if(output_commit(&output))
+		error_emit(FATAL, "output-write", output_file, strerror(errno));
+}
+
+/*
+	write_fd()
+
+	Writes the header and the binary content to an inherited file
+	descriptor, such as a memfd or a pipe, at its current position. There
+	is no temporary file: the header and a flat payload (mapped from the
+	input) are sent with a single vectored write.
+
+	@arg	payload	Input binary content.
+	@arg	fd	Output file descriptor, closed once written.
+	@arg	name	Output name, for diagnostics.
+	@arg	data	Header data address (casted as char *).
+*/
+
+void write_fd(const struct Payload *payload, int fd, const char *name,
+	unsigned char *data)
+{
+	// Using an output file.
+	struct Output output;
+
+	// Writing the file size and checksums, and inverting the MCS header.
+	output_stream(&output, fd, name);
+	header_finalize(data, payload->size + HEADER_SIZE);
+
+	if(payload_write(payload, &output, data, HEADER_SIZE)
+		|| output_commit(&output))
+		error_emit(FATAL, "output-write", name, strerror(errno));
+}
+
+/*
+	watch()
+
+	Keeps rebuilding the output file whenever the input or icon files are
+	rewritten, until interrupted. The header is generated once and kept: a
+	new payload is wrapped with it, and a new icon only rewrites the header
+	of the existing output file, whose size does not change. Rebuilds do
+	not use the cache, and outputs that may share their inode with a cache
+	entry (or any other file) are always rewritten whole.
+
+	@arg	options	Options structure, whose icon is updated.
+	@arg	size	Size of the payload of the current output file.
+*/
+
+void watch(struct Options *options, uint32_t size)
+{
+	// Using the watched files (the whole sheet, for sprite sheet cells).
+	const char *files[2] = { options->input, options->icon_file };
+	char *sheet = NULL;
+	size_t length;
+	struct Watch watch;
+	uint32_t changed;
+	// Using the generated header and a copy to finalize.
+	unsigned char header[HEADER_SIZE], data[HEADER_SIZE];
+	// Using the new input binary content.
+	struct Payload payload;
+	// Using the rebuild start and end dates.
+	struct timespec start, end;
+	// Using the output status, and is the output rewritten whole ?
+	struct stat st;
+	int whole;
+
+	length = options->icon_file ? bitmap_cell(options->icon_file, NULL,
+		NULL) : 0;
+	if(length && !(files[1] = sheet = strndup(options->icon_file,
+		length)))
 	{
-		// Emitting an error.
-		error_emit(ERROR, "g1a-valid", filename, "not an add-in");
+		error_emit(ERROR, "alloc");
 		return;
 	}
 
-	// Looking for the file size.
-	t1 = (data[16] << 24) | (data[17] << 16) | (data[18] << 8) | data[19];
-	t2 = (data[496] << 24) | (data[497] << 16) | (data[498] << 8)
-		| data[499];
-	// Checking validity.
-	if(t1 != filesize || t2 != filesize)
+	if(watch_open(&watch, files, options->icon_file ? 2 : 1))
 	{
-		// Emitting an error.
-		error_emit(ERROR, "g1a-valid", filename, "wrong file size");
+		error_emit(ERROR, "watch", strerror(errno));
+		free(sheet);
 		return;
 	}
+	generate(options, header);
 
-	// Getting the checksums.
-	t1 = (data[19] + 0x41) & 0xff;
-	t2 = (data[19] + 0xb8) & 0xff;
-	// Checking checksums.
-	if((uint8_t)data[14] != t1 || (uint8_t)data[20] != t2)
+	while(!watch_wait(&watch, options->debounce, &changed))
 	{
-		// Emitting an error message.
-		error_emit(ERROR, "g1a-valid", filename, "wrong checksums");
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		STATS_ADD(STATS_JOBS_QUEUED, 1);
+		TRACE_BEGIN("rebuild", "changed", changed);
+		STATS_BEGIN(STATS_WRITE);
+
+		// Reading the icon again, and updating the header.
+		if(changed & 2)
+		{
+			bitmap_read(options->icon_file, 30, 19, options->icon,
+				options->dither, options->arena);
+			arena_reset(options->arena);
+			generate(options, header);
+		}
+		memcpy(data, header, HEADER_SIZE);
+
+		// Hard links to cache entries must never be modified in place.
+		whole = changed & 1 || options->cache || stat(options->output,
+			&st) || st.st_nlink > 1;
+
+		// Wrapping the new payload with the generated header.
+		if(whole)
+		{
+			if(!payload_open(&payload, options->input, PAYLOAD_ELF))
+			{
+				write(&payload, options->output, data);
+				size = payload.size;
+				payload_close(&payload);
+			}
+			else
+			{
+				if(payload.defect) error_emit(ERROR, "elf",
+					options->input, payload.defect);
+				else error_emit(ERROR, "watch-input",
+					options->input, strerror(errno));
+				changed = 0;
+			}
+		}
+
+		// Otherwise, only rewriting the header of the output file.
+		else
+		{
+			header_finalize(data, size + HEADER_SIZE);
+			if(output_patch(options->output, data, HEADER_SIZE, 0))
+			{
+				error_emit(ERROR, "watch-output",
+					options->output, strerror(errno));
+				changed = 0;
+			}
+		}
+
+		STATS_END(STATS_WRITE);
+		STATS_ADD(STATS_JOBS_DONE, 1);
+		TRACE_END("rebuild");
+		if(output_sync()) error_emit(ERROR, "sync", strerror(errno));
+
+		// Publishing the metrics after every rebuild.
+		metrics_write();
+		if(!changed) continue;
+
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		error_emit(NOTE, "rebuild", options->output, changed & 1 ?
+			"payload" : "header", (end.tv_sec - start.tv_sec) * 1e3
+			+ (end.tv_nsec - start.tv_nsec) / 1e6);
+	}
+
+	// Stopping on a signal, or on failure.
+	if(errno != EINTR) error_emit(ERROR, "watch", strerror(errno));
+	watch_close(&watch);
+	free(sheet);
+}
+
+/*
+	sring_format()
+
+	This simple function checks if a string matches the given fixed-length
+	format.
+	If the format is shorter than the string (and the format matches all
+	the beginning of the string), the string matches.
+
+	List of special characters :
+	-  'a' = [a-z]
+	-  'A' = [A-Z]
+	-  '0' = [0-9]
+	-  '*' = everything printable
+	Everything else is literal.
+
+	@arg	string	String to test.
+	@arg	format	Format to match.
+
+	@return		0 if the string matches, 1 otherwise.
+	
+*/
+
+int string_format(const char *str, const char *format)
+{
+	// Iterating over the characters.
+	while(*str && *format)
+	{
+		// Handling the current character.
+		switch(*format)
+		{
+			// Handling lowercase letters with islower().
+			case 'a': if(!islower(*str)) return 1; break;
+			// Handling uppercase letters with isupper().
+			case 'A': if(!isupper(*str)) return 1; break;
+			// Handling decimal digits with isdigit().
+			case '0': if(!isdigit(*str)) return 1; break;
+			// Handling printable characters with isprint().
+			case '*': if(!isprint(*str)) return 1; break;
+			// Handling anything else as literal.
+			default: if(*str != *format) return 1; break;
+		}
+
+		// Incrementing the two pointer.
+		str++;
+		format++;
+	}
+
+	// At this point, the string matches, except if it's longer that the
+	// format.
+	return !*format;
+}
+
+/*
+	headers()
+
+	Reads the header of a g1a file, or the headers of the g1a files of an
+	archive (see archive_open()), and passes each one to a function. Only
+	the first bytes of archive members are read. Members that cannot be
+	read are reported and skipped.
+
+	@arg	input	File or archive name.
+	@arg	show	Function receiving the name (as 'archive:member' for
+			archive members), raw header and size of every file.
+	@arg	spaced	Separate headers with blank lines, as dumps are.
+
+	@return		0 on success, 1 if the input cannot be opened (errno is
+			set).
+*/
+
+int headers(const char *input, void (*show)(const char *filename,
+	const uint8_t *raw, uint64_t filesize), int spaced)
+{
+	// Using an array to store raw header data.
+	uint8_t raw[HEADER_SIZE];
+	// Using the archive, its current member and the name of the member.
+	struct Archive archive;
+	struct Archive_Member member;
+	char *label;
+	int count = 0;
+	// Using a file pointer to read file contents.
+	FILE *fp;
+	// Using a long to store the total file size.
+	long filesize;
+
+	if(archive_open(&archive, input)) return 1;
+
+	// Reading the g1a files of an archive, in order.
+	if(archive.type)
+	{
+		while(!archive_next(&archive, &member))
+		{
+			label = archive_label(input, &archive, &member);
+			if(!label)
+			{
+				error_emit(ERROR, "alloc");
+				break;
+			}
+
+			// Short members are caught by the display function.
+			memset(raw, 0, HEADER_SIZE);
+			if(archive_read(&archive, &member, raw, HEADER_SIZE) < 0)
+				error_emit(ERROR, "read", label, strerror(errno));
+			else
+			{
+				if(spaced && count++) putchar('\n');
+				show(label, raw, member.size);
+			}
+			free(label);
+		}
+
+		if(errno) error_emit(ERROR, "read", input, strerror(errno));
+		archive_close(&archive);
+		return 0;
+	}
+
+	// Opening file.
+	fp = fopen(input, "r");
+	if(!fp) return 1;
+	// Reading file header contents (short files are caught below).
+	memset(raw, 0, HEADER_SIZE);
+	fread(raw, HEADER_SIZE, 1, fp);
+	STATS_ADD(STATS_BYTES_READ, HEADER_SIZE);
+	STATS_ADD(STATS_READ_CALLS, 1);
+	// Retrieving the file size.
+	fseek(fp, 0, SEEK_END);
+	filesize = ftell(fp);
+	// Closing the file.
+	fclose(fp);
+
+	show(input, raw, filesize);
+	return 0;
+}
+
+/*
+	dump()
+
+	Dumps the file header contents, assuming the file is a g1a file. The
+	file may be an archive, whose g1a files are all dumped.
+
+	@arg	filename	File to dump header.
+*/
+
+void dump(const char *filename)
+{
+	// Handling failure by emitting a fatal error.
+	if(headers(filename, dump_header, 1))
+		error_emit(FATAL, "input", filename);
+}
+
+/*
+	dump_header()
+
+	Checks a header read from a g1a file and displays its contents.
+
+	@arg	filename	File name, for display.
+	@arg	raw		Header as stored in the file.
+	@arg	filesize	Total file size.
+*/
+
+void dump_header(const char *filename, const uint8_t *raw, uint64_t filesize)
+{
+	// Using an array to store decoded header data.
+	uint8_t data[HEADER_SIZE];
+	// Using the defect found in the header, if any.
+	const char *defect;
+	// Using a buffer for text fields (the longest is 14 bytes).
+	char text[16];
+	// Using an iterator.
+	int i;
+
+	// Printed text fields, in order, and their labels.
+	static const char *labels[][2] = {
+		{ "name",	"Program name   " },
+		{ "internal",	"Internal name  " },
+		{ "version",	"Version        " },
+		{ "date",	"Build date     " },
+	};
+
+	// Inverting the general header !
+	header_decode(raw, data);
+
+	// Checking file validity: why would we analyze an non-g1a file ?
+	defect = header_check(data, filesize);
+	if(defect)
+	{
+		error_emit(ERROR, "g1a-valid", filename, defect);
 		return;
 	}
 
 	// Printing the input file name.
 	printf("Input file     '%s'\n", filename);
 	// Printing the input file size.
-	printf("File size       %d bytes\n\n", filesize);
-
-	// Printing the program name.
-	printf("Program name   '");
-	ptr = data + 0x1d4;
-	// Printing the header characters and a line break.
-	while(ptr < data + 0x1dc && *ptr) putchar(*ptr++);
-	puts("'");
-
-	// Printing the program internal name.
-	printf("Internal name  '");
-	ptr = data + 0x020;
-	// Printing the header characters and a line break.
-	while(ptr < data + 0x028 && *ptr) putchar(*ptr++);
-	puts("'");
-
-	// Printing the program version.
-	printf("Version        '");
-	ptr = data + 0x030;
-	// Printing the header characters and a line break.
-	while(ptr < data + 0x03a && *ptr) putchar(*ptr++);
-	puts("'");
-
-	// Printing the program build date.
-	printf("Build date     '");
-	ptr = data + 0x03c;
-	// Printing the header characters and a line break.
-	while(ptr < data + 0x04a && *ptr) putchar(*ptr++);
-	puts("'\n");
+	printf("File size       %llu bytes\n\n", (unsigned long long)filesize);
+
+	// Printing the text fields, with a blank line after the last one.
+	for(i = 0; i < 4; i++) printf("%s'%s'\n%s", labels[i][1],
+		header_string(data, header_field(labels[i][0]), text),
+		i == 3 ? "\n" : "");
 
 	puts("Icon:");
-	bitmap_output((uint8_t *)(data + 0x4c), 30, 19, stdout);
+	bitmap_output(data + header_field("icon")->offset, 30, 19, stdout);
+}
+
+/*
+	catalog()
+
+	Lists the given g1a files, or the g1a files of the given archives, one
+	per line. Only their headers are read, so that large archives can be
+	indexed quickly.
+
+	@arg	options	Options structure.
+*/
+
+void catalog(const struct Options *options)
+{
+	// Using an iterator.
+	int i;
+
+	for(i = 0; i < options->input_count; i++)
+		if(headers(options->inputs[i], index_header, 0))
+		error_emit(ERROR, "read", options->inputs[i], strerror(errno));
+}
+
+/*
+	index_header()
+
+	Checks a header read from a g1a file and displays it on one line: file
+	name, file size, program name, internal name, version and build date,
+	separated by tabs.
+
+	@arg	filename	File name, for display.
+	@arg	raw		Header as stored in the file.
+	@arg	filesize	Total file size.
+*/
+
+void index_header(const char *filename, const uint8_t *raw,
+	uint64_t filesize)
+{
+	// Using decoded header data, and its defect if any.
+	uint8_t data[HEADER_SIZE];
+	const char *defect;
+	// Using a buffer for text fields, and an iterator.
+	char text[16];
+	int i;
+
+	// Listed text fields, in order.
+	static const char *fields[] = { "name", "internal", "version", "date" };
+
+	header_decode(raw, data);
+	defect = header_check(data, filesize);
+	if(defect)
+	{
+		error_emit(ERROR, "g1a-valid", filename, defect);
+		return;
+	}
+
+	printf("%s\t%llu", filename, (unsigned long long)filesize);
+	for(i = 0; i < 4; i++) printf("\t%s", header_string(data,
+		header_field(fields[i]), text));
+	putchar('\n');
+}
+
+/*
+	fsck()
+
+	Checks the headers of the given g1a files, and of the g1a files of the
+	given directories, and repairs them if requested. Every defective file
+	is listed on one line, with its defects and what was done, followed by
+	a summary of the whole run.
+
+	@arg	options	Options structure.
+
+	@return		Number of files whose header is still defective or which
+			could not be read.
+*/
+
+int fsck(const struct Options *options)
+{
+	// Using the file list and the current file.
+	struct Fsck list = { NULL, 0, 0 };
+	struct Fsck_File *file;
+	// Using the counts of every defect class, and of repaired, defective
+	// and unreadable files.
+	int defects[HEADER_DEFECTS] = { 0 };
+	int checked = 0, repaired = 0, defective = 0, unreadable = 0;
+	// Using iterators.
+	int i, k;
+
+	for(i = 0; i < options->input_count; i++)
+		if(fsck_add(&list, options->inputs[i]))
+		{
+			error_emit(ERROR, "read", options->inputs[i],
+				strerror(errno));
+			unreadable++;
+		}
+
+	fsck_run(&list, options->repair);
+
+	for(i = 0; i < list.count; i++)
+	{
+		file = list.files + i;
+
+		// Files that could not be read have not been checked.
+		if(file->error && !file->defects)
+		{
+			error_emit(ERROR, "read", file->path,
+				strerror(file->error));
+			unreadable++;
+			continue;
+		}
+		checked++;
+		if(!file->defects) continue;
+
+		// Listing the defects, separated by commas.
+		printf("%s\t", file->path);
+		for(k = 0; k < HEADER_DEFECTS; k++)
+		{
+			if(!(file->defects & (1 << k))) continue;
+			printf("%s%s", header_defects[k], file->defects >>
+				(k + 1) ? "," : "");
+			defects[k]++;
+		}
+
+		if(file->repaired) repaired++;
+		else defective++;
+
+		if(file->error) error_emit(ERROR, "repair", file->path,
+			strerror(file->error));
+		printf("\t%s\n", file->repaired ? "repaired" :
+			file->defects & ~HEADER_REPAIRABLE ? "unrepairable" :
+			options->repair ? "not repaired" : "repairable");
+	}
+
+	// Printing the summary.
+	printf("%sChecked        %d files\n", repaired + defective ? "\n" :
+		"", checked);
+	printf("Valid          %d\n", checked - repaired - defective);
+	printf("Defective      %d\n", repaired + defective);
+	for(k = 0; k < HEADER_DEFECTS; k++) if(defects[k])
+		printf("  %-13s%d\n", header_defects[k], defects[k]);
+	if(options->repair) printf("Repaired       %d\n", repaired);
+	printf("Remaining      %d\n", defective);
+	printf("Unreadable     %d\n", unreadable);
+
+	fsck_free(&list);
+	return defective + unreadable;
+}
+
+/*
+	scan()
+
+	Looks for the patterns of the patterns file in the payloads of the
+	given g1a files, and of the g1a files of the given directories. Every
+	match is listed on one line: file name, offset in the file and pattern
+	name, separated by tabs.
+
+	@arg	options	Options structure.
+
+	@return		Number of matches.
+*/
+
+int scan(const struct Options *options)
+{
+	// Using the patterns, the file list and the matches of every file.
+	struct Scan patterns;
+	struct Fsck list = { NULL, 0, 0 };
+	struct Scan_Result *results;
+	struct Scan_Match *match;
+	// Using the number of matches and iterators.
+	int found = 0, i, k;
+
+	if(scan_load(&patterns, options->scan))
+	{
+		if(errno != EINVAL) error_emit(ERROR, "scan-patterns",
+			options->scan, strerror(errno));
+		else if(patterns.line) error_emit(ERROR, "scan-syntax",
+			patterns.line, options->scan);
+		else error_emit(ERROR, "scan-empty", options->scan);
+		scan_free(&patterns);
+		return 0;
+	}
+
+	for(i = 0; i < options->input_count; i++)
+		if(fsck_add(&list, options->inputs[i])) error_emit(ERROR,
+		"read", options->inputs[i], strerror(errno));
+
+	results = calloc(list.count + 1, sizeof *results);
+	if(!results) error_emit(ERROR, "alloc");
+	else scan_run(&patterns, &list, results);
+
+	for(i = 0; results && i < list.count; i++)
+	{
+		if(results[i].error) error_emit(ERROR, "read",
+			list.files[i].path, strerror(results[i].error));
+
+		for(k = 0; k < results[i].count; k++)
+		{
+			match = results[i].matches + k;
+			printf("%s\t0x%llx\t%s\n", list.files[i].path,
+				(unsigned long long)match->offset,
+				patterns.patterns[match->pattern].name);
+		}
+		found += results[i].count;
+	}
+
+	if(results) scan_results_free(results, list.count);
+	free(results);
+	fsck_free(&list);
+	scan_free(&patterns);
+	return found;
+}
+
+/*
+	dedup()
+
+	Finds the given g1a files, and the g1a files of the given directories,
+	whose payloads are identical. Every cluster of such files is listed,
+	followed by a summary of the space they could save. Files identical as
+	a whole are replaced with links to the first one if requested.
+
+	@arg	options	Options structure.
+*/
+
+void dedup(const struct Options *options)
+{
+	// Using the file list, the file records and the current file.
+	struct Fsck list = { NULL, 0, 0 };
+	struct Dedup set;
+	struct Dedup_File *file;
+	// Using the counts of clusters, duplicates, identical and linked files,
+	// and of the bytes they could save.
+	int clusters = 0, duplicates = 0, identical = 0, linked = 0;
+	uint64_t payload_bytes = 0, identical_bytes = 0, linked_bytes = 0;
+	// Using iterators.
+	int i;
+
+	for(i = 0; i < options->input_count; i++)
+		if(fsck_add(&list, options->inputs[i])) error_emit(ERROR,
+		"read", options->inputs[i], strerror(errno));
+
+	if(dedup_init(&set, &list))
+	{
+		error_emit(ERROR, "alloc");
+		fsck_free(&list);
+		return;
+	}
+	dedup_run(&set);
+
+	for(i = 0; i < set.count; i++)
+	{
+		file = set.files + i;
+
+		if(file->error) error_emit(ERROR, "read", file->path,
+			strerror(file->error));
+		if(file->cluster < 0) continue;
+
+		// Starting a cluster with its first file.
+		if(file->cluster == i)
+		{
+			printf("%s%llu-byte payload:\n  %s\n", clusters++ ? "\n"
+				: "", (unsigned long long)(file->size
+				- HEADER_SIZE), file->path);
+			continue;
+		}
+
+		// Files sharing an inode take no space of their own.
+		if(!file->same)
+		{
+			duplicates++;
+			payload_bytes += file->size - HEADER_SIZE;
+		}
+		if(file->whole && !file->same)
+		{
+			identical++;
+			identical_bytes += file->size;
+		}
+
+		if(file->whole && !file->same && options->link)
+		{
+			if(dedup_link(&set, i, options->link))
+				error_emit(ERROR, "link", file->path,
+				set.files[file->cluster].path, strerror(errno));
+			else
+			{
+				linked++;
+				linked_bytes += file->size;
+				printf("  %s\tlinked\n", file->path);
+				continue;
+			}
+		}
+
+		printf("  %s\t%s\n", file->path, file->same ? "same file" :
+			file->whole ? "identical" : "same payload");
+	}
+
+	// Printing the summary.
+	printf("%sFiles          %d\n", clusters ? "\n" : "", set.count);
+	printf("Clusters       %d\n", clusters);
+	printf("Duplicates     %d (%llu payload bytes)\n", duplicates,
+		(unsigned long long)payload_bytes);
+	printf("Identical      %d (%llu bytes)\n", identical,
+		(unsigned long long)identical_bytes);
+	if(options->link) printf("Linked         %d (%llu bytes)\n", linked,
+		(unsigned long long)linked_bytes);
+
+	dedup_free(&set);
+	fsck_free(&list);
+}
+
+/*
+	pack()
+
+	Stores the given g1a files, and the g1a files of the given directories,
+	in the pack given with --pack, followed by a summary. Files that cannot
+	be read, or are too short to be g1a files, are reported and left out.
+
+	@arg	options	Options structure.
+*/
+
+void pack(const struct Options *options)
+{
+	// Using the file list, the current file and the pack written.
+	struct Fsck list = { NULL, 0, 0 };
+	struct Fsck_File *file;
+	struct Pack result;
+	// Using an iterator.
+	int i;
+
+	for(i = 0; i < options->input_count; i++)
+		if(fsck_add(&list, options->inputs[i])) error_emit(ERROR,
+		"read", options->inputs[i], strerror(errno));
+
+	// Reading the sizes of the files, and leaving out the short ones.
+	fsck_run(&list, 0);
+	for(i = 0; i < list.count; i++)
+	{
+		file = list.files + i;
+		if(file->error) error_emit(ERROR, "read", file->path,
+			strerror(file->error));
+		else if(file->defects & DEFECT_SHORT) error_emit(ERROR,
+			"g1a-valid", file->path, "too short");
+	}
+
+	if(pack_write(&result, options->pack, &list))
+	{
+		if(result.failed) error_emit(ERROR, "read", result.failed,
+			strerror(errno));
+		else error_emit(ERROR, "pack", options->pack, strerror(errno));
+		fsck_free(&list);
+		return;
+	}
+
+	// Printing the summary.
+	printf("Files          %d\n", result.count);
+	printf("Size           %llu bytes\n", (unsigned long long)result.size);
+	printf("Pack size      %llu bytes", (unsigned long long)result.stored);
+	if(result.size) printf(" (%llu%%)", (unsigned long long)(result.stored
+		* 100 / result.size));
+	putchar('\n');
+
+	fsck_free(&list);
+}
+
+/*
+	unpack()
+
+	Restores the g1a files of the given packs (or other archives), header
+	included, under the directory given with -o or the current directory,
+	at the paths given by their names.
+
+	@arg	options	Options structure.
+*/
+
+void unpack(const struct Options *options)
+{
+	// Using the output directory, the archive, its current member and the
+	// name of the member.
+	const char *dir = options->output ? options->output : ".";
+	struct Archive archive;
+	struct Archive_Member member;
+	char *label;
+	// Using an iterator.
+	int i;
+
+	for(i = 0; i < options->input_count; i++)
+	{
+		if(archive_open(&archive, options->inputs[i]))
+		{
+			error_emit(ERROR, "read", options->inputs[i],
+				strerror(errno));
+			continue;
+		}
+		if(!archive.type)
+		{
+			error_emit(ERROR, "read", options->inputs[i],
+				"not a pack");
+			continue;
+		}
+
+		while(!archive_next(&archive, &member))
+		{
+			label = archive_label(options->inputs[i], &archive,
+				&member);
+			if(!label)
+			{
+				error_emit(ERROR, "alloc");
+				break;
+			}
+
+			if(pack_restore(&archive, &member, dir)) error_emit(
+				ERROR, "unpack", label, dir, strerror(errno));
+			free(label);
+		}
+
+		if(errno) error_emit(ERROR, "read", options->inputs[i],
+			strerror(errno));
+		archive_close(&archive);
+	}
+}
+
+/*
+	manifest()
+
+	Reads the batch manifest, and adds its jobs to the input files. Every
+	line lists an input file, optionally followed by its icon file, which
+	may be a sprite sheet cell ('sheet.bmp@col,row'). Empty lines and lines
+	starting with '#' are ignored.
+
+	@arg	options	Options structure, whose input and icon lists are
+			extended.
+*/
+
+void manifest(struct Options *options)
+{
+	// Using the manifest file and its size.
+	FILE *fp = fopen(options->manifest, "r");
+	long size;
+	// Using the extended lists, the current line and its fields.
+	char **inputs, **icons, *line, *next, *input, *icon, *extra;
+	int count = 0;
+
+	if(!fp || fseek(fp, 0, SEEK_END) || (size = ftell(fp)) < 0
+		|| fseek(fp, 0, SEEK_SET)) goto fail;
+
+	options->manifest_data = malloc(size + 1);
+	if(!options->manifest_data)
+	{
+		error_emit(ERROR, "alloc");
+		fclose(fp);
+		return;
+	}
+	if(fread(options->manifest_data, 1, size, fp) != (size_t)size)
+		goto fail;
+	STATS_ADD(STATS_BYTES_READ, size);
+	STATS_ADD(STATS_READ_CALLS, 1);
+	fclose(fp);
+	options->manifest_data[size] = 0;
+
+	// Sizing the lists for one job per line at most.
+	for(line = options->manifest_data; *line; line++)
+		count += *line == '\n';
+	count += options->input_count + 1;
+
+	inputs = realloc(options->inputs, count * sizeof *inputs);
+	if(inputs) options->inputs = inputs;
+	icons = calloc(count, sizeof *icons);
+	if(!inputs || !icons)
+	{
+		error_emit(ERROR, "alloc");
+		free(icons);
+		return;
+	}
+	options->icons = icons;
+
+	for(line = options->manifest_data; line; line = next)
+	{
+		// Splitting the line, then its fields.
+		next = strchr(line, '\n');
+		if(next) *next++ = 0;
+
+		input = strtok(line, " \t\r");
+		if(!input || *input == '#') continue;
+		icon = strtok(NULL, " \t\r");
+		extra = icon ? strtok(NULL, " \t\r") : NULL;
+		if(extra) error_emit(ERROR, "illegal", extra);
+
+		icons[options->input_count] = icon;
+		inputs[options->input_count++] = input;
+		if(!options->input) options->input = input;
+	}
+	return;
+
+fail:
+	error_emit(ERROR, "manifest", options->manifest, strerror(errno));
+	if(fp) fclose(fp);
+}
+
+/*
+	batch()
+
+	Wraps every input file into a g1a file, or dumps every input file if
+	the dump option is set. Outputs are named after their input with the
+	extension '.g1a', in the directory given with -o or next to the input.
+	Unless a name was given, each program is named after its output.
+
+	With a bundle, outputs are written as entries of a single tar archive
+	instead, named after the base name of their input (in the directory
+	given with -o, inside the archive). Inputs whose entries would share a
+	name are refused.
+
+	@arg	options	Options structure.
+*/
+
+void batch(const struct Options *options)
+{
+	// Using the jobs, and the options of the current job.
+	struct Batch_Job *jobs;
+	struct Options job;
+	int count = options->input_count;
+	// Using the backend used, the bundle and its state, and iterators.
+	enum Batch_Backend used;
+	struct Bundle bundle;
+	const char *base;
+	int broken, i;
+
+	jobs = calloc(count, sizeof *jobs);
+	if(!jobs)
+	{
+		error_emit(ERROR, "alloc");
+		return;
+	}
+
+	// Preparing the jobs: headers are generated here, only sizes and
+	// checksums are left to set.
+	for(i = 0; i < count; i++)
+	{
+		jobs[i].input = options->inputs[i];
+		if(options->dump) continue;
+
+		// Bundle entries do not keep the directory of the input.
+		base = strrchr(jobs[i].input, '/');
+		base = options->bundle && base ? base + 1 : jobs[i].input;
+		jobs[i].output = output_name(base, options->output, ".g1a");
+		if(!jobs[i].output)
+		{
+			error_emit(ERROR, "alloc");
+			goto end;
+		}
+
+		// Naming the program after its output, without extension.
+		job = *options;
+		if(!*job.name) default_name(job.name, jobs[i].output);
+
+		// Reading the icon of the job. Sprite sheet cells are copied
+		// from the sheet, which is only decoded once.
+		if(options->icons && options->icons[i])
+		{
+			STATS_BEGIN(STATS_ICON);
+			bitmap_read(options->icons[i], 30, 19, job.icon,
+				options->dither, options->arena);
+			arena_reset(options->arena);
+			STATS_END(STATS_ICON);
+		}
+
+		STATS_BEGIN(STATS_GENERATE);
+		generate(&job, jobs[i].header);
+		STATS_END(STATS_GENERATE);
+	}
+
+	// Writing the archive sequentially, stopping if it breaks.
+	if(options->bundle)
+	{
+		// Extracting an archive keeps only the last entry of a name.
+		if(bundle_unique(jobs, count, &base))
+		{
+			error_emit(ERROR, "alloc");
+			goto end;
+		}
+		if(base)
+		{
+			error_emit(ERROR, "bundle-name", options->bundle, base);
+			goto end;
+		}
+
+		// Entries are dated from SOURCE_DATE_EPOCH if it is set, and
+		// from the epoch in reproducible mode.
+		if(bundle_open(&bundle, options->bundle, options->epoch >= 0
+			? options->epoch : options->reproducible ? 0 : -1))
+		{
+			error_emit(ERROR, "bundle", options->bundle,
+				strerror(errno));
+			goto end;
+		}
+
+		STATS_ADD(STATS_JOBS_QUEUED, count);
+		for(i = 0; i < count; i++)
+		{
+			TRACE_BEGIN("bundle", "job", i);
+			broken = bundle_add(&bundle, jobs + i, jobs[i].output);
+			TRACE_END("bundle");
+			STATS_ADD(STATS_JOBS_DONE, 1);
+			if(broken) break;
+		}
+
+		if(i < count)
+		{
+			error_emit(ERROR, "bundle", options->bundle,
+				strerror(errno));
+			bundle_abort(&bundle);
+			goto end;
+		}
+		if(bundle_close(&bundle)) error_emit(ERROR, "bundle",
+			options->bundle, strerror(errno));
+	}
+
+	// Running all the jobs.
+	else
+	{
+		used = options->dump ? batch_dump(jobs, count, options->io)
+			: batch_wrap(jobs, count, options->io);
+		if(options->io == BATCH_URING && used != BATCH_URING)
+			error_emit(WARNING, "uring");
+	}
+
+	// Reporting failures, and displaying headers in input order.
+	for(i = 0; i < count; i++)
+	{
+		if(jobs[i].defect) error_emit(ERROR, "elf", jobs[i].input,
+			jobs[i].defect);
+		else if(jobs[i].error && options->dump) error_emit(ERROR,
+			"batch-read", jobs[i].input, strerror(jobs[i].error));
+		else if(jobs[i].error) error_emit(ERROR, "batch",
+			jobs[i].input, jobs[i].output, strerror(jobs[i].error));
+		else if(options->dump)
+		{
+			if(i) putchar('\n');
+			dump_header(jobs[i].input, jobs[i].header,
+				jobs[i].size);
+		}
+	}
+
+end:
+	for(i = 0; i < count; i++) free(jobs[i].output);
+	free(jobs);
+}
+
+/*
+	diff()
+
+	Compares two g1a files and displays their differences: header fields
+	first, then ranges of binary content. Both files are mapped, so that
+	identical parts are never copied.
+
+	@arg	first	First g1a file.
+	@arg	second	Second g1a file.
+
+	@return		Number of differences found (header fields and content
+			ranges), 0 if the files are identical or invalid.
+*/
+
+int diff(const char *first, const char *second)
+{
+	// Using both files and their decoded headers.
+	const char *names[2] = { first, second };
+	struct Payload files[2];
+	uint8_t data[2][HEADER_SIZE];
+	// Using the defect of invalid files.
+	const char *defect;
+	// Using a difference counter and an iterator.
+	int count, i;
+
+	for(i = 0; i < 2; i++)
+	{
+		// Loading the file, which is mapped if possible.
+		if(payload_open(files + i, names[i], 0))
+			error_emit(FATAL, "input", names[i]);
+
+		// Checking that it is a valid g1a file.
+		defect = "too short";
+		if(files[i].size >= HEADER_SIZE)
+		{
+			header_decode(files[i].data, data[i]);
+			defect = header_check(data[i], files[i].size);
+		}
+		if(!defect) continue;
+
+		error_emit(ERROR, "g1a-valid", names[i], defect);
+		payload_close(files);
+		if(i) payload_close(files + 1);
+		return 0;
+	}
+
+	printf("--- %s\n+++ %s\n\n", first, second);
+
+	// Comparing the headers, then the binary contents.
+	count = diff_header(data[0], data[1]);
+	count += diff_payload(files[0].data + HEADER_SIZE, files[0].size -
+		HEADER_SIZE, files[1].data + HEADER_SIZE, files[1].size -
+		HEADER_SIZE);
+
+	if(!count) puts("Files are identical.");
+
+	payload_close(files);
+	payload_close(files + 1);
+	return count;
+}
+
+/*
+	unwrap()
+
+	Extracts the binary content of every input g1a file. With a single
+	input, the output file name is the one given with -o; with several, -o
+	names the output directory. By default, outputs are written next to the
+	input files, with extension '.bin'.
+
+	@arg	options	Options structure.
+*/
+
+void unwrap(const struct Options *options)
+{
+	// Using the output file name, and the defect of invalid files.
+	char *output;
+	const char *defect;
+	// Using the archive given as input, if any.
+	struct Archive archive;
+	// Using an iterator.
+	int i;
+
+	for(i = 0; i < options->input_count; i++)
+	{
+		// Extracting the g1a files of archives.
+		if(archive_open(&archive, options->inputs[i]))
+		{
+			error_emit(ERROR, "read", options->inputs[i],
+				strerror(errno));
+			continue;
+		}
+		if(archive.type)
+		{
+			unwrap_archive(options, &archive, options->inputs[i]);
+			archive_close(&archive);
+			continue;
+		}
+
+		// Building the output file name.
+		if(options->output && options->input_count == 1)
+			output = strdup(options->output);
+		else output = output_name(options->inputs[i],
+			options->output, ".bin");
+		if(!output)
+		{
+			error_emit(ERROR, "alloc");
+			return;
+		}
+
+		// Extracting the file, and going on with the next ones on
+		// failure.
+		if(extract(options->inputs[i], output, &defect))
+		{
+			if(defect) error_emit(ERROR, "g1a-valid",
+				options->inputs[i], defect);
+			else error_emit(ERROR, "extract", options->inputs[i],
+				output, strerror(errno));
+		}
+
+		free(output);
+	}
+}
+
+/*
+	unwrap_archive()
+
+	Extracts the binary content of the g1a files of an archive. Outputs are
+	named after the members, in the directory given with -o or next to the
+	archive. A single member, given as 'archive:member', is extracted to
+	the file given with -o, as a single file is.
+
+	@arg	options	Options structure.
+	@arg	archive	Open archive.
+	@arg	input	Input name the archive was opened with.
+*/
+
+void unwrap_archive(const struct Options *options, struct Archive *archive,
+	const char *input)
+{
+	// Using the current member, its base name, its name for display and
+	// its path next to the archive.
+	struct Archive_Member member;
+	const char *base, *defect;
+	char *label, *path, *output;
+	// Using the length of the archive directory, with its slash.
+	int length;
+
+	// Finding the directory of the archive, before the member name.
+	length = archive->member ? archive->member - 1 - input : (int)strlen(
+		input);
+	while(length && input[length - 1] != '/') length--;
+
+	while(!archive_next(archive, &member))
+	{
+		base = strrchr(member.name, '/');
+		base = base ? base + 1 : member.name;
+
+		// Building the output file name.
+		path = malloc(length + strlen(base) + 1);
+		if(path) sprintf(path, "%.*s%s", length, input, base);
+		if(!path) output = NULL;
+		else if(options->output && archive->member
+			&& options->input_count == 1)
+			output = strdup(options->output);
+		else output = output_name(path, options->output, ".bin");
+		label = archive_label(input, archive, &member);
+
+		if(!output || !label)
+		{
+			error_emit(ERROR, "alloc");
+			free(path);
+			free(output);
+			free(label);
+			return;
+		}
+
+		// Extracting the member, and going on with the next ones on
+		// failure.
+		if(extract_member(archive, &member, output, &defect))
+		{
+			if(defect) error_emit(ERROR, "g1a-valid", label,
+				defect);
+			else error_emit(ERROR, "extract", label, output,
+				strerror(errno));
+		}
+
+		free(path);
+		free(output);
+		free(label);
+	}
+
+	if(errno) error_emit(ERROR, "read", input, strerror(errno));
 }
 
 /*
@@ -719,11 +2583,15 @@ void help(void)
 "\n"
 "g1a-wrapper creates a g1a file (add-in application for CASIO fx-9860G\n"
 "calculator series) from the given binary file and options.\n"
+"The binary file may also be an ELF file linked at 0x00300200, whose\n"
+"loadable segments are used directly.\n"
 "\n\n"
 "General options :\n"
 "  -o   Output file name. Default is 'addin.g1a'.\n"
-"  -i   Program icon, must be a valid non-indexed bmp file.\n"
-"       Default is a blank icon.\n"
+"  -i   Program icon, a 1, 16, 24 or 32-bit bmp file. Larger images are\n"
+"       scaled down to 30x19. With '<file>@<col>,<row>', the icon is a\n"
+"       cell of a sprite sheet of 30x19 cells, counted from the top left\n"
+"       corner. Default is a blank icon.\n"
 "  -n   Name of the add-in application. At most 8 characters.\n"
 "       Default is the truncated output filename.\n"
 "\n"
@@ -733,12 +2601,112 @@ void help(void)
 "  --internal=<name>  Internal name of the program. Uppercase and '@' at\n"
 "                     beginning advised. Default is '@ADDIN'.\n"
 "  --date=<date>      Date of the build, using format 'yyyy.MMdd.hhmm'.\n"
-"                     Default is the current time.\n"
+"                     Default is $SOURCE_DATE_EPOCH if set (in UTC), or\n"
+"                     the current time.\n"
+"  --dither           Dither scaled icons (Floyd-Steinberg) instead of\n"
+"                     thresholding them.\n"
+"\n"
+"Build system options :\n"
+"  -MD         Write a dependency file for make or ninja listing the input\n"
+"              and bitmap files, named after the output with extension '.d'.\n"
+"  -MF <file>  Write the dependency file to <file>.\n"
 "\n"
 "Other options :\n"
 "  -h, --help           Displays this help.\n"
 "      --info           Displays header format information.\n"
-"  -d                   Display informations about a g1a file.\n"
+"  -d                   Display informations about a g1a file, or about\n"
+"                       the g1a files of a tar or zip archive or pack.\n"
+"      --diff           Compare two g1a files: header fields, and binary\n"
+"                       content as byte ranges. Returns 1 if they differ.\n"
+"      --batch          Wrap (or dump, with -d) every given file. Outputs\n"
+"                       are named after their input, in the directory\n"
+"                       given with -o or next to the input.\n"
+"      --bundle <file>  Batch mode, writing all the outputs as entries of a\n"
+"                       tar archive ('-' for the standard output) instead\n"
+"                       of separate files. With -o, entries are put in\n"
+"                       that directory of the archive. Entries are dated\n"
+"                       $SOURCE_DATE_EPOCH if set.\n"
+"      --manifest=<file>\n"
+"                       Batch mode, with jobs listed in a file: one\n"
+"                       input file per line, optionally followed by its\n"
+"                       icon (which may be a sprite sheet cell). Sheets\n"
+"                       are decoded once for all the jobs.\n"
+"      --io=<backend>   Batch I/O backend: 'uring', 'threads' or 'auto'\n"
+"                       (io_uring if available). Default is 'auto'.\n"
+"      --extract        Extract the binary content of the given g1a files.\n"
+"                       With several files, -o names the output directory;\n"
+"                       by default, '.bin' files are written next to them.\n"
+"      --index          List the given g1a files, one per line: file name,\n"
+"                       size, name, internal name, version and date.\n"
+"      --fsck           Check the headers of the given g1a files, and of\n"
+"                       the '.g1a' files of the given directories: list\n"
+"                       every defective file with all its defects, then a\n"
+"                       summary. Returns 1 if defects remain.\n"
+"      --repair         With --fsck, rewrite the headers whose only defects\n"
+"                       are their sizes, checksums or MCS inversion.\n"
+"      --scan <file>    Look for the byte signatures listed in <file> in\n"
+"                       the payloads of the given g1a files, and of the\n"
+"                       '.g1a' files of the given directories. Every line\n"
+"                       of <file> is a name followed by a quoted string or\n"
+"                       by hex bytes. Matches are listed one per line:\n"
+"                       file name, offset and pattern name. Returns 1 if\n"
+"                       nothing is found.\n"
+"      --dedup          Find the given g1a files, and the '.g1a' files of\n"
+"                       the given directories, whose payloads are\n"
+"                       identical, and list them by cluster with the\n"
+"                       space they take more than once.\n"
+"      --link[=<mode>]  With --dedup, replace files that are identical as\n"
+"                       a whole with links to the first file of their\n"
+"                       cluster: 'reflink', 'hard' (hard links), or\n"
+"                       'auto' (reflink if supported, the default).\n"
+"      --pack <file>    Store the given g1a files, and the '.g1a' files of\n"
+"                       the given directories, in a single pack file:\n"
+"                       headers uncompressed in one table, payloads\n"
+"                       compressed one by one. Packs are read as archives.\n"
+"      --unpack         Restore the g1a files of the given packs, whole,\n"
+"                       under the directory given with -o (default is the\n"
+"                       current directory).\n"
+"      --variant <set>  Write an output file with its own settings, given\n"
+"                       as 'out=<file>,name=<name>,icon=<bmp>,\n"
+"                       version=<text>,internal=<name>,date=<date>'. Only\n"
+"                       'out' is mandatory; the others default to the\n"
+"                       command-line options. May be repeated: all the\n"
+"                       variants are written from a single read of the\n"
+"                       binary, instead of the default output.\n"
+"      --watch[=<ms>]   Keep running and rebuild the output whenever the\n"
+"                       input or icon file is rewritten, once no change\n"
+"                       happened for <ms> milliseconds (default is 5).\n"
+"      --input-fd <n>   Read the binary from the inherited file descriptor\n"
+"                       <n> (a file, memfd or pipe) instead of a file.\n"
+"                       Needs -o or --output-fd.\n"
+"      --output-fd <n>  Write the g1a file to the inherited file descriptor\n"
+"                       <n> (a file, memfd or pipe), at its current\n"
+"                       position, instead of a file.\n"
+"      --durable        Sync output files to disk before exiting (once per\n"
+"                       file system).\n"
+"      --reproducible   Refuse nondeterministic defaults: the build date\n"
+"                       must come from --date or $SOURCE_DATE_EPOCH.\n"
+"      --cache=<dir>    Reuse g1a files generated earlier from the same\n"
+"                       payload and options, stored in this directory.\n"
+"      --cache-size=<n> Cache size limit in bytes, with optional K, M or G\n"
+"                       suffix. Default is 256M.\n"
+"      --cache-stats    Display cache statistics (needs --cache).\n"
+"      --stats[=<file>] Report phase timings and I/O counters on stderr, or\n"
+"                       as JSON in the given file.\n"
+"      --trace <file>   Record phases and batch jobs, per thread, in the\n"
+"                       Chrome trace-event format (for Perfetto), written\n"
+"                       to the given file at exit.\n"
+"      --metrics=<file> Write metrics in the Prometheus text format to the\n"
+"                       given file at exit, and after every rebuild with\n"
+"                       --watch.\n"
+"\n"
+"Archives :\n"
+"  -d, --extract and --index also read g1a files stored in tar and zip\n"
+"  archives and in packs, without unpacking them: 'archive.zip' stands\n"
+"  for all its members with extension '.g1a', and\n"
+"  'archive.zip:dir/file.g1a' for a single one. Only member headers are\n"
+"  read, except when extracting; the headers of packs are not even read,\n"
+"  but mapped in memory.\n"
 "\n\n"
 "You may also disable some warnings or errors during program execution.\n"
 "However, disabling errors is strongly discouraged.\n"
@@ -749,6 +2717,7 @@ void help(void)
 "  -Wbmp-width    The icon does not have the expected width.\n"
 "  -Wbmp-height   The icon does not have the expected height.\n"
 "  -Wbmp-color    The bitmap icon is not absolutely blank-and-white.\n"
+"  -Wcache        The cache could not be used.\n"
 "\n"
 "Error options :\n"
 "  -Eoption       Unrecognized option found.\n"
@@ -767,41 +2736,22 @@ void help(void)
 
 void info(void)
 {
+	// Using a field iterator.
+	const struct Header_Field *field;
+
 	// Printing header file format informations.
 	puts(
 		"Add-in header format :\n"
 		"\n"
-		"Offset	Size	Description\n"
-		"0x000	8	\"USBPower\"\n"
-		"0x008	1	0xF3 (AddIn)\n"
-		"0x009	5	{ 0x00, 0x10, 0x00, 0x10, 0x00 }\n"
-		"0x00E	1	@0x13 + 0x41\n"
-		"0x00F	1	0x01\n"
-		"0x010	4	File size: unsigned int, big endian\n"
-		"0x014	1	@0x13 + 0xB8\n"
-		"0x015	9	[Unsignificant]\n"
-		"0x01E	2	Number of objects (if MCS)\n"
-		"0x020	8	Internal name '@APPNAME'\n"
-		"0x028	3	-\n"
-		"0x02B	1	Number of estrips\n"
-		"0x02C	4	-\n"
-		"0x030	10	Version 'MM.mm.pppp'\n"
-		"0x03A	2	-\n"
-		"0x03C	14	Date 'yyyy.MMdd.hhmm'\n"
-		"0x04A	2	-\n"
-		"0x04C	68	30*17 icon.\n"
-		"0x090	80	eStrip 1\n"
-		"0x0E0	80	eStrip 2\n"
-		"0x130	80	eStrip 3\n"
-		"0x180	80	eStrip 4\n"
-		"0x1D0	4	-\n"
-		"0x1D4	8	Program name\n"
-		"0x1DC	20	-\n"
-		"0x1F0	4	File size: unsigned long, big endian\n"
-		"0x1F4	12	-\n"
-		"0x200	...	Binary content\n"
+		"Offset	Size	Description"
 	);
 
+	// Printing the fields from the header description table.
+	for(field = header_fields; field->size; field++)
+		printf("0x%03X\t%d\t%s\n", field->offset, field->size,
+		field->description);
+	puts("0x200\t...\tBinary content\n");
+
 	// Exiting the program.
 	exit(0);
 }
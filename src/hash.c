@@ -0,0 +1,211 @@
+/*
+	Hash module.
+*/
+
+
+
+/*
+	Header inclusions.
+*/
+
+// Standard headers.
+#include <string.h>
+
+// Module header.
+#include "hash.h"
+
+
+
+/*
+	Constants definitions.
+*/
+
+// Block multiplication constants.
+#define C1	0x87c37b91114253d5ull
+#define C2	0x4cf5ad432745937full
+
+
+
+/*
+	Static function definitions.
+*/
+
+/*
+	rotl(), fmix(), load()
+
+	Rotation, final avalanche and little-endian load helpers.
+*/
+
+static inline uint64_t rotl(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t fmix(uint64_t k)
+{
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdull;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ull;
+	k ^= k >> 33;
+	return k;
+}
+
+static inline uint64_t load(const uint8_t *p)
+{
+	return (uint64_t)p[0] | ((uint64_t)p[1] << 8) | ((uint64_t)p[2] << 16)
+		| ((uint64_t)p[3] << 24) | ((uint64_t)p[4] << 32)
+		| ((uint64_t)p[5] << 40) | ((uint64_t)p[6] << 48)
+		| ((uint64_t)p[7] << 56);
+}
+
+/*
+	block()
+
+	Mixes a 16-byte block into the hash state.
+
+	@arg	hash	Hash state.
+	@arg	p	Block address.
+*/
+
+static inline void block(struct Hash *hash, const uint8_t *p)
+{
+	uint64_t k1 = load(p), k2 = load(p + 8);
+
+	k1 *= C1; k1 = rotl(k1, 31); k1 *= C2; hash->h1 ^= k1;
+	hash->h1 = rotl(hash->h1, 27) + hash->h2;
+	hash->h1 = hash->h1 * 5 + 0x52dce729;
+
+	k2 *= C2; k2 = rotl(k2, 33); k2 *= C1; hash->h2 ^= k2;
+	hash->h2 = rotl(hash->h2, 31) + hash->h1;
+	hash->h2 = hash->h2 * 5 + 0x38495ab5;
+}
+
+
+
+/*
+	Function definitions.
+*/
+
+/*
+	hash_init()
+
+	Initializes a hash computation.
+
+	@arg	hash	Hash state.
+	@arg	seed	Seed value.
+*/
+
+void hash_init(struct Hash *hash, uint64_t seed)
+{
+	hash->h1 = hash->h2 = seed;
+	hash->length = 0;
+	hash->tail_length = 0;
+}
+
+/*
+	hash_update()
+
+	Hashes data. Can be called any number of times with arbitrary sizes.
+
+	@arg	hash	Hash state.
+	@arg	data	Data to hash.
+	@arg	size	Size of the data.
+*/
+
+void hash_update(struct Hash *hash, const void *data, size_t size)
+{
+	// Using a byte pointer and the size of a partial copy.
+	const uint8_t *p = data;
+	size_t x;
+
+	hash->length += size;
+
+	// Completing a pending block.
+	if(hash->tail_length)
+	{
+		x = 16 - hash->tail_length;
+		if(x > size) x = size;
+		memcpy(hash->tail + hash->tail_length, p, x);
+		hash->tail_length += x;
+		p += x;
+		size -= x;
+
+		if(hash->tail_length < 16) return;
+		block(hash, hash->tail);
+		hash->tail_length = 0;
+	}
+
+	// Hashing full blocks directly from the data.
+	for(; size >= 16; p += 16, size -= 16) block(hash, p);
+
+	// Keeping the remaining bytes for later.
+	memcpy(hash->tail, p, size);
+	hash->tail_length = size;
+}
+
+/*
+	hash_final()
+
+	Finalizes the computation. The state must not be used afterwards.
+
+	@arg	hash	Hash state.
+	@arg	value	Array receiving the 128-bit hash value.
+*/
+
+void hash_final(struct Hash *hash, uint64_t value[2])
+{
+	// Using the tail words.
+	uint64_t k1 = 0, k2 = 0;
+	const uint8_t *t = hash->tail;
+	unsigned int i;
+
+	// Mixing the last, incomplete block.
+	for(i = hash->tail_length; i > 8; i--) k2 |= (uint64_t)t[i-1]
+		<< (8 * (i - 9));
+	for(i = hash->tail_length < 8 ? hash->tail_length : 8; i > 0; i--)
+		k1 |= (uint64_t)t[i-1] << (8 * (i - 1));
+
+	if(hash->tail_length > 8)
+	{
+		k2 *= C2; k2 = rotl(k2, 33); k2 *= C1; hash->h2 ^= k2;
+	}
+	if(hash->tail_length)
+	{
+		k1 *= C1; k1 = rotl(k1, 31); k1 *= C2; hash->h1 ^= k1;
+	}
+
+	// Finalization.
+	hash->h1 ^= hash->length;
+	hash->h2 ^= hash->length;
+	hash->h1 += hash->h2;
+	hash->h2 += hash->h1;
+	hash->h1 = fmix(hash->h1);
+	hash->h2 = fmix(hash->h2);
+	hash->h1 += hash->h2;
+	hash->h2 += hash->h1;
+
+	value[0] = hash->h1;
+	value[1] = hash->h2;
+}
+
+/*
+	hash_data()
+
+	Hashes a memory area.
+
+	@arg	data	Data to hash.
+	@arg	size	Size of the data.
+	@arg	seed	Seed value.
+	@arg	value	Array receiving the 128-bit hash value.
+*/
+
+void hash_data(const void *data, size_t size, uint64_t seed,
+	uint64_t value[2])
+{
+	struct Hash hash;
+
+	hash_init(&hash, seed);
+	hash_update(&hash, data, size);
+	hash_final(&hash, value);
+}
@@ -0,0 +1,368 @@
+/*
+	Header module.
+*/
+
+
+
+/*
+	Header inclusions.
+*/
+
+// Standard headers.
+#include <string.h>
+
+// Project headers.
+#include "g1a-wrapper.h"
+#include "header.h"
+
+
+
+/*
+	Global variables definitions.
+*/
+
+// Header layout. Offsets must be increasing.
+const struct Header_Field header_fields[] = {
+	{ 0x000,  8, FIELD_CONSTANT, "magic", "\"USBPower\"",
+		"USBPower", 0, "\"USBPower\"" },
+	{ 0x008,  1, FIELD_CONSTANT, "type", "0xF3 (AddIn)",
+		"\xf3", 0, "not an add-in" },
+	{ 0x009,  5, FIELD_CONSTANT, "unknown1",
+		"{ 0x00, 0x10, 0x00, 0x10, 0x00 }",
+		"\x00\x10\x00\x10\x00", 0, NULL },
+	{ 0x00e,  1, FIELD_CHECKSUM, "checksum1", "@0x13 + 0x41",
+		"\x41", 0, "wrong checksums" },
+	{ 0x00f,  1, FIELD_CONSTANT, "control", "0x01",
+		"\x01", 0, NULL },
+	{ 0x010,  4, FIELD_SIZE, "size1",
+		"File size: unsigned int, big endian",
+		NULL, 0, "wrong file size" },
+	{ 0x014,  1, FIELD_CHECKSUM, "checksum2", "@0x13 + 0xB8",
+		"\xb8", 0, "wrong checksums" },
+	{ 0x015,  9, FIELD_RAW, "gap1", "[Unsignificant]",
+		NULL, 0, NULL },
+	{ 0x01e,  2, FIELD_RAW, "objects", "Number of objects (if MCS)",
+		NULL, 0, NULL },
+	{ 0x020,  8, FIELD_STRING, "internal", "Internal name '@APPNAME'",
+		NULL, offsetof(struct Options, internal), NULL },
+	{ 0x028,  3, FIELD_RAW, "gap2", "-",
+		NULL, 0, NULL },
+	{ 0x02b,  1, FIELD_RAW, "estrips", "Number of estrips",
+		NULL, 0, NULL },
+	{ 0x02c,  4, FIELD_RAW, "gap3", "-",
+		NULL, 0, NULL },
+	{ 0x030, 10, FIELD_STRING, "version", "Version 'MM.mm.pppp'",
+		NULL, offsetof(struct Options, version), NULL },
+	{ 0x03a,  2, FIELD_RAW, "gap4", "-",
+		NULL, 0, NULL },
+	{ 0x03c, 14, FIELD_STRING, "date", "Date 'yyyy.MMdd.hhmm'",
+		NULL, offsetof(struct Options, date), NULL },
+	{ 0x04a,  2, FIELD_RAW, "gap5", "-",
+		NULL, 0, NULL },
+	{ 0x04c, 68, FIELD_ICON, "icon", "30*17 icon.",
+		NULL, 0, NULL },
+	{ 0x090, 80, FIELD_RAW, "estrip1", "eStrip 1",
+		NULL, 0, NULL },
+	{ 0x0e0, 80, FIELD_RAW, "estrip2", "eStrip 2",
+		NULL, 0, NULL },
+	{ 0x130, 80, FIELD_RAW, "estrip3", "eStrip 3",
+		NULL, 0, NULL },
+	{ 0x180, 80, FIELD_RAW, "estrip4", "eStrip 4",
+		NULL, 0, NULL },
+	{ 0x1d0,  4, FIELD_RAW, "gap6", "-",
+		NULL, 0, NULL },
+	{ 0x1d4,  8, FIELD_STRING, "name", "Program name",
+		NULL, offsetof(struct Options, name), NULL },
+	{ 0x1dc, 20, FIELD_RAW, "gap7", "-",
+		NULL, 0, NULL },
+	{ 0x1f0,  4, FIELD_SIZE, "size2",
+		"File size: unsigned long, big endian",
+		NULL, 0, "wrong file size" },
+	{ 0x1f4, 12, FIELD_RAW, "gap8", "-",
+		NULL, 0, NULL },
+	{ 0, 0, 0, NULL, NULL, NULL, 0, NULL }
+};
+
+// Defect classes, in the order of their bits. Checked fields have the
+// name of their field.
+const char *header_defects[HEADER_DEFECTS] = {
+	"short", "large", "magic", "type", "inverted", "size1", "size2",
+	"checksum1", "checksum2"
+};
+
+
+
+/*
+	Static variables definitions.
+*/
+
+// Header template, and its initialization indicator.
+static uint8_t template[HEADER_SIZE];
+static int template_ready = 0;
+
+
+
+/*
+	Function definitions.
+*/
+
+/*
+	header_template()
+
+	Returns a header in which every constant field is set and everything
+	else is zero. It is assembled on the first call only.
+
+	@return		Header template.
+*/
+
+const uint8_t *header_template(void)
+{
+	// Using a field iterator.
+	const struct Header_Field *field;
+
+	if(template_ready) return template;
+
+	for(field = header_fields; field->size; field++)
+	{
+		if(field->type != FIELD_CONSTANT) continue;
+		memcpy(template + field->offset, field->value, field->size);
+	}
+
+	template_ready = 1;
+	return template;
+}
+
+/*
+	header_field()
+
+	Looks up a field by its short name.
+
+	@arg	name	Field name.
+
+	@return		Field descriptor, or NULL if there is no such field.
+*/
+
+const struct Header_Field *header_field(const char *name)
+{
+	const struct Header_Field *field;
+
+	for(field = header_fields; field->size; field++)
+		if(!strcmp(field->name, name)) return field;
+
+	return NULL;
+}
+
+/*
+	header_finalize()
+
+	Sets the file size and checksum fields of a header, and inverts its MCS
+	part as stored on disk.
+
+	@arg	data	Header data.
+	@arg	size	Total file size.
+*/
+
+void header_finalize(uint8_t *data, uint32_t size)
+{
+	// Using a field iterator and a byte iterator.
+	const struct Header_Field *field;
+	int i;
+
+	for(field = header_fields; field->size; field++)
+	{
+		// Writing the size in big endian.
+		if(field->type == FIELD_SIZE) for(i = 0; i < 4; i++)
+			data[field->offset + i] = size >> (24 - 8 * i);
+
+		// Computing the checksums (automatically truncated).
+		else if(field->type == FIELD_CHECKSUM)
+			data[field->offset] = size + (uint8_t)*field->value;
+	}
+
+	// Inverting the MCS standard header.
+	for(i = 0; i < HEADER_INVERTED; i++) data[i] = ~data[i];
+}
+
+/*
+	header_decode()
+
+	Copies a header read from a file, inverting its MCS part back.
+
+	@arg	raw	Header as stored in the file.
+	@arg	data	Decoded header.
+*/
+
+void header_decode(const uint8_t *raw, uint8_t *data)
+{
+	int i;
+
+	memcpy(data, raw, HEADER_SIZE);
+	for(i = 0; i < HEADER_INVERTED; i++) data[i] = ~data[i];
+}
+
+/*
+	header_size()
+
+	Reads the file size stored in a size field.
+
+	@arg	data	Decoded header.
+	@arg	field	Size field.
+
+	@return		Stored file size.
+*/
+
+uint32_t header_size(const uint8_t *data, const struct Header_Field *field)
+{
+	const uint8_t *p = data + field->offset;
+	return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/*
+	header_check()
+
+	Checks a decoded header against the actual file size, field by field.
+
+	@arg	data		Decoded header.
+	@arg	filesize	Actual file size.
+
+	@return		NULL if the header is valid, or a short description of
+			the first defect found.
+*/
+
+const char *header_check(const uint8_t *data, uint64_t filesize)
+{
+	// Checking the identification fields first, then the sizes, and the
+	// checksums (which depend on the size) last.
+	const enum Field_Type order[] = {
+		FIELD_CONSTANT, FIELD_SIZE, FIELD_CHECKSUM
+	};
+	// Using a field iterator and a type iterator.
+	const struct Header_Field *field;
+	unsigned int i;
+	// Using the low byte of the stored size.
+	uint8_t low = data[header_field("size1")->offset + 3];
+
+	// A g1a must have binary code with its header !
+	if(filesize < HEADER_SIZE) return "too short";
+
+	for(i = 0; i < sizeof order / sizeof *order; i++)
+	for(field = header_fields; field->size; field++)
+	{
+		if(!field->defect || field->type != order[i]) continue;
+
+		switch(field->type)
+		{
+		case FIELD_CONSTANT:
+			if(memcmp(data + field->offset, field->value,
+				field->size)) return field->defect;
+			break;
+		case FIELD_SIZE:
+			if(header_size(data, field) != filesize)
+				return field->defect;
+			break;
+		case FIELD_CHECKSUM:
+			if(data[field->offset] != (uint8_t)(low +
+				(uint8_t)*field->value)) return field->defect;
+			break;
+		default:
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+	header_audit()
+
+	Checks a raw header against the actual file size, and reports all its
+	defects instead of the first one. Checksums are checked against the
+	actual size, since this is what they must be once the size fields are
+	repaired. An MCS part that was not inverted is accepted as such, and
+	reported as a defect of its own.
+
+	@arg	raw		Header as stored in the file.
+	@arg	filesize	Actual file size.
+	@arg	fixed		Receives the repaired header, as stored in the
+				file, if all the defects are repairable.
+
+	@return		Defects found (enum Header_Defect bits), 0 if none.
+*/
+
+unsigned int header_audit(const uint8_t *raw, uint64_t filesize,
+	uint8_t *fixed)
+{
+	// Using the decoded header, the field iterator and the defects found.
+	uint8_t data[HEADER_SIZE];
+	const struct Header_Field *field;
+	unsigned int defects = 0;
+	int i, bad;
+
+	// Nothing else can be checked without a whole header.
+	if(filesize < HEADER_SIZE) return DEFECT_SHORT;
+	if(filesize > UINT32_MAX) defects |= DEFECT_LARGE;
+
+	// Using the header as is if its MCS part has not been inverted.
+	header_decode(raw, data);
+	if(memcmp(data, header_fields[0].value, header_fields[0].size)
+		&& !memcmp(raw, header_fields[0].value, header_fields[0].size))
+	{
+		memcpy(data, raw, HEADER_SIZE);
+		defects |= DEFECT_INVERTED;
+	}
+
+	for(field = header_fields; field->size; field++)
+	{
+		if(!field->defect) continue;
+
+		for(i = 0; i < HEADER_DEFECTS; i++)
+			if(!strcmp(header_defects[i], field->name)) break;
+
+		switch(field->type)
+		{
+		case FIELD_CONSTANT:
+			bad = memcmp(data + field->offset, field->value,
+				field->size);
+			break;
+		case FIELD_SIZE:
+			bad = header_size(data, field) != filesize;
+			break;
+		case FIELD_CHECKSUM:
+			bad = data[field->offset] != (uint8_t)(filesize +
+				(uint8_t)*field->value);
+			break;
+		default:
+			bad = 0;
+			break;
+		}
+		if(bad) defects |= 1 << i;
+	}
+
+	// The size and checksums are rewritten from the actual size, which
+	// inverts the MCS part again.
+	if(defects & ~HEADER_REPAIRABLE) return defects;
+	memcpy(fixed, data, HEADER_SIZE);
+	header_finalize(fixed, filesize);
+	return defects;
+}
+
+/*
+	header_string()
+
+	Extracts a text field, which is not NUL-terminated when it fills its
+	whole area.
+
+	@arg	data	Decoded header.
+	@arg	field	Field to extract.
+	@arg	buffer	Buffer of at least field->size + 1 bytes.
+
+	@return		The buffer.
+*/
+
+char *header_string(const uint8_t *data, const struct Header_Field *field,
+	char *buffer)
+{
+	memcpy(buffer, data + field->offset, field->size);
+	buffer[field->size] = 0;
+	return buffer;
+}
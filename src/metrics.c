@@ -0,0 +1,226 @@
+/*
+	Metrics module.
+*/
+
+
+
+/*
+	Header inclusions.
+*/
+
+// Standard headers.
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Project headers.
+#include "error.h"
+#include "metrics.h"
+#include "output.h"
+#include "stats.h"
+
+
+
+/*
+	Constants definitions.
+*/
+
+// Prefix of the metric names.
+#define PREFIX	"g1a_wrapper_"
+
+
+
+/*
+	Static variables definitions.
+*/
+
+// Metrics file name, or NULL if metrics are disabled.
+static const char *metrics_file = NULL;
+
+
+
+/*
+	Static function definitions.
+*/
+
+/*
+	diagnostic()
+
+	Writes the counter of an error, as given by error_counts().
+
+	@arg	level	Error level.
+	@arg	name	Error name.
+	@arg	count	Number of times the error was emitted.
+	@arg	data	Output stream.
+*/
+
+static void diagnostic(enum Error_Level level, const char *name,
+	unsigned long count, void *data)
+{
+	// Using level names, as labels.
+	const char *levels[] = { "debug", "note", "warning", "error", "fatal" };
+
+	fprintf(data, PREFIX "diagnostics_total{level=\"%s\",name=\"%s\"} "
+		"%lu\n", levels[level], name, count);
+}
+
+/*
+	metrics_text()
+
+	Writes the metrics in the Prometheus text format.
+
+	@arg	fp	Output stream.
+*/
+
+static void metrics_text(FILE *fp)
+{
+	// Using the aggregated statistics, the uptime in seconds, a bucket
+	// bound, a cumulated count and iterators.
+	struct Stats_Snapshot s;
+	double uptime, bound;
+	uint64_t cumulated, lookups;
+	int i, k;
+
+	stats_snapshot(&s);
+	uptime = s.uptime / 1e9;
+
+	fputs("# HELP " PREFIX "uptime_seconds Time since the program "
+		"started.\n# TYPE " PREFIX "uptime_seconds gauge\n", fp);
+	fprintf(fp, PREFIX "uptime_seconds %.6f\n", uptime);
+
+	// Counters, with the names of the statistics report.
+	for(i = 0; i < STATS_COUNTERS; i++) fprintf(fp, "# TYPE " PREFIX
+		"%s_total counter\n" PREFIX "%s_total %llu\n",
+		stats_counter_name(i), stats_counter_name(i),
+		(unsigned long long)s.counters[i]);
+
+	// Values derived from the counters.
+	fputs("# HELP " PREFIX "jobs_per_second Average job rate since the "
+		"program started.\n# TYPE " PREFIX "jobs_per_second gauge\n",
+		fp);
+	fprintf(fp, PREFIX "jobs_per_second %.3f\n", uptime > 0 ?
+		s.counters[STATS_JOBS_DONE] / uptime : 0);
+
+	fputs("# HELP " PREFIX "queue_depth Jobs queued and not done yet.\n"
+		"# TYPE " PREFIX "queue_depth gauge\n", fp);
+	fprintf(fp, PREFIX "queue_depth %llu\n", (unsigned long long)
+		(s.counters[STATS_JOBS_QUEUED] - s.counters[STATS_JOBS_DONE]));
+
+	lookups = s.counters[STATS_CACHE_HITS] + s.counters[STATS_CACHE_MISSES];
+	fputs("# HELP " PREFIX "cache_hit_ratio Ratio of cache lookups that "
+		"hit.\n# TYPE " PREFIX "cache_hit_ratio gauge\n", fp);
+	fprintf(fp, PREFIX "cache_hit_ratio %.4f\n", lookups ? (double)
+		s.counters[STATS_CACHE_HITS] / lookups : 0);
+
+	// Phase latency histograms, with cumulated buckets.
+	fputs("# HELP " PREFIX "phase_seconds Duration of the program "
+		"phases.\n# TYPE " PREFIX "phase_seconds histogram\n", fp);
+	for(i = 0; i < STATS_PHASES; i++)
+	{
+		cumulated = 0;
+		bound = 1e-5;
+		for(k = 0; k < STATS_BUCKETS; k++, bound *= 10)
+		{
+			cumulated += s.phase_buckets[i][k];
+			fprintf(fp, PREFIX "phase_seconds_bucket{phase=\"%s\","
+				"le=\"%g\"} %llu\n", stats_phase_name(i), bound,
+				(unsigned long long)cumulated);
+		}
+		fprintf(fp, PREFIX "phase_seconds_bucket{phase=\"%s\","
+			"le=\"+Inf\"} %llu\n", stats_phase_name(i),
+			(unsigned long long)s.phase_count[i]);
+		fprintf(fp, PREFIX "phase_seconds_sum{phase=\"%s\"} %.9f\n",
+			stats_phase_name(i), s.phase_total[i] / 1e9);
+		fprintf(fp, PREFIX "phase_seconds_count{phase=\"%s\"} %llu\n",
+			stats_phase_name(i), (unsigned long long)
+			s.phase_count[i]);
+	}
+
+	// Diagnostics, by level and name.
+	fputs("# HELP " PREFIX "diagnostics_total Diagnostics emitted, even "
+		"masked ones.\n# TYPE " PREFIX "diagnostics_total counter\n",
+		fp);
+	error_counts(diagnostic, fp);
+}
+
+/*
+	metrics_exit()
+
+	Writes the metrics file at exit, including on fatal errors.
+*/
+
+static void metrics_exit(void)
+{
+	metrics_write();
+}
+
+
+
+/*
+	Function definitions.
+*/
+
+/*
+	metrics_init()
+
+	Enables statistics collection and the metrics file, which is written at
+	exit.
+
+	@arg	file	Metrics file name.
+*/
+
+void metrics_init(const char *file)
+{
+	metrics_file = file;
+	stats_enable();
+	atexit(metrics_exit);
+}
+
+/*
+	metrics_write()
+
+	Formats the metrics in memory, then replaces the metrics file with them.
+	Emits an error on failure.
+*/
+
+void metrics_write(void)
+{
+	// Using the formatted text, its size and its stream.
+	char *text = NULL;
+	size_t size = 0;
+	FILE *fp;
+	struct Output output;
+
+	if(!metrics_file) return;
+
+	fp = open_memstream(&text, &size);
+	if(!fp)
+	{
+		error_emit(ERROR, "metrics-output", metrics_file,
+			strerror(errno));
+		return;
+	}
+	metrics_text(fp);
+	if(fclose(fp))
+	{
+		error_emit(ERROR, "metrics-output", metrics_file,
+			strerror(errno));
+		free(text);
+		return;
+	}
+
+	if(output_open(&output, metrics_file, size))
+		error_emit(ERROR, "metrics-output", metrics_file,
+			strerror(errno));
+	else if(output_append(&output, text, size))
+	{
+		error_emit(ERROR, "metrics-output", metrics_file,
+			strerror(errno));
+		output_abort(&output);
+	}
+	else if(output_commit(&output)) error_emit(ERROR, "metrics-output",
+		metrics_file, strerror(errno));
+
+	free(text);
+}
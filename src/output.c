@@ -0,0 +1,734 @@
+/*
+	Output module.
+*/
+
+
+
+/*
+	Header inclusions.
+*/
+
+// Feature macros, for fallocate(), syncfs(), copy_file_range() and
+// splice().
+#define _GNU_SOURCE
+
+// Standard headers.
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+
+// Project headers.
+#include "output.h"
+#include "stats.h"
+
+
+
+/*
+	Composed types definitions.
+
+	These types are used only in this file.
+*/
+
+// File system written to in durable mode.
+struct Filesystem
+{
+	// Device identifier.
+	dev_t device;
+	// Descriptor of a directory on this file system, used by syncfs().
+	int fd;
+};
+
+
+
+/*
+	Static variables definitions.
+*/
+
+// Durable mode indicator.
+static int durable = 0;
+// File systems to sync at the end of the run, and their lock (batch jobs
+// commit files from several threads).
+static struct Filesystem *filesystems = NULL;
+static int filesystem_count = 0;
+static pthread_mutex_t filesystems_lock = PTHREAD_MUTEX_INITIALIZER;
+// Creation mode of output files, derived from the umask once.
+static mode_t file_mode;
+static pthread_once_t file_mode_once = PTHREAD_ONCE_INIT;
+
+
+
+/*
+	Static function definitions.
+*/
+
+/*
+	directory()
+
+	Returns the directory part of a path. The returned string is allocated.
+
+	@arg	path	File path.
+
+	@return		Allocated directory name, or NULL on alloc failure.
+*/
+
+static char *directory(const char *path)
+{
+	// Looking for the last slash.
+	const char *slash = strrchr(path, '/');
+	char *dir;
+
+	// Files without a slash are in the current directory.
+	if(!slash) return strdup(".");
+	// Files at the root are in the root directory.
+	if(slash == path) return strdup("/");
+
+	dir = malloc(slash - path + 1);
+	if(!dir) return NULL;
+	memcpy(dir, path, slash - path);
+	dir[slash - path] = 0;
+
+	return dir;
+}
+
+/*
+	remember_filesystem()
+
+	Registers the file system holding the given path, so that it is synced
+	at the end of the run.
+
+	@arg	path	Output file path.
+
+	@return		0 on success, 1 on failure (errno is set).
+*/
+
+static int remember_filesystem(const char *path)
+{
+	// Using the directory name and its descriptor.
+	char *dir = directory(path);
+	struct Filesystem *tmp;
+	struct stat st;
+	int fd, i;
+
+	if(!dir) return 1;
+	fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	free(dir);
+	STATS_ADD(STATS_SYSCALLS, 1);
+	if(fd < 0) return 1;
+
+	// Getting the device identifier.
+	STATS_ADD(STATS_SYSCALLS, 1);
+	if(fstat(fd, &st))
+	{
+		close(fd);
+		return 1;
+	}
+
+	// Keeping a single descriptor per file system.
+	pthread_mutex_lock(&filesystems_lock);
+	for(i = 0; i < filesystem_count; i++)
+	{
+		if(filesystems[i].device != st.st_dev) continue;
+		pthread_mutex_unlock(&filesystems_lock);
+		STATS_ADD(STATS_SYSCALLS, 1);
+		close(fd);
+		return 0;
+	}
+
+	tmp = realloc(filesystems, (filesystem_count + 1) * sizeof *tmp);
+	if(!tmp)
+	{
+		pthread_mutex_unlock(&filesystems_lock);
+		close(fd);
+		return 1;
+	}
+	filesystems = tmp;
+	filesystems[filesystem_count].device = st.st_dev;
+	filesystems[filesystem_count].fd = fd;
+	filesystem_count++;
+	pthread_mutex_unlock(&filesystems_lock);
+
+	return 0;
+}
+
+/*
+	init_file_mode()
+
+	Computes the creation mode of output files, as fopen() would use it.
+*/
+
+static void init_file_mode(void)
+{
+	mode_t mask = umask(0);
+
+	umask(mask);
+	file_mode = 0666 & ~mask;
+	STATS_ADD(STATS_SYSCALLS, 2);
+}
+
+
+
+/*
+	Function definitions.
+*/
+
+/*
+	output_durable()
+
+	Enables or disables durable mode. In durable mode, output_sync() syncs
+	every file system that received an output file.
+
+	@arg	enable	Non-zero to enable durable mode.
+*/
+
+void output_durable(int enable)
+{
+	durable = enable;
+}
+
+/*
+	output_open()
+
+	Creates a temporary file next to the destination path and preallocates
+	it to the final file size. If the destination exists and is not a
+	regular file (a device, a pipe...), it is opened directly instead.
+
+	@arg	output	Output structure to initialize.
+	@arg	path	Destination file name.
+	@arg	size	Final file size, used for preallocation.
+
+	@return		0 on success, 1 on failure (errno is set).
+*/
+
+int output_open(struct Output *output, const char *path, uint64_t size)
+{
+	// Using the base name of the destination.
+	const char *base = strrchr(path, '/');
+	// Using the directory name and the status of the destination.
+	char *dir;
+	struct stat st;
+	int exists = !stat(path, &st);
+
+	output->path = path;
+	output->offset = 0;
+	output->temp = NULL;
+	STATS_ADD(STATS_SYSCALLS, 1);
+
+	// Writing special files in place, as they cannot be replaced.
+	if(exists && !S_ISREG(st.st_mode))
+	{
+		output->fd = open(path, O_WRONLY | O_TRUNC | O_CLOEXEC);
+		STATS_ADD(STATS_SYSCALLS, 1);
+		return output->fd < 0;
+	}
+
+	// Computing the creation mode once.
+	pthread_once(&file_mode_once, init_file_mode);
+
+	// Building a hidden temporary name in the destination directory, so
+	// that the final rename() does not cross file systems.
+	base = base ? base + 1 : path;
+	dir = directory(path);
+	if(!dir) return 1;
+	output->temp = malloc(strlen(dir) + strlen(base) + 10);
+	if(!output->temp)
+	{
+		free(dir);
+		return 1;
+	}
+	sprintf(output->temp, "%s/.%s.XXXXXX", dir, base);
+	free(dir);
+
+	output->fd = mkostemp(output->temp, O_CLOEXEC);
+	STATS_ADD(STATS_SYSCALLS, 1);
+	if(output->fd < 0)
+	{
+		free(output->temp);
+		return 1;
+	}
+
+	// Giving the file the permissions fopen() would have given it: those
+	// of the file it replaces, if any.
+	fchmod(output->fd, exists ? st.st_mode & 07777 : file_mode);
+	STATS_ADD(STATS_SYSCALLS, 1 + !!size);
+
+	// Preallocating the whole file. File systems that cannot do it are
+	// not an error, but running out of space is.
+	if(size && fallocate(output->fd, 0, 0, size) && errno == ENOSPC)
+	{
+		output_abort(output);
+		errno = ENOSPC;
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+	output_stream()
+
+	Uses an open descriptor, such as the standard output, as an output
+	file. It is written in place, and closed by output_commit().
+
+	@arg	output	Output structure to initialize.
+	@arg	fd	File descriptor.
+	@arg	path	Name of the output, for diagnostics.
+*/
+
+void output_stream(struct Output *output, int fd, const char *path)
+{
+	output->fd = fd;
+	output->path = path;
+	output->temp = NULL;
+	output->offset = 0;
+}
+
+/*
+	output_append()
+
+	Appends data to the output file, retrying on short writes. Special
+	files, which are opened in place, are written sequentially (see
+	output_appendv()), as pipes have no offset.
+
+	@arg	output	Output file.
+	@arg	data	Data to write.
+	@arg	size	Number of bytes to write.
+
+	@return		0 on success, 1 on failure (errno is set).
+*/
+
+int output_append(struct Output *output, const void *data, size_t size)
+{
+	// Using a single buffer.
+	struct iovec iov = { (void *)data, size };
+
+	return output_appendv(output, &iov, 1);
+}
+
+/*
+	output_appendv()
+
+	Appends several buffers to the output file with vectored writes, so
+	that a header and a payload go out in a single system call. Retries on
+	short writes. Special files are written sequentially, as pipes have no
+	offset.
+
+	@arg	output	Output file.
+	@arg	iov	Buffers to write (modified on short writes).
+	@arg	count	Number of buffers.
+
+	@return		0 on success, 1 on failure (errno is set).
+*/
+
+int output_appendv(struct Output *output, struct iovec *iov, int count)
+{
+	// Using the size of the last write, 0 to start with.
+	ssize_t x = 0;
+
+	while(1)
+	{
+		// Skipping the buffers written (and empty ones), and the written
+		// part of the next one.
+		while(count && (size_t)x >= iov->iov_len)
+		{
+			x -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if(!count) return 0;
+		iov->iov_base = (char *)iov->iov_base + x;
+		iov->iov_len -= x;
+
+		x = output->temp ? pwritev(output->fd, iov, count,
+			output->offset) : writev(output->fd, iov, count);
+		STATS_ADD(STATS_SYSCALLS, 1);
+		if(x < 0 && errno == EINTR)
+		{
+			x = 0;
+			continue;
+		}
+		if(x < 0) return 1;
+
+		STATS_ADD(STATS_WRITE_CALLS, 1);
+		STATS_ADD(STATS_BYTES_WRITTEN, x);
+		output->offset += x;
+	}
+}
+
+/*
+	output_zero()
+
+	Appends zeros to the output file. Temporary files are only extended:
+	the skipped range reads as zeros once the file is truncated to its
+	final size, and takes no space if the file system supports holes.
+
+	@arg	output	Output file.
+	@arg	size	Number of zeros to write.
+
+	@return		0 on success, 1 on failure (errno is set).
+*/
+
+int output_zero(struct Output *output, size_t size)
+{
+	// Using a block of zeros, for special files.
+	static const char zeros[0x1000];
+	size_t x;
+
+	if(output->temp)
+	{
+		output->offset += size;
+		return 0;
+	}
+
+	for(; size; size -= x)
+	{
+		x = size < sizeof zeros ? size : sizeof zeros;
+		if(output_append(output, zeros, x)) return 1;
+	}
+
+	return 0;
+}
+
+/*
+	output_clone()
+
+	Makes an empty output file share the extents of another file (reflink),
+	which costs a single metadata operation on file systems that support it
+	(Btrfs, XFS...).
+
+	@arg	output	Output file, with nothing written yet.
+	@arg	fd	Source file descriptor.
+
+	@return		0 on success, 1 if the file system cannot do it.
+*/
+
+int output_clone(struct Output *output, int fd)
+{
+	// Using the source file status.
+	struct stat st;
+
+	if(output->fd < 0 || output->offset || fstat(fd, &st)) return 1;
+	STATS_ADD(STATS_SYSCALLS, 2);
+	if(ioctl(output->fd, FICLONE, fd)) return 1;
+
+	output->offset = st.st_size;
+	return 0;
+}
+
+/*
+	output_link()
+
+	Replaces an empty output file with a hard link to another file. The
+	output then shares its inode with the source, which must never be
+	modified in place afterwards.
+
+	@arg	output	Output file, with nothing written yet.
+	@arg	source	Source file name, on the same file system.
+
+	@return		0 on success, 1 on failure (errno is set, and the output
+			file is left empty).
+*/
+
+int output_link(struct Output *output, const char *source)
+{
+	// Using the name of the link.
+	char *name;
+
+	// Special files cannot be linked.
+	if(!output->temp || output->offset) return 1;
+
+	// Creating the link next to the temporary file.
+	name = malloc(strlen(output->temp) + 6);
+	if(!name) return 1;
+	sprintf(name, "%s.link", output->temp);
+	STATS_ADD(STATS_SYSCALLS, 1);
+	if(link(source, name))
+	{
+		free(name);
+		return 1;
+	}
+
+	// Replacing the temporary file with the link.
+	close(output->fd);
+	unlink(output->temp);
+	STATS_ADD(STATS_SYSCALLS, 2);
+	free(output->temp);
+	output->temp = name;
+	output->fd = -1;
+	return 0;
+}
+
+/*
+	output_copy()
+
+	Copies part of another file into the output file, in the kernel when
+	possible: with copy_file_range() between files, or with splice() when
+	the output is a pipe.
+
+	@arg	output	Output file.
+	@arg	fd	Source file descriptor.
+	@arg	offset	Offset of the copied data in the source.
+	@arg	size	Number of bytes to copy.
+
+	@return		0 on success, 1 on failure (errno is set).
+*/
+
+int output_copy(struct Output *output, int fd, uint64_t offset,
+	uint64_t size)
+{
+	// Using source and destination offsets and a fallback buffer.
+	loff_t in = offset, out = output->offset;
+	char buffer[0x10000];
+	ssize_t x;
+
+	// Copying in the kernel, without a round trip through user space.
+	// Files written in place are written at their current position.
+	while(size)
+	{
+		x = copy_file_range(fd, &in, output->fd, output->temp ? &out
+			: NULL, size, 0);
+		STATS_ADD(STATS_SYSCALLS, 1);
+		if(x < 0 && errno == EINTR) continue;
+		if(x <= 0) break;
+
+		STATS_ADD(STATS_WRITE_CALLS, 1);
+		STATS_ADD(STATS_BYTES_WRITTEN, x);
+		if(!output->temp) out += x;
+		size -= x;
+	}
+	output->offset = out;
+
+	// Pipes have no offset, but the page cache can be spliced into them.
+	while(size && !output->temp)
+	{
+		x = splice(fd, &in, output->fd, NULL, size, SPLICE_F_MORE);
+		STATS_ADD(STATS_SYSCALLS, 1);
+		if(x < 0 && errno == EINTR) continue;
+		if(x <= 0) break;
+
+		STATS_ADD(STATS_WRITE_CALLS, 1);
+		STATS_ADD(STATS_BYTES_WRITTEN, x);
+		output->offset += x;
+		size -= x;
+	}
+
+	// Falling back to a buffered copy on failure (cross-device copies on
+	// old kernels, special files...).
+	while(size)
+	{
+		x = pread(fd, buffer, size < sizeof buffer ? size :
+			sizeof buffer, in);
+		STATS_ADD(STATS_SYSCALLS, 1);
+		if(x < 0 && errno == EINTR) continue;
+		if(x < 0) return 1;
+		if(!x)
+		{
+			errno = EIO;
+			return 1;
+		}
+
+		STATS_ADD(STATS_READ_CALLS, 1);
+		STATS_ADD(STATS_BYTES_READ, x);
+		if(output_append(output, buffer, x)) return 1;
+		in += x;
+		size -= x;
+	}
+
+	return 0;
+}
+
+/*
+	output_commit()
+
+	Truncates the output file to the written size, closes it and renames it
+	over the destination. In durable mode, the destination file system is
+	remembered for output_sync().
+
+	@arg	output	Output file.
+
+	@return		0 on success, 1 on failure (errno is set, and the
+			temporary file is removed).
+*/
+
+int output_commit(struct Output *output)
+{
+	// Special files are only closed.
+	STATS_ADD(STATS_SYSCALLS, 1);
+	if(!output->temp) return close(output->fd) != 0;
+
+	// Dropping any preallocated space that was not used. Hard links are
+	// already complete.
+	if(output->fd >= 0)
+	{
+		STATS_ADD(STATS_SYSCALLS, 2);
+		if(ftruncate(output->fd, output->offset)) goto fail;
+		if(close(output->fd))
+		{
+			output->fd = -1;
+			goto fail;
+		}
+		output->fd = -1;
+	}
+
+	if(rename(output->temp, output->path)) goto fail;
+	free(output->temp);
+
+	return output_remember(output->path);
+
+fail:
+	output_abort(output);
+	return 1;
+}
+
+/*
+	output_remember()
+
+	Registers an output file for output_sync() in durable mode. This is done
+	by output_commit(); files written by other means must be registered
+	explicitly.
+
+	@arg	path	Output file name.
+
+	@return		0 on success, 1 on failure (errno is set).
+*/
+
+int output_remember(const char *path)
+{
+	return durable && remember_filesystem(path);
+}
+
+/*
+	output_patch()
+
+	Overwrites part of an existing output file in place, without the
+	temporary file. This is only safe when the file keeps its size.
+
+	@arg	path	Output file name.
+	@arg	data	Data to write.
+	@arg	size	Number of bytes to write.
+	@arg	offset	Position in the file.
+
+	@return		0 on success, 1 on failure (errno is set).
+*/
+
+int output_patch(const char *path, const void *data, size_t size,
+	uint64_t offset)
+{
+	// Using the output file, whose offset is the patch position. Outputs
+	// without a temporary file are written at the file position, which is
+	// moved there first.
+	struct Output output = { -1, path, NULL, offset };
+	int error;
+
+	output.fd = open(path, O_WRONLY | O_CLOEXEC);
+	STATS_ADD(STATS_SYSCALLS, 2);
+	if(output.fd < 0) return 1;
+
+	STATS_ADD(STATS_SYSCALLS, 1);
+	if(lseek(output.fd, offset, SEEK_SET) < 0
+		|| output_append(&output, data, size) || output_remember(path))
+	{
+		error = errno;
+		close(output.fd);
+		errno = error;
+		return 1;
+	}
+
+	return close(output.fd) != 0;
+}
+
+/*
+	output_abort()
+
+	Closes and removes the temporary file. Preserves errno.
+
+	@arg	output	Output file.
+*/
+
+void output_abort(struct Output *output)
+{
+	int error = errno;
+
+	if(output->fd >= 0) close(output->fd);
+	if(output->temp) unlink(output->temp);
+	free(output->temp);
+	output->fd = -1;
+
+	errno = error;
+}
+
+/*
+	output_sync()
+
+	Syncs every file system that received an output file, once each. Does
+	nothing outside durable mode.
+
+	@return		0 on success, 1 on failure (errno is set).
+*/
+
+int output_sync(void)
+{
+	// Using a return value and an iterator.
+	int ret = 0, i;
+
+	for(i = 0; i < filesystem_count; i++)
+	{
+		if(syncfs(filesystems[i].fd)) ret = 1;
+		close(filesystems[i].fd);
+		STATS_ADD(STATS_SYSCALLS, 2);
+	}
+
+	free(filesystems);
+	filesystems = NULL;
+	filesystem_count = 0;
+
+	return ret;
+}
+
+/*
+	output_name()
+
+	Builds a default output file name by replacing the extension of an input
+	file. The file is put in the given directory, or next to the input file.
+	The returned string is allocated.
+
+	@arg	input		Input file name.
+	@arg	dir		Output directory, or NULL.
+	@arg	extension	New extension, with its dot.
+
+	@return		Allocated file name, or NULL on alloc failure.
+*/
+
+char *output_name(const char *input, const char *dir, const char *extension)
+{
+	// Using the base name and the extension.
+	const char *base = strrchr(input, '/');
+	const char *dot;
+	char *name;
+	int length;
+
+	base = base ? base + 1 : input;
+	dot = strrchr(base, '.');
+	length = dot && dot != base ? dot - base : (int)strlen(base);
+
+	// Keeping the directory of the input file when none is given.
+	if(!dir)
+	{
+		name = malloc((base - input) + length + strlen(extension) + 1);
+		if(!name) return NULL;
+		sprintf(name, "%.*s%.*s%s", (int)(base - input), input, length,
+			base, extension);
+		return name;
+	}
+
+	name = malloc(strlen(dir) + length + strlen(extension) + 2);
+	if(!name) return NULL;
+	sprintf(name, "%s/%.*s%s", dir, length, base, extension);
+	return name;
+}
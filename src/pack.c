@@ -0,0 +1,563 @@
+/*
+	Pack module.
+*/
+
+
+
+/*
+	Header inclusions.
+*/
+
+// Standard headers.
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Library headers.
+#include <zlib.h>
+
+// Project headers.
+#include "pack.h"
+#include "pool.h"
+#include "stats.h"
+#include "trace.h"
+
+
+
+/*
+	Constants definitions.
+*/
+
+// Longest file name stored in a pack.
+#define PACK_NAME_MAX		0xffff
+
+
+
+/*
+	Composed types definitions.
+
+	These types are used only in this file.
+*/
+
+// Files shared by the worker threads.
+struct Pool
+{
+	// File list, and indexes of the packed files in it.
+	const struct Fsck_File *files;
+	int *order;
+	int count;
+	// Pack descriptor, offset of the header table, and index entries.
+	int fd;
+	uint64_t table;
+	uint8_t *index;
+	// Frames are placed in file order: index of the file whose frame is
+	// placed next, and end of the frames placed so far.
+	pthread_mutex_t lock;
+	pthread_cond_t turn_done;
+	int turn;
+	uint64_t end;
+	// Index of the first file that could not be packed (-1 if none), and
+	// the reason why.
+	int failed;
+	int error;
+};
+
+
+
+/*
+	Static function definitions.
+*/
+
+/*
+	put16(), put32(), put64()
+
+	Write little-endian integers, as read by the archive module.
+*/
+
+static void put16(uint8_t *p, uint32_t value)
+{
+	p[0] = value;
+	p[1] = value >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t value)
+{
+	put16(p, value);
+	put16(p + 2, value >> 16);
+}
+
+static void put64(uint8_t *p, uint64_t value)
+{
+	put32(p, value);
+	put32(p + 4, value >> 32);
+}
+
+/*
+	member_name()
+
+	Gives the name under which a file is stored: its path, without leading
+	'./' and slashes.
+
+	@arg	path	File path.
+
+	@return		Name, pointing into the path.
+*/
+
+static const char *member_name(const char *path)
+{
+	while(*path == '/' || !strncmp(path, "./", 2))
+		path += *path == '/' ? 1 : 2;
+	return path;
+}
+
+/*
+	pack_pwrite()
+
+	Writes data at the given offset of the pack, retrying on short writes.
+
+	@arg	fd	Pack descriptor.
+	@arg	data	Data to write.
+	@arg	size	Number of bytes to write.
+	@arg	offset	Offset in the pack.
+
+	@return		0 on success, 1 on failure (errno is set).
+*/
+
+static int pack_pwrite(int fd, const void *data, size_t size,
+	uint64_t offset)
+{
+	// Using a cursor in the data.
+	const uint8_t *ptr = data;
+	ssize_t x;
+
+	while(size)
+	{
+		x = pwrite(fd, ptr, size, offset);
+		STATS_ADD(STATS_SYSCALLS, 1);
+		if(x < 0 && errno == EINTR) continue;
+		if(x < 0) return 1;
+
+		STATS_ADD(STATS_WRITE_CALLS, 1);
+		STATS_ADD(STATS_BYTES_WRITTEN, x);
+		ptr += x;
+		size -= x;
+		offset += x;
+	}
+
+	return 0;
+}
+
+/*
+	place()
+
+	Waits for the frames of the previous files to be placed, and places the
+	frame of a file after them, so that the pack does not depend on the
+	order in which the files are compressed.
+
+	@arg	pool	File pool.
+	@arg	k	Index of the file in the pack.
+	@arg	size	Frame size.
+
+	@return		Frame offset.
+*/
+
+static uint64_t place(struct Pool *pool, int k, uint64_t size)
+{
+	uint64_t offset;
+
+	pthread_mutex_lock(&pool->lock);
+	while(pool->turn != k) pthread_cond_wait(&pool->turn_done,
+		&pool->lock);
+
+	offset = pool->end;
+	pool->end += size;
+	pool->turn++;
+	pthread_cond_broadcast(&pool->turn_done);
+	pthread_mutex_unlock(&pool->lock);
+
+	return offset;
+}
+
+/*
+	pack_file()
+
+	Compresses the payload of a file into a frame, and writes its header,
+	its frame and its index entry (whose name fields are already set). The
+	frame is stored when compression does not make it smaller.
+
+	@arg	pool	File pool.
+	@arg	k	Index of the file in the pack.
+
+	@return		0 on success, 1 on failure (errno is set; the frame is
+			placed all the same, empty).
+*/
+
+static int pack_file(struct Pool *pool, int k)
+{
+	// Using the file, its contents and its size.
+	const char *path = pool->files[pool->order[k]].path;
+	uint8_t *data = MAP_FAILED, *entry = pool->index + k * PACK_ENTRY;
+	struct stat st;
+	uint64_t size = 0;
+	// Using the deflate stream, the compressed frame, and the frame that is
+	// written with its size and offset.
+	z_stream stream;
+	uint8_t *frame = NULL;
+	const uint8_t *written;
+	uint64_t stored, offset;
+	int fd, method, error;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	STATS_ADD(STATS_SYSCALLS, 2);
+	if(fd < 0 || fstat(fd, &st)) goto fail;
+	size = st.st_size;
+
+	// The file may have been truncated since it was checked.
+	if(size < PACK_HEADER)
+	{
+		errno = EINVAL;
+		goto fail;
+	}
+
+	data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	STATS_ADD(STATS_SYSCALLS, 1);
+	if(data == MAP_FAILED) goto fail;
+	STATS_ADD(STATS_READ_CALLS, 1);
+	STATS_ADD(STATS_BYTES_READ, size);
+
+	// Compressing the payload in a single call, as a raw deflate stream.
+	memset(&stream, 0, sizeof stream);
+	if(deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS,
+		8, Z_DEFAULT_STRATEGY) != Z_OK)
+	{
+		errno = ENOMEM;
+		goto fail;
+	}
+
+	stored = deflateBound(&stream, size - PACK_HEADER);
+	frame = malloc(stored);
+	if(frame)
+	{
+		stream.next_in = data + PACK_HEADER;
+		stream.avail_in = size - PACK_HEADER;
+		stream.next_out = frame;
+		stream.avail_out = stored;
+		if(deflate(&stream, Z_FINISH) != Z_STREAM_END)
+		{
+			free(frame);
+			frame = NULL;
+		}
+	}
+	deflateEnd(&stream);
+	if(!frame)
+	{
+		errno = ENOMEM;
+		goto fail;
+	}
+
+	// Storing payloads that do not compress.
+	method = stream.total_out < size - PACK_HEADER ? Z_DEFLATED : 0;
+	written = method ? frame : data + PACK_HEADER;
+	stored = method ? stream.total_out : size - PACK_HEADER;
+
+	offset = place(pool, k, stored);
+	put64(entry, offset);
+	put64(entry + 8, stored);
+	put64(entry + 16, size - PACK_HEADER);
+	put16(entry + 30, method);
+
+	if(pack_pwrite(pool->fd, data, PACK_HEADER, pool->table
+		+ (uint64_t)k * PACK_HEADER)) goto fail_placed;
+	if(pack_pwrite(pool->fd, written, stored, offset)) goto fail_placed;
+
+	free(frame);
+	munmap(data, size);
+	close(fd);
+	return 0;
+
+fail:
+	error = errno;
+	place(pool, k, 0);
+	errno = error;
+fail_placed:
+	error = errno;
+	free(frame);
+	if(data != MAP_FAILED) munmap(data, size);
+	if(fd >= 0) close(fd);
+	errno = error;
+	return 1;
+}
+
+/*
+	pack_job()
+
+	Pool job: packs a file of the pool. Once a file has failed, the other
+	ones are only placed, as the pack is dropped.
+
+	@arg	arg	File pool.
+	@arg	k	Index of the file in the pack.
+*/
+
+static void pack_job(void *arg, int k)
+{
+	struct Pool *pool = arg;
+
+	if(__atomic_load_n(&pool->failed, __ATOMIC_RELAXED) >= 0)
+	{
+		place(pool, k, 0);
+		return;
+	}
+
+	TRACE_BEGIN("pack", "job", k);
+	if(pack_file(pool, k))
+	{
+		// Keeping the first failure, in file order.
+		pthread_mutex_lock(&pool->lock);
+		if(pool->failed < 0 || k < pool->failed)
+		{
+			pool->failed = k;
+			pool->error = errno;
+		}
+		pthread_mutex_unlock(&pool->lock);
+	}
+	TRACE_END("pack");
+	STATS_ADD(STATS_JOBS_DONE, 1);
+}
+
+
+
+/*
+	Function definitions.
+*/
+
+/*
+	pack_write()
+
+	Writes the files of a list to a pack, in order, replacing it atomically
+	(see output_open()). Only the files that were checked (see fsck_run())
+	and found long enough to have a header are packed; the others are left
+	out. Payloads are compressed on worker threads, one per processor, but
+	the pack only depends on the files.
+
+	@arg	pack	Receives the number and sizes of the files packed, and
+			the file that could not be read on failure.
+	@arg	path	Pack file name, which must be a regular file.
+	@arg	list	Checked file list.
+
+	@return		0 on success, 1 on failure (errno is set).
+*/
+
+int pack_write(struct Pack *pack, const char *path, const struct Fsck *list)
+{
+	// Using the pack superblock, names and the output file.
+	uint8_t super[PACK_SUPER];
+	char *names = NULL;
+	uint64_t names_size = 0, index, start;
+	struct Output out;
+	// Using the file pool, the current name and its length.
+	struct Pool pool;
+	const char *name;
+	size_t length;
+	int error, i, k;
+
+	memset(pack, 0, sizeof *pack);
+	memset(&pool, 0, sizeof pool);
+	pool.files = list->files;
+	pool.failed = -1;
+
+	// Selecting the files, and measuring their names.
+	pool.order = malloc((list->count + 1) * sizeof *pool.order);
+	if(!pool.order) return 1;
+	for(i = 0; i < list->count; i++)
+	{
+		if(list->files[i].error || list->files[i].size < PACK_HEADER)
+			continue;
+
+		length = strlen(member_name(list->files[i].path));
+		if(!length || length > PACK_NAME_MAX || names_size + length
+			> UINT32_MAX)
+		{
+			free(pool.order);
+			errno = ENAMETOOLONG;
+			return 1;
+		}
+		names_size += length;
+		pool.order[pool.count++] = i;
+	}
+
+	// Laying out the pack: everything but the frames has a known size.
+	pool.table = PACK_SUPER;
+	index = pool.table + (uint64_t)pool.count * PACK_HEADER;
+	start = index + (uint64_t)pool.count * PACK_ENTRY;
+	pool.end = start + names_size;
+
+	pool.index = calloc(pool.count + 1, PACK_ENTRY);
+	names = malloc(names_size + 1);
+	if(!pool.index || !names)
+	{
+		free(pool.index);
+		free(names);
+		free(pool.order);
+		errno = ENOMEM;
+		return 1;
+	}
+
+	for(k = 0, names_size = 0; k < pool.count; k++)
+	{
+		name = member_name(list->files[pool.order[k]].path);
+		length = strlen(name);
+		memcpy(names + names_size, name, length);
+		put32(pool.index + k * PACK_ENTRY + 24, names_size);
+		put16(pool.index + k * PACK_ENTRY + 28, length);
+		names_size += length;
+	}
+
+	memset(super, 0, sizeof super);
+	memcpy(super, PACK_MAGIC, 8);
+	put32(super + 0x08, PACK_VERSION);
+	put32(super + 0x0c, pool.count);
+	put64(super + 0x10, pool.table);
+	put64(super + 0x18, index);
+	put64(super + 0x20, start);
+	put64(super + 0x28, names_size);
+	put64(super + 0x30, pool.end);
+
+	// Frames are written at their offsets, which special files lack.
+	if(output_open(&out, path, 0)) goto fail;
+	if(!out.temp)
+	{
+		output_abort(&out);
+		errno = ESPIPE;
+		goto fail;
+	}
+	pool.fd = out.fd;
+
+	if(pack_pwrite(out.fd, super, sizeof super, 0)
+		|| pack_pwrite(out.fd, names, names_size, start))
+		goto fail_output;
+
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.turn_done, NULL);
+	STATS_ADD(STATS_JOBS_QUEUED, pool.count);
+	pool_run(pool.count, pack_job, &pool);
+	pthread_cond_destroy(&pool.turn_done);
+	pthread_mutex_destroy(&pool.lock);
+
+	if(pool.failed >= 0)
+	{
+		pack->failed = list->files[pool.order[pool.failed]].path;
+		errno = pool.error;
+		goto fail_output;
+	}
+
+	// The index is complete once all the frames are placed.
+	if(pack_pwrite(out.fd, pool.index, (uint64_t)pool.count * PACK_ENTRY,
+		index)) goto fail_output;
+
+	out.offset = pool.end;
+	if(output_commit(&out)) goto fail;
+
+	pack->count = pool.count;
+	for(k = 0; k < pool.count; k++) pack->size +=
+		list->files[pool.order[k]].size;
+	pack->stored = pool.end;
+
+	free(pool.index);
+	free(names);
+	free(pool.order);
+	return 0;
+
+fail_output:
+	output_abort(&out);
+fail:
+	error = errno;
+	free(pool.index);
+	free(names);
+	free(pool.order);
+	errno = error;
+	return 1;
+}
+
+/*
+	pack_restore()
+
+	Restores a whole g1a file stored in an archive (header and payload)
+	under a directory, at the path given by its member name. Missing
+	directories are created. Names that would leave the directory are
+	refused.
+
+	@arg	archive	Archive.
+	@arg	member	Archive member.
+	@arg	dir	Output directory.
+
+	@return		0 on success, 1 on failure (errno is set, to EINVAL if
+			the name is refused).
+*/
+
+int pack_restore(struct Archive *archive, struct Archive_Member *member,
+	const char *dir)
+{
+	// Using the name without its leading './', the output path and a
+	// cursor in it.
+	const char *name = member->name, *part;
+	char *path, *slash;
+	struct Output out;
+	size_t length = strlen(dir);
+	int error;
+
+	while(!strncmp(name, "./", 2)) name += 2;
+
+	// Refusing absolute names and parent directory components.
+	if(!*name || *name == '/')
+	{
+		errno = EINVAL;
+		return 1;
+	}
+	for(part = name; part; part = strchr(part, '/'))
+	{
+		if(*part == '/') part++;
+		if(!strncmp(part, "..", 2) && (!part[2] || part[2] == '/'))
+		{
+			errno = EINVAL;
+			return 1;
+		}
+	}
+
+	path = malloc(length + strlen(name) + 2);
+	if(!path) return 1;
+	sprintf(path, "%s%s%s", dir, length && dir[length - 1] != '/' ? "/" :
+		"", name);
+
+	// Creating the directories; failures show when the file is opened.
+	for(slash = strchr(path + 1, '/'); slash; slash = strchr(slash + 1,
+		'/'))
+	{
+		*slash = 0;
+		mkdir(path, 0777);
+		STATS_ADD(STATS_SYSCALLS, 1);
+		*slash = '/';
+	}
+
+	if(output_open(&out, path, member->size)) goto fail;
+	if(archive_copy(archive, member, &out, 0))
+	{
+		output_abort(&out);
+		goto fail;
+	}
+	if(output_commit(&out)) goto fail;
+
+	free(path);
+	return 0;
+
+fail:
+	error = errno;
+	free(path);
+	errno = error;
+	return 1;
+}
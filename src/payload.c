@@ -0,0 +1,481 @@
+/*
+	Payload module.
+*/
+
+
+
+/*
+	Header inclusions.
+*/
+
+// Standard headers.
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Project headers.
+#include "output.h"
+#include "payload.h"
+#include "stats.h"
+
+
+
+/*
+	Composed types definitions.
+
+	These types are used only in this file.
+*/
+
+// Loadable segment of an ELF file.
+struct Elf_Load
+{
+	// Segment data in the file, load address and size.
+	const uint8_t *data;
+	uint32_t address, size;
+};
+
+
+
+/*
+	Constants definitions.
+*/
+
+// Largest number of buffers in a vectored write.
+#define PAYLOAD_IOV	16
+
+
+
+/*
+	Static function definitions.
+*/
+
+/*
+	payload_read()
+
+	Reads a whole stream into an allocated buffer, for inputs that cannot be
+	mapped (pipes, character devices...).
+
+	@arg	payload	Payload structure to fill.
+	@arg	fd	File descriptor to read from.
+
+	@return		0 on success, 1 on failure (errno is set).
+*/
+
+static int payload_read(struct Payload *payload, int fd)
+{
+	// Using a growing buffer, its capacity and the size read.
+	uint8_t *data = NULL, *tmp;
+	size_t capacity = 0, size = 0;
+	ssize_t x;
+
+	while(1)
+	{
+		// Doubling the buffer when it is full.
+		if(size == capacity)
+		{
+			capacity = capacity ? capacity * 2 : 0x10000;
+			tmp = realloc(data, capacity);
+			if(!tmp)
+			{
+				free(data);
+				errno = ENOMEM;
+				return 1;
+			}
+			data = tmp;
+		}
+
+		x = read(fd, data + size, capacity - size);
+		STATS_ADD(STATS_SYSCALLS, 1);
+		if(x < 0 && errno == EINTR) continue;
+		if(x < 0)
+		{
+			free(data);
+			return 1;
+		}
+
+		STATS_ADD(STATS_READ_CALLS, 1);
+		STATS_ADD(STATS_BYTES_READ, x);
+		if(!x) break;
+		size += x;
+	}
+
+	payload->data = data;
+	payload->size = size;
+	payload->mapped = 0;
+	return 0;
+}
+
+/*
+	read32(), read16()
+
+	Read an ELF field in the byte order of the file.
+
+	@arg	p	Field address.
+	@arg	big	Non-zero for big-endian files.
+
+	@return		Field value.
+*/
+
+static uint32_t read32(const uint8_t *p, int big)
+{
+	if(big) return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8)
+		| p[3];
+	return ((uint32_t)p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0];
+}
+
+static uint16_t read16(const uint8_t *p, int big)
+{
+	return big ? (p[0] << 8) | p[1] : (p[1] << 8) | p[0];
+}
+
+/*
+	compare_loads()
+
+	Comparison function for qsort(), by load address.
+*/
+
+static int compare_loads(const void *a, const void *b)
+{
+	const struct Elf_Load *x = a, *y = b;
+	return (x->address > y->address) - (x->address < y->address);
+}
+
+/*
+	elf_image()
+
+	Builds the binary image of a 32-bit ELF file from its PT_LOAD segments,
+	as objcopy -O binary does: the file data of every segment is placed at
+	its load (physical) address, starting at the add-in base, and the gaps
+	are zero-filled. Nothing is copied: the segments point into the file.
+
+	@arg	payload	Payload whose file field is an ELF file.
+
+	@return		NULL on success, or the defect of the file.
+*/
+
+static const char *elf_image(struct Payload *payload)
+{
+	// Using the file contents, the program header table and its entries.
+	const uint8_t *elf = payload->file, *ph;
+	size_t size = payload->file_size;
+	uint32_t phoff, offset, address, filesz, end;
+	uint16_t phentsize, phnum;
+	// Using the loadable segments, and the image segments.
+	struct Elf_Load *loads;
+	struct Payload_Segment *segments;
+	int big, count = 0, n = 0, i;
+
+	// Checking the identification and the program header table.
+	if(size < 52 || elf[4] != 1 || (elf[5] != 1 && elf[5] != 2))
+		return "not a 32-bit ELF file";
+	big = elf[5] == 2;
+	phoff = read32(elf + 28, big);
+	phentsize = read16(elf + 42, big);
+	phnum = read16(elf + 44, big);
+	if(phentsize < 32 || phoff > size || (size - phoff) / phentsize <
+		phnum) return "truncated program header table";
+
+	loads = malloc((phnum + 1) * sizeof *loads);
+	if(!loads) return "alloc failure";
+
+	// Collecting the segments that have data in the file.
+	for(i = 0; i < phnum; i++)
+	{
+		ph = elf + phoff + i * phentsize;
+		if(read32(ph, big) != 1 /* PT_LOAD */) continue;
+
+		offset = read32(ph + 4, big);
+		address = read32(ph + 12, big);
+		filesz = read32(ph + 16, big);
+		if(!filesz) continue;
+
+		if(offset > size || size - offset < filesz)
+		{
+			free(loads);
+			return "segment outside the file";
+		}
+		if(address < PAYLOAD_BASE || address > PAYLOAD_LIMIT
+			|| PAYLOAD_LIMIT - address < filesz)
+		{
+			free(loads);
+			return "segment outside the add-in area";
+		}
+
+		loads[count].data = elf + offset;
+		loads[count].address = address;
+		loads[count].size = filesz;
+		count++;
+	}
+
+	if(!count)
+	{
+		free(loads);
+		return "no loadable segment";
+	}
+
+	// Ordering the segments by address, and checking that the image
+	// starts at the add-in base and that no segments overlap.
+	qsort(loads, count, sizeof *loads, compare_loads);
+	if(loads[0].address != PAYLOAD_BASE)
+	{
+		free(loads);
+		return "first segment not at the add-in base 0x00300200";
+	}
+	for(i = 1; i < count; i++) if(loads[i].address < loads[i-1].address
+		+ loads[i-1].size)
+	{
+		free(loads);
+		return "overlapping segments";
+	}
+
+	// Building the image, with a zero segment for every gap.
+	segments = malloc(2 * count * sizeof *segments);
+	if(!segments)
+	{
+		free(loads);
+		return "alloc failure";
+	}
+	for(i = 0, end = PAYLOAD_BASE; i < count; i++)
+	{
+		if(loads[i].address > end)
+		{
+			segments[n].data = NULL;
+			segments[n++].size = loads[i].address - end;
+		}
+		segments[n].data = loads[i].data;
+		segments[n++].size = loads[i].size;
+		end = loads[i].address + loads[i].size;
+	}
+	free(loads);
+
+	payload->segments = segments;
+	payload->segment_count = n;
+	payload->data = NULL;
+	payload->size = end - PAYLOAD_BASE;
+	return NULL;
+}
+
+
+
+/*
+	Function definitions.
+*/
+
+/*
+	payload_open()
+
+	Loads the content of a file. Regular files are mapped read-only; other
+	files are read into memory. With the PAYLOAD_ELF flag, ELF files are
+	converted to their binary image.
+
+	@arg	payload	Payload structure to fill.
+	@arg	file	Input file name.
+	@arg	flags	Loading flags.
+
+	@return		0 on success, 1 on failure (errno is set, and the defect
+			field is set for invalid ELF files).
+*/
+
+int payload_open(struct Payload *payload, const char *file, int flags)
+{
+	// Using a file descriptor and the result of the loading.
+	int fd, ret, error;
+
+	payload->defect = NULL;
+
+	fd = open(file, O_RDONLY | O_CLOEXEC);
+	STATS_ADD(STATS_SYSCALLS, 1);
+	if(fd < 0) return 1;
+
+	// Loading the file; the mapping outlives the descriptor.
+	ret = payload_fd(payload, fd, flags);
+	error = errno;
+	close(fd);
+	STATS_ADD(STATS_SYSCALLS, 1);
+	errno = error;
+	return ret;
+}
+
+/*
+	payload_fd()
+
+	Loads the content of an open file, such as a descriptor inherited from
+	a parent process, which is left open. Regular files, including memfds
+	(sealed or not), are mapped read-only from their start; streams are
+	read from their current position to their end. With the PAYLOAD_ELF
+	flag, ELF files are converted to their binary image.
+
+	@arg	payload	Payload structure to fill.
+	@arg	fd	File descriptor.
+	@arg	flags	Loading flags.
+
+	@return		0 on success, 1 on failure (errno is set, and the defect
+			field is set for invalid ELF files).
+*/
+
+int payload_fd(struct Payload *payload, int fd, int flags)
+{
+	// Using the file status.
+	struct stat st;
+	void *map;
+
+	payload->segments = NULL;
+	payload->segment_count = 0;
+	payload->defect = NULL;
+
+	STATS_ADD(STATS_SYSCALLS, 1);
+	if(fstat(fd, &st)) return 1;
+
+	// Reading streams and special files.
+	if(!S_ISREG(st.st_mode))
+	{
+		if(payload_read(payload, fd)) return 1;
+	}
+
+	// Empty files cannot be mapped.
+	else if(!st.st_size)
+	{
+		payload->size = 0;
+		payload->mapped = 1;
+		payload->data = NULL;
+	}
+
+	// Mapping the file.
+	else
+	{
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(map == MAP_FAILED) return 1;
+
+		// The whole payload is about to be read.
+		madvise(map, st.st_size, MADV_WILLNEED);
+		payload->data = map;
+		payload->size = st.st_size;
+		payload->mapped = 1;
+		STATS_ADD(STATS_SYSCALLS, 2);
+		STATS_ADD(STATS_BYTES_READ, payload->size);
+	}
+
+	payload->file = payload->data;
+	payload->file_size = payload->size;
+	payload->whole.data = payload->data;
+	payload->whole.size = payload->size;
+
+	// Converting ELF files.
+	if((flags & PAYLOAD_ELF) && payload->size >= 4
+		&& !memcmp(payload->data, "\x7f" "ELF", 4))
+	{
+		payload->defect = elf_image(payload);
+		if(payload->defect)
+		{
+			payload_close(payload);
+			errno = ENOEXEC;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+	payload_segments()
+
+	Returns the segments making up a payload: the file itself, or the
+	segments and gaps of an ELF file.
+
+	@arg	payload	Payload.
+	@arg	count	Set to the number of segments.
+
+	@return		Segment array.
+*/
+
+const struct Payload_Segment *payload_segments(const struct Payload *payload,
+	int *count)
+{
+	if(payload->segments)
+	{
+		*count = payload->segment_count;
+		return payload->segments;
+	}
+
+	*count = 1;
+	return &payload->whole;
+}
+
+/*
+	payload_write()
+
+	Appends a payload to an output file, after a header if one is given.
+	Consecutive data segments are sent with vectored writes, so that the
+	header and a flat payload take a single system call. Gaps of ELF images
+	are skipped rather than written when the output file allows it.
+
+	@arg	payload	Payload.
+	@arg	output	Output file.
+	@arg	header	Data written before the payload, or NULL.
+	@arg	size	Size of the header.
+
+	@return		0 on success, 1 on failure (errno is set).
+*/
+
+int payload_write(const struct Payload *payload, struct Output *output,
+	const void *header, size_t size)
+{
+	// Using the segments, and the buffers of the next vectored write.
+	const struct Payload_Segment *segments;
+	struct iovec iov[PAYLOAD_IOV];
+	int count, n = 0, i;
+
+	if(header && size)
+	{
+		iov[n].iov_base = (void *)header;
+		iov[n++].iov_len = size;
+	}
+
+	segments = payload_segments(payload, &count);
+	for(i = 0; i < count; i++)
+	{
+		// Writing the pending buffers before a gap or when full.
+		if(n && (!segments[i].data || n == PAYLOAD_IOV))
+		{
+			if(output_appendv(output, iov, n)) return 1;
+			n = 0;
+		}
+
+		if(!segments[i].data)
+		{
+			if(output_zero(output, segments[i].size)) return 1;
+			continue;
+		}
+		iov[n].iov_base = (void *)segments[i].data;
+		iov[n++].iov_len = segments[i].size;
+	}
+
+	return n && output_appendv(output, iov, n);
+}
+
+/*
+	payload_close()
+
+	Releases the memory associated with a payload.
+
+	@arg	payload	Payload to release.
+*/
+
+void payload_close(struct Payload *payload)
+{
+	if(payload->mapped && payload->file)
+	{
+		munmap((void *)payload->file, payload->file_size);
+		STATS_ADD(STATS_SYSCALLS, 1);
+	}
+	else if(!payload->mapped) free((void *)payload->file);
+	free(payload->segments);
+
+	payload->data = payload->file = NULL;
+	payload->segments = NULL;
+	payload->size = payload->file_size = 0;
+}
@@ -0,0 +1,104 @@
+/*
+	Pool module.
+*/
+
+
+
+/*
+	Header inclusions.
+*/
+
+// Standard headers.
+#include <pthread.h>
+#include <unistd.h>
+
+// Project headers.
+#include "pool.h"
+
+
+
+/*
+	Composed types definitions.
+
+	These types are used only in this file.
+*/
+
+// Indexes shared by the worker threads.
+struct Pool
+{
+	// Job, and its argument.
+	void (*job)(void *arg, int index);
+	void *arg;
+	// Number of indexes, and next index to run.
+	int count;
+	int next;
+};
+
+
+
+/*
+	Static function definitions.
+*/
+
+/*
+	worker()
+
+	Thread routine: runs the job of the pool on every index until there are
+	none left.
+
+	@arg	arg	Pool.
+
+	@return		NULL.
+*/
+
+static void *worker(void *arg)
+{
+	struct Pool *pool = arg;
+	int i;
+
+	while((i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED))
+		< pool->count) pool->job(pool->arg, i);
+
+	return NULL;
+}
+
+
+
+/*
+	Function definitions.
+*/
+
+/*
+	pool_run()
+
+	Runs a job on every index from 0 to count - 1, on worker threads, one
+	per processor. The calling thread is one of the workers, and the
+	function returns once every job is done.
+
+	@arg	count	Number of indexes.
+	@arg	job	Job, called with arg and the index to run.
+	@arg	arg	Argument of the job.
+*/
+
+void pool_run(int count, void (*job)(void *arg, int index), void *arg)
+{
+	// Using the pool and the threads.
+	struct Pool pool = { job, arg, count, 0 };
+	pthread_t threads[POOL_THREADS_MAX];
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	int started = 0, i;
+
+	if(n > POOL_THREADS_MAX) n = POOL_THREADS_MAX;
+	if(n > count) n = count;
+
+	// Starting the other workers; failing to start some is not an error.
+	for(i = 1; i < n; i++)
+	{
+		if(pthread_create(threads + started, NULL, worker, &pool))
+			break;
+		started++;
+	}
+
+	worker(&pool);
+	for(i = 0; i < started; i++) pthread_join(threads[i], NULL);
+}
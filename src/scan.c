@@ -0,0 +1,515 @@
+/*
+	Scan module.
+*/
+
+
+
+/*
+	Header inclusions.
+*/
+
+// Standard headers.
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Project headers.
+#include "header.h"
+#include "pool.h"
+#include "scan.h"
+#include "stats.h"
+#include "trace.h"
+
+
+
+/*
+	Composed types definitions.
+
+	These types are used only in this file.
+*/
+
+// Files scanned on worker threads.
+struct Run
+{
+	const struct Scan *scan;
+	const struct Fsck_File *files;
+	struct Scan_Result *results;
+};
+
+
+
+/*
+	Static function definitions.
+*/
+
+/*
+	hex()
+
+	Returns the value of a hexadecimal digit, or -1.
+*/
+
+static int hex(int c)
+{
+	if(c >= '0' && c <= '9') return c - '0';
+	if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+/*
+	parse()
+
+	Reads the bytes of a pattern, written as a quoted string or as hex
+	bytes.
+
+	@arg	text	Pattern text, up to the end of the line.
+	@arg	bytes	Buffer of at least strlen(text) bytes.
+
+	@return		Number of bytes, or 0 if the pattern is invalid or
+			empty.
+*/
+
+static size_t parse(const char *text, uint8_t *bytes)
+{
+	size_t size = 0;
+	int x, y;
+
+	// Reading hex bytes, optionally separated by spaces.
+	if(*text != '"')
+	{
+		while(*text)
+		{
+			if(isspace((unsigned char)*text))
+			{
+				text++;
+				continue;
+			}
+			if((x = hex(text[0])) < 0 || (y = hex(text[1])) < 0)
+				return 0;
+			bytes[size++] = (x << 4) | y;
+			text += 2;
+		}
+		return size;
+	}
+
+	// Reading a quoted string and its escapes.
+	for(text++; *text && *text != '"'; text++)
+	{
+		if(*text != '\\')
+		{
+			bytes[size++] = *text;
+			continue;
+		}
+
+		switch(*++text)
+		{
+		case '\\':
+		case '"':
+			bytes[size++] = *text;
+			break;
+		case 'n':
+			bytes[size++] = '\n';
+			break;
+		case 't':
+			bytes[size++] = '\t';
+			break;
+		case '0':
+			bytes[size++] = 0;
+			break;
+		case 'x':
+			if((x = hex(text[1])) < 0 || (y = hex(text[2])) < 0)
+				return 0;
+			bytes[size++] = (x << 4) | y;
+			text += 2;
+			break;
+		default:
+			return 0;
+		}
+	}
+
+	// Only spaces may follow the closing quote.
+	if(*text++ != '"') return 0;
+	while(isspace((unsigned char)*text)) text++;
+	return *text ? 0 : size;
+}
+
+/*
+	compile()
+
+	Sets the window length and fills the shift table and the pattern lists
+	from the patterns.
+
+	@arg	scan	Pattern set.
+
+	@return		0 on success, 1 on alloc failure.
+*/
+
+static int compile(struct Scan *scan)
+{
+	// Using the pair length, the current pattern and table index.
+	size_t pair, j;
+	struct Scan_Pattern *pattern;
+	unsigned int key;
+	int i;
+
+	scan->shift = malloc(SCAN_PAIRS * sizeof *scan->shift);
+	scan->heads = malloc(SCAN_PAIRS * sizeof *scan->heads);
+	if(!scan->shift || !scan->heads) return 1;
+
+	scan->window = SCAN_WINDOW;
+	for(i = 0; i < scan->count; i++)
+		if(scan->patterns[i].size < scan->window)
+		scan->window = scan->patterns[i].size;
+
+	// Windows of one byte are indexed by that byte only.
+	pair = scan->window >= 2 ? 2 : 1;
+	for(key = 0; key < SCAN_PAIRS; key++)
+	{
+		scan->shift[key] = scan->window - pair + 1;
+		scan->heads[key] = -1;
+	}
+
+	// Adding the patterns in reverse order, so that the lists are in the
+	// file order.
+	for(i = scan->count - 1; i >= 0; i--)
+	{
+		pattern = scan->patterns + i;
+
+		for(j = pair - 1; j < scan->window; j++)
+		{
+			key = pair == 2 ? (pattern->bytes[j - 1] << 8)
+				| pattern->bytes[j] : pattern->bytes[j];
+			if(scan->window - 1 - j < scan->shift[key])
+				scan->shift[key] = scan->window - 1 - j;
+		}
+
+		pattern->next = scan->heads[key];
+		scan->heads[key] = i;
+	}
+
+	return 0;
+}
+
+/*
+	add()
+
+	Records a match.
+
+	@arg	result	Matches of the file.
+	@arg	offset	Offset of the match in the file.
+	@arg	pattern	Index of the pattern.
+
+	@return		0 on success, 1 on alloc failure.
+*/
+
+static int add(struct Scan_Result *result, uint64_t offset, int pattern)
+{
+	struct Scan_Match *match;
+
+	if(result->count == result->capacity)
+	{
+		int capacity = result->capacity ? result->capacity * 2 : 16;
+		match = realloc(result->matches, capacity * sizeof *match);
+		if(!match) return 1;
+		result->matches = match;
+		result->capacity = capacity;
+	}
+
+	match = result->matches + result->count++;
+	match->offset = offset;
+	match->pattern = pattern;
+	return 0;
+}
+
+/*
+	search()
+
+	Finds all the occurrences of all the patterns in a buffer. The window
+	covers the first bytes of a possible match; its last pair of bytes
+	tells how far it can move without skipping one. When it cannot move,
+	the patterns whose window ends with this pair are compared.
+
+	@arg	scan	Pattern set.
+	@arg	data	Buffer.
+	@arg	size	Buffer size.
+	@arg	base	Offset of the buffer in the file.
+	@arg	result	Matches of the file.
+
+	@return		0 on success, 1 on alloc failure.
+*/
+
+static int search(const struct Scan *scan, const uint8_t *data, size_t size,
+	uint64_t base, struct Scan_Result *result)
+{
+	// Using the window length, the position of its last byte and start.
+	size_t window = scan->window, pos, start;
+	// Using the pattern iterator and the current pair of bytes.
+	const struct Scan_Pattern *pattern;
+	unsigned int key, shift;
+	int i;
+
+	for(pos = window - 1; pos < size; pos++)
+	{
+		key = window >= 2 ? (data[pos - 1] << 8) | data[pos]
+			: data[pos];
+		shift = scan->shift[key];
+		if(shift)
+		{
+			pos += shift - 1;
+			continue;
+		}
+
+		start = pos - (window - 1);
+		for(i = scan->heads[key]; i >= 0; i = pattern->next)
+		{
+			pattern = scan->patterns + i;
+			if(pattern->size > size - start || memcmp(data + start,
+				pattern->bytes, pattern->size)) continue;
+			if(add(result, base + start, i)) return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+	scan_file()
+
+	Maps a file in memory and scans its payload.
+
+	@arg	scan	Pattern set.
+	@arg	path	File name.
+	@arg	result	Matches of the file.
+
+	@return		0 on success, or an error number.
+*/
+
+static int scan_file(const struct Scan *scan, const char *path,
+	struct Scan_Result *result)
+{
+	// Using the file descriptor, its status and its contents.
+	struct stat st;
+	uint8_t *map;
+	int fd, error = 0;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	STATS_ADD(STATS_SYSCALLS, 1);
+	if(fd < 0) return errno;
+	if(fstat(fd, &st))
+	{
+		error = errno;
+		close(fd);
+		return error;
+	}
+
+	// Files without a payload have nothing to scan.
+	if(st.st_size <= HEADER_SIZE)
+	{
+		close(fd);
+		STATS_ADD(STATS_SYSCALLS, 2);
+		return 0;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(map == MAP_FAILED) error = errno;
+	close(fd);
+	STATS_ADD(STATS_SYSCALLS, 3);
+	if(error) return error;
+
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+	if(search(scan, map + HEADER_SIZE, st.st_size - HEADER_SIZE,
+		HEADER_SIZE, result)) error = ENOMEM;
+
+	munmap(map, st.st_size);
+	STATS_ADD(STATS_SYSCALLS, 2);
+	STATS_ADD(STATS_BYTES_READ, st.st_size - HEADER_SIZE);
+	return error;
+}
+
+/*
+	scan_job()
+
+	Pool job: scans a file of the list.
+
+	@arg	arg	Pattern set, files and results.
+	@arg	index	Index of the file.
+*/
+
+static void scan_job(void *arg, int index)
+{
+	struct Run *run = arg;
+
+	// Unreadable directories have nothing to scan.
+	run->results[index].error = run->files[index].error;
+	if(run->files[index].error) return;
+
+	TRACE_BEGIN("scan", "job", index);
+	run->results[index].error = scan_file(run->scan,
+		run->files[index].path, run->results + index);
+	TRACE_END("scan");
+	STATS_ADD(STATS_JOBS_DONE, 1);
+}
+
+
+
+/*
+	Function definitions.
+*/
+
+/*
+	scan_load()
+
+	Reads a patterns file and compiles its patterns.
+
+	@arg	scan	Pattern set to initialize.
+	@arg	file	Patterns file name.
+
+	@return		0 on success, 1 on failure (errno is set). Syntax errors
+			set errno to EINVAL, and scan->line to the line of the
+			error, or to 0 if there is no pattern at all. The
+			pattern set must be freed with scan_free() in any case.
+*/
+
+int scan_load(struct Scan *scan, const char *file)
+{
+	// Using the patterns file and its size.
+	FILE *fp = fopen(file, "r");
+	long size;
+	// Using the extended pattern list, the current line and its fields.
+	struct Scan_Pattern *patterns;
+	char *line, *next, *name, *text;
+	int number = 0;
+
+	memset(scan, 0, sizeof *scan);
+	if(!fp) return 1;
+	if(fseek(fp, 0, SEEK_END) || (size = ftell(fp)) < 0
+		|| fseek(fp, 0, SEEK_SET)) goto fail;
+	scan->data = malloc(size + 1);
+	if(!scan->data)
+	{
+		errno = ENOMEM;
+		goto fail;
+	}
+	if(fread(scan->data, 1, size, fp) != (size_t)size) goto fail;
+	STATS_ADD(STATS_BYTES_READ, size);
+	STATS_ADD(STATS_READ_CALLS, 1);
+	fclose(fp);
+	scan->data[size] = 0;
+
+	for(line = scan->data; line; line = next)
+	{
+		// Splitting the line, then the name from the pattern.
+		next = strchr(line, '\n');
+		if(next) *next++ = 0;
+		number++;
+
+		name = line + strspn(line, " \t\r");
+		if(!*name || *name == '#') continue;
+		text = name + strcspn(name, " \t\r");
+		if(*text) *text++ = 0;
+		text += strspn(text, " \t\r");
+
+		patterns = realloc(scan->patterns, (scan->count + 1)
+			* sizeof *patterns);
+		if(!patterns)
+		{
+			errno = ENOMEM;
+			return 1;
+		}
+		scan->patterns = patterns;
+
+		patterns += scan->count++;
+		patterns->name = name;
+		patterns->bytes = malloc(strlen(text) + 1);
+		if(!patterns->bytes)
+		{
+			errno = ENOMEM;
+			return 1;
+		}
+		patterns->size = parse(text, patterns->bytes);
+		if(!patterns->size)
+		{
+			scan->line = number;
+			errno = EINVAL;
+			return 1;
+		}
+	}
+
+	if(!scan->count)
+	{
+		errno = EINVAL;
+		return 1;
+	}
+
+	if(compile(scan))
+	{
+		errno = ENOMEM;
+		return 1;
+	}
+	return 0;
+
+fail:
+	fclose(fp);
+	return 1;
+}
+
+/*
+	scan_run()
+
+	Scans the payloads of files on worker threads, one per processor. The
+	calling thread is one of the workers.
+
+	@arg	scan	Pattern set.
+	@arg	files	Files to scan, as collected by fsck_add().
+	@arg	results	Zeroed matches of every file, which are filled.
+*/
+
+void scan_run(const struct Scan *scan, const struct Fsck *files,
+	struct Scan_Result *results)
+{
+	struct Run run = { scan, files->files, results };
+
+	STATS_ADD(STATS_JOBS_QUEUED, files->count);
+	pool_run(files->count, scan_job, &run);
+}
+
+/*
+	scan_results_free()
+
+	Frees the matches of files.
+
+	@arg	results	Matches of every file.
+	@arg	count	Number of files.
+*/
+
+void scan_results_free(struct Scan_Result *results, int count)
+{
+	int i;
+	for(i = 0; i < count; i++) free(results[i].matches);
+}
+
+/*
+	scan_free()
+
+	Frees the patterns and the tables.
+
+	@arg	scan	Pattern set.
+*/
+
+void scan_free(struct Scan *scan)
+{
+	int i;
+
+	for(i = 0; i < scan->count; i++) free(scan->patterns[i].bytes);
+	free(scan->patterns);
+	free(scan->shift);
+	free(scan->heads);
+	free(scan->data);
+	memset(scan, 0, sizeof *scan);
+}
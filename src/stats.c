@@ -0,0 +1,379 @@
+/*
+	Statistics module.
+*/
+
+
+
+/*
+	Header inclusions.
+*/
+
+// Standard headers.
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+// Project headers.
+#include "error.h"
+#include "stats.h"
+#include "trace.h"
+
+
+
+/*
+	Constants definitions.
+*/
+
+// Number of per-thread slots. Threads beyond this number share the last
+// slot.
+#define STATS_THREADS	64
+
+
+
+/*
+	Composed types definitions.
+*/
+
+// Counters and phase timings of a thread, on their own cache lines.
+struct Slot
+{
+	uint64_t counters[STATS_COUNTERS];
+	uint64_t phase_total[STATS_PHASES];
+	uint64_t phase_count[STATS_PHASES];
+	uint64_t phase_buckets[STATS_PHASES][STATS_BUCKETS];
+} __attribute__((aligned(64)));
+
+
+
+/*
+	Global and static variables definitions.
+*/
+
+// Statistics activation flag.
+int stats_enabled = 0;
+
+// Is a report requested, and to which file (NULL for a single line on
+// stderr) ?
+static int report = 0;
+static const char *report_file = NULL;
+// Program start date.
+static uint64_t start;
+// Phase start dates of the thread. Durations (in nanoseconds), number of
+// runs and latency distributions are accumulated in the slot of the thread.
+static __thread uint64_t phase_start[STATS_PHASES];
+// Slots, number of slots handed out, and slot of the thread.
+static struct Slot slots[STATS_THREADS];
+static unsigned int slot_count = 0;
+static __thread struct Slot *slot = NULL;
+
+// Phase names, as used in the report.
+static const char *phase_names[STATS_PHASES] = {
+	"args", "icon", "generate", "write", "dump", "cache", "extract",
+	"diff", "batch", "index", "fsck", "scan", "dedup", "pack", "unpack"
+};
+// Counter names, as used in the report.
+static const char *counter_names[STATS_COUNTERS] = {
+	"bytes_read", "bytes_written", "read_calls", "write_calls",
+	"syscalls", "uring_ops", "jobs_queued", "jobs_done", "cache_hits",
+	"cache_misses"
+};
+
+
+
+/*
+	Static function definitions.
+*/
+
+/*
+	now()
+
+	Returns the value of the monotonic clock, in nanoseconds.
+
+	@return		Current time.
+*/
+
+static uint64_t now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+	own_slot()
+
+	Returns the slot of the calling thread, handing out a new one on its
+	first update.
+
+	@return		Slot of the thread.
+*/
+
+static struct Slot *own_slot(void)
+{
+	// Using the index of a new slot.
+	unsigned int i;
+
+	if(!slot)
+	{
+		i = __atomic_fetch_add(&slot_count, 1, __ATOMIC_RELAXED);
+		slot = slots + (i < STATS_THREADS ? i : STATS_THREADS - 1);
+	}
+	return slot;
+}
+
+/*
+	aggregate()
+
+	Sums the counters and phase timings of all the threads.
+
+	@arg	snapshot	Receives the counters and phase timings; the
+				uptime is left unset.
+*/
+
+static void aggregate(struct Stats_Snapshot *snapshot)
+{
+	// Using the number of slots in use, and iterators.
+	unsigned int n = __atomic_load_n(&slot_count, __ATOMIC_RELAXED);
+	unsigned int i;
+	int c, k;
+
+	if(n > STATS_THREADS) n = STATS_THREADS;
+	memset(snapshot->counters, 0, sizeof snapshot->counters);
+	memset(snapshot->phase_total, 0, sizeof snapshot->phase_total);
+	memset(snapshot->phase_count, 0, sizeof snapshot->phase_count);
+	memset(snapshot->phase_buckets, 0, sizeof snapshot->phase_buckets);
+
+	for(i = 0; i < n; i++)
+	{
+		for(c = 0; c < STATS_COUNTERS; c++) snapshot->counters[c] +=
+			__atomic_load_n(&slots[i].counters[c],
+			__ATOMIC_RELAXED);
+		for(c = 0; c < STATS_PHASES; c++)
+		{
+			snapshot->phase_total[c] += __atomic_load_n(
+				&slots[i].phase_total[c], __ATOMIC_RELAXED);
+			snapshot->phase_count[c] += __atomic_load_n(
+				&slots[i].phase_count[c], __ATOMIC_RELAXED);
+			for(k = 0; k < STATS_BUCKETS; k++)
+				snapshot->phase_buckets[c][k] +=
+				__atomic_load_n(&slots[i].phase_buckets[c][k],
+				__ATOMIC_RELAXED);
+		}
+	}
+}
+
+
+
+/*
+	Function definitions.
+*/
+
+/*
+	stats_init()
+
+	Enables statistics collection and starts the program clock.
+
+	@arg	file	JSON report file name, or NULL to print a single line on
+			stderr.
+*/
+
+void stats_init(const char *file)
+{
+	report = 1;
+	report_file = file;
+	stats_enable();
+}
+
+/*
+	stats_enable()
+
+	Enables statistics collection and starts the program clock, if not done
+	yet. Nothing is reported unless stats_init() is called too.
+*/
+
+void stats_enable(void)
+{
+	if(stats_enabled) return;
+	start = now();
+	stats_enabled = 1;
+}
+
+/*
+	stats_begin()
+
+	Starts timing a phase. Phases may be entered several times, and from
+	several threads at once; their durations are accumulated. Phases are
+	also traced, if enabled.
+
+	@arg	phase	Phase to start.
+*/
+
+void stats_begin(enum Stats_Phase phase)
+{
+	phase_start[phase] = now();
+	TRACE_BEGIN(phase_names[phase], NULL, 0);
+}
+
+/*
+	stats_end()
+
+	Stops timing a phase and accumulates the elapsed time in the slot of the
+	calling thread.
+
+	@arg	phase	Phase to stop.
+*/
+
+void stats_end(enum Stats_Phase phase)
+{
+	// Using the duration, the bucket bound and index, and the slot.
+	uint64_t duration = now() - phase_start[phase], bound = 10000;
+	struct Slot *s = own_slot();
+	int k;
+
+	TRACE_END(phase_names[phase]);
+
+	__atomic_fetch_add(&s->phase_total[phase], duration, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&s->phase_count[phase], 1, __ATOMIC_RELAXED);
+
+	for(k = 0; k < STATS_BUCKETS && duration > bound; k++) bound *= 10;
+	if(k < STATS_BUCKETS) __atomic_fetch_add(&s->phase_buckets[phase][k],
+		1, __ATOMIC_RELAXED);
+}
+
+/*
+	stats_add()
+
+	Adds a value to a counter. Counters may be updated from several threads;
+	each thread gets its own slot on its first update, so that the update
+	never contends with other threads.
+
+	@arg	counter	Counter to increment.
+	@arg	value	Value to add.
+*/
+
+void stats_add(enum Stats_Counter counter, uint64_t value)
+{
+	__atomic_fetch_add(&own_slot()->counters[counter], value,
+		__ATOMIC_RELAXED);
+}
+
+/*
+	stats_report()
+
+	Outputs the collected statistics, either as a single line on stderr or
+	as a JSON object in the report file. Does nothing if no report was
+	requested.
+*/
+
+void stats_report(void)
+{
+	// Using a resource usage structure to get the peak RSS.
+	struct rusage usage;
+	// Using the aggregated statistics, the total duration and the write
+	// throughput.
+	struct Stats_Snapshot snapshot;
+	uint64_t *counters = snapshot.counters;
+	uint64_t *phase_total = snapshot.phase_total, total;
+	double throughput = 0;
+	// Using an output stream.
+	FILE *fp;
+	// Using an iterator.
+	int i;
+
+	if(!report) return;
+
+	// Getting the counters, the total duration and the peak resident set
+	// size.
+	aggregate(&snapshot);
+	total = now() - start;
+	if(getrusage(RUSAGE_SELF, &usage)) usage.ru_maxrss = 0;
+
+	// Computing the copy throughput in MiB/s.
+	if(phase_total[STATS_WRITE]) throughput =
+		counters[STATS_BYTES_WRITTEN] * 1e9 /
+		phase_total[STATS_WRITE] / 1048576.0;
+
+	// Printing a single line on stderr if no file was given.
+	if(!report_file)
+	{
+		fputs("g1a-wrapper: stats:", stderr);
+		for(i = 0; i < STATS_PHASES; i++) fprintf(stderr, " %s=%.3fms",
+			phase_names[i], phase_total[i] / 1e6);
+		fprintf(stderr, " total=%.3fms", total / 1e6);
+		for(i = 0; i < STATS_COUNTERS; i++) fprintf(stderr, " %s=%llu",
+			counter_names[i], (unsigned long long)counters[i]);
+		fprintf(stderr, " peak_rss=%ldKiB throughput=%.2fMiB/s\n",
+			usage.ru_maxrss, throughput);
+		return;
+	}
+
+	// Opening the report file.
+	fp = fopen(report_file, "w");
+	if(!fp)
+	{
+		error_emit(ERROR, "stats-output", report_file);
+		return;
+	}
+
+	// Writing the JSON object.
+	fputs("{\n\t\"phases_ns\": {", fp);
+	for(i = 0; i < STATS_PHASES; i++) fprintf(fp, "%s\n\t\t\"%s\": %llu",
+		i ? "," : "", phase_names[i],
+		(unsigned long long)phase_total[i]);
+	fprintf(fp, "\n\t},\n\t\"total_ns\": %llu,\n",
+		(unsigned long long)total);
+	for(i = 0; i < STATS_COUNTERS; i++) fprintf(fp, "\t\"%s\": %llu,\n",
+		counter_names[i], (unsigned long long)counters[i]);
+	fprintf(fp, "\t\"peak_rss_kib\": %ld,\n", usage.ru_maxrss);
+	fprintf(fp, "\t\"throughput_mib_s\": %.2f\n}\n", throughput);
+
+	fclose(fp);
+}
+
+/*
+	stats_snapshot()
+
+	Aggregates the collected statistics, including the counters and phase
+	timings of all the threads.
+
+	@arg	snapshot	Receives the statistics.
+*/
+
+void stats_snapshot(struct Stats_Snapshot *snapshot)
+{
+	snapshot->uptime = now() - start;
+	aggregate(snapshot);
+}
+
+/*
+	stats_phase_name()
+
+	Returns the name of a phase, as used in the reports.
+
+	@arg	phase	Phase.
+
+	@return		Phase name.
+*/
+
+const char *stats_phase_name(enum Stats_Phase phase)
+{
+	return phase_names[phase];
+}
+
+/*
+	stats_counter_name()
+
+	Returns the name of a counter, as used in the reports.
+
+	@arg	counter	Counter.
+
+	@return		Counter name.
+*/
+
+const char *stats_counter_name(enum Stats_Counter counter)
+{
+	return counter_names[counter];
+}
@@ -0,0 +1,250 @@
+/*
+	Trace module.
+*/
+
+
+
+/*
+	Header inclusions.
+*/
+
+// Standard headers.
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+// Project headers.
+#include "error.h"
+#include "output.h"
+#include "stats.h"
+#include "trace.h"
+
+
+
+/*
+	Composed types definitions.
+*/
+
+// Recorded event.
+struct Event
+{
+	// Date, in nanoseconds since tracing was enabled.
+	uint64_t date;
+	// Name, and argument key (or NULL) and value.
+	const char *name;
+	const char *key;
+	int64_t value;
+	// Event type: 'B' (begin) or 'E' (end).
+	char phase;
+};
+
+// Ring buffer of a thread.
+struct Buffer
+{
+	// Next buffer.
+	struct Buffer *next;
+	// Thread id, and number of events recorded (the last TRACE_EVENTS
+	// are kept).
+	long tid;
+	uint64_t count;
+	struct Event events[TRACE_EVENTS];
+};
+
+
+
+/*
+	Global and static variables definitions.
+*/
+
+// Trace activation flag.
+int trace_enabled = 0;
+
+// Trace file name.
+static const char *trace_file = NULL;
+// Date at which tracing was enabled.
+static uint64_t start;
+// Buffers of all the threads, and buffer of the current thread.
+static struct Buffer *buffers = NULL;
+static __thread struct Buffer *buffer = NULL;
+
+
+
+/*
+	Static function definitions.
+*/
+
+/*
+	now()
+
+	Returns the value of the monotonic clock, in nanoseconds.
+
+	@return		Current time.
+*/
+
+static uint64_t now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+	trace_text()
+
+	Writes the recorded events as a JSON trace, thread by thread, each
+	thread being named after its role.
+
+	@arg	fp	Output stream.
+*/
+
+static void trace_text(FILE *fp)
+{
+	// Using the process id, a buffer, an event, and the first event kept
+	// and number of events dropped in a buffer.
+	long pid = getpid();
+	const struct Buffer *b;
+	const struct Event *e;
+	uint64_t first, i, dropped = 0;
+	const char *separator = "";
+
+	fputs("{\"traceEvents\":[", fp);
+	for(b = buffers; b; b = b->next)
+	{
+		fprintf(fp, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\","
+			"\"pid\":%ld,\"tid\":%ld,\"args\":{\"name\":\"%s\"}}",
+			separator, pid, b->tid, b->tid == pid ? "main" :
+			"worker");
+		separator = ",";
+
+		first = b->count > TRACE_EVENTS ? b->count - TRACE_EVENTS : 0;
+		dropped += first;
+		for(i = first; i < b->count; i++)
+		{
+			e = b->events + i % TRACE_EVENTS;
+			fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":"
+				"%llu.%03u,\"pid\":%ld,\"tid\":%ld", e->name,
+				e->phase, (unsigned long long)(e->date / 1000),
+				(unsigned int)(e->date % 1000), pid, b->tid);
+			if(e->key) fprintf(fp, ",\"args\":{\"%s\":%lld}",
+				e->key, (long long)e->value);
+			fputc('}', fp);
+		}
+	}
+	fprintf(fp, "\n],\"displayTimeUnit\":\"ms\",\"otherData\":"
+		"{\"dropped_events\":%llu}}\n", (unsigned long long)dropped);
+}
+
+/*
+	trace_exit()
+
+	Writes the trace file at exit, replacing it atomically, then releases
+	the buffers.
+*/
+
+static void trace_exit(void)
+{
+	// Using the formatted text and its size, a stream and the output file.
+	char *text = NULL;
+	size_t size = 0;
+	FILE *fp;
+	struct Output output;
+	// Using the next buffer.
+	struct Buffer *next;
+
+	trace_enabled = 0;
+
+	fp = open_memstream(&text, &size);
+	if(!fp) error_emit(ERROR, "trace-output", trace_file,
+		strerror(errno));
+	else
+	{
+		trace_text(fp);
+		if(fclose(fp) || output_open(&output, trace_file, size))
+			error_emit(ERROR, "trace-output", trace_file,
+			strerror(errno));
+		else if(output_append(&output, text, size))
+		{
+			error_emit(ERROR, "trace-output", trace_file,
+				strerror(errno));
+			output_abort(&output);
+		}
+		else if(output_commit(&output)) error_emit(ERROR,
+			"trace-output", trace_file, strerror(errno));
+		free(text);
+	}
+
+	while(buffers)
+	{
+		next = buffers->next;
+		free(buffers);
+		buffers = next;
+	}
+}
+
+
+
+/*
+	Function definitions.
+*/
+
+/*
+	trace_init()
+
+	Enables tracing, and statistics collection so that phases are traced
+	too. The trace file is written at exit.
+
+	@arg	file	Trace file name.
+*/
+
+void trace_init(const char *file)
+{
+	trace_file = file;
+	start = now();
+	trace_enabled = 1;
+	stats_enable();
+	atexit(trace_exit);
+}
+
+/*
+	trace_event()
+
+	Records an event in the buffer of the calling thread, which is created
+	and linked to the others on the first event of the thread.
+
+	@arg	phase	Event type: 'B' (begin) or 'E' (end).
+	@arg	name	Event name.
+	@arg	key	Argument key, or NULL.
+	@arg	value	Argument value.
+*/
+
+void trace_event(char phase, const char *name, const char *key,
+	int64_t value)
+{
+	// Using the recorded event.
+	struct Event *e;
+
+	if(!buffer)
+	{
+		buffer = malloc(sizeof *buffer);
+		if(!buffer) return;
+		buffer->tid = syscall(SYS_gettid);
+		buffer->count = 0;
+
+		// Linking the buffer without a lock.
+		buffer->next = __atomic_load_n(&buffers, __ATOMIC_RELAXED);
+		while(!__atomic_compare_exchange_n(&buffers, &buffer->next,
+			buffer, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	}
+
+	e = buffer->events + buffer->count++ % TRACE_EVENTS;
+	e->date = now() - start;
+	e->name = name;
+	e->key = key;
+	e->value = value;
+	e->phase = phase;
+}
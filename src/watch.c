@@ -0,0 +1,237 @@
+/*
+	Watch module.
+*/
+
+
+
+/*
+	Header inclusions.
+*/
+
+// Feature macros, for ppoll().
+#define _GNU_SOURCE
+
+// Standard headers.
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+// Project headers.
+#include "stats.h"
+#include "watch.h"
+
+
+
+/*
+	Constants definitions.
+*/
+
+// Events that mark a file as rewritten: closed after writing, or renamed
+// into place. Creations are ignored, as the file is still being written.
+#define WATCH_EVENTS	(IN_CLOSE_WRITE | IN_MOVED_TO)
+
+
+
+/*
+	Static variables definitions.
+*/
+
+// Stop request indicator, set by SIGINT and SIGTERM.
+static volatile sig_atomic_t stop = 0;
+// Signal mask in use outside of the watch, restored while waiting.
+static sigset_t wait_mask;
+
+
+
+/*
+	Static function definitions.
+*/
+
+/*
+	handler()
+
+	Signal handler, requesting the watch to stop.
+
+	@arg	signal	Received signal.
+*/
+
+static void handler(int signal)
+{
+	(void)signal;
+	stop = 1;
+}
+
+
+
+/*
+	Function definitions.
+*/
+
+/*
+	watch_open()
+
+	Starts watching the directories of the given files. SIGINT and SIGTERM
+	are blocked, except while waiting, so that they stop the watch between
+	two rebuilds instead of killing the program during one.
+
+	@arg	watch	Watch structure to initialize.
+	@arg	files	File names.
+	@arg	count	Number of files, at most WATCH_MAX.
+
+	@return		0 on success, 1 on failure (errno is set).
+*/
+
+int watch_open(struct Watch *watch, const char **files, int count)
+{
+	// Using a directory name, a signal action, the blocked signals and an
+	// iterator.
+	char dir[PATH_MAX];
+	struct sigaction action;
+	sigset_t block;
+	const char *slash;
+	int i, error;
+
+	if(count > WATCH_MAX)
+	{
+		errno = EINVAL;
+		return 1;
+	}
+
+	watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if(watch->fd < 0) return 1;
+	watch->count = count;
+
+	for(i = 0; i < count; i++)
+	{
+		// Splitting the file name into directory and base name.
+		slash = strrchr(files[i], '/');
+		if(!slash) strcpy(dir, ".");
+		else if(slash - files[i] >= PATH_MAX) goto fail;
+		else if(slash == files[i]) strcpy(dir, "/");
+		else
+		{
+			memcpy(dir, files[i], slash - files[i]);
+			dir[slash - files[i]] = 0;
+		}
+		watch->names[i] = slash ? slash + 1 : files[i];
+
+		// Files in the same directory share the same descriptor.
+		watch->wds[i] = inotify_add_watch(watch->fd, dir, WATCH_EVENTS
+			| IN_ONLYDIR);
+		STATS_ADD(STATS_SYSCALLS, 1);
+		if(watch->wds[i] < 0) goto fail;
+	}
+
+	// Catching the stop signals, which are only delivered while waiting.
+	memset(&action, 0, sizeof action);
+	action.sa_handler = handler;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	sigemptyset(&block);
+	sigaddset(&block, SIGINT);
+	sigaddset(&block, SIGTERM);
+	sigprocmask(SIG_BLOCK, &block, &wait_mask);
+	stop = 0;
+
+	return 0;
+
+fail:
+	error = errno;
+	close(watch->fd);
+	errno = error;
+	return 1;
+}
+
+/*
+	watch_wait()
+
+	Waits until some of the files are rewritten, then until no event has
+	been received for the debounce delay, so that a burst of writes only
+	triggers one rebuild.
+
+	@arg	watch		Watch structure.
+	@arg	debounce	Debounce delay, in milliseconds.
+	@arg	changed		Receives the set of changed files, bit i standing
+				for the i-th file.
+
+	@return		0 on success, 1 when stopped by a signal (errno is
+			EINTR) or on failure (errno is set).
+*/
+
+int watch_wait(struct Watch *watch, int debounce, uint32_t *changed)
+{
+	// Using an event buffer, aligned for the event structures.
+	char buffer[4096] __attribute__((aligned(__alignof__(struct
+		inotify_event))));
+	const struct inotify_event *event;
+	// Using the poll descriptor, the current timeout and a read size.
+	struct pollfd pfd = { watch->fd, POLLIN, 0 };
+	struct timespec delay, *timeout = NULL;
+	ssize_t x, offset;
+	int i;
+
+	delay.tv_sec = debounce / 1000;
+	delay.tv_nsec = debounce % 1000 * 1000000l;
+	*changed = 0;
+
+	while(!stop)
+	{
+		x = ppoll(&pfd, 1, timeout, &wait_mask);
+		STATS_ADD(STATS_SYSCALLS, 1);
+		if(x < 0 && errno == EINTR) continue;
+		if(x < 0) return 1;
+
+		// The burst is over once the delay elapsed without events.
+		if(!x) return 0;
+
+		x = read(watch->fd, buffer, sizeof buffer);
+		STATS_ADD(STATS_SYSCALLS, 1);
+		if(x < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+		if(x < 0) return 1;
+
+		for(offset = 0; offset < x; offset += sizeof *event
+			+ event->len)
+		{
+			event = (const void *)(buffer + offset);
+
+			// Events were lost: rebuilding everything to be safe.
+			if(event->mask & IN_Q_OVERFLOW)
+				*changed |= (1u << watch->count) - 1;
+
+			if(!event->len) continue;
+			for(i = 0; i < watch->count; i++)
+				if(event->wd == watch->wds[i] && !strcmp(event
+				->name, watch->names[i])) *changed |= 1u << i;
+		}
+
+		// Starting or extending the debounce delay.
+		if(*changed) timeout = &delay;
+	}
+
+	errno = EINTR;
+	return 1;
+}
+
+/*
+	watch_close()
+
+	Stops watching, and restores the default handling of stop signals.
+
+	@arg	watch	Watch structure.
+*/
+
+void watch_close(struct Watch *watch)
+{
+	close(watch->fd);
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	sigprocmask(SIG_SETMASK, &wait_mask, NULL);
+}